@@ -0,0 +1,208 @@
+// PolyphaseResampler.cpp
+
+#include "PolyphaseResampler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+
+namespace
+{
+// Stopband attenuation of the filters, in dB
+constexpr double STOPBAND_ATTENUATION_DB = 85.0;
+// Transition band width of the polyphase resampler, relative to the lower of the two rates
+constexpr double TRANSITION_WIDTH = 0.1;
+
+constexpr double PI = 3.14159265358979323846;
+
+/** Zeroth order modified Bessel function of the first kind, from its power series */
+double besselI0(double x)
+{
+    double sum = 1.0;
+    double term = 1.0;
+    for (int k = 1; k < 50 && term > 1e-12 * sum; k++) {
+        term *= (x / (2.0 * k)) * (x / (2.0 * k));
+        sum += term;
+    }
+    return sum;
+}
+
+/** Kaiser beta for a given stopband attenuation (Kaiser's formula, for attenuations above 50 dB) */
+double kaiserBeta(double inAttenuationDB)
+{
+    return 0.1102 * (inAttenuationDB - 8.7);
+}
+
+/**
+ * Kaiser windowed sinc lowpass.
+ * @param inCutoff Cutoff frequency in cycles per sample
+ * @param inLength Number of taps
+ * @param inIndex Tap index in [0, inLength)
+ * @return Tap value, the filter has unit gain at DC before normalisation
+ */
+double windowedSinc(double inCutoff, int inLength, int inIndex)
+{
+    const double centre = 0.5 * (inLength - 1);
+    const double t = inIndex - centre;
+    const double x = 2.0 * inCutoff * t;
+    const double sinc = std::abs(x) < 1e-12 ? 1.0 : std::sin(PI * x) / (PI * x);
+
+    const double r = centre > 0.0 ? t / centre : 0.0;
+    const double beta = kaiserBeta(STOPBAND_ATTENUATION_DB);
+    const double window = besselI0(beta * std::sqrt(std::max(0.0, 1.0 - r * r))) / besselI0(beta);
+
+    return 2.0 * inCutoff * sinc * window;
+}
+
+bool isInteger(double inValue)
+{
+    return inValue > 0.0 && std::abs(inValue - std::round(inValue)) < 1e-6;
+}
+} // namespace
+
+HalfBandDecimator::HalfBandDecimator()
+{
+    // Half-band of 2 * NUM_TAPS - 1 taps: the centre tap is 0.5 and only taps at an odd offset from it are non-zero.
+    // Those are the taps at even indices, aligned with the newest input sample.
+    const int length = 2 * NUM_TAPS - 1;
+    mCoeffs.resize(NUM_TAPS);
+    double sum = 0.0;
+    for (int j = 0; j < NUM_TAPS; j++) {
+        const double tap = windowedSinc(0.25, length, 2 * j);
+        mCoeffs[static_cast<size_t>(j)] = static_cast<float>(tap);
+        sum += tap;
+    }
+    // Unit gain at DC
+    for (auto& coeff: mCoeffs)
+        coeff = static_cast<float>(coeff * 0.5 / sum);
+}
+
+void HalfBandDecimator::prepare(int inMaxBlockSize)
+{
+    mMaxBlockSize = std::max(1, inMaxBlockSize);
+    mAligned.resize(static_cast<size_t>(NUM_TAPS - 1 + (mMaxBlockSize + 1) / 2));
+    mCentre.resize(static_cast<size_t>(NUM_CENTRE_HISTORY + (mMaxBlockSize + 1) / 2));
+    reset();
+}
+
+void HalfBandDecimator::reset()
+{
+    std::fill(mAligned.begin(), mAligned.end(), 0.0f);
+    std::fill(mCentre.begin(), mCentre.end(), 0.0f);
+    mPhase = 0;
+}
+
+int HalfBandDecimator::process(const float* inBuffer, float* outBuffer, int inNumSamples)
+{
+    assert(inNumSamples <= mMaxBlockSize);
+
+    const int num_aligned = getNumOutSamples(inNumSamples);
+    const int num_centre = inNumSamples - num_aligned;
+    float* aligned = mAligned.data() + NUM_TAPS - 1;
+    float* centre = mCentre.data() + NUM_CENTRE_HISTORY;
+
+    for (int k = 0; k < num_aligned; k++)
+        aligned[k] = inBuffer[mPhase + 2 * k];
+
+    for (int k = 0; k < num_centre; k++)
+        centre[k] = inBuffer[1 - mPhase + 2 * k];
+
+    // The centre tap is NUM_TAPS - 1 samples before the output sample, in the other stream. The sample of the other
+    // stream just before aligned sample k is centre[k - 1 + mPhase].
+    const int centre_offset = mPhase - 1 - (NUM_CENTRE_HISTORY - 1);
+
+    for (int k = 0; k < num_aligned; k++) {
+        outBuffer[k] = FloatDot::dot(mCoeffs.data(), aligned + k - (NUM_TAPS - 1), NUM_TAPS)
+                       + 0.5f * centre[k + centre_offset];
+    }
+
+    // Keep the history for the next block, the ranges overlap for short blocks
+    std::memmove(mAligned.data(), aligned + num_aligned - (NUM_TAPS - 1), (NUM_TAPS - 1) * sizeof(float));
+    std::memmove(mCentre.data(), centre + num_centre - NUM_CENTRE_HISTORY, NUM_CENTRE_HISTORY * sizeof(float));
+
+    mPhase += 2 * num_aligned - inNumSamples;
+
+    return num_aligned;
+}
+
+bool PolyphaseResampler::prepare(double inSourceSampleRate, double inTargetSampleRate, int inMaxBlockSize)
+{
+    if (!isInteger(inSourceSampleRate) || !isInteger(inTargetSampleRate))
+        return false;
+
+    const auto source_rate = static_cast<int64_t>(std::round(inSourceSampleRate));
+    const auto target_rate = static_cast<int64_t>(std::round(inTargetSampleRate));
+    const int64_t gcd = std::gcd(source_rate, target_rate);
+
+    if (target_rate / gcd > MAX_NUM_PHASES)
+        return false;
+
+    mNumPhases = static_cast<int>(target_rate / gcd);
+    mDecimation = static_cast<int>(source_rate / gcd);
+
+    // Number of taps per phase (the filter length in input samples) from Kaiser's estimate
+    const double min_rate = static_cast<double>(std::min(source_rate, target_rate));
+    const double transition = TRANSITION_WIDTH * min_rate / static_cast<double>(source_rate);
+    const int num_taps = static_cast<int>(std::ceil((STOPBAND_ATTENUATION_DB - 7.95) / (14.36 * transition)));
+    mNumTaps = std::min(MAX_NUM_TAPS,
+                        (num_taps + FloatDot::BlockSize - 1) / FloatDot::BlockSize * FloatDot::BlockSize);
+
+    // Prototype at mNumPhases times the source rate. Tap j of phase p is the prototype tap p + j * mNumPhases,
+    // applied to the input sample j samples before the newest one.
+    const int length = mNumPhases * mNumTaps;
+    const double cutoff = (0.5 - 0.5 * TRANSITION_WIDTH) * min_rate / static_cast<double>(source_rate * mNumPhases);
+
+    std::vector<double> prototype(static_cast<size_t>(length));
+    double sum = 0.0;
+    for (int i = 0; i < length; i++) {
+        prototype[static_cast<size_t>(i)] = windowedSinc(cutoff, length, i);
+        sum += prototype[static_cast<size_t>(i)];
+    }
+
+    // Zero stuffing divides the gain by mNumPhases: unit gain at DC on average over the phases
+    const double gain = static_cast<double>(mNumPhases) / sum;
+    mCoeffs.resize(static_cast<size_t>(length));
+    for (int p = 0; p < mNumPhases; p++) {
+        for (int j = 0; j < mNumTaps; j++) {
+            mCoeffs[static_cast<size_t>(p * mNumTaps + mNumTaps - 1 - j)] =
+                static_cast<float>(gain * prototype[static_cast<size_t>(p + j * mNumPhases)]);
+        }
+    }
+
+    mMaxBlockSize = std::max(1, inMaxBlockSize);
+    mInput.resize(static_cast<size_t>(mNumTaps - 1 + mMaxBlockSize));
+    reset();
+
+    return true;
+}
+
+void PolyphaseResampler::reset()
+{
+    std::fill(mInput.begin(), mInput.end(), 0.0f);
+    mTime = 0;
+}
+
+int PolyphaseResampler::process(const float* inBuffer, float* outBuffer, int inNumSamples)
+{
+    assert(inNumSamples <= mMaxBlockSize);
+
+    std::copy(inBuffer, inBuffer + inNumSamples, mInput.begin() + mNumTaps - 1);
+
+    const int num_out = getNumOutSamples(inNumSamples);
+    int64_t time = mTime;
+
+    for (int k = 0; k < num_out; k++) {
+        // The filter covers the mNumTaps input samples up to the newest one, the history comes first in mInput
+        const auto newest = static_cast<int>(time / mNumPhases);
+        const auto phase = static_cast<int>(time % mNumPhases);
+        outBuffer[k] = FloatDot::dot(mCoeffs.data() + phase * mNumTaps, mInput.data() + newest, mNumTaps);
+        time += mDecimation;
+    }
+
+    mTime = time - static_cast<int64_t>(inNumSamples) * mNumPhases;
+
+    std::memmove(mInput.data(), mInput.data() + inNumSamples, static_cast<size_t>(mNumTaps - 1) * sizeof(float));
+
+    return num_out;
+}
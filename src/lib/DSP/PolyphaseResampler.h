@@ -0,0 +1,204 @@
+// PolyphaseResampler.h
+
+#ifndef PolyphaseResampler_h
+#define PolyphaseResampler_h
+
+#include <cassert>
+#include <cstdint>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+/**
+ * Float dot products used by the polyphase FIR filters.
+ */
+namespace FloatDot
+{
+/** Dot product lengths must be a multiple of this. Filters are zero padded accordingly. */
+static constexpr int BlockSize = 8;
+
+/**
+ * Dot product of two vectors.
+ * @param inA First vector
+ * @param inB Second vector
+ * @param inLength Length of both vectors, multiple of BlockSize
+ * @return Dot product
+ */
+static inline float dot(const float* inA, const float* inB, int inLength)
+{
+    assert(inLength % BlockSize == 0);
+
+#if defined(__AVX__)
+    __m256 acc = _mm256_setzero_ps();
+    for (int n = 0; n < inLength; n += BlockSize) {
+#if defined(__FMA__)
+        acc = _mm256_fmadd_ps(_mm256_loadu_ps(inA + n), _mm256_loadu_ps(inB + n), acc);
+#else
+        acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_loadu_ps(inA + n), _mm256_loadu_ps(inB + n)));
+#endif
+    }
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, _MM_SHUFFLE(1, 1, 1, 1)));
+    return _mm_cvtss_f32(sum);
+#elif defined(__SSE2__)
+    // Two accumulators to hide the latency of the additions
+    __m128 acc_0 = _mm_setzero_ps();
+    __m128 acc_1 = _mm_setzero_ps();
+    for (int n = 0; n < inLength; n += BlockSize) {
+        acc_0 = _mm_add_ps(acc_0, _mm_mul_ps(_mm_loadu_ps(inA + n), _mm_loadu_ps(inB + n)));
+        acc_1 = _mm_add_ps(acc_1, _mm_mul_ps(_mm_loadu_ps(inA + n + 4), _mm_loadu_ps(inB + n + 4)));
+    }
+    __m128 sum = _mm_add_ps(acc_0, acc_1);
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, _MM_SHUFFLE(1, 1, 1, 1)));
+    return _mm_cvtss_f32(sum);
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    float32x4_t acc_0 = vdupq_n_f32(0.0f);
+    float32x4_t acc_1 = vdupq_n_f32(0.0f);
+    for (int n = 0; n < inLength; n += BlockSize) {
+        acc_0 = vfmaq_f32(acc_0, vld1q_f32(inA + n), vld1q_f32(inB + n));
+        acc_1 = vfmaq_f32(acc_1, vld1q_f32(inA + n + 4), vld1q_f32(inB + n + 4));
+    }
+    return vaddvq_f32(vaddq_f32(acc_0, acc_1));
+#else
+    float acc = 0.0f;
+    for (int n = 0; n < inLength; n++) {
+        acc += inA[n] * inB[n];
+    }
+    return acc;
+#endif
+}
+} // namespace FloatDot
+
+/**
+ * Decimation by 2 with a linear phase half-band FIR (Kaiser windowed sinc, cutoff at the output Nyquist frequency).
+ * All even offsets from the centre tap of a half-band filter are zero and the centre tap is 0.5, so the input is
+ * split in two streams: the samples aligned with the outputs go through a dense FIR of NUM_TAPS taps and the other
+ * stream only contributes its sample at the centre of the filter.
+ * Latency: NUM_TAPS - 1 input samples.
+ */
+class HalfBandDecimator
+{
+public:
+    /** Number of non-zero taps besides the centre one, multiple of FloatDot::BlockSize */
+    static constexpr int NUM_TAPS = 48;
+
+    HalfBandDecimator();
+
+    /**
+     * Allocate for blocks of up to inMaxBlockSize input samples and reset.
+     * @param inMaxBlockSize Maximum number of input samples sent to process
+     */
+    void prepare(int inMaxBlockSize);
+
+    /** Clear the filter history */
+    void reset();
+
+    /**
+     * @param inNumSamples Number of input samples
+     * @return Number of samples the next call to process with inNumSamples input samples writes
+     */
+    int getNumOutSamples(int inNumSamples) const
+    {
+        return inNumSamples > mPhase ? (inNumSamples - mPhase + 1) / 2 : 0;
+    }
+
+    /**
+     * Decimate a block.
+     * @param inBuffer Input samples
+     * @param outBuffer Output samples, getNumOutSamples(inNumSamples) are written
+     * @param inNumSamples Number of input samples, at most the inMaxBlockSize sent to prepare
+     * @return Number of samples written to outBuffer
+     */
+    int process(const float* inBuffer, float* outBuffer, int inNumSamples);
+
+private:
+    static constexpr int NUM_CENTRE_HISTORY = NUM_TAPS / 2;
+
+    // Non-zero taps of the half-band aligned with the newest input sample, in FloatDot order
+    std::vector<float> mCoeffs;
+    // Input samples aligned with the outputs: NUM_TAPS - 1 samples of history then the current block
+    std::vector<float> mAligned;
+    // The other input samples: NUM_CENTRE_HISTORY samples of history then the current block
+    std::vector<float> mCentre;
+
+    int mMaxBlockSize = 0;
+    // Index in the next block of the first sample aligned with an output: 0 or 1
+    int mPhase = 0;
+};
+
+/**
+ * Rational resampler by L / M (L phases, decimation M) with a polyphase Kaiser windowed sinc FIR designed at L times
+ * the source rate. Each output is a single dot product between the last mNumTaps input samples and the phase of the
+ * filter at its position, so only the outputs are computed. The cutoff is at 0.45 of the lower of the two rates,
+ * with the stopband starting at its Nyquist frequency.
+ * Latency: (mNumTaps - 1 / L) / 2 input samples.
+ */
+class PolyphaseResampler
+{
+public:
+    /** Largest L accepted by prepare: covers the ratios between the usual 44.1 and 48 kHz families */
+    static constexpr int MAX_NUM_PHASES = 1024;
+    /** Largest number of taps per phase */
+    static constexpr int MAX_NUM_TAPS = 256;
+
+    PolyphaseResampler() = default;
+
+    /**
+     * Design the filter and allocate for blocks of up to inMaxBlockSize input samples, then reset.
+     * @param inSourceSampleRate Input sample rate, integer
+     * @param inTargetSampleRate Output sample rate, integer
+     * @param inMaxBlockSize Maximum number of input samples sent to process
+     * @return False if a rate is not an integer or the ratio needs more than MAX_NUM_PHASES phases. The resampler
+     * must not be used then.
+     */
+    bool prepare(double inSourceSampleRate, double inTargetSampleRate, int inMaxBlockSize);
+
+    /** Clear the filter history and restart the phase */
+    void reset();
+
+    /**
+     * @param inNumSamples Number of input samples
+     * @return Number of samples the next call to process with inNumSamples input samples writes
+     */
+    int getNumOutSamples(int inNumSamples) const
+    {
+        const int64_t end_time = static_cast<int64_t>(inNumSamples) * mNumPhases;
+        return end_time > mTime ? static_cast<int>((end_time - mTime + mDecimation - 1) / mDecimation) : 0;
+    }
+
+    /**
+     * Resample a block.
+     * @param inBuffer Input samples
+     * @param outBuffer Output samples, getNumOutSamples(inNumSamples) are written
+     * @param inNumSamples Number of input samples, at most the inMaxBlockSize sent to prepare
+     * @return Number of samples written to outBuffer
+     */
+    int process(const float* inBuffer, float* outBuffer, int inNumSamples);
+
+    int getNumPhases() const { return mNumPhases; }
+
+    int getDecimation() const { return mDecimation; }
+
+    int getNumTaps() const { return mNumTaps; }
+
+private:
+    // mNumPhases filters of mNumTaps taps, each in FloatDot order
+    std::vector<float> mCoeffs;
+    // mNumTaps - 1 input samples of history then the current block
+    std::vector<float> mInput;
+
+    int mNumPhases = 1;
+    int mDecimation = 1;
+    int mNumTaps = 0;
+    int mMaxBlockSize = 0;
+    // Position of the next output in the next block, in 1 / mNumPhases of input samples
+    int64_t mTime = 0;
+};
+
+#endif // PolyphaseResampler_h
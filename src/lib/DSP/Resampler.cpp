@@ -4,13 +4,29 @@
 
 #include "Resampler.h"
 
+#include <cstring>
+
 void Resampler::prepareToPlay(double inSourceSampleRate, int inMaxBlockSize, double inTargetSampleRate)
 {
     mSourceSampleRate = inSourceSampleRate;
     mTargetSampleRate = inTargetSampleRate;
     mSpeedRatio = mSourceSampleRate / mTargetSampleRate;
 
-    mInternalBuffer.setSize(1, inMaxBlockSize + 2 * static_cast<int>(LagrangeInterpolator::getBaseLatency()) + 1);
+    // Whole files are sent in one block by AudioUtils::resampleBuffer, both paths only need chunk sized buffers
+    mMaxBlockSize = jlimit(1, MAX_CHUNK_SIZE, inMaxBlockSize);
+
+    mUsePolyphase = mPolyphaseEnabled && _preparePolyphase();
+
+    if (mUsePolyphase) {
+        mInputWindow.clear();
+        mLowpassFilters.clear();
+        reset();
+        return;
+    }
+
+    // Room for two chunks after the samples left by the interpolator: the window is compacted at most every other
+    // chunk.
+    mInputWindow.resize(static_cast<size_t>(2 * mMaxBlockSize + _maxNumInterpolatorSamplesLeft() + 1));
 
     // Lowpass filter stuffs
     if (mTargetSampleRate < mSourceSampleRate) {
@@ -30,52 +46,197 @@ void Resampler::prepareToPlay(double inSourceSampleRate, int inMaxBlockSize, dou
     reset();
 }
 
+bool Resampler::_preparePolyphase()
+{
+    mHalfBands.clear();
+    mUseRational = false;
+
+    double rate = mSourceSampleRate;
+    int num_half_bands = 0;
+    while (rate / 2.0 >= mTargetSampleRate) {
+        rate /= 2.0;
+        num_half_bands++;
+    }
+
+    // Largest block sent to each stage
+    int block_size = mMaxBlockSize;
+    mHalfBands.resize(static_cast<size_t>(num_half_bands));
+    for (auto& half_band: mHalfBands) {
+        half_band.prepare(block_size);
+        block_size = (block_size + 1) / 2;
+    }
+
+    if (rate != mTargetSampleRate) {
+        if (!mRational.prepare(rate, mTargetSampleRate, block_size)) {
+            mHalfBands.clear();
+            return false;
+        }
+        mUseRational = true;
+    }
+
+    for (auto& buffer: mStageBuffers)
+        buffer.resize(static_cast<size_t>((mMaxBlockSize + 1) / 2));
+
+    return true;
+}
+
 void Resampler::reset()
 {
-    mInternalBuffer.clear();
+    for (auto& half_band: mHalfBands)
+        half_band.reset();
+    if (mUseRational)
+        mRational.reset();
+
+    std::fill(mInputWindow.begin(), mInputWindow.end(), 0.0f);
+    mReadPosition = 0;
     mNumInputSamplesAvailable = mInitPadding;
+    mInterpolatorPosition = 1.0;
     mInterpolator.reset();
 
     for (auto& lowpass_filter: mLowpassFilters)
         lowpass_filter.reset();
 }
+
 int Resampler::processBlock(const float* inBuffer, float* outBuffer, int inNumSamples)
 {
-    jassert(mNumInputSamplesAvailable + inNumSamples <= mInternalBuffer.getNumSamples());
+    if (mUsePolyphase)
+        return _processPolyphase(inBuffer, outBuffer, inNumSamples);
 
-    mInternalBuffer.copyFrom(0, mNumInputSamplesAvailable, inBuffer, inNumSamples);
-    float* internal_buffer_ptr = mInternalBuffer.getWritePointer(0);
+    int num_out = 0;
+    for (int start = 0; start < inNumSamples; start += mMaxBlockSize) {
+        num_out += _processInterpolatorChunk(
+            inBuffer + start, outBuffer + num_out, std::min(mMaxBlockSize, inNumSamples - start));
+    }
 
-    // Lowpass filter if necessary
-    if (mTargetSampleRate < mSourceSampleRate) {
-        for (int i = 0; i < inNumSamples; i++) {
-            for (auto& lowpass_filter: mLowpassFilters) {
-                internal_buffer_ptr[mNumInputSamplesAvailable + i] =
-                    lowpass_filter.processSample(internal_buffer_ptr[mNumInputSamplesAvailable + i]);
-            }
-        }
+    return num_out;
+}
+
+int Resampler::_processInterpolatorChunk(const float* inBuffer, float* outBuffer, int inNumSamples)
+{
+    if (mReadPosition + mNumInputSamplesAvailable + inNumSamples > static_cast<int>(mInputWindow.size())) {
+        std::memmove(mInputWindow.data(),
+                     mInputWindow.data() + mReadPosition,
+                     static_cast<size_t>(mNumInputSamplesAvailable) * sizeof(float));
+        mReadPosition = 0;
+    }
+
+    float* chunk_ptr = mInputWindow.data() + mReadPosition + mNumInputSamplesAvailable;
+    std::copy(inBuffer, inBuffer + inNumSamples, chunk_ptr);
+
+    // Lowpass filter if necessary, one section of the cascade over the whole chunk at a time
+    if (!mLowpassFilters.empty()) {
+        juce::dsp::AudioBlock<float> block(&chunk_ptr, 1, static_cast<size_t>(inNumSamples));
+        for (auto& lowpass_filter: mLowpassFilters)
+            lowpass_filter.process(juce::dsp::ProcessContextReplacing<float>(block));
     }
 
     mNumInputSamplesAvailable += inNumSamples;
 
     int num_out_samples_to_produce = static_cast<int>(std::floor(mNumInputSamplesAvailable / mSpeedRatio));
 
-    int num_input_samples_used =
-        mInterpolator.process(mSpeedRatio, mInternalBuffer.getReadPointer(0), outBuffer, num_out_samples_to_produce);
+    int num_input_samples_used = mInterpolator.process(
+        mSpeedRatio, mInputWindow.data() + mReadPosition, outBuffer, num_out_samples_to_produce);
+
+    const int num_input_samples_expected =
+        _numInterpolatorInputSamplesUsed(mSpeedRatio, mInterpolatorPosition, num_out_samples_to_produce);
 
     jassert(num_input_samples_used <= mNumInputSamplesAvailable);
+    jassertquiet(num_input_samples_used == num_input_samples_expected);
 
     mNumInputSamplesAvailable -= num_input_samples_used;
-
-    for (int i = 0; i < mNumInputSamplesAvailable; i++) {
-        mInternalBuffer.setSample(0, i, mInternalBuffer.getSample(0, i + num_input_samples_used));
-    }
+    mReadPosition += num_input_samples_used;
 
     return num_out_samples_to_produce;
 }
 
+int Resampler::_maxNumInterpolatorSamplesLeft() const
+{
+    // Each chunk produces floor(available / mSpeedRatio) samples, which use all but about 2 * mSpeedRatio of them
+    return 2 * static_cast<int>(std::ceil(mSpeedRatio)) + mInitPadding;
+}
+
+int Resampler::_numInterpolatorInputSamplesUsed(double inSpeedRatio, double& inOutPosition, int inNumOutSamples)
+{
+    // Same steps as the interpolator: inputs are pushed until the position is below one, then it advances by the ratio
+    int num_used = 0;
+    double position = inOutPosition;
+    for (int i = 0; i < inNumOutSamples; i++) {
+        while (position >= 1.0) {
+            num_used++;
+            position -= 1.0;
+        }
+        position += inSpeedRatio;
+    }
+    inOutPosition = position;
+    return num_used;
+}
+
+int Resampler::_processPolyphase(const float* inBuffer, float* outBuffer, int inNumSamples)
+{
+    int num_out = 0;
+
+    for (int start = 0; start < inNumSamples; start += mMaxBlockSize) {
+        const float* stage_in = inBuffer + start;
+        int stage_num_samples = std::min(mMaxBlockSize, inNumSamples - start);
+
+        for (size_t i = 0; i < mHalfBands.size(); i++) {
+            const bool is_last_stage = i + 1 == mHalfBands.size() && !mUseRational;
+            float* stage_out = is_last_stage ? outBuffer + num_out : mStageBuffers[i % 2].data();
+            stage_num_samples = mHalfBands[i].process(stage_in, stage_out, stage_num_samples);
+            stage_in = stage_out;
+        }
+
+        if (mUseRational) {
+            stage_num_samples = mRational.process(stage_in, outBuffer + num_out, stage_num_samples);
+        } else if (mHalfBands.empty()) {
+            // Same rates
+            std::copy(stage_in, stage_in + stage_num_samples, outBuffer + num_out);
+        }
+
+        num_out += stage_num_samples;
+    }
+
+    return num_out;
+}
 
 int Resampler::getNumOutSamplesOnNextProcessBlock(int inNumSamples) const
 {
-    return static_cast<int>(std::floor((mNumInputSamplesAvailable + inNumSamples) / mSpeedRatio));
+    if (mUsePolyphase) {
+        // Each stage outputs the same total whether the block is split in chunks or not
+        int num_samples = inNumSamples;
+        for (auto& half_band: mHalfBands)
+            num_samples = half_band.getNumOutSamples(num_samples);
+        return mUseRational ? mRational.getNumOutSamples(num_samples) : num_samples;
+    }
+
+    // Same chunks as processBlock
+    int num_available = mNumInputSamplesAvailable;
+    double position = mInterpolatorPosition;
+    int num_out = 0;
+    for (int start = 0; start < inNumSamples; start += mMaxBlockSize) {
+        num_available += std::min(mMaxBlockSize, inNumSamples - start);
+        const int num_chunk_out = static_cast<int>(std::floor(num_available / mSpeedRatio));
+        num_available -= _numInterpolatorInputSamplesUsed(mSpeedRatio, position, num_chunk_out);
+        num_out += num_chunk_out;
+    }
+    return num_out;
+}
+
+int Resampler::getMaxNumOutSamples(int inNumSamples) const
+{
+    if (mUsePolyphase) {
+        // Each stage gives the most outputs from its reset state
+        int num_samples = inNumSamples;
+        for (size_t i = 0; i < mHalfBands.size(); i++)
+            num_samples = (num_samples + 1) / 2;
+        if (!mUseRational)
+            return num_samples;
+        const int64_t end_time = static_cast<int64_t>(num_samples) * mRational.getNumPhases();
+        return static_cast<int>((end_time + mRational.getDecimation() - 1) / mRational.getDecimation());
+    }
+
+    // K outputs since the reset use floor((K - 1) * mSpeedRatio) + 1 inputs, so a block gives less than
+    // (samples left + inNumSamples + 1) / mSpeedRatio outputs
+    return static_cast<int>(
+        std::ceil((_maxNumInterpolatorSamplesLeft() + inNumSamples + 1) / mSpeedRatio));
 }
@@ -7,6 +7,8 @@
 
 #include <JuceHeader.h>
 
+#include "PolyphaseResampler.h"
+
 class Resampler
 {
 public:
@@ -14,24 +16,76 @@ public:
 
     ~Resampler() = default;
 
+    /** picks the polyphase FIR path when the rates allow it: half-band decimators by 2 while the rate stays at or
+     * above the target (44.1 kHz is a single half-band, 88.2 and 176.4 kHz a cascade), then a rational polyphase
+     * resampler for what is left (147:160 from the 48 kHz family). Other rates use the IIR lowpass and Lagrange
+     * interpolator.
+     */
     void prepareToPlay(double inSourceSampleRate, int inMaxBlockSize, double inTargetSampleRate);
 
     void reset();
-    /** resamples the sent audio and writes to outBuffer.  i think the number of samples it processes is limited by
-     * both inNumSamples and the inMaxBlockSize set previously in prepareToPlay.
+    /** resamples the sent audio and writes to outBuffer. Any number of samples can be sent, blocks larger than the
+     * inMaxBlockSize set in prepareToPlay are processed in chunks, nothing is allocated.
+     * @return number of samples written, as returned by getNumOutSamplesOnNextProcessBlock(inNumSamples)
     */
     int processBlock(const float* inBuffer, float* outBuffer, int inNumSamples);
 
+    /** @return exact number of samples the next processBlock call with inNumSamples samples writes */
     int getNumOutSamplesOnNextProcessBlock(int inNumSamples) const;
 
+    /** @return the most samples a processBlock call with inNumSamples samples can write, whatever the state left by
+     * the previous blocks. Use it to size output buffers */
+    int getMaxNumOutSamples(int inNumSamples) const;
+
+    /** allow the polyphase path (default). Applied by the next prepareToPlay, used to compare with the
+     * IIR lowpass and Lagrange interpolator */
+    void setPolyphaseEnabled(bool inEnabled) { mPolyphaseEnabled = inEnabled; }
+
+    /** @return whether the last prepareToPlay selected the polyphase path */
+    bool isPolyphase() const { return mUsePolyphase; }
+
 private:
+    /** set up the polyphase stages, @return false if the rates need the interpolator */
+    bool _preparePolyphase();
+
+    int _processPolyphase(const float* inBuffer, float* outBuffer, int inNumSamples);
+
+    /** lowpass and interpolate one chunk of at most mMaxBlockSize samples */
+    int _processInterpolatorChunk(const float* inBuffer, float* outBuffer, int inNumSamples);
+
+    /** follows the sub-sample position of LagrangeInterpolator::process to tell how many input samples it uses
+     * @param inOutPosition position before the call (1.0 after a reset), updated
+     * @return number of input samples used to produce inNumOutSamples samples */
+    static int _numInterpolatorInputSamplesUsed(double inSpeedRatio, double& inOutPosition, int inNumOutSamples);
+
+    /** @return bound on the input samples left unused by the interpolator after a chunk */
+    int _maxNumInterpolatorSamplesLeft() const;
+
+    static constexpr int MAX_CHUNK_SIZE = 4096;
+
+    bool mPolyphaseEnabled = true;
+    bool mUsePolyphase = false;
+    // Both paths process chunks of mMaxBlockSize input samples at most
+    int mMaxBlockSize = 0;
+    // Polyphase path: mHalfBands in turn then mRational if mUseRational
+    std::vector<HalfBandDecimator> mHalfBands;
+    PolyphaseResampler mRational;
+    bool mUseRational = false;
+    // Outputs of the half-bands before the last stage, used in turn
+    std::vector<float> mStageBuffers[2];
+
     LagrangeInterpolator mInterpolator;
 
-    AudioBuffer<float> mInternalBuffer;
+    // Contiguous window of input samples for the interpolator: the samples not used yet start at mReadPosition.
+    // New chunks are appended after them, the few samples left are only moved back to the start when a chunk
+    // does not fit in the rest of the window.
+    std::vector<float> mInputWindow;
+    int mReadPosition = 0;
 
     const int mInitPadding = static_cast<int>(LagrangeInterpolator::getBaseLatency());
 
     int mNumInputSamplesAvailable = mInitPadding;
+    double mInterpolatorPosition = 1.0;
     double mSpeedRatio;
     double mSourceSampleRate;
     double mTargetSampleRate;
@@ -7,34 +7,97 @@
 void BasicPitch::reset()
 {
     mBasicPitchCNN.reset();
-    mNotesCreator.clear();
-
-    mContoursPG.clear();
-    mContoursPG.shrink_to_fit();
-    mNotesPG.clear();
-    mNotesPG.shrink_to_fit();
-    mOnsetsPG.clear();
-    mOnsetsPG.shrink_to_fit();
+
+    // O(1), event storage is kept for the next transcription. The posteriorgrams are overwritten by the next one.
     mNoteEvents.clear();
-    mNoteEvents.shrink_to_fit();
 
     mNumFrames = 0;
 }
 
+void BasicPitch::reserve(int inNumSamples)
+{
+    // Centered feature frames, one every FFT_HOP samples
+    const size_t num_frames = static_cast<size_t>(std::max(0, inNumSamples)) / FFT_HOP + 1;
+
+    _resizePosteriorgram(mOnsetsPG, num_frames, NUM_FREQ_OUT);
+    _resizePosteriorgram(mNotesPG, num_frames, NUM_FREQ_OUT);
+    _resizePosteriorgram(mContoursPG, num_frames, NUM_FREQ_IN);
+}
+
 void BasicPitch::setParameters(float inNoteSensitivity, float inSplitSensitivity, float inMinNoteDurationMs)
 {
-    mParams.frameThreshold = 1.0f - inNoteSensitivity;
-    mParams.onsetThreshold = 1.0f - inSplitSensitivity;
+    setThresholds(inNoteSensitivity, inSplitSensitivity, inMinNoteDurationMs, mParams);
+}
 
-    mParams.minNoteLength =
+void BasicPitch::setThresholds(float inNoteSensitivity,
+                               float inSplitSensitivity,
+                               float inMinNoteDurationMs,
+                               Notes::ConvertParams& outParams)
+{
+    outParams.frameThreshold = 1.0f - inNoteSensitivity;
+    outParams.onsetThreshold = 1.0f - inSplitSensitivity;
+
+    outParams.minNoteLength =
         static_cast<int>(std::round(inMinNoteDurationMs / 1000.0f / (FFT_HOP / BASIC_PITCH_SAMPLE_RATE)));
 
-    mParams.pitchBend = MultiPitchBend;
-    mParams.melodiaTrick = true;
-    mParams.inferOnsets = true;
+    outParams.melodiaTrick = true;
+    outParams.inferOnsets = true;
+}
+
+void BasicPitch::setPitchBendMode(PitchBendModes inPitchBendMode)
+{
+    mParams.pitchBend = inPitchBendMode;
+}
+
+void BasicPitch::setScale(NoteUtils::ScaleType inScaleType,
+                          NoteUtils::RootNote inRootNote,
+                          NoteUtils::SnapMode inSnapMode)
+{
+    mParams.scaleType = inScaleType;
+    mParams.rootNote = inRootNote;
+    mParams.snapMode = inSnapMode;
+}
+
+void BasicPitch::setPitchRange(int inMinMidiNote, int inMaxMidiNote)
+{
+    inMinMidiNote = std::clamp(inMinMidiNote, MIN_MIDI_NOTE, MAX_MIDI_NOTE);
+    inMaxMidiNote = std::clamp(inMaxMidiNote, inMinMidiNote, MAX_MIDI_NOTE);
+
+    mParams.minFrequency = inMinMidiNote == MIN_MIDI_NOTE ? -1.0f : NoteUtils::midiToHz((float) inMinMidiNote);
+    mParams.maxFrequency = inMaxMidiNote == MAX_MIDI_NOTE ? -1.0f : NoteUtils::midiToHz((float) inMaxMidiNote);
+
+    // Changing the CNN range resets it, only do it when needed
+    if (inMinMidiNote != mMinMidiNote || inMaxMidiNote != mMaxMidiNote) {
+        mMinMidiNote = inMinMidiNote;
+        mMaxMidiNote = inMaxMidiNote;
+        mBasicPitchCNN.setPitchRange(mMinMidiNote, mMaxMidiNote);
+    }
+}
+
+int BasicPitch::getMinMidiNote() const
+{
+    return mMinMidiNote;
+}
+
+int BasicPitch::getMaxMidiNote() const
+{
+    return mMaxMidiNote;
 }
 
 void BasicPitch::transcribeToMIDI(float* inAudio, int inNumSamples)
+{
+    computePosteriorgrams(inAudio, inNumSamples);
+
+    createNoteEvents();
+}
+
+void BasicPitch::computePosteriorgrams(float* inAudio, int inNumSamples)
+{
+    beginPosteriorgrams(inAudio, inNumSamples);
+    computePosteriorgramFrames(getNumPosteriorgramFrames());
+}
+
+void BasicPitch::beginPosteriorgrams(float* inAudio, int inNumSamples)
 {
     // To test if downsampling works as expected
 #if SAVE_DOWNSAMPLED_AUDIO
@@ -56,58 +119,191 @@ void BasicPitch::transcribeToMIDI(float* inAudio, int inNumSamples)
     }
 #endif
 
-    const float* stacked_cqt = mFeaturesCalculator.computeFeatures(inAudio, inNumSamples, mNumFrames);
-
-    mOnsetsPG.resize(mNumFrames, std::vector<float>(static_cast<size_t>(NUM_FREQ_OUT), 0.0f));
-    mNotesPG.resize(mNumFrames, std::vector<float>(static_cast<size_t>(NUM_FREQ_OUT), 0.0f));
-    mContoursPG.resize(mNumFrames, std::vector<float>(static_cast<size_t>(NUM_FREQ_IN), 0.0f));
+    mStackedCQT = mFeaturesCalculator.computeFeatures(inAudio, inNumSamples, mNumFrames);
 
-    mOnsetsPG.shrink_to_fit();
-    mNotesPG.shrink_to_fit();
-    mContoursPG.shrink_to_fit();
+    _resizePosteriorgram(mOnsetsPG, mNumFrames, NUM_FREQ_OUT);
+    _resizePosteriorgram(mNotesPG, mNumFrames, NUM_FREQ_OUT);
+    _resizePosteriorgram(mContoursPG, mNumFrames, NUM_FREQ_IN);
 
     mBasicPitchCNN.reset();
+    mNextFrameInference = 0;
+}
+
+void BasicPitch::_resizePosteriorgram(std::vector<std::vector<float>>& inOutPG, size_t inNumFrames, int inNumBins)
+{
+    // Frames are only allocated when the posteriorgram grows: windows of the same length reuse all of them
+    if (inOutPG.size() < inNumFrames) {
+        inOutPG.resize(inNumFrames, std::vector<float>(static_cast<size_t>(inNumBins), 0.0f));
+    } else {
+        inOutPG.resize(inNumFrames);
+    }
 
+    for (auto& frame: inOutPG) {
+        std::fill(frame.begin(), frame.end(), 0.0f);
+    }
+}
+
+int BasicPitch::computePosteriorgramFrames(int inMaxNumFrames)
+{
     const size_t num_lh_frames = BasicPitchCNN::getNumFramesLookahead();
+    const auto num_delay_frames = static_cast<size_t>(mBasicPitchCNN.getNumFramesDelay());
+    const auto num_inferences = static_cast<size_t>(getNumPosteriorgramFrames());
+    const size_t end = std::min(num_inferences, mNextFrameInference + static_cast<size_t>(std::max(0, inMaxNumFrames)));
 
-    std::vector<float> zero_stacked_cqt(NUM_HARMONICS * NUM_FREQ_IN, 0.0f);
+    // The CNN is run on num_lh_frames of zeros, then on the features, then on num_delay_frames of zeros.
+    // Its output lags its input by num_delay_frames (num_lh_frames, more in eco mode), the outputs of the first
+    // num_lh_frames + num_delay_frames inferences are discarded.
+    for (size_t i = mNextFrameInference; i < end; i++) {
+        const bool zero_input = i < num_lh_frames || i >= mNumFrames + num_lh_frames;
+        const float* input =
+            zero_input ? mZeroStackedCQT.data() : mStackedCQT + (i - num_lh_frames) * NUM_HARMONICS * NUM_FREQ_IN;
+        const size_t frame_idx = i < num_lh_frames + num_delay_frames ? 0 : i - num_lh_frames - num_delay_frames;
 
-    // Run the CNN with 0 input and discard output (only for num_lh_frames)
-    for (int i = 0; i < num_lh_frames; i++) {
-        mBasicPitchCNN.frameInference(zero_stacked_cqt.data(), mContoursPG[0], mNotesPG[0], mOnsetsPG[0]);
+        mBasicPitchCNN.frameInference(input, mContoursPG[frame_idx], mNotesPG[frame_idx], mOnsetsPG[frame_idx]);
     }
+    mNextFrameInference = end;
 
-    // Run the CNN with real inputs and discard outputs (only for num_lh_frames)
-    for (size_t frame_idx = 0; frame_idx < num_lh_frames; frame_idx++) {
-        mBasicPitchCNN.frameInference(
-            stacked_cqt + frame_idx * NUM_HARMONICS * NUM_FREQ_IN, mContoursPG[0], mNotesPG[0], mOnsetsPG[0]);
-    }
+    return static_cast<int>(num_inferences - mNextFrameInference);
+}
+
+int BasicPitch::getNumPosteriorgramFrames() const
+{
+    return static_cast<int>(mNumFrames) + BasicPitchCNN::getNumFramesLookahead() + mBasicPitchCNN.getNumFramesDelay();
+}
+
+void BasicPitch::createNoteEvents()
+{
+    mNotesCreator.convert(mNotesPG, mOnsetsPG, mContoursPG, mParams, true, mNoteEvents);
+}
 
-    // Run the CNN with real inputs and correct outputs
-    for (size_t frame_idx = num_lh_frames; frame_idx < mNumFrames; frame_idx++) {
-        mBasicPitchCNN.frameInference(stacked_cqt + frame_idx * NUM_HARMONICS * NUM_FREQ_IN,
-                                      mContoursPG[frame_idx - num_lh_frames],
-                                      mNotesPG[frame_idx - num_lh_frames],
-                                      mOnsetsPG[frame_idx - num_lh_frames]);
+void BasicPitch::updateMIDI()
+{
+    mNotesCreator.convert(mNotesPG, mOnsetsPG, mContoursPG, mParams, false, mNoteEvents);
+}
+
+const NoteEvents& BasicPitch::getNoteEvents() const
+{
+    return mNoteEvents;
+}
+
+const Notes::ConvertParams& BasicPitch::getConvertParams() const
+{
+    return mParams;
+}
+
+void BasicPitch::setCNNEngine(CNNEngine inEngine)
+{
+    mBasicPitchCNN.setEngine((inEngine == Int8Engine && !mBasicPitchCNN.isInt8Calibrated()) ? FusedEngine
+                                                                                              : inEngine);
+}
+
+CNNEngine BasicPitch::getCNNEngine() const
+{
+    return mBasicPitchCNN.getEngine();
+}
+
+void BasicPitch::prepareCNNEngine(CNNEngine inEngine)
+{
+    mBasicPitchCNN.prepareEngine(inEngine);
+}
+
+void BasicPitch::setCNNDecimation(int inFactor)
+{
+    mBasicPitchCNN.setDecimation(inFactor);
+}
+
+int BasicPitch::getCNNDecimation() const
+{
+    return mBasicPitchCNN.getDecimation();
+}
+
+void BasicPitch::calibrateInt8(float* inAudio, int inNumSamples)
+{
+    size_t num_frames = 0;
+    const float* stacked_cqt = mFeaturesCalculator.computeFeatures(inAudio, inNumSamples, num_frames);
+
+    mBasicPitchCNN.calibrateInt8(stacked_cqt, num_frames);
+}
+
+void BasicPitch::calibrateInt8()
+{
+    // Same signal and same model for all instances: measured by the first caller only, once per process
+    static const BasicPitchCNN::Int8Calibration calibration = [this]() {
+        std::vector<float> audio = makeCalibrationAudio();
+        size_t num_frames = 0;
+        const float* stacked_cqt = mFeaturesCalculator.computeFeatures(audio.data(), audio.size(), num_frames);
+
+        return mBasicPitchCNN.measureInt8Calibration(stacked_cqt, num_frames);
+    }();
+
+    mBasicPitchCNN.setInt8Calibration(calibration);
+}
+
+bool BasicPitch::isInt8Calibrated() const
+{
+    return mBasicPitchCNN.isInt8Calibrated();
+}
+
+std::vector<float> BasicPitch::makeCalibrationAudio()
+{
+    constexpr int num_segments = 24;
+    constexpr int segment_length = static_cast<int>(BASIC_PITCH_SAMPLE_RATE / 4);
+    constexpr int noise_length = static_cast<int>(BASIC_PITCH_SAMPLE_RATE / 2);
+    constexpr float levels[] = {0.9f, 0.5f, 0.2f};
+    constexpr double pi = 3.14159265358979323846;
+
+    std::vector<float> audio(static_cast<size_t>(num_segments * segment_length + noise_length), 0.0f);
+
+    // Plain LCG: the signal must not depend on the standard library implementation
+    uint32_t state = 12345u;
+    auto next_random = [&state]() {
+        state = state * 1664525u + 1013904223u;
+        return static_cast<float>(state >> 8) / static_cast<float>(1u << 24);
+    };
+
+    for (int segment = 0; segment < num_segments; segment++) {
+        const int num_tones = 1 + segment % 4;
+        const float level = levels[segment % 3] / static_cast<float>(num_tones);
+        float* out = audio.data() + segment * segment_length;
+
+        for (int tone = 0; tone < num_tones; tone++) {
+            // Roots walk up the pitch range, chord notes a few semitones apart
+            const int midi_note = std::min(MAX_MIDI_NOTE,
+                                           MIN_MIDI_NOTE + (segment * 37) % (MAX_MIDI_NOTE - MIN_MIDI_NOTE + 1)
+                                               + tone * (3 + tone));
+            const double freq = 440.0 * std::pow(2.0, (midi_note - 69) / 12.0);
+            const int num_harmonics = std::max(1, std::min(10, static_cast<int>(BASIC_PITCH_SAMPLE_RATE / 2 / freq)));
+
+            for (int i = 0; i < segment_length; i++) {
+                const double phase = 2.0 * pi * freq * i / BASIC_PITCH_SAMPLE_RATE;
+                float sample = 0.0f;
+                for (int h = 1; h <= num_harmonics; h++) {
+                    sample += static_cast<float>(std::sin(h * phase)) / static_cast<float>(h);
+                }
+                out[i] += level * 0.6f * sample;
+            }
+        }
     }
 
-    // Run end with zeroes as input and last frames as output
-    for (size_t frame_idx = mNumFrames; frame_idx < mNumFrames + num_lh_frames; frame_idx++) {
-        mBasicPitchCNN.frameInference(zero_stacked_cqt.data(),
-                                      mContoursPG[frame_idx - num_lh_frames],
-                                      mNotesPG[frame_idx - num_lh_frames],
-                                      mOnsetsPG[frame_idx - num_lh_frames]);
+    float* noise = audio.data() + num_segments * segment_length;
+    for (int i = 0; i < noise_length; i++) {
+        noise[i] = 0.5f * (2.0f * next_random() - 1.0f);
     }
 
-    mNoteEvents = mNotesCreator.convert(mNotesPG, mOnsetsPG, mContoursPG, mParams, true);
+    return audio;
 }
 
-void BasicPitch::updateMIDI()
+const std::vector<std::vector<float>>& BasicPitch::getContoursPG() const
 {
-    mNoteEvents = mNotesCreator.convert(mNotesPG, mOnsetsPG, mContoursPG, mParams, false);
+    return mContoursPG;
 }
 
-const std::vector<Notes::Event>& BasicPitch::getNoteEvents() const
+const std::vector<std::vector<float>>& BasicPitch::getNotesPG() const
 {
-    return mNoteEvents;
+    return mNotesPG;
+}
+
+const std::vector<std::vector<float>>& BasicPitch::getOnsetsPG() const
+{
+    return mOnsetsPG;
 }
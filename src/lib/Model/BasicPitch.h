@@ -19,10 +19,18 @@ public:
     BasicPitch() = default;
 
     /**
-     * Resets all states of model, clear the posteriorgrams vector computed by the CNN and the note event vector.
+     * Resets all states of model and clear the note events. Nothing is freed: the storage of the note events and of
+     * the posteriorgrams is reused by the next transcription, which overwrites the posteriorgrams.
      */
     void reset();
 
+    /**
+     * Allocate the posteriorgrams of a transcription of inNumSamples samples ahead, so that transcribing windows of
+     * that length does not allocate them (the features model may still allocate).
+     * @param inNumSamples Number of samples of the windows that will be transcribed.
+     */
+    void reserve(int inNumSamples);
+
     /**
      * Set parameters for next transcription or midi update.
      * @param inNoteSensitivity Note sensitivity threshold (0.05, 0.95). Higher gives more notes.
@@ -31,6 +39,53 @@ public:
      */
     void setParameters(float inNoteSensitivity, float inSplitSensitivity, float inMinNoteDurationMs);
 
+    /**
+     * Set the thresholds of setParameters in note creation parameters, e.g. to create notes again from saved
+     * posteriorgrams with Notes::convert.
+     * @param inNoteSensitivity Note sensitivity threshold (0.05, 0.95)
+     * @param inSplitSensitivity Split sensitivity threshold (0.05, 0.95)
+     * @param inMinNoteDurationMs Minimum note duration to keep in ms.
+     * @param outParams Parameters whose thresholds are set, the others are left as they are.
+     */
+    static void setThresholds(float inNoteSensitivity,
+                              float inSplitSensitivity,
+                              float inMinNoteDurationMs,
+                              Notes::ConvertParams& outParams);
+
+    /**
+     * Select if and how pitch bends are extracted for the next transcriptions. Off by default: no contour
+     * posteriorgram work is done by the note creation unless pitch bends are requested.
+     * @param inPitchBendMode NoPitchBend, SinglePitchBend (dropped on notes overlapping others) or MultiPitchBend
+     */
+    void setPitchBendMode(PitchBendModes inPitchBendMode);
+
+    /**
+     * Constrain the notes of the next transcriptions to a scale. In Remove mode, the note creation does not visit
+     * the notes out of the scale at all.
+     * @param inScaleType Scale type, Chromatic for no constraint
+     * @param inRootNote Root note of the scale
+     * @param inSnapMode Adjust: notes out of the scale are moved to the nearest note of the scale. Remove: ignored.
+     */
+    void setScale(NoteUtils::ScaleType inScaleType, NoteUtils::RootNote inRootNote, NoteUtils::SnapMode inSnapMode);
+
+    /**
+     * Restrict transcription to a pitch range. Both the CNN and the note creation skip the notes outside the range,
+     * so the cost of a transcription drops with the size of the range.
+     * @param inMinMidiNote Lowest note to transcribe (MIN_MIDI_NOTE to MAX_MIDI_NOTE)
+     * @param inMaxMidiNote Highest note to transcribe (MIN_MIDI_NOTE to MAX_MIDI_NOTE)
+     */
+    void setPitchRange(int inMinMidiNote, int inMaxMidiNote);
+
+    /**
+     * @return Lowest note transcribed, set by setPitchRange.
+     */
+    int getMinMidiNote() const;
+
+    /**
+     * @return Highest note transcribed, set by setPitchRange.
+     */
+    int getMaxMidiNote() const;
+
     /**
      * Transcribe the input audio. The note event vector can be obtained after this with getNoteEvents
      * @param inAudio Pointer to raw audio (must be at 22050 Hz)
@@ -38,6 +93,45 @@ public:
      */
     void transcribeToMIDI(float* inAudio, int inNumSamples);
 
+    /**
+     * Only run Features + CNN on the input audio, without creating note events.
+     * Posteriorgrams can then be read with getNotesPG, getOnsetsPG and getContoursPG (used for streaming note
+     * extraction with NoteStream).
+     * @param inAudio Pointer to raw audio (must be at 22050 Hz)
+     * @param inNumSamples Number of input samples available.
+     */
+    void computePosteriorgrams(float* inAudio, int inNumSamples);
+
+    /**
+     * Same as computePosteriorgrams, in steps: compute the features and size the posteriorgrams, then run the CNN
+     * with computePosteriorgramFrames. The audio is not used after this.
+     * @param inAudio Pointer to raw audio (must be at 22050 Hz)
+     * @param inNumSamples Number of input samples available.
+     */
+    void beginPosteriorgrams(float* inAudio, int inNumSamples);
+
+    /**
+     * Run the next CNN frame inferences of the posteriorgrams started by beginPosteriorgrams.
+     * @param inMaxNumFrames Maximum number of frame inferences to run.
+     * @return Number of frame inferences left, 0 once all the posteriorgrams are computed.
+     */
+    int computePosteriorgramFrames(int inMaxNumFrames);
+
+    /**
+     * @return Number of frame inferences computePosteriorgramFrames runs in total after beginPosteriorgrams.
+     */
+    int getNumPosteriorgramFrames() const;
+
+    /**
+     * Create the note events from the posteriorgrams just computed, the end of transcribeToMIDI.
+     */
+    void createNoteEvents();
+
+    /**
+     * @return Note creation parameters set by setParameters, setPitchBendMode, setScale and setPitchRange.
+     */
+    const Notes::ConvertParams& getConvertParams() const;
+
     /**
      * Function to call to update the midi transcription with new parameters.
      * The whole Features + CNN is not rerun for this. Only Notes::Convert is.
@@ -45,22 +139,112 @@ public:
     void updateMIDI();
 
     /**
-     * @return Note event vector.
+     * @return Note events of last transcription or midi update.
      */
-    const std::vector<Notes::Event>& getNoteEvents() const;
+    const NoteEvents& getNoteEvents() const;
+
+    /**
+     * Select the implementation used to run the CNN for the next transcriptions.
+     * Int8Engine is only used if calibrateInt8 has been called before, FusedEngine is used otherwise.
+     * @param inEngine Engine to use.
+     */
+    void setCNNEngine(CNNEngine inEngine);
+
+    /**
+     * @return Engine used to run the CNN.
+     */
+    CNNEngine getCNNEngine() const;
+
+    /**
+     * Build the CNN layers of an engine, so that selecting it later does not allocate. Not real-time safe.
+     * See BasicPitchCNN::prepareEngine.
+     * @param inEngine Engine to build.
+     */
+    void prepareCNNEngine(CNNEngine inEngine);
+
+    /**
+     * Eco quality tier for the next transcriptions: the most expensive layer of the contour and note branch runs
+     * on one frame out of inFactor and is interpolated in between, onsets keep the full frame rate.
+     * See BasicPitchCNN::setDecimation.
+     * @param inFactor 1 for full quality, up to BasicPitchCNN::MAX_DECIMATION
+     */
+    void setCNNDecimation(int inFactor);
+
+    /**
+     * @return Decimation factor set by setCNNDecimation.
+     */
+    int getCNNDecimation() const;
+
+    /**
+     * Calibrate the activation ranges of the int8 engine on representative audio.
+     * @param inAudio Pointer to raw audio (must be at 22050 Hz)
+     * @param inNumSamples Number of input samples available.
+     */
+    void calibrateInt8(float* inAudio, int inNumSamples);
+
+    /**
+     * Calibrate the int8 engine on a built-in signal (see makeCalibrationAudio), for when no representative audio
+     * is at hand. The calibration is measured on the first call in the process (runs the features and the CNN on a
+     * few seconds of audio) and shared by all instances: the next calls only quantise the weights. Not real-time safe.
+     */
+    void calibrateInt8();
+
+    /**
+     * @return True if the int8 engine has been calibrated, Int8Engine can then be used.
+     */
+    bool isInt8Calibrated() const;
+
+    /**
+     * Built-in int8 calibration signal: chords of one to four harmonic tones spread over the whole pitch range, at
+     * several levels, then white noise. Deterministic.
+     * @return Audio at BASIC_PITCH_SAMPLE_RATE
+     */
+    static std::vector<float> makeCalibrationAudio();
+
+    /**
+     * @return Contour posteriorgrams of last transcription (one vector of NUM_FREQ_IN per frame).
+     */
+    const std::vector<std::vector<float>>& getContoursPG() const;
+
+    /**
+     * @return Note posteriorgrams of last transcription (one vector of NUM_FREQ_OUT per frame).
+     */
+    const std::vector<std::vector<float>>& getNotesPG() const;
+
+    /**
+     * @return Onset posteriorgrams of last transcription (one vector of NUM_FREQ_OUT per frame).
+     */
+    const std::vector<std::vector<float>>& getOnsetsPG() const;
 
 private:
+    /**
+     * Size a posteriorgram to frames of zeros, reusing the frames it already has.
+     * @param inOutPG Posteriorgram to size
+     * @param inNumFrames Number of frames
+     * @param inNumBins Number of bins of a frame
+     */
+    static void _resizePosteriorgram(std::vector<std::vector<float>>& inOutPG, size_t inNumFrames, int inNumBins);
+
     // Posteriorgrams vector
     std::vector<std::vector<float>> mContoursPG;
     std::vector<std::vector<float>> mNotesPG;
     std::vector<std::vector<float>> mOnsetsPG;
 
-    std::vector<Notes::Event> mNoteEvents;
+    NoteEvents mNoteEvents;
 
     Notes::ConvertParams mParams;
 
     size_t mNumFrames = 0;
 
+    // Features of the posteriorgrams being computed, owned by mFeaturesCalculator
+    const float* mStackedCQT = nullptr;
+    // Next CNN frame inference, counting the lookahead frames run on zeros
+    size_t mNextFrameInference = 0;
+    std::vector<float> mZeroStackedCQT = std::vector<float>(NUM_HARMONICS * NUM_FREQ_IN, 0.0f);
+
+    int mMinMidiNote = MIN_MIDI_NOTE;
+    int mMaxMidiNote = MAX_MIDI_NOTE;
+
     Features mFeaturesCalculator;
     BasicPitchCNN mBasicPitchCNN;
     Notes mNotesCreator;
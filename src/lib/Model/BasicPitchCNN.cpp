@@ -6,29 +6,160 @@
 
 using json = nlohmann::json;
 
-BasicPitchCNN::BasicPitchCNN()
+/**
+ * Load weights and bias of a conv2d layer from its RTNeural json description.
+ */
+template <typename Layer>
+static void loadLayer(Layer& outLayer, const json& inLayerJson)
 {
-    json json_cnn_contour = json::parse(BinaryData::cnn_contour_model_json,
-                                        BinaryData::cnn_contour_model_json + BinaryData::cnn_contour_model_jsonSize);
+    const auto& weights = inLayerJson.at("weights");
+    outLayer.setWeights(weights.at(0).get<std::vector<std::vector<std::vector<std::vector<float>>>>>());
+    outLayer.setBias(weights.at(1).get<std::vector<float>>());
+}
 
-    mCNNContour.parseJson(json_cnn_contour);
+/**
+ * Parse the json of the four models, in order: contour, note, onset input, onset output.
+ */
+static std::array<json, 4> parseModelJsons()
+{
+    return {json::parse(BinaryData::cnn_contour_model_json,
+                        BinaryData::cnn_contour_model_json + BinaryData::cnn_contour_model_jsonSize),
+            json::parse(BinaryData::cnn_note_model_json,
+                        BinaryData::cnn_note_model_json + BinaryData::cnn_note_model_jsonSize),
+            json::parse(BinaryData::cnn_onset_1_model_json,
+                        BinaryData::cnn_onset_1_model_json + BinaryData::cnn_onset_1_model_jsonSize),
+            json::parse(BinaryData::cnn_onset_2_model_json,
+                        BinaryData::cnn_onset_2_model_json + BinaryData::cnn_onset_2_model_jsonSize)};
+}
 
-    json json_cnn_note = json::parse(BinaryData::cnn_note_model_json,
-                                     BinaryData::cnn_note_model_json + BinaryData::cnn_note_model_jsonSize);
+/**
+ * Load all layers of a FusedLayers or Int8Layers struct from the json of the four models (see parseModelJsons).
+ */
+template <typename Layers>
+static void loadLayers(Layers& outLayers, const std::array<json, 4>& inJsons)
+{
+    loadLayer(outLayers.contourConv1, inJsons[0].at("layers").at(0));
+    loadLayer(outLayers.contourConv2, inJsons[0].at("layers").at(1));
+    loadLayer(outLayers.noteConv1, inJsons[1].at("layers").at(0));
+    loadLayer(outLayers.noteConv2, inJsons[1].at("layers").at(1));
+    loadLayer(outLayers.onsetInputConv, inJsons[2].at("layers").at(0));
+    loadLayer(outLayers.onsetOutputConv, inJsons[3].at("layers").at(0));
+}
 
-    mCNNNote.parseJson(json_cnn_note);
+/**
+ * Reset all layers of a FusedLayers or Int8Layers struct.
+ */
+template <typename Layers>
+static void resetLayers(Layers& outLayers)
+{
+    outLayers.contourConv1.reset();
+    outLayers.contourConv2.reset();
+    outLayers.noteConv1.reset();
+    outLayers.noteConv2.reset();
+    outLayers.onsetInputConv.reset();
+    outLayers.onsetOutputConv.reset();
+}
 
-    json json_cnn_onset_input =
-        json::parse(BinaryData::cnn_onset_1_model_json,
-                    BinaryData::cnn_onset_1_model_json + BinaryData::cnn_onset_1_model_jsonSize);
+/**
+ * Update running maximum with data
+ */
+static void updateMax(float& inOutMax, const float* inData, int inSize)
+{
+    for (int i = 0; i < inSize; i++) {
+        inOutMax = std::max(inOutMax, inData[i]);
+    }
+}
 
-    mCNNOnsetInput.parseJson(json_cnn_onset_input);
+/**
+ * Update running minimum and maximum of each channel with data in [feat][channel] layout
+ */
+template <size_t NumChannels>
+static void updateRanges(std::array<float, NumChannels>& inOutMin,
+                         std::array<float, NumChannels>& inOutMax,
+                         const float* inData,
+                         int inNumFeat)
+{
+    for (int f = 0; f < inNumFeat; f++) {
+        for (size_t c = 0; c < NumChannels; c++) {
+            inOutMin[c] = std::min(inOutMin[c], inData[(size_t) f * NumChannels + c]);
+            inOutMax[c] = std::max(inOutMax[c], inData[(size_t) f * NumChannels + c]);
+        }
+    }
+}
 
-    json json_cnn_onset_output =
-        json::parse(BinaryData::cnn_onset_2_model_json,
-                    BinaryData::cnn_onset_2_model_json + BinaryData::cnn_onset_2_model_jsonSize);
+BasicPitchCNN::BasicPitchCNN()
+{
+    prepareEngine(mEngine);
+}
 
-    mCNNOnsetOutput.parseJson(json_cnn_onset_output);
+void BasicPitchCNN::prepareEngine(CNNEngine inEngine)
+{
+    switch (inEngine) {
+        case RTNeuralEngine:
+            if (!mRTNeuralModels) {
+                const auto jsons = parseModelJsons();
+                mRTNeuralModels = std::make_unique<RTNeuralModels>();
+                mRTNeuralModels->contour.parseJson(jsons[0]);
+                mRTNeuralModels->note.parseJson(jsons[1]);
+                mRTNeuralModels->onsetInput.parseJson(jsons[2]);
+                mRTNeuralModels->onsetOutput.parseJson(jsons[3]);
+                _resetRTNeuralModels();
+            }
+            break;
+        case FusedEngine:
+            if (!mFusedLayers) {
+                mFusedLayers = _buildLayers<FusedLayers<float>>();
+            }
+            break;
+        case FusedHalfEngine:
+            if (!mHalfLayers) {
+                mHalfLayers = _buildLayers<FusedLayers<HalfFloat::Half>>();
+            }
+            break;
+        case Int8Engine:
+            if (!mInt8Layers) {
+                mInt8Layers = std::make_unique<Int8Layers>();
+                _loadInt8Layers();
+            }
+            break;
+    }
+}
+
+template <typename Layers>
+std::unique_ptr<Layers> BasicPitchCNN::_buildLayers() const
+{
+    auto layers = std::make_unique<Layers>();
+    loadLayers(*layers, parseModelJsons());
+    _setLayersRange(*layers);
+    resetLayers(*layers);
+    return layers;
+}
+
+void BasicPitchCNN::_loadInt8Layers()
+{
+    if (mInt8Calibrated) {
+        const Int8Calibration& calibration = mInt8Calibration;
+        mInt8Layers->contourConv1.setInputRanges(calibration.minCQT.data(), calibration.maxCQT.data());
+        mInt8Layers->onsetInputConv.setInputRanges(calibration.minCQT.data(), calibration.maxCQT.data());
+        mInt8Layers->contourConv2.setInputRanges(calibration.minContourHidden.data(),
+                                                 calibration.maxContourHidden.data());
+        mInt8Layers->noteConv1.setInputRanges(calibration.minContour.data(), calibration.maxContour.data());
+        mInt8Layers->noteConv2.setInputRanges(calibration.minNoteHidden.data(), calibration.maxNoteHidden.data());
+        mInt8Layers->onsetOutputConv.setInputRanges(calibration.minConcat.data(), calibration.maxConcat.data());
+    }
+
+    // Input scales are folded into the weights: quantised after the ranges are set
+    loadLayers(*mInt8Layers, parseModelJsons());
+    _setLayersRange(*mInt8Layers);
+    resetLayers(*mInt8Layers);
+}
+
+void BasicPitchCNN::_resetRTNeuralModels()
+{
+    mRTNeuralModels->contour.reset();
+    mRTNeuralModels->note.reset();
+    mRTNeuralModels->onsetInput.reset();
+    mRTNeuralModels->onsetOutput.reset();
 }
 
 void BasicPitchCNN::reset()
@@ -45,15 +176,30 @@ void BasicPitchCNN::reset()
         array.fill(0.0f);
     }
 
-    mCNNContour.reset();
-    mCNNNote.reset();
-    mCNNOnsetInput.reset();
-    mCNNOnsetOutput.reset();
+    for (auto& array: mConcat2HalfCircularBuffer) {
+        array.fill(0);
+    }
+
+    // Only the layers of the engines used so far are built
+    if (mRTNeuralModels) {
+        _resetRTNeuralModels();
+    }
+    if (mFusedLayers) {
+        resetLayers(*mFusedLayers);
+    }
+    if (mHalfLayers) {
+        resetLayers(*mHalfLayers);
+    }
+    if (mInt8Layers) {
+        resetLayers(*mInt8Layers);
+    }
 
     mNoteIdx = 0;
     mContourIdx = 0;
     mConcat2Idx = 0;
 
+    mNumFramesIn = 0;
+
     mInputArray.fill(0.0f);
 }
 
@@ -62,6 +208,143 @@ int BasicPitchCNN::getNumFramesLookahead()
     return mTotalLookahead;
 }
 
+void BasicPitchCNN::setEngine(CNNEngine inEngine)
+{
+    // Int8 engine can't run without activation scales
+    assert(inEngine != Int8Engine || mInt8Calibrated);
+    mEngine = (inEngine == Int8Engine && !mInt8Calibrated) ? FusedEngine : inEngine;
+    prepareEngine(mEngine);
+    reset();
+}
+
+CNNEngine BasicPitchCNN::getEngine() const
+{
+    return mEngine;
+}
+
+BasicPitchCNN::Int8Calibration BasicPitchCNN::measureInt8Calibration(const float* inStackedCQT, size_t inNumFrames)
+{
+    // The float engine gives the reference ranges
+    prepareEngine(FusedEngine);
+    reset();
+
+    // Only the stacked CQT (batch normalised) goes below 0, the other inputs are ReLU or sigmoid outputs. Channels of
+    // the concat have different ranges: the notes posteriorgram is in [0, 1], the 32 onset input channels go much
+    // higher.
+    Int8Calibration calibration;
+
+    for (size_t frame_idx = 0; frame_idx < inNumFrames; frame_idx++) {
+        std::copy(inStackedCQT + frame_idx * NUM_HARMONICS * NUM_FREQ_IN,
+                  inStackedCQT + (frame_idx + 1) * NUM_HARMONICS * NUM_FREQ_IN,
+                  mInputArray.begin());
+
+        _runLayers(*mFusedLayers);
+
+        updateRanges(calibration.minCQT, calibration.maxCQT, mInputArray.data(), NUM_FREQ_IN);
+        updateRanges(calibration.minContourHidden,
+                     calibration.maxContourHidden,
+                     mFusedLayers->contourConv1.getOutputs(),
+                     NUM_FREQ_IN);
+        updateRanges(
+            calibration.minContour, calibration.maxContour, mFusedLayers->contourConv2.getOutputs(), NUM_FREQ_IN);
+        updateRanges(
+            calibration.minNoteHidden, calibration.maxNoteHidden, mFusedLayers->noteConv1.getOutputs(), NUM_FREQ_OUT);
+        updateRanges(calibration.minConcat, calibration.maxConcat, mConcatArray.data(), NUM_FREQ_OUT);
+
+        mContourIdx = (mContourIdx == mNumContourStored - 1) ? 0 : mContourIdx + 1;
+        mNoteIdx = (mNoteIdx == mNumNoteStored - 1) ? 0 : mNoteIdx + 1;
+        mConcat2Idx = (mConcat2Idx == mNumConcat2Stored - 1) ? 0 : mConcat2Idx + 1;
+    }
+
+    reset();
+
+    return calibration;
+}
+
+void BasicPitchCNN::setInt8Calibration(const Int8Calibration& inCalibration)
+{
+    mInt8Calibration = inCalibration;
+    mInt8Calibrated = true;
+
+    if (mInt8Layers) {
+        _loadInt8Layers();
+    }
+
+    reset();
+}
+
+void BasicPitchCNN::calibrateInt8(const float* inStackedCQT, size_t inNumFrames)
+{
+    setInt8Calibration(measureInt8Calibration(inStackedCQT, inNumFrames));
+}
+
+bool BasicPitchCNN::isInt8Calibrated() const
+{
+    return mInt8Calibrated;
+}
+
+void BasicPitchCNN::setPitchRange(int inMinMidiNote, int inMaxMidiNote)
+{
+    assert(MIN_MIDI_NOTE <= inMinMidiNote && inMinMidiNote <= inMaxMidiNote && inMaxMidiNote <= MAX_MIDI_NOTE);
+
+    using Layers = FusedLayers<float>;
+
+    // Go backwards through the models: each layer computes what the next layers read.
+    const int note_begin = inMinMidiNote - MIDI_OFFSET;
+    const int note_end = inMaxMidiNote - MIDI_OFFSET + 1;
+
+    mOnsetOutputConvRange = {note_begin, note_end};
+
+    // Concat of note posteriorgrams and onset input model output
+    const auto concat_range = decltype(Layers::onsetOutputConv)::getInputRange(note_begin, note_end);
+    mNoteConv2Range = {std::min(note_begin, concat_range.first), std::max(note_end, concat_range.second)};
+    mOnsetInputConvRange = concat_range;
+
+    mNoteConv1Range = decltype(Layers::noteConv2)::getInputRange(mNoteConv2Range.first, mNoteConv2Range.second);
+
+    // Contours are also read for pitch bends
+    const auto note_contour_range =
+        decltype(Layers::noteConv1)::getInputRange(mNoteConv1Range.first, mNoteConv1Range.second);
+    mContourConv2Range = {
+        std::max(0,
+                 std::min(note_contour_range.first,
+                          note_begin * CONTOURS_BINS_PER_SEMITONE - PITCH_BEND_NUM_BINS_TOLERANCE)),
+        std::min(NUM_FREQ_IN,
+                 std::max(note_contour_range.second,
+                          (note_end - 1) * CONTOURS_BINS_PER_SEMITONE + PITCH_BEND_NUM_BINS_TOLERANCE + 1))};
+
+    mContourConv1Range =
+        decltype(Layers::contourConv2)::getInputRange(mContourConv2Range.first, mContourConv2Range.second);
+
+    if (mFusedLayers) {
+        _setLayersRange(*mFusedLayers);
+    }
+    if (mHalfLayers) {
+        _setLayersRange(*mHalfLayers);
+    }
+    if (mInt8Layers) {
+        _setLayersRange(*mInt8Layers);
+    }
+
+    reset();
+}
+
+void BasicPitchCNN::setDecimation(int inFactor)
+{
+    mDecimation = std::clamp(inFactor, 1, MAX_DECIMATION);
+    reset();
+}
+
+int BasicPitchCNN::getDecimation() const
+{
+    return mDecimation;
+}
+
+int BasicPitchCNN::getNumFramesDelay() const
+{
+    return mTotalLookahead + (_isDecimated() ? mDecimation - 1 : 0);
+}
+
 void BasicPitchCNN::frameInference(const float* inData,
                                    std::vector<float>& outContours,
                                    std::vector<float>& outNotes,
@@ -72,13 +355,27 @@ void BasicPitchCNN::frameInference(const float* inData,
     assert(outNotes.size() == NUM_FREQ_OUT);
     assert(outOnsets.size() == NUM_FREQ_OUT);
 
-    // Copy data in aligned input array for inference
-    std::copy(inData, inData + NUM_HARMONICS * NUM_FREQ_IN, mInputArray.begin());
+    if (_isDecimated()) {
+        // The models run getDecimation() - 1 frames behind, nothing to output before
+        const bool ready = mEngine == FusedEngine       ? _pushDecimated(*mFusedLayers, inData)
+                           : mEngine == FusedHalfEngine ? _pushDecimated(*mHalfLayers, inData)
+                                                        : _pushDecimated(*mInt8Layers, inData);
+        if (!ready) {
+            return;
+        }
+    } else {
+        // Copy data in aligned input array for inference
+        std::copy(inData, inData + NUM_HARMONICS * NUM_FREQ_IN, mInputArray.begin());
+    }
 
     _runModels();
 
     // Fill output vectors
-    std::copy(mCNNOnsetOutput.getOutputs(), mCNNOnsetOutput.getOutputs() + NUM_FREQ_OUT, outOnsets.begin());
+    const float* onsets = mEngine == FusedEngine       ? mFusedLayers->onsetOutputConv.getOutputs()
+                          : mEngine == FusedHalfEngine ? mHalfLayers->onsetOutputConv.getOutputs()
+                          : mEngine == Int8Engine      ? mInt8Layers->onsetOutputConv.getOutputs()
+                                                       : mRTNeuralModels->onsetOutput.getOutputs();
+    std::copy(onsets, onsets + NUM_FREQ_OUT, outOnsets.begin());
 
     std::copy(mNotesCircularBuffer[(size_t) _wrapIndex(mNoteIdx + 1, mNumNoteStored)].begin(),
               mNotesCircularBuffer[(size_t) _wrapIndex(mNoteIdx + 1, mNumNoteStored)].end(),
@@ -96,25 +393,150 @@ void BasicPitchCNN::frameInference(const float* inData,
 
 void BasicPitchCNN::_runModels()
 {
+    const float* contour_hidden = _isDecimated() ? mContourHidden.data() : nullptr;
+
+    if (mEngine == FusedEngine) {
+        _runLayers(*mFusedLayers, contour_hidden);
+        return;
+    }
+
+    if (mEngine == FusedHalfEngine) {
+        _runLayers(*mHalfLayers, contour_hidden);
+        return;
+    }
+
+    if (mEngine == Int8Engine) {
+        _runLayers(*mInt8Layers, contour_hidden);
+        return;
+    }
+
     // Run models and push results in appropriate circular buffer
-    mCNNOnsetInput.forward(mInputArray.data());
-    std::copy(mCNNOnsetInput.getOutputs(),
-              mCNNOnsetInput.getOutputs() + 32 * NUM_FREQ_OUT,
-              mConcat2CircularBuffer[(size_t) mConcat2Idx].begin());
-
-    mCNNContour.forward(mInputArray.data());
-    std::copy(mCNNContour.getOutputs(),
-              mCNNContour.getOutputs() + NUM_FREQ_IN,
+    RTNeuralModels& models = *mRTNeuralModels;
+
+    models.onsetInput.forward(mInputArray.data());
+    _storeConcat2(models.onsetInput.getOutputs());
+
+    models.contour.forward(mInputArray.data());
+    std::copy(models.contour.getOutputs(),
+              models.contour.getOutputs() + NUM_FREQ_IN,
               mContoursCircularBuffer[(size_t) mContourIdx].begin());
 
-    mCNNNote.forward(mCNNContour.getOutputs());
-    std::copy(
-        mCNNNote.getOutputs(), mCNNNote.getOutputs() + NUM_FREQ_OUT, mNotesCircularBuffer[(size_t) mNoteIdx].begin());
+    models.note.forward(models.contour.getOutputs());
+    std::copy(models.note.getOutputs(),
+              models.note.getOutputs() + NUM_FREQ_OUT,
+              mNotesCircularBuffer[(size_t) mNoteIdx].begin());
 
     // Concat operation with correct frame shift
-    _concat();
+    _concat(models.note.getOutputs());
 
-    mCNNOnsetOutput.forward(mConcatArray.data());
+    models.onsetOutput.forward(mConcatArray.data());
+}
+
+template <typename Layers>
+void BasicPitchCNN::_runLayers(Layers& inLayers, const float* inContourHidden)
+{
+    inLayers.onsetInputConv.forward(mInputArray.data());
+    _storeConcat2(inLayers.onsetInputConv.getOutputs());
+
+    if (inContourHidden == nullptr) {
+        inLayers.contourConv1.forward(mInputArray.data());
+        inContourHidden = inLayers.contourConv1.getOutputs();
+    }
+    inLayers.contourConv2.forward(inContourHidden);
+    std::copy(inLayers.contourConv2.getOutputs(),
+              inLayers.contourConv2.getOutputs() + NUM_FREQ_IN,
+              mContoursCircularBuffer[(size_t) mContourIdx].begin());
+
+    inLayers.noteConv1.forward(inLayers.contourConv2.getOutputs());
+    inLayers.noteConv2.forward(inLayers.noteConv1.getOutputs());
+    std::copy(inLayers.noteConv2.getOutputs(),
+              inLayers.noteConv2.getOutputs() + NUM_FREQ_OUT,
+              mNotesCircularBuffer[(size_t) mNoteIdx].begin());
+
+    _concat(inLayers.noteConv2.getOutputs());
+
+    inLayers.onsetOutputConv.forward(mConcatArray.data());
+}
+
+bool BasicPitchCNN::_isDecimated() const
+{
+    return mDecimation > 1 && mEngine != RTNeuralEngine;
+}
+
+template <typename Layers>
+bool BasicPitchCNN::_pushDecimated(Layers& inLayers, const float* inData)
+{
+    const auto decimation = static_cast<size_t>(mDecimation);
+    const size_t frame = mNumFramesIn++;
+    const size_t slot = frame % decimation;
+    constexpr size_t input_size = NUM_HARMONICS * NUM_FREQ_IN;
+    constexpr size_t hidden_size = 8 * NUM_FREQ_IN;
+
+    // Anchors are on a grid of one frame out of getDecimation(), plus the frames where the input changes sharply, so
+    // that onsets and note ends are not smeared by the interpolation
+    bool is_anchor = slot == 0;
+    if (!is_anchor) {
+        const auto& previous_input = mDelayedInputs[(frame - 1) % decimation];
+        float change = 0.0f;
+        for (size_t i = 0; i < input_size; i++) {
+            change += std::abs(inData[i] - previous_input[i]);
+        }
+        is_anchor = change > ECO_ANCHOR_CHANGE * static_cast<float>(input_size);
+    }
+
+    // The convolution still gets every frame in its history, its output is only computed on anchor frames
+    if (is_anchor) {
+        inLayers.contourConv1.forward(inData);
+        std::copy(inLayers.contourConv1.getOutputs(),
+                  inLayers.contourConv1.getOutputs() + hidden_size,
+                  mContourHiddenFrames[slot].begin());
+    } else {
+        inLayers.contourConv1.push(inData);
+    }
+    mIsAnchor[slot] = is_anchor;
+    std::copy(inData, inData + input_size, mDelayedInputs[slot].begin());
+
+    if (frame + 1 < decimation) {
+        return false;
+    }
+
+    // Frame run by the other models: the anchors before and after it have been computed by now
+    const size_t run_frame = frame + 1 - decimation;
+    const size_t run_slot = run_frame % decimation;
+    std::copy(mDelayedInputs[run_slot].begin(), mDelayedInputs[run_slot].end(), mInputArray.begin());
+
+    if (mIsAnchor[run_slot]) {
+        std::copy(mContourHiddenFrames[run_slot].begin(), mContourHiddenFrames[run_slot].end(), mContourHidden.begin());
+        mPreviousAnchor = mContourHiddenFrames[run_slot];
+        mPreviousAnchorFrame = run_frame;
+        return true;
+    }
+
+    // There is a grid anchor at most getDecimation() - 1 frames after a frame that is not an anchor
+    size_t next_anchor_frame = run_frame + 1;
+    while (!mIsAnchor[next_anchor_frame % decimation]) {
+        next_anchor_frame++;
+    }
+    const auto& next_anchor = mContourHiddenFrames[next_anchor_frame % decimation];
+    const float weight = static_cast<float>(run_frame - mPreviousAnchorFrame)
+                         / static_cast<float>(next_anchor_frame - mPreviousAnchorFrame);
+
+    for (size_t i = 0; i < hidden_size; i++) {
+        mContourHidden[i] = mPreviousAnchor[i] + weight * (next_anchor[i] - mPreviousAnchor[i]);
+    }
+
+    return true;
+}
+
+template <typename Layers>
+void BasicPitchCNN::_setLayersRange(Layers& outLayers) const
+{
+    outLayers.contourConv1.setOutputRange(mContourConv1Range.first, mContourConv1Range.second);
+    outLayers.contourConv2.setOutputRange(mContourConv2Range.first, mContourConv2Range.second);
+    outLayers.noteConv1.setOutputRange(mNoteConv1Range.first, mNoteConv1Range.second);
+    outLayers.noteConv2.setOutputRange(mNoteConv2Range.first, mNoteConv2Range.second);
+    outLayers.onsetInputConv.setOutputRange(mOnsetInputConvRange.first, mOnsetInputConvRange.second);
+    outLayers.onsetOutputConv.setOutputRange(mOnsetOutputConvRange.first, mOnsetOutputConvRange.second);
 }
 
 constexpr int BasicPitchCNN::_wrapIndex(int inIndex, int inSize)
@@ -128,14 +550,32 @@ constexpr int BasicPitchCNN::_wrapIndex(int inIndex, int inSize)
     return wrapped_index;
 }
 
-void BasicPitchCNN::_concat()
+void BasicPitchCNN::_storeConcat2(const float* inOnsetInputOutput)
+{
+    if (mEngine == FusedHalfEngine) {
+        HalfFloat::fromFloat(
+            inOnsetInputOutput, mConcat2HalfCircularBuffer[(size_t) mConcat2Idx].data(), 32 * NUM_FREQ_OUT);
+    } else {
+        std::copy(inOnsetInputOutput,
+                  inOnsetInputOutput + 32 * NUM_FREQ_OUT,
+                  mConcat2CircularBuffer[(size_t) mConcat2Idx].begin());
+    }
+}
+
+void BasicPitchCNN::_concat(const float* inNotes)
 {
     auto concat2_index = (size_t) _wrapIndex(mConcat2Idx + 1, mNumConcat2Stored);
 
     for (size_t i = 0; i < NUM_FREQ_OUT; i++) {
-        mConcatArray[i * 33] = mCNNNote.getOutputs()[i];
-        std::copy(mConcat2CircularBuffer[concat2_index].begin() + i * 32,
-                  mConcat2CircularBuffer[concat2_index].begin() + (i + 1) * 32,
-                  mConcatArray.begin() + i * 33 + 1);
+        mConcatArray[i * 33] = inNotes[i];
+
+        if (mEngine == FusedHalfEngine) {
+            HalfFloat::toFloat(
+                mConcat2HalfCircularBuffer[concat2_index].data() + i * 32, mConcatArray.data() + i * 33 + 1, 32);
+        } else {
+            std::copy(mConcat2CircularBuffer[concat2_index].begin() + i * 32,
+                      mConcat2CircularBuffer[concat2_index].begin() + (i + 1) * 32,
+                      mConcatArray.begin() + i * 33 + 1);
+        }
     }
 }
@@ -5,10 +5,24 @@
 #ifndef BasicPitchCNN_h
 #define BasicPitchCNN_h
 
+#include <memory>
+
 #include "RTNeural/RTNeural.h"
 
 #include "BinaryData.h"
 #include "BasicPitchConstants.h"
+#include "FusedConv2D.h"
+#include "QuantizedConv2D.h"
+
+/**
+ * Implementation used to run the CNN.
+ * RTNeuralEngine: generic RTNeural layers, kept as reference.
+ * FusedEngine: all models run with FusedConv2D kernels specialised for their shapes, activations fused in.
+ * Int8Engine: int8 weights and activations (QuantizedConv2D). Needs calibrateInt8 to be called first.
+ * FusedHalfEngine: same as FusedEngine but weights and past frames (in the layers and in the concat buffer) are
+ * stored in half precision. Compute is still done in float.
+ */
+enum CNNEngine { RTNeuralEngine = 0, FusedEngine, Int8Engine, FusedHalfEngine };
 
 /**
  * Class to run basic pitch CNN with RTNeural
@@ -32,6 +46,108 @@ public:
      */
     static int getNumFramesLookahead();
 
+    /**
+     * Build the layers of an engine if they are not built yet: only the engines used by an instance hold their
+     * weights and state. Parses the models and converts their weights, not real-time safe. The engine in use keeps
+     * its state.
+     * @param inEngine Engine to build. Int8Engine layers are quantised with the calibration set, if any.
+     */
+    void prepareEngine(CNNEngine inEngine);
+
+    /**
+     * Select the implementation used to run the CNN. Resets the internal state.
+     * Builds the layers of the engine the first time it is selected (see prepareEngine): call prepareEngine before
+     * to select it from a real-time thread.
+     * @param inEngine Engine to use for next calls to frameInference.
+     */
+    void setEngine(CNNEngine inEngine);
+
+    /**
+     * @return Engine currently used.
+     */
+    CNNEngine getEngine() const;
+
+    /**
+     * Range of each input channel of each convolution, measured on representative input. Sets the quantisation of
+     * the int8 engine. Does not depend on the instance it was measured with: it can be measured once and shared.
+     */
+    struct Int8Calibration {
+        std::array<float, NUM_HARMONICS> minCQT {}, maxCQT {};
+        std::array<float, 8> minContourHidden {}, maxContourHidden {};
+        std::array<float, 1> minContour {}, maxContour {};
+        std::array<float, 32> minNoteHidden {}, maxNoteHidden {};
+        std::array<float, 33> minConcat {}, maxConcat {};
+    };
+
+    /**
+     * Measure the range of each input channel of each layer by running the float engine on representative input.
+     * Resets the internal state.
+     * @param inStackedCQT Features of representative audio (as given by Features::computeFeatures)
+     * @param inNumFrames Number of frames in inStackedCQT
+     * @return Calibration to give to setInt8Calibration
+     */
+    Int8Calibration measureInt8Calibration(const float* inStackedCQT, size_t inNumFrames);
+
+    /**
+     * Set the activation scales and zero points of the int8 engine from a calibration. The weights are quantised
+     * again with the input scales folded in. Resets the internal state.
+     * @param inCalibration Ranges given by measureInt8Calibration, on this instance or another one.
+     */
+    void setInt8Calibration(const Int8Calibration& inCalibration);
+
+    /**
+     * Measure the int8 calibration on representative input and set it, see measureInt8Calibration.
+     * Resets the internal state.
+     * @param inStackedCQT Features of representative audio (as given by Features::computeFeatures)
+     * @param inNumFrames Number of frames in inStackedCQT
+     */
+    void calibrateInt8(const float* inStackedCQT, size_t inNumFrames);
+
+    /**
+     * @return True if a calibration has been set, Int8Engine can then be used.
+     */
+    bool isInt8Calibrated() const;
+
+    /**
+     * Only compute the outputs needed for notes in a pitch range: the output columns of each convolution outside
+     * the range and the receptive field halo of the next layers are skipped. Contours are computed for the range
+     * extended by the pitch bend tolerance. Posteriorgram values that are not computed are left to 0.
+     * Not used by RTNeuralEngine, which always computes everything. Resets the internal state.
+     * @param inMinMidiNote Lowest note (MIN_MIDI_NOTE to MAX_MIDI_NOTE)
+     * @param inMaxMidiNote Highest note (MIN_MIDI_NOTE to MAX_MIDI_NOTE)
+     */
+    void setPitchRange(int inMinMidiNote, int inMaxMidiNote);
+
+    /**
+     * Eco mode: run the first convolution of the contour model, which holds most of the cost of the CNN, on one
+     * frame out of inFactor only, and on the frames where the input changes sharply (the anchor frames, see
+     * ECO_ANCHOR_CHANGE). Its outputs in between are interpolated linearly from the two surrounding anchors, so the
+     * rest of the contour and note models still see every frame and the onset models run at full rate on the exact
+     * input. The outputs are exact on anchor frames and lag the input by inFactor - 1 more frames (see
+     * getNumFramesDelay). Not used by RTNeuralEngine. Resets the internal state.
+     * @param inFactor 1 for full rate, up to MAX_DECIMATION
+     */
+    void setDecimation(int inFactor);
+
+    /**
+     * @return Decimation factor set by setDecimation.
+     */
+    int getDecimation() const;
+
+    /**
+     * @return Number of frames the outputs of frameInference lag its input: getNumFramesLookahead, plus
+     * getDecimation() - 1 in eco mode.
+     */
+    int getNumFramesDelay() const;
+
+    static constexpr int MAX_DECIMATION = 4;
+
+    /**
+     * Eco mode: mean absolute change of the input features from the previous frame above which a frame is an anchor
+     * too. Chosen on the TranscriberTest signals: at 0.1, onsets there start to move by 2 frames.
+     */
+    static constexpr float ECO_ANCHOR_CHANGE = 0.05f;
+
     /**
      * Run inference for a single frame. inData should have 8 * 264 elements
      * @param inData input features (CQT harmonically stacked).
@@ -45,15 +161,68 @@ public:
                         std::vector<float>& outOnsets);
 
 private:
+    /**
+     * Build a FusedLayers struct: load the weights, set the output ranges and reset it.
+     */
+    template <typename Layers>
+    std::unique_ptr<Layers> _buildLayers() const;
+
+    /**
+     * Quantise the weights of the int8 layers, with the input ranges of the calibration if one is set. Set their
+     * output ranges and reset them.
+     */
+    void _loadInt8Layers();
+
+    /**
+     * Reset the RTNeural models, which should be built.
+     */
+    void _resetRTNeuralModels();
+
     /**
      * Run different sequential models with correct time offset ...
      */
     void _runModels();
 
+    /**
+     * Run all models with the given layer implementation (FusedLayers or Int8Layers).
+     * @param inContourHidden Output of the first contour convolution for this frame (interpolated in eco mode),
+     *  nullptr to run that convolution.
+     */
+    template <typename Layers>
+    void _runLayers(Layers& inLayers, const float* inContourHidden = nullptr);
+
+    /**
+     * @return True if frames are decimated: eco mode with an engine that supports it.
+     */
+    bool _isDecimated() const;
+
+    /**
+     * Eco mode: push a new input frame in the first contour convolution (run on anchor frames only) and in the
+     * delay line of the other models, then set mInputArray and mContourHidden for the frame getDecimation() - 1
+     * frames back.
+     * @param inData Input features of the new frame
+     * @return False during the first getDecimation() - 1 frames after a reset, when there is no such frame yet.
+     */
+    template <typename Layers>
+    bool _pushDecimated(Layers& inLayers, const float* inData);
+
+    /**
+     * Set the output ranges of all layers of a FusedLayers or Int8Layers struct.
+     */
+    template <typename Layers>
+    void _setLayersRange(Layers& outLayers) const;
+
+    /**
+     * Store output of onset input model in the concat circular buffer (in half precision for FusedHalfEngine).
+     * @param inOnsetInputOutput Output of onset input model for the current frame.
+     */
+    void _storeConcat2(const float* inOnsetInputOutput);
+
     /**
      * Perform concat operation with correct time offset
+     * @param inNotes Output of note model for the current frame.
      */
-    void _concat();
+    void _concat(const float* inNotes);
 
     /**
      * Return in-range index for given size as if periodic.
@@ -80,42 +249,98 @@ private:
     std::array<std::array<float, NUM_FREQ_IN>, mNumContourStored> mContoursCircularBuffer {};
     std::array<std::array<float, NUM_FREQ_OUT>, mNumNoteStored> mNotesCircularBuffer {}; // Also concat 1
     std::array<std::array<float, 32 * NUM_FREQ_OUT>, mNumConcat2Stored> mConcat2CircularBuffer {};
+    std::array<std::array<HalfFloat::Half, 32 * NUM_FREQ_OUT>, mNumConcat2Stored> mConcat2HalfCircularBuffer {};
 
     int mContourIdx = 0;
     int mNoteIdx = 0;
     int mConcat2Idx = 0;
 
-    RTNeural::ModelT<float,
-                     NUM_FREQ_IN * NUM_HARMONICS,
-                     NUM_FREQ_IN,
-                     RTNeural::Conv2DT<float, NUM_HARMONICS, 8, NUM_FREQ_IN, 3, 39, 1, 1, false>,
-                     RTNeural::ReLuActivationT<float, 8 * NUM_FREQ_IN>,
-                     RTNeural::Conv2DT<float, 8, 1, NUM_FREQ_IN, 5, 5, 1, 1, false>,
-                     RTNeural::SigmoidActivationT<float, NUM_FREQ_IN>>
-        mCNNContour;
-
-    RTNeural::ModelT<float,
-                     NUM_FREQ_IN,
-                     NUM_FREQ_OUT,
-                     RTNeural::Conv2DT<float, 1, 32, NUM_FREQ_IN, 7, 7, 1, 3, false>,
-                     RTNeural::ReLuActivationT<float, 32 * NUM_FREQ_OUT>,
-                     RTNeural::Conv2DT<float, 32, 1, NUM_FREQ_OUT, 7, 3, 1, 1, false>,
-                     RTNeural::SigmoidActivationT<float, NUM_FREQ_OUT>>
-        mCNNNote;
-
-    RTNeural::ModelT<float,
-                     NUM_FREQ_IN * NUM_HARMONICS,
-                     32 * NUM_FREQ_OUT,
-                     RTNeural::Conv2DT<float, 8, 32, NUM_FREQ_IN, 5, 5, 1, 3, false>,
-                     RTNeural::ReLuActivationT<float, 32 * NUM_FREQ_OUT>>
-        mCNNOnsetInput;
-
-    RTNeural::ModelT<float,
-                     33 * NUM_FREQ_OUT,
-                     NUM_FREQ_OUT,
-                     RTNeural::Conv2DT<float, 33, 1, NUM_FREQ_OUT, 3, 3, 1, 1, false>,
-                     RTNeural::SigmoidActivationT<float, NUM_FREQ_OUT>>
-        mCNNOnsetOutput;
+    // Eco mode: input frames not yet run by the models after the first contour convolution, outputs of that
+    // convolution on those of them that are anchors and on the last anchor run, and its output for the frame run
+    int mDecimation = 1;
+    size_t mNumFramesIn = 0;
+    std::array<std::array<float, NUM_FREQ_IN * NUM_HARMONICS>, MAX_DECIMATION> mDelayedInputs {};
+    std::array<std::array<float, 8 * NUM_FREQ_IN>, MAX_DECIMATION> mContourHiddenFrames {};
+    std::array<bool, MAX_DECIMATION> mIsAnchor {};
+    std::array<float, 8 * NUM_FREQ_IN> mPreviousAnchor {};
+    size_t mPreviousAnchorFrame = 0;
+    alignas(RTNEURAL_DEFAULT_ALIGNMENT) std::array<float, 8 * NUM_FREQ_IN> mContourHidden {};
+
+    CNNEngine mEngine = FusedEngine;
+
+    // Output ranges [begin, end) of each layer, set by setPitchRange
+    std::pair<int, int> mContourConv1Range {0, NUM_FREQ_IN};
+    std::pair<int, int> mContourConv2Range {0, NUM_FREQ_IN};
+    std::pair<int, int> mNoteConv1Range {0, NUM_FREQ_OUT};
+    std::pair<int, int> mNoteConv2Range {0, NUM_FREQ_OUT};
+    std::pair<int, int> mOnsetInputConvRange {0, NUM_FREQ_OUT};
+    std::pair<int, int> mOnsetOutputConvRange {0, NUM_FREQ_OUT};
+
+    // Reference models, run by RTNeuralEngine
+    struct RTNeuralModels {
+        RTNeural::ModelT<float,
+                         NUM_FREQ_IN * NUM_HARMONICS,
+                         NUM_FREQ_IN,
+                         RTNeural::Conv2DT<float, NUM_HARMONICS, 8, NUM_FREQ_IN, 3, 39, 1, 1, false>,
+                         RTNeural::ReLuActivationT<float, 8 * NUM_FREQ_IN>,
+                         RTNeural::Conv2DT<float, 8, 1, NUM_FREQ_IN, 5, 5, 1, 1, false>,
+                         RTNeural::SigmoidActivationT<float, NUM_FREQ_IN>>
+            contour;
+
+        RTNeural::ModelT<float,
+                         NUM_FREQ_IN,
+                         NUM_FREQ_OUT,
+                         RTNeural::Conv2DT<float, 1, 32, NUM_FREQ_IN, 7, 7, 1, 3, false>,
+                         RTNeural::ReLuActivationT<float, 32 * NUM_FREQ_OUT>,
+                         RTNeural::Conv2DT<float, 32, 1, NUM_FREQ_OUT, 7, 3, 1, 1, false>,
+                         RTNeural::SigmoidActivationT<float, NUM_FREQ_OUT>>
+            note;
+
+        RTNeural::ModelT<float,
+                         NUM_FREQ_IN * NUM_HARMONICS,
+                         32 * NUM_FREQ_OUT,
+                         RTNeural::Conv2DT<float, 8, 32, NUM_FREQ_IN, 5, 5, 1, 3, false>,
+                         RTNeural::ReLuActivationT<float, 32 * NUM_FREQ_OUT>>
+            onsetInput;
+
+        RTNeural::ModelT<float,
+                         33 * NUM_FREQ_OUT,
+                         NUM_FREQ_OUT,
+                         RTNeural::Conv2DT<float, 33, 1, NUM_FREQ_OUT, 3, 3, 1, 1, false>,
+                         RTNeural::SigmoidActivationT<float, NUM_FREQ_OUT>>
+            onsetOutput;
+    };
+
+    // Fused versions of the models above. Register blocking chosen for these shapes:
+    // 4 bins x 8 channels of accumulators for the 3x39 harmonic convolution, 2 bins x 32 channels for the others.
+    template <typename Storage>
+    struct FusedLayers {
+        FusedConv2D<NUM_HARMONICS, 8, NUM_FREQ_IN, 3, 39, 1, 1, FusedActivation::ReLu, 4, Storage> contourConv1;
+        FusedConv2D<8, 1, NUM_FREQ_IN, 5, 5, 1, 1, FusedActivation::Sigmoid, 1, Storage> contourConv2;
+        FusedConv2D<1, 32, NUM_FREQ_IN, 7, 7, 1, 3, FusedActivation::ReLu, 2, Storage> noteConv1;
+        FusedConv2D<32, 1, NUM_FREQ_OUT, 7, 3, 1, 1, FusedActivation::Sigmoid, 1, Storage> noteConv2;
+        FusedConv2D<NUM_HARMONICS, 32, NUM_FREQ_IN, 5, 5, 1, 3, FusedActivation::ReLu, 2, Storage> onsetInputConv;
+        FusedConv2D<33, 1, NUM_FREQ_OUT, 3, 3, 1, 1, FusedActivation::Sigmoid, 1, Storage> onsetOutputConv;
+    };
+
+    // Int8 versions of the models above
+    struct Int8Layers {
+        QuantizedConv2D<NUM_HARMONICS, 8, NUM_FREQ_IN, 3, 39, 1, 1, FusedActivation::ReLu> contourConv1;
+        QuantizedConv2D<8, 1, NUM_FREQ_IN, 5, 5, 1, 1, FusedActivation::Sigmoid> contourConv2;
+        QuantizedConv2D<1, 32, NUM_FREQ_IN, 7, 7, 1, 3, FusedActivation::ReLu> noteConv1;
+        QuantizedConv2D<32, 1, NUM_FREQ_OUT, 7, 3, 1, 1, FusedActivation::Sigmoid> noteConv2;
+        QuantizedConv2D<NUM_HARMONICS, 32, NUM_FREQ_IN, 5, 5, 1, 3, FusedActivation::ReLu> onsetInputConv;
+        QuantizedConv2D<33, 1, NUM_FREQ_OUT, 3, 3, 1, 1, FusedActivation::Sigmoid> onsetOutputConv;
+    };
+
+    // Layers of each engine, only built when the engine is used (see prepareEngine)
+    std::unique_ptr<RTNeuralModels> mRTNeuralModels;
+    std::unique_ptr<FusedLayers<float>> mFusedLayers;
+    std::unique_ptr<FusedLayers<HalfFloat::Half>> mHalfLayers;
+    std::unique_ptr<Int8Layers> mInt8Layers;
+
+    Int8Calibration mInt8Calibration;
+    bool mInt8Calibrated = false;
 };
 
 #endif // BasicPitchCNN_h
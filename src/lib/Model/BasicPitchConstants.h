@@ -20,6 +20,8 @@ static constexpr int AUDIO_WINDOW_LENGTH = 2;
 // lowest key on a piano
 static constexpr float ANNOTATIONS_BASE_FREQUENCY = 27.5;
 static constexpr int CONTOURS_BINS_PER_SEMITONE = 3;
+// contour bins searched around each note for pitch bends
+static constexpr int PITCH_BEND_NUM_BINS_TOLERANCE = 25;
 
 static constexpr int MIN_MIDI_NOTE = 21;
 static constexpr int MAX_MIDI_NOTE = 108;
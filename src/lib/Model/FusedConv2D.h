@@ -0,0 +1,360 @@
+// FusedConv2D.h
+
+#ifndef FusedConv2D_h
+#define FusedConv2D_h
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "FastMath.h"
+#include "HalfFloat.h"
+
+/**
+ * Activations that can be fused in the output loop of FusedConv2D. All are branch-free so that the output loops
+ * stay vectorised.
+ */
+namespace FusedActivation
+{
+struct Identity {
+    static inline float apply(float x) { return x; }
+};
+
+struct ReLu {
+    static inline float apply(float x) { return x > 0.0f ? x : 0.0f; }
+};
+
+// See FastMath.h for error bounds
+struct Sigmoid {
+    static inline float apply(float x) { return FastMath::sigmoid(x); }
+};
+} // namespace FusedActivation
+
+/**
+ * Streaming 2D convolution (time x frequency) with the activation fused in: it is applied while the accumulators
+ * are still in registers (or in L1 for single channel outputs), instead of in a separate pass over the output.
+ * Computes the same thing as an RTNeural::Conv2DT followed by its activation layer, with the same memory layout:
+ * input index is feature * InCh + channel and output index is feature * OutCh + channel.
+ * In time the convolution is causal: tap k of the kernel is applied to the frame (KernelTime - 1 - k) * Dilation
+ * frames in the past. In frequency "same" padding is used, as in tensorflow.
+ * All loop bounds are compile time constants so each instantiation is specialised for its shape.
+ * @tparam FeatBlock Number of output frequency bins computed together (register blocking).
+ * Each weight vector loaded from memory is then reused FeatBlock times. Only used when OutCh > 1.
+ * @tparam Storage Type used to store weights and past input frames: float, or HalfFloat::Half to halve the memory
+ * footprint. With half storage, weights and frames are converted to float a register block at a time inside the
+ * kernel loops, and compute is done in float.
+ */
+template <int InCh,
+          int OutCh,
+          int NumFeatIn,
+          int KernelTime,
+          int KernelFeat,
+          int Dilation,
+          int Stride,
+          typename Activation,
+          int FeatBlock = 1,
+          typename Storage = float>
+class FusedConv2D
+{
+public:
+    static constexpr int NumFeatOut = (NumFeatIn + Stride - 1) / Stride;
+    static constexpr int PadLeft = std::max(0, (NumFeatOut - 1) * Stride + KernelFeat - NumFeatIn) / 2;
+    static constexpr int NumFeatPadded = (NumFeatOut - 1) * Stride + KernelFeat;
+    static constexpr int ReceptiveField = (KernelTime - 1) * Dilation + 1;
+    static constexpr int WindowSize = KernelFeat * InCh;
+    static constexpr int InSize = NumFeatIn * InCh;
+    static constexpr int OutSize = NumFeatOut * OutCh;
+
+    static constexpr bool IsHalf = std::is_same<Storage, HalfFloat::Half>::value;
+
+    static_assert(NumFeatOut % FeatBlock == 0, "FeatBlock should divide the number of output features");
+    static_assert(IsHalf || std::is_same<Storage, float>::value, "Storage should be float or HalfFloat::Half");
+
+    /**
+     * Set kernel weights.
+     * @param inWeights Kernel in tensorflow layout: [KernelTime][KernelFeat][InCh][OutCh]
+     */
+    void setWeights(const std::vector<std::vector<std::vector<std::vector<float>>>>& inWeights)
+    {
+        assert(inWeights.size() == KernelTime);
+
+        size_t idx = 0;
+        for (const auto& kernel_feat: inWeights) {
+            assert(kernel_feat.size() == KernelFeat);
+            for (const auto& in_channels: kernel_feat) {
+                assert(in_channels.size() == InCh);
+                for (const auto& out_channels: in_channels) {
+                    assert(out_channels.size() == OutCh);
+                    for (float w: out_channels) {
+                        mWeights[idx++] = _store(w);
+                    }
+                }
+            }
+        }
+    }
+
+    /**
+     * Set bias.
+     * @param inBias One value per output channel.
+     */
+    void setBias(const std::vector<float>& inBias)
+    {
+        assert(inBias.size() == OutCh);
+        std::copy(inBias.begin(), inBias.end(), mBias.begin());
+    }
+
+    /**
+     * Restrict the computation to a range of output features. Outputs outside the range keep their last value
+     * (0 after reset). Ranges are extended to whole FeatBlock blocks.
+     * @param inBegin First output feature to compute
+     * @param inEnd One past the last output feature to compute
+     */
+    void setOutputRange(int inBegin, int inEnd)
+    {
+        assert(0 <= inBegin && inBegin <= inEnd && inEnd <= NumFeatOut);
+
+        mFeatBegin = inBegin / FeatBlock * FeatBlock;
+        mFeatEnd = std::min(NumFeatOut, (inEnd + FeatBlock - 1) / FeatBlock * FeatBlock);
+    }
+
+    /**
+     * Input features read to compute a range of output features (the halo of the kernel in frequency).
+     * @param inBegin First output feature
+     * @param inEnd One past the last output feature
+     * @return First input feature and one past the last input feature
+     */
+    static std::pair<int, int> getInputRange(int inBegin, int inEnd)
+    {
+        if (inBegin >= inEnd) {
+            return {0, 0};
+        }
+
+        return {std::max(0, inBegin * Stride - PadLeft),
+                std::min(NumFeatIn, (inEnd - 1) * Stride - PadLeft + KernelFeat)};
+    }
+
+    /**
+     * Clear the frames stored for the time dimension of the kernel.
+     */
+    void reset()
+    {
+        for (auto& frame: mHistory) {
+            frame.fill(_store(0.0f));
+        }
+
+        mOuts.fill(0.0f);
+        mHistoryIdx = 0;
+    }
+
+    /**
+     * Run the convolution for one new frame.
+     * @param inData Frame of InSize elements.
+     */
+    void forward(const float* inData)
+    {
+        // Zero padding in frequency is kept around the frame so that the kernel loops have no boundary checks.
+        if constexpr (IsHalf) {
+            HalfFloat::fromFloat(inData, mHistory[(size_t) mHistoryIdx].data() + PadLeft * InCh, InSize);
+        } else {
+            std::copy(inData, inData + InSize, mHistory[(size_t) mHistoryIdx].begin() + PadLeft * InCh);
+        }
+
+        std::array<const Storage*, KernelTime> taps;
+        for (int k = 0; k < KernelTime; k++) {
+            taps[(size_t) k] = mHistory[(size_t) _tapFrameIndex(k)].data();
+        }
+
+        if constexpr (OutCh == 1) {
+            _forwardDot(taps);
+        } else {
+            _forwardBlocked(taps);
+        }
+
+        mHistoryIdx = (mHistoryIdx == ReceptiveField - 1) ? 0 : mHistoryIdx + 1;
+    }
+
+    /**
+     * Store a new frame in the history without running the convolution: the outputs keep the values of the last
+     * forward call. Used to run the layer on some frames only, the later forward calls still seeing every frame.
+     * @param inData Frame of InSize elements.
+     */
+    void push(const float* inData)
+    {
+        if constexpr (IsHalf) {
+            HalfFloat::fromFloat(inData, mHistory[(size_t) mHistoryIdx].data() + PadLeft * InCh, InSize);
+        } else {
+            std::copy(inData, inData + InSize, mHistory[(size_t) mHistoryIdx].begin() + PadLeft * InCh);
+        }
+
+        mHistoryIdx = (mHistoryIdx == ReceptiveField - 1) ? 0 : mHistoryIdx + 1;
+    }
+
+    /**
+     * @return Pointer to the OutSize outputs of the last forward call.
+     */
+    const float* getOutputs() const { return mOuts.data(); }
+
+private:
+    /**
+     * @return Value converted to the storage type
+     */
+    static Storage _store(float inValue)
+    {
+        if constexpr (IsHalf) {
+            return HalfFloat::fromFloat(inValue);
+        } else {
+            return inValue;
+        }
+    }
+
+    /**
+     * @return Value converted back to float
+     */
+    static float _load(Storage inValue)
+    {
+        if constexpr (IsHalf) {
+            return HalfFloat::toFloat(inValue);
+        } else {
+            return inValue;
+        }
+    }
+
+    /**
+     * Get Size consecutive stored values as floats. With float storage this is the stored data itself, so the kernel
+     * loops are unchanged. With half storage the values are converted into a small buffer local to the loop, which
+     * the compiler keeps in registers or on the stack.
+     * @tparam Size Number of values
+     * @param inData Stored values
+     * @param outBuffer Buffer of Size floats, used with half storage only
+     * @return Pointer to Size floats
+     */
+    template <int Size>
+    static const float* _toFloat(const Storage* inData, float* outBuffer)
+    {
+        if constexpr (IsHalf) {
+            HalfFloat::toFloat(inData, outBuffer, Size);
+            return outBuffer;
+        } else {
+            return inData;
+        }
+    }
+
+    /**
+     * @return Index in mHistory of the frame to which tap inTap of the kernel is applied
+     */
+    int _tapFrameIndex(int inTap) const
+    {
+        int frame_idx = mHistoryIdx - (KernelTime - 1 - inTap) * Dilation;
+        return frame_idx < 0 ? frame_idx + ReceptiveField : frame_idx;
+    }
+
+    /**
+     * Single output channel: each output is a dot product between the contiguous KernelFeat * InCh input window
+     * and the kernel, for each time tap. Several partial sums are used so that the reduction can be vectorised.
+     */
+    void _forwardDot(const std::array<const Storage*, KernelTime>& inTaps)
+    {
+        static constexpr int NumLanes = 8;
+        static constexpr int NumFullLanes = (WindowSize / NumLanes) * NumLanes;
+
+        for (int f = mFeatBegin; f < mFeatEnd; f++) {
+            float partial[NumLanes] = {};
+            float acc = mBias[0];
+
+            for (int k = 0; k < KernelTime; k++) {
+                const Storage* w = mWeights.data() + k * WindowSize;
+                const Storage* x = inTaps[(size_t) k] + f * Stride * InCh;
+
+                for (int n = 0; n < NumFullLanes; n += NumLanes) {
+                    float w_buffer[IsHalf ? NumLanes : 1], x_buffer[IsHalf ? NumLanes : 1];
+                    const float* w_lanes = _toFloat<NumLanes>(w + n, w_buffer);
+                    const float* x_lanes = _toFloat<NumLanes>(x + n, x_buffer);
+
+                    for (int l = 0; l < NumLanes; l++) {
+                        partial[l] += w_lanes[l] * x_lanes[l];
+                    }
+                }
+
+                for (int n = NumFullLanes; n < WindowSize; n++) {
+                    acc += _load(w[n]) * _load(x[n]);
+                }
+            }
+
+            for (float p: partial) {
+                acc += p;
+            }
+
+            mOuts[(size_t) f] = acc;
+        }
+
+        // Separate loop so that the activation is vectorised across output features
+        for (int f = mFeatBegin; f < mFeatEnd; f++) {
+            mOuts[(size_t) f] = Activation::apply(mOuts[(size_t) f]);
+        }
+    }
+
+    /**
+     * Several output channels: accumulate FeatBlock x OutCh outputs in registers, the innermost loop running over
+     * output channels (contiguous in the kernel) so that it maps onto SIMD lanes.
+     */
+    void _forwardBlocked(const std::array<const Storage*, KernelTime>& inTaps)
+    {
+        // Inputs read by one block of output features
+        static constexpr int BlockInSize = (FeatBlock - 1) * Stride * InCh + WindowSize;
+
+        for (int f = mFeatBegin; f < mFeatEnd; f += FeatBlock) {
+            float acc[FeatBlock][OutCh];
+
+            for (int b = 0; b < FeatBlock; b++) {
+                for (int o = 0; o < OutCh; o++) {
+                    acc[b][o] = mBias[(size_t) o];
+                }
+            }
+
+            for (int k = 0; k < KernelTime; k++) {
+                const Storage* w = mWeights.data() + k * WindowSize * OutCh;
+
+                float x_buffer[IsHalf ? BlockInSize : 1];
+                const float* x = _toFloat<BlockInSize>(inTaps[(size_t) k] + f * Stride * InCh, x_buffer);
+
+                for (int n = 0; n < WindowSize; n++) {
+                    float w_buffer[IsHalf ? OutCh : 1];
+                    const float* w_n = _toFloat<OutCh>(w + n * OutCh, w_buffer);
+
+                    for (int b = 0; b < FeatBlock; b++) {
+                        const float x_val = x[b * Stride * InCh + n];
+
+                        for (int o = 0; o < OutCh; o++) {
+                            acc[b][o] += x_val * w_n[o];
+                        }
+                    }
+                }
+            }
+
+            for (int b = 0; b < FeatBlock; b++) {
+                float* out = mOuts.data() + (f + b) * OutCh;
+                for (int o = 0; o < OutCh; o++) {
+                    out[o] = Activation::apply(acc[b][o]);
+                }
+            }
+        }
+    }
+
+    alignas(32) std::array<Storage, KernelTime * WindowSize * OutCh> mWeights {};
+    std::array<float, OutCh> mBias {};
+
+    alignas(32) std::array<std::array<Storage, NumFeatPadded * InCh>, ReceptiveField> mHistory {};
+    int mHistoryIdx = 0;
+
+    alignas(32) std::array<float, OutSize> mOuts {};
+
+    // Range of output features computed
+    int mFeatBegin = 0;
+    int mFeatEnd = NumFeatOut;
+};
+
+#endif // FusedConv2D_h
@@ -0,0 +1,192 @@
+// HalfFloat.h
+
+#ifndef HalfFloat_h
+#define HalfFloat_h
+
+#include <cstdint>
+#include <cstring>
+
+// On x86-64 with GCC or Clang, builds that do not target F16C compile its conversions with target attributes and use
+// them when the CPU has it (any x86-64 CPU since 2012), as done for the int8 dot products.
+#if defined(__F16C__) && defined(__AVX__)
+#define HALFFLOAT_F16C 1
+#define HALFFLOAT_TARGET
+#elif defined(__x86_64__) && defined(__GNUC__)
+#define HALFFLOAT_F16C 1
+#define HALFFLOAT_RUNTIME_DISPATCH 1
+#define HALFFLOAT_TARGET __attribute__((target("avx,f16c")))
+#endif
+
+#if defined(HALFFLOAT_F16C)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+/**
+ * IEEE half precision storage (compute is always done in float).
+ * Conversions use F16C on x86 (detected at runtime if the build does not target it) or NEON on aarch64, with a
+ * scalar fallback giving the same results
+ * (round to nearest even, overflow to infinity).
+ * Relative precision is 2^-11, more than enough for CNN weights and activations in [0, 65504].
+ */
+namespace HalfFloat
+{
+/** Bit pattern of an IEEE binary16 value */
+using Half = uint16_t;
+
+/**
+ * Convert a single float to half precision.
+ * @param inValue Float value
+ * @return Half bit pattern
+ */
+static inline Half fromFloat(float inValue)
+{
+    uint32_t bits;
+    std::memcpy(&bits, &inValue, sizeof(float));
+
+    const uint32_t sign = (bits >> 16) & 0x8000u;
+    bits &= 0x7fffffffu;
+
+    // Too large, infinity or NaN
+    if (bits >= 0x47800000u) {
+        return static_cast<Half>(sign | (bits > 0x7f800000u ? 0x7e00u : 0x7c00u));
+    }
+
+    // Subnormal half (or zero): let the float adder do the rounding
+    if (bits < 0x38800000u) {
+        float abs_value;
+        std::memcpy(&abs_value, &bits, sizeof(float));
+        abs_value += 0.5f;
+        std::memcpy(&bits, &abs_value, sizeof(float));
+        return static_cast<Half>(sign | (bits - 0x3f000000u));
+    }
+
+    // Normal: rebias exponent and round mantissa to nearest even
+    const uint32_t mantissa_odd = (bits >> 13) & 1u;
+    bits += 0xc8000fffu + mantissa_odd;
+    return static_cast<Half>(sign | (bits >> 13));
+}
+
+/**
+ * Convert a single half precision value to float.
+ * @param inValue Half bit pattern
+ * @return Float value
+ */
+static inline float toFloat(Half inValue)
+{
+    const uint32_t sign = static_cast<uint32_t>(inValue & 0x8000u) << 16;
+    const uint32_t exponent = (inValue >> 10) & 0x1fu;
+    const uint32_t mantissa = inValue & 0x3ffu;
+
+    uint32_t bits;
+    if (exponent == 0) {
+        // Zero or subnormal: mantissa * 2^-24 is exact in float
+        const float value = static_cast<float>(mantissa) * 5.9604644775390625e-8f;
+        std::memcpy(&bits, &value, sizeof(float));
+        bits |= sign;
+    } else if (exponent == 31) {
+        // Infinity, or NaN made quiet as done by the hardware conversions
+        bits = sign | 0x7f800000u | (mantissa << 13) | (mantissa != 0 ? 0x400000u : 0u);
+    } else {
+        bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+    }
+
+    float out;
+    std::memcpy(&out, &bits, sizeof(float));
+    return out;
+}
+
+#if defined(HALFFLOAT_F16C)
+/**
+ * @return True if the CPU running the code has F16C: fixed at compile time, or detected once with runtime dispatch.
+ */
+static inline bool hasF16C()
+{
+#if defined(HALFFLOAT_RUNTIME_DISPATCH)
+    static const bool has_f16c = [] {
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx") && __builtin_cpu_supports("f16c");
+    }();
+    return has_f16c;
+#else
+    return true;
+#endif
+}
+
+/**
+ * Convert the first elements of an array of floats to half precision, 8 at a time.
+ * @return Number of elements converted
+ */
+HALFFLOAT_TARGET static inline int _fromFloatF16C(const float* inData, Half* outData, int inSize)
+{
+    int i = 0;
+    for (; i + 8 <= inSize; i += 8) {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(outData + i),
+                         _mm256_cvtps_ph(_mm256_loadu_ps(inData + i), _MM_FROUND_TO_NEAREST_INT));
+    }
+    return i;
+}
+
+/**
+ * Convert the first elements of an array of half precision values to float, 8 at a time.
+ * @return Number of elements converted
+ */
+HALFFLOAT_TARGET static inline int _toFloatF16C(const Half* inData, float* outData, int inSize)
+{
+    int i = 0;
+    for (; i + 8 <= inSize; i += 8) {
+        _mm256_storeu_ps(outData + i, _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(inData + i))));
+    }
+    return i;
+}
+#endif
+
+/**
+ * Convert an array of floats to half precision.
+ * @param inData Float input
+ * @param outData Half output
+ * @param inSize Number of elements
+ */
+static inline void fromFloat(const float* inData, Half* outData, int inSize)
+{
+    int i = 0;
+#if defined(HALFFLOAT_F16C)
+    if (hasF16C()) {
+        i = _fromFloatF16C(inData, outData, inSize);
+    }
+#elif defined(__aarch64__)
+    for (; i + 4 <= inSize; i += 4) {
+        vst1_u16(outData + i, vreinterpret_u16_f16(vcvt_f16_f32(vld1q_f32(inData + i))));
+    }
+#endif
+    for (; i < inSize; i++) {
+        outData[i] = fromFloat(inData[i]);
+    }
+}
+
+/**
+ * Convert an array of half precision values to float.
+ * @param inData Half input
+ * @param outData Float output
+ * @param inSize Number of elements
+ */
+static inline void toFloat(const Half* inData, float* outData, int inSize)
+{
+    int i = 0;
+#if defined(HALFFLOAT_F16C)
+    if (hasF16C()) {
+        i = _toFloatF16C(inData, outData, inSize);
+    }
+#elif defined(__aarch64__)
+    for (; i + 4 <= inSize; i += 4) {
+        vst1q_f32(outData + i, vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16(inData + i))));
+    }
+#endif
+    for (; i < inSize; i++) {
+        outData[i] = toFloat(inData[i]);
+    }
+}
+} // namespace HalfFloat
+
+#endif // HalfFloat_h
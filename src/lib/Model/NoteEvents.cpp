@@ -0,0 +1,129 @@
+//
+// NoteEvents.cpp
+//
+
+#include "NoteEvents.h"
+
+#include <algorithm>
+#include <array>
+
+void NoteEvents::clear()
+{
+    mStartTime.clear();
+    mEndTime.clear();
+    mStartFrame.clear();
+    mEndFrame.clear();
+    mPitch.clear();
+    mAmplitude.clear();
+    mBendsOffset.clear();
+    mBendsSize.clear();
+    mOrder.clear();
+    mBendsArena.clear();
+}
+
+void NoteEvents::release()
+{
+    *this = NoteEvents();
+}
+
+void NoteEvents::reserve(size_t inNumEvents, size_t inNumBends)
+{
+    mStartTime.reserve(inNumEvents);
+    mEndTime.reserve(inNumEvents);
+    mStartFrame.reserve(inNumEvents);
+    mEndFrame.reserve(inNumEvents);
+    mPitch.reserve(inNumEvents);
+    mAmplitude.reserve(inNumEvents);
+    mBendsOffset.reserve(inNumEvents);
+    mBendsSize.reserve(inNumEvents);
+    mOrder.reserve(inNumEvents);
+    mBendsArena.reserve(inNumBends);
+}
+
+size_t NoteEvents::add(
+    double inStartTime, double inEndTime, int inStartFrame, int inEndFrame, int inPitch, double inAmplitude)
+{
+    mOrder.push_back(static_cast<int>(mStartTime.size()));
+
+    mStartTime.push_back(inStartTime);
+    mEndTime.push_back(inEndTime);
+    mStartFrame.push_back(inStartFrame);
+    mEndFrame.push_back(inEndFrame);
+    mPitch.push_back(inPitch);
+    mAmplitude.push_back(inAmplitude);
+    mBendsOffset.push_back(0);
+    mBendsSize.push_back(0);
+
+    return mOrder.size() - 1;
+}
+
+int* NoteEvents::allocateBends(size_t inPosition, int inNumBends)
+{
+    assert(inPosition < mOrder.size() && inNumBends >= 0);
+    const auto idx = static_cast<size_t>(mOrder[inPosition]);
+
+    mBendsOffset[idx] = mBendsArena.size();
+    mBendsSize[idx] = inNumBends;
+    mBendsArena.resize(mBendsArena.size() + static_cast<size_t>(inNumBends));
+
+    return mBendsArena.data() + mBendsOffset[idx];
+}
+
+void NoteEvents::dropBends(size_t inPosition)
+{
+    assert(inPosition < mOrder.size());
+    mBendsSize[static_cast<size_t>(mOrder[inPosition])] = 0;
+}
+
+void NoteEvents::sort()
+{
+    std::sort(mOrder.begin(), mOrder.end(), [this](int a, int b) {
+        return mStartFrame[a] < mStartFrame[b] || (mStartFrame[a] == mStartFrame[b] && mEndFrame[a] < mEndFrame[b]);
+    });
+}
+
+void NoteEvents::mergeOverlappingNotesWithSamePitch()
+{
+    sort();
+
+    // Storage index of the last kept note of each midi pitch, -1 if none
+    std::array<int, 128> last_note_idx;
+    last_note_idx.fill(-1);
+
+    size_t n_out = 0;
+    for (size_t i = 0; i < mOrder.size(); i++) {
+        const int idx = mOrder[i];
+        assert(mPitch[idx] >= 0 && mPitch[idx] < 128);
+        auto& last_idx = last_note_idx[mPitch[idx]];
+
+        // If notes overlap and have the same pitch: merge them
+        if (last_idx >= 0 && mStartFrame[idx] < mEndFrame[last_idx]) {
+            mEndTime[last_idx] = mEndTime[idx];
+            mEndFrame[last_idx] = mEndFrame[idx];
+            continue;
+        }
+
+        mOrder[n_out++] = idx;
+        last_idx = idx;
+    }
+
+    mOrder.resize(n_out);
+}
+
+void NoteEvents::dropOverlappingPitchBends()
+{
+    const auto n_events = mOrder.size();
+    int max_end_frame = 0;
+
+    for (size_t i = 0; i < n_events; i++) {
+        const int idx = mOrder[i];
+        const bool overlaps_previous = i > 0 && mStartFrame[idx] < max_end_frame;
+        const bool overlaps_next = i + 1 < n_events && mStartFrame[mOrder[i + 1]] < mEndFrame[idx];
+
+        max_end_frame = i == 0 ? mEndFrame[idx] : std::max(max_end_frame, mEndFrame[idx]);
+
+        if (overlaps_previous || overlaps_next) {
+            mBendsSize[idx] = 0;
+        }
+    }
+}
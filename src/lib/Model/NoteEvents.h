@@ -0,0 +1,170 @@
+//
+// NoteEvents.h
+//
+
+#ifndef NoteEvents_h
+#define NoteEvents_h
+
+#include <cassert>
+#include <cstddef>
+#include <vector>
+
+/**
+ * Note events stored as a structure of arrays, used by Notes::convert to create events without allocating once
+ * the storage has grown to the size of a window.
+ *
+ * - Each field has its own array, indexed by storage index (creation order). The order of the events (positions
+ *   used by all accessors) is a separate permutation of storage indices, so sorting and merging only move ints.
+ * - Pitch bends of all events live in one bump arena: each event refers to a range of it.
+ * - clear is O(1) and keeps all capacities.
+ */
+class NoteEvents
+{
+public:
+    /**
+     * Read-only view on the pitch bends of one event (one value per frame, in 1/3 of semitones).
+     * Valid until the next call to allocateBends or clear.
+     */
+    class Bends
+    {
+    public:
+        Bends(const int* inData, int inSize) : mData(inData), mSize(inSize) {}
+
+        const int* begin() const { return mData; }
+        const int* end() const { return mData + mSize; }
+        size_t size() const { return static_cast<size_t>(mSize); }
+        bool empty() const { return mSize == 0; }
+        int operator[](size_t inIdx) const { return mData[inIdx]; }
+
+    private:
+        const int* mData;
+        int mSize;
+    };
+
+    /**
+     * Copy of the fields of one event, same as Notes::Event but with bends as a view on the arena.
+     */
+    typedef struct EventView {
+        double startTime;
+        double endTime;
+        int startFrame;
+        int endFrame;
+        int pitch; // MIDI note number
+        double amplitude;
+        Bends bends;
+    } EventView;
+
+    class Iterator
+    {
+    public:
+        Iterator(const NoteEvents* inEvents, size_t inPosition) : mEvents(inEvents), mPosition(inPosition) {}
+
+        EventView operator*() const { return (*mEvents)[mPosition]; }
+        Iterator& operator++()
+        {
+            mPosition++;
+            return *this;
+        }
+        bool operator!=(const Iterator& inOther) const { return mPosition != inOther.mPosition; }
+
+    private:
+        const NoteEvents* mEvents;
+        size_t mPosition;
+    };
+
+    NoteEvents() = default;
+
+    /**
+     * Remove all events and bends. O(1), capacities are kept.
+     */
+    void clear();
+
+    /**
+     * Remove all events and release memory.
+     */
+    void release();
+
+    /**
+     * Reserve storage to avoid growing later.
+     * @param inNumEvents Number of events
+     * @param inNumBends Total number of pitch bend values
+     */
+    void reserve(size_t inNumEvents, size_t inNumBends);
+
+    /**
+     * Append an event (without bends) at the end of the order.
+     * @return Position of the new event
+     */
+    size_t add(double inStartTime, double inEndTime, int inStartFrame, int inEndFrame, int inPitch, double inAmplitude);
+
+    /**
+     * Allocate the pitch bends of an event in the arena, replacing its current ones.
+     * @param inPosition Position of the event
+     * @param inNumBends Number of values (usually endFrame - startFrame)
+     * @return Pointer to the inNumBends values to fill, valid until the next allocateBends or clear.
+     */
+    int* allocateBends(size_t inPosition, int inNumBends);
+
+    /**
+     * Remove the pitch bends of an event. O(1), arena space is only reclaimed by clear.
+     * @param inPosition Position of the event
+     */
+    void dropBends(size_t inPosition);
+
+    /**
+     * Sort events by start frame then end frame (same order as Notes::sortEvents), moving indices only.
+     */
+    void sort();
+
+    /**
+     * Same as Notes::mergeOverlappingNotesWithSamePitch, moving indices only. Events are sorted first.
+     */
+    void mergeOverlappingNotesWithSamePitch();
+
+    /**
+     * Same as Notes::dropOverlappingPitchBends. Events are expected to be sorted.
+     */
+    void dropOverlappingPitchBends();
+
+    size_t size() const { return mOrder.size(); }
+    bool empty() const { return mOrder.empty(); }
+
+    /**
+     * @param inPosition Position of the event
+     * @return Copy of the event fields
+     */
+    EventView operator[](size_t inPosition) const
+    {
+        assert(inPosition < mOrder.size());
+        const auto idx = static_cast<size_t>(mOrder[inPosition]);
+        return EventView {mStartTime[idx],
+                          mEndTime[idx],
+                          mStartFrame[idx],
+                          mEndFrame[idx],
+                          mPitch[idx],
+                          mAmplitude[idx],
+                          Bends(mBendsArena.data() + mBendsOffset[idx], mBendsSize[idx])};
+    }
+
+    Iterator begin() const { return Iterator(this, 0); }
+    Iterator end() const { return Iterator(this, mOrder.size()); }
+
+private:
+    // Event fields, indexed by storage index
+    std::vector<double> mStartTime;
+    std::vector<double> mEndTime;
+    std::vector<int> mStartFrame;
+    std::vector<int> mEndFrame;
+    std::vector<int> mPitch;
+    std::vector<double> mAmplitude;
+    std::vector<size_t> mBendsOffset;
+    std::vector<int> mBendsSize;
+
+    // Storage indices in event order
+    std::vector<int> mOrder;
+
+    // Pitch bends of all events
+    std::vector<int> mBendsArena;
+};
+
+#endif // NoteEvents_h
@@ -0,0 +1,158 @@
+//
+// NoteStream.cpp
+//
+
+#include "NoteStream.h"
+
+NoteStream::NoteStream()
+{
+    setParameters(mParams);
+}
+
+void NoteStream::setParameters(const Notes::ConvertParams& inParams)
+{
+    mParams = inParams;
+
+    mMaxNoteIdx =
+        inParams.maxFrequency < 0
+            ? NUM_FREQ_OUT - 1
+            : std::min(NUM_FREQ_OUT - 1, NoteUtils::hzToMidi(inParams.maxFrequency) - MIDI_OFFSET);
+    mMinNoteIdx =
+        inParams.minFrequency < 0 ? 0 : std::max(0, NoteUtils::hzToMidi(inParams.minFrequency) - MIDI_OFFSET);
+
+    Notes::makeScaleMapping(inParams, mMinNoteIdx, mMaxNoteIdx, mVisitNote, mEventNoteIdx);
+}
+
+void NoteStream::reset()
+{
+    mNumFrames = 0;
+
+    for (auto& frame: mNotesHistory) {
+        frame.fill(0.0f);
+    }
+
+    for (auto& frame: mOnsetsHistory) {
+        frame.fill(0.0f);
+    }
+
+    mMaxOnset = 0.0f;
+    mMaxNotesDiff = 0.0f;
+
+    mActive.fill(false);
+    mStartFrame.fill(0);
+    mNumFramesBelow.fill(0);
+}
+
+void NoteStream::processFrame(const float* inNotes, const float* inOnsets, std::vector<Message>& outMessages)
+{
+    const int frame_idx = mNumFrames;
+    const float frame_threshold = mParams.frameThreshold;
+
+    // Onsets of the current frame, inferred as in Notes::_inferOnsets but with running maxima
+    std::array<float, NUM_FREQ_OUT> onsets;
+
+    for (int j = 0; j < NUM_FREQ_OUT; j++) {
+        onsets[j] = inOnsets[j];
+        mMaxOnset = std::max(mMaxOnset, inOnsets[j]);
+    }
+
+    if (mParams.inferOnsets) {
+        std::array<float, NUM_FREQ_OUT> notes_diff;
+
+        for (int j = 0; j < NUM_FREQ_OUT; j++) {
+            const float diff = std::min(inNotes[j] - mNotesHistory[0][j], inNotes[j] - mNotesHistory[1][j]);
+            notes_diff[j] = frame_idx >= 2 ? std::max(diff, 0.0f) : 0.0f;
+            mMaxNotesDiff = std::max(mMaxNotesDiff, notes_diff[j]);
+        }
+
+        if (mMaxNotesDiff > 0.0f) {
+            for (int j = 0; j < NUM_FREQ_OUT; j++) {
+                onsets[j] = std::max(onsets[j], mMaxOnset * notes_diff[j] / mMaxNotesDiff);
+            }
+        }
+    }
+
+    // Onset peaks of the previous frame are confirmed now that the next frame is known
+    if (frame_idx >= 1) {
+        const int peak_frame = frame_idx - 1;
+
+        for (int j = mMinNoteIdx; j <= mMaxNoteIdx; j++) {
+            const float onset = mOnsetsHistory[0][j];
+            const float prev = peak_frame == 0 ? onset : mOnsetsHistory[1][j];
+
+            if (!mVisitNote[j] || onset < mParams.onsetThreshold || onset < prev || onset < onsets[j]) {
+                continue;
+            }
+
+            // Notes::convert would drop a note without energy after its onset (too short)
+            if (mNotesHistory[0][j] < frame_threshold && inNotes[j] < frame_threshold) {
+                continue;
+            }
+
+            // Later onsets cut notes at the same and neighbouring pitches
+            for (int n = std::max(0, j - 1); n <= std::min(MAX_NOTE_IDX, j + 1); n++) {
+                if (mActive[n]) {
+                    _noteOff(n, peak_frame, outMessages);
+                }
+            }
+
+            // And notes sent at the same pitch (moved by the scale): only one can be held
+            for (int n = 0; n < NUM_FREQ_OUT; n++) {
+                if (mActive[n] && mSentNoteIdx[n] == mEventNoteIdx[j]) {
+                    _noteOff(n, peak_frame, outMessages);
+                }
+            }
+
+            mActive[j] = true;
+            mStartFrame[j] = peak_frame;
+            mNumFramesBelow[j] = 0;
+            mSentNoteIdx[j] = mEventNoteIdx[j];
+
+            outMessages.push_back(Message {
+                peak_frame, mEventNoteIdx[j] + MIDI_OFFSET, true, std::max(mNotesHistory[0][j], inNotes[j])});
+        }
+    }
+
+    // Sustain: a note ends on the first of energyThreshold consecutive frames below threshold
+    for (int j = 0; j < NUM_FREQ_OUT; j++) {
+        if (!mActive[j] || mStartFrame[j] == frame_idx) {
+            continue;
+        }
+
+        mNumFramesBelow[j] = inNotes[j] < frame_threshold ? mNumFramesBelow[j] + 1 : 0;
+
+        if (mNumFramesBelow[j] >= mParams.energyThreshold) {
+            const int end_frame = frame_idx - mNumFramesBelow[j] + 1;
+            _noteOff(j, std::max(end_frame, mStartFrame[j] + mParams.minNoteLength + 1), outMessages);
+        }
+    }
+
+    // Shift history
+    mNotesHistory[1] = mNotesHistory[0];
+    std::copy(inNotes, inNotes + NUM_FREQ_OUT, mNotesHistory[0].begin());
+
+    mOnsetsHistory[1] = mOnsetsHistory[0];
+    mOnsetsHistory[0] = onsets;
+
+    mNumFrames++;
+}
+
+void NoteStream::flush(std::vector<Message>& outMessages)
+{
+    for (int j = 0; j < NUM_FREQ_OUT; j++) {
+        if (mActive[j]) {
+            _noteOff(j, mNumFrames, outMessages);
+        }
+    }
+}
+
+int NoteStream::getNumFrames() const
+{
+    return mNumFrames;
+}
+
+void NoteStream::_noteOff(int inNoteIdx, int inFrame, std::vector<Message>& outMessages)
+{
+    mActive[inNoteIdx] = false;
+    outMessages.push_back(Message {inFrame, mSentNoteIdx[inNoteIdx] + MIDI_OFFSET, false, 0.0});
+}
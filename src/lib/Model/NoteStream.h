@@ -0,0 +1,106 @@
+//
+// NoteStream.h
+//
+
+#ifndef NoteStream_h
+#define NoteStream_h
+
+#include <array>
+#include <vector>
+
+#include "BasicPitchConstants.h"
+#include "Notes.h"
+
+/**
+ * Incremental version of Notes::convert: note and onset posteriorgram frames are consumed as they arrive, and
+ * note on / note off messages are emitted as soon as they are known instead of once the whole window is available.
+ *
+ * - Onsets (inferred from note posteriorgram differences if enabled) are peak picked with a one frame lookahead:
+ *   the note on of a peak at frame t is emitted when frame t + 1 arrives.
+ * - A note is sustained with the energyThreshold logic of Notes::convert: it ends on the first of energyThreshold
+ *   consecutive frames below frameThreshold. The note off is emitted when the last of these frames arrives.
+ * - As in Notes::convert, a new onset cuts any note at the same pitch or at a neighbouring pitch.
+ * - The scale is applied as in Notes::convert: onsets of notes out of the scale are skipped in Remove mode, and
+ *   their notes are sent at the nearest note of the scale in Adjust mode. A note moved onto the pitch of a held
+ *   note cuts it, where Notes::convert merges the two.
+ *
+ * Differences with Notes::convert: no melodia trick (it needs the whole window), inferred onsets are scaled with
+ * running maxima instead of maxima over the window, and the amplitude is the note posteriorgram at the onset.
+ */
+class NoteStream
+{
+public:
+    typedef struct Message {
+        int frame; // Frame of the event. Note offs are usually emitted energyThreshold frames after it.
+        int pitch; // Midi note number
+        bool isNoteOn;
+        double amplitude; // 0 for note offs
+    } Message;
+
+    NoteStream();
+
+    /**
+     * Set parameters. Used: onsetThreshold, frameThreshold, minNoteLength (minimum number of frames between note
+     * on and note off), inferOnsets, minFrequency, maxFrequency, energyThreshold, scaleType, rootNote and snapMode.
+     * @param inParams Parameters, same as for Notes::convert
+     */
+    void setParameters(const Notes::ConvertParams& inParams);
+
+    /**
+     * Forget all frames and active notes. No note off is emitted, call flush before if needed.
+     */
+    void reset();
+
+    /**
+     * Process next posteriorgram frame.
+     * @param inNotes Note posteriorgram frame (NUM_FREQ_OUT values)
+     * @param inOnsets Onset posteriorgram frame (NUM_FREQ_OUT values)
+     * @param outMessages Messages emitted by this frame are appended here, in frame order for each pitch.
+     */
+    void processFrame(const float* inNotes, const float* inOnsets, std::vector<Message>& outMessages);
+
+    /**
+     * End all active notes at the current frame.
+     * @param outMessages Note offs are appended here.
+     */
+    void flush(std::vector<Message>& outMessages);
+
+    /**
+     * @return Number of frames processed since last reset.
+     */
+    int getNumFrames() const;
+
+private:
+    /**
+     * End active note at given pitch
+     */
+    void _noteOff(int inNoteIdx, int inFrame, std::vector<Message>& outMessages);
+
+    Notes::ConvertParams mParams;
+    int mMinNoteIdx = 0;
+    int mMaxNoteIdx = NUM_FREQ_OUT - 1;
+
+    // Scale mapping, see Notes::makeScaleMapping. Notes are tracked at the pitch of their onset, and sent at the
+    // pitch they are moved to.
+    std::array<uint8_t, NUM_FREQ_OUT> mVisitNote {};
+    std::array<int, NUM_FREQ_OUT> mEventNoteIdx {};
+
+    int mNumFrames = 0;
+
+    // Last 2 frames of note posteriorgrams and of (inferred) onsets, index 0 is the latest
+    std::array<std::array<float, NUM_FREQ_OUT>, 2> mNotesHistory {};
+    std::array<std::array<float, NUM_FREQ_OUT>, 2> mOnsetsHistory {};
+
+    // Running maxima used to scale inferred onsets
+    float mMaxOnset = 0.0f;
+    float mMaxNotesDiff = 0.0f;
+
+    // State of each pitch
+    std::array<bool, NUM_FREQ_OUT> mActive {};
+    std::array<int, NUM_FREQ_OUT> mStartFrame {};
+    std::array<int, NUM_FREQ_OUT> mNumFramesBelow {};
+    // Note index of the note on sent, for the note off to match it if the scale changes in between
+    std::array<int, NUM_FREQ_OUT> mSentNoteIdx {};
+};
+
+#endif // NoteStream_h
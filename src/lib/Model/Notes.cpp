@@ -4,6 +4,101 @@
 
 #include "Notes.h"
 
+#include <condition_variable>
+#include <mutex>
+
+struct Notes::_worker_pool {
+    explicit _worker_pool(int inNumWorkers)
+    {
+        threads.reserve(static_cast<size_t>(inNumWorkers));
+        for (int i = 0; i < inNumWorkers; i++) {
+            threads.emplace_back(&_worker_pool::loop, this, i + 1);
+        }
+    }
+
+    ~_worker_pool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        start.notify_all();
+        for (auto& thread: threads) {
+            thread.join();
+        }
+    }
+
+    /**
+     * Run inTask(1) to inTask(inNumTasks - 1) on the workers and inTask(0) on the calling thread.
+     * Returns when all of them are done. Does not allocate.
+     * @param inNumTasks Number of tasks, up to the number of workers + 1
+     * @param inTask Callable taking the task index
+     */
+    template <typename Task>
+    void run(int inNumTasks, Task& inTask)
+    {
+        assert(inNumTasks - 1 <= static_cast<int>(threads.size()));
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            task = [](void* inContext, int inTaskIdx) { (*static_cast<Task*>(inContext))(inTaskIdx); };
+            context = &inTask;
+            numTasks = inNumTasks;
+            numPending = inNumTasks - 1;
+            generation++;
+        }
+        start.notify_all();
+
+        inTask(0);
+
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this] { return numPending == 0; });
+    }
+
+    /**
+     * Worker thread: wait for each run and take its task if there is one for it.
+     * @param inTaskIdx Index of the task of this worker
+     */
+    void loop(int inTaskIdx)
+    {
+        uint64_t last_generation = 0;
+        std::unique_lock<std::mutex> lock(mutex);
+
+        while (true) {
+            start.wait(lock, [&] { return stop || generation != last_generation; });
+            if (stop) {
+                return;
+            }
+            last_generation = generation;
+
+            if (inTaskIdx < numTasks) {
+                lock.unlock();
+                task(context, inTaskIdx);
+                lock.lock();
+
+                if (--numPending == 0) {
+                    done.notify_one();
+                }
+            }
+        }
+    }
+
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable start; // A run started (generation incremented) or the pool is stopping
+    std::condition_variable done; // All tasks of the run are done
+    void (*task)(void*, int) = nullptr;
+    void* context = nullptr;
+    int numTasks = 0;
+    int numPending = 0; // Tasks of the workers not done yet
+    uint64_t generation = 0;
+    bool stop = false;
+};
+
+Notes::Notes() = default;
+
+Notes::~Notes() = default;
+
 bool Notes::Event::operator==(const Notes::Event& other) const
 {
     return this->startTime == other.startTime && this->endTime == other.endTime && this->startFrame == other.startFrame
@@ -17,12 +112,36 @@ std::vector<Notes::Event> Notes::convert(const std::vector<std::vector<float>>&
                                          const ConvertParams& inParams,
                                          bool inNewAudio)
 {
+    convert(inNotesPG, inOnsetsPG, inContoursPG, inParams, inNewAudio, mEvents);
+
     std::vector<Event> events;
-    events.reserve(1024);
+    events.reserve(mEvents.size());
+
+    for (const auto& event: mEvents) {
+        events.push_back(Event {event.startTime,
+                                event.endTime,
+                                event.startFrame,
+                                event.endFrame,
+                                event.pitch,
+                                event.amplitude,
+                                std::vector<int>(event.bends.begin(), event.bends.end())});
+    }
+
+    return events;
+}
+
+void Notes::convert(const std::vector<std::vector<float>>& inNotesPG,
+                    const std::vector<std::vector<float>>& inOnsetsPG,
+                    const std::vector<std::vector<float>>& inContoursPG,
+                    const ConvertParams& inParams,
+                    bool inNewAudio,
+                    NoteEvents& outEvents)
+{
+    outEvents.clear();
 
     const auto n_frames = static_cast<int>(inNotesPG.size());
     if (n_frames == 0) {
-        return events;
+        return;
     }
 
     const auto n_notes = static_cast<int>(inNotesPG[0].size());
@@ -31,160 +150,310 @@ std::vector<Notes::Event> Notes::convert(const std::vector<std::vector<float>>&
     assert(n_notes == inOnsetsPG[0].size());
     assert(n_notes == NUM_FREQ_OUT);
 
-    std::vector<std::vector<float>> inferred_onsets;
-    auto onsets_ptr = &inOnsetsPG;
-    if (inParams.inferOnsets) {
-        inferred_onsets = _inferredOnsets<float>(inOnsetsPG, inNotesPG);
-        onsets_ptr = &inferred_onsets;
+    // constrain frequencies: notes outside the range are not read at all (the CNN may not have computed them)
+    const auto max_note_idx =
+        inParams.maxFrequency < 0
+            ? n_notes - 1
+            : std::min(n_notes - 1, NoteUtils::hzToMidi(inParams.maxFrequency) - MIDI_OFFSET);
+    const auto min_note_idx =
+        inParams.minFrequency < 0 ? 0 : std::max(0, NoteUtils::hzToMidi(inParams.minFrequency) - MIDI_OFFSET);
+
+    mScaleMovesNotes = makeScaleMapping(inParams, min_note_idx, max_note_idx, mVisitNote, mEventNoteIdx);
+
+    // Variant only chosen again when a mode changes
+    const int mode = _convertMode(inParams, min_note_idx == 0 && max_note_idx == n_notes - 1);
+    if (mode != mConvertMode) {
+        mConvertVariant = _getConvertVariant(mode);
+        mConvertMode = mode;
     }
-    auto& onsets = *onsets_ptr;
 
-    if (inNewAudio) {
-        mRemainingEnergy = inNotesPG;
-    } else {
-        // Copy without changing the location of the original data
-        assert(mRemainingEnergy.size() == n_frames);
-        for (size_t f = 0; f < n_frames; f++) {
-            assert(inNotesPG[f].size() == NUM_FREQ_OUT);
-            assert(mRemainingEnergy[f].size() == NUM_FREQ_OUT);
+    (this->*mConvertVariant)(
+        inNotesPG, inOnsetsPG, inContoursPG, inParams, inNewAudio, min_note_idx, max_note_idx, outEvents);
+}
+
+bool Notes::makeScaleMapping(const ConvertParams& inParams,
+                             int inMinNoteIdx,
+                             int inMaxNoteIdx,
+                             std::array<uint8_t, NUM_FREQ_OUT>& outVisitNote,
+                             std::array<int, NUM_FREQ_OUT>& outEventNoteIdx)
+{
+    bool moves_notes = false;
 
-            std::copy(inNotesPG[f].begin(), inNotesPG[f].end(), mRemainingEnergy[f].begin());
+    for (int note_idx = 0; note_idx < NUM_FREQ_OUT; note_idx++) {
+        outVisitNote[note_idx] = 1;
+        outEventNoteIdx[note_idx] = note_idx;
+
+        if (inParams.scaleType == NoteUtils::Chromatic
+            || NoteUtils::isInScale(note_idx + MIDI_OFFSET, inParams.rootNote, inParams.scaleType)) {
+            continue;
         }
-    }
 
-    if (inParams.melodiaTrick) {
-        if (inNewAudio) {
-            // Fill mRemainingEnergyIndex
-            mRemainingEnergyIndex.clear();
-            mRemainingEnergyIndex.reserve(static_cast<size_t>(n_frames) * static_cast<size_t>(NUM_FREQ_OUT));
+        if (inParams.snapMode == NoteUtils::Remove) {
+            outVisitNote[note_idx] = 0;
+            continue;
+        }
 
-            for (int frame_idx = 0; frame_idx < n_frames; frame_idx++) {
-                for (int freq_idx = 0; freq_idx < NUM_FREQ_OUT; freq_idx++) {
-                    mRemainingEnergyIndex.push_back(
-                        {&mRemainingEnergy[static_cast<size_t>(frame_idx)][static_cast<size_t>(freq_idx)],
-                         frame_idx,
-                         freq_idx});
-                }
+        // Nearest note of the scale in the range, the lower one if both are as near
+        for (int distance = 1; distance < 12; distance++) {
+            const int lower = note_idx - distance;
+            const int upper = note_idx + distance;
+            if (lower >= inMinNoteIdx
+                && NoteUtils::isInScale(lower + MIDI_OFFSET, inParams.rootNote, inParams.scaleType)) {
+                outEventNoteIdx[note_idx] = lower;
+                break;
+            }
+            if (upper <= inMaxNoteIdx
+                && NoteUtils::isInScale(upper + MIDI_OFFSET, inParams.rootNote, inParams.scaleType)) {
+                outEventNoteIdx[note_idx] = upper;
+                break;
             }
-
-            mRemainingEnergyIndex.shrink_to_fit();
         }
+
+        moves_notes |= note_idx >= inMinNoteIdx && note_idx <= inMaxNoteIdx && outEventNoteIdx[note_idx] != note_idx;
     }
 
-    const auto frame_threshold = inParams.frameThreshold;
-    // TODO: infer frame_threshold if < 0, can be merged with inferredOnsets.
+    return moves_notes;
+}
 
-    // constrain frequencies
-    const auto max_note_idx =
-        inParams.maxFrequency < 0 ? n_notes - 1 : NoteUtils::hzToMidi(inParams.maxFrequency) - MIDI_OFFSET;
-    const auto min_note_idx = inParams.minFrequency < 0 ? 0 : NoteUtils::hzToMidi(inParams.minFrequency) - MIDI_OFFSET;
+template <bool InferOnsets, bool MelodiaTrick, PitchBendModes PitchBend, bool FullRange>
+void Notes::_convert(const std::vector<std::vector<float>>& inNotesPG,
+                     const std::vector<std::vector<float>>& inOnsetsPG,
+                     const std::vector<std::vector<float>>& inContoursPG,
+                     const ConvertParams& inParams,
+                     bool inNewAudio,
+                     int inMinNoteIdx,
+                     int inMaxNoteIdx,
+                     NoteEvents& outEvents)
+{
+    // The remaining energy is copied into the storage of the segments whatever inNewAudio
+    static_cast<void>(inNewAudio);
+
+    const int min_note_idx = FullRange ? 0 : inMinNoteIdx;
+    const int max_note_idx = FullRange ? NUM_FREQ_OUT - 1 : inMaxNoteIdx;
+
+    // TODO: infer frame_threshold if < 0, can be merged with _inferOnsets.
 
     // stop 1 frame early to prevent edge case
     // as per https://github.com/spotify/basic-pitch/blob/f85a8e9ade1f297b8adb39b155c483e2312e1aca/basic_pitch/note_creation.py#L399
-    const int last_frame = n_frames - 1;
+    const int last_frame = static_cast<int>(inNotesPG.size()) - 1;
 
-    // Go backwards in time
-    for (int frame_idx = last_frame - 1; frame_idx >= 0; frame_idx--) {
-        for (int note_idx = max_note_idx; note_idx >= min_note_idx; note_idx--) {
-            auto onset = onsets[frame_idx][note_idx];
+    float max_onset = 0.0f;
+    float max_notes_diff = 0.0f;
+    if constexpr (InferOnsets) {
+        _inferOnsets<FullRange>(inOnsetsPG, inNotesPG, min_note_idx, max_note_idx, max_onset, max_notes_diff);
+    }
 
-            // equivalent to argrelmax logic
-            auto prev = frame_idx <= 0 ? onset : onsets[frame_idx - 1][note_idx];
-            auto next = frame_idx >= last_frame ? onset : onsets[frame_idx + 1][note_idx];
+    _findOnsetPeaks<InferOnsets, FullRange>(
+        inOnsetsPG, inParams, min_note_idx, max_note_idx, last_frame, max_onset, max_notes_diff);
 
-            if (onset < inParams.onsetThreshold || onset < prev || onset < next) {
-                continue;
-            }
+    const int n_segments = _planSegments(inNotesPG, inParams, min_note_idx, max_note_idx);
 
-            // find time index at this frequency band where the frames drop below an energy threshold
-            int i = frame_idx + 1;
-            int k = 0; // number of frames since energy dropped below threshold
-            while (i < last_frame && k < inParams.energyThreshold) {
-                if (mRemainingEnergy[i][note_idx] < frame_threshold) {
-                    k++;
-                } else {
-                    k = 0;
-                }
-                i++;
+    bool extracted = false;
+    if (n_segments > 1) {
+        auto extract_segment = [&](int s) {
+            auto& segment = mSegments[s];
+            segment.events.clear();
+            segment.valid = _extractEvents<MelodiaTrick, true>(
+                inNotesPG, inParams, min_note_idx, max_note_idx, segment, segment.events, &segment.melodiaKeys);
+        };
+
+        mWorkers->run(n_segments, extract_segment);
+
+        extracted = std::all_of(
+            mSegments.begin(), mSegments.begin() + n_segments, [](const _segment& segment) { return segment.valid; });
+        if (extracted) {
+            _mergeSegments(n_segments, outEvents);
+        }
+    }
+
+    // Serial extraction, also when a segment could have differed from it
+    if (!extracted) {
+        auto& segment = mSegments[0];
+        segment.firstFrame = 0;
+        segment.endFrame = static_cast<int>(inNotesPG.size());
+        segment.firstPeak = 0;
+        segment.endPeak = mOnsetPeaks.size();
+        _extractEvents<MelodiaTrick, false>(
+            inNotesPG, inParams, min_note_idx, max_note_idx, segment, outEvents, nullptr);
+    }
+
+    // Notes moved to the same pitch by the scale may overlap
+    if (mScaleMovesNotes) {
+        outEvents.mergeOverlappingNotesWithSamePitch();
+    } else {
+        outEvents.sort();
+    }
+
+    if constexpr (PitchBend != NoPitchBend) {
+        _addPitchBends(outEvents, inContoursPG);
+        if constexpr (PitchBend == SinglePitchBend) {
+            outEvents.dropOverlappingPitchBends();
+        }
+    }
+}
+
+template <bool MelodiaTrick, bool Speculative>
+bool Notes::_extractEvents(const std::vector<std::vector<float>>& inNotesPG,
+                           const ConvertParams& inParams,
+                           int inMinNoteIdx,
+                           int inMaxNoteIdx,
+                           _segment& ioSegment,
+                           NoteEvents& outEvents,
+                           std::vector<_pg_index>* outMelodiaKeys)
+{
+    const int n_frames = static_cast<int>(inNotesPG.size());
+    const int last_frame = n_frames - 1;
+    const auto frame_threshold = inParams.frameThreshold;
+
+    // Remaining energy of the frames of the segment, and of the frames around it that walks may reach
+    const int halo = Speculative ? std::max(inParams.energyThreshold, 0) : 0;
+    const int energy_first_frame = std::max(0, ioSegment.firstFrame - halo);
+    const int energy_end_frame = std::min(n_frames, ioSegment.endFrame + halo);
+    ioSegment.energy.resize(static_cast<size_t>(energy_end_frame - energy_first_frame) * NUM_FREQ_OUT);
+    for (int f = energy_first_frame; f < energy_end_frame; f++) {
+        assert(inNotesPG[f].size() == NUM_FREQ_OUT);
+        std::copy(inNotesPG[f].begin(),
+                  inNotesPG[f].end(),
+                  ioSegment.energy.begin() + static_cast<size_t>(f - energy_first_frame) * NUM_FREQ_OUT);
+    }
+
+    auto energy_row = [&](int frame_idx) {
+        assert(frame_idx >= energy_first_frame && frame_idx < energy_end_frame);
+        return ioSegment.energy.data() + static_cast<size_t>(frame_idx - energy_first_frame) * NUM_FREQ_OUT;
+    };
+
+    // Speculative: the serial extraction may see a cell of another segment differently, unless it is below the
+    // frame threshold from the start (it then compares below the threshold whether it was zeroed or not).
+    // Walks only go past such cells, so they reach at most energyThreshold frames out of the segment.
+    auto is_foreign_active = [&](int frame_idx, int note_idx) {
+        return Speculative && (frame_idx < ioSegment.firstFrame || frame_idx >= ioSegment.endFrame)
+               && inNotesPG[frame_idx][note_idx] >= frame_threshold;
+    };
+
+    // Go backwards in time, and down in pitch
+    const auto peaks_begin = mOnsetPeaks.rbegin() + static_cast<ptrdiff_t>(mOnsetPeaks.size() - ioSegment.endPeak);
+    const auto peaks_end = mOnsetPeaks.rbegin() + static_cast<ptrdiff_t>(mOnsetPeaks.size() - ioSegment.firstPeak);
+    for (auto peak = peaks_begin; peak != peaks_end; ++peak) {
+        const int frame_idx = peak->frameIdx;
+        const int note_idx = peak->noteIdx;
+
+        // find time index at this frequency band where the frames drop below an energy threshold
+        int i = frame_idx + 1;
+        int k = 0; // number of frames since energy dropped below threshold
+        while (i < last_frame && k < inParams.energyThreshold) {
+            if (is_foreign_active(i, note_idx)) {
+                return false;
+            }
+            if (energy_row(i)[note_idx] < frame_threshold) {
+                k++;
+            } else {
+                k = 0;
             }
+            i++;
+        }
 
-            i -= k; // go back to frame above threshold
+        i -= k; // go back to frame above threshold
 
-            // if the note is too short, skip it
-            if (i - frame_idx <= inParams.minNoteLength) {
-                continue;
+        // if the note is too short, skip it
+        if (i - frame_idx <= inParams.minNoteLength) {
+            continue;
+        }
+
+        // Its amplitude sums remaining energies: all of them must be in the segment
+        if (Speculative && i > ioSegment.endFrame) {
+            return false;
+        }
+
+        double amplitude = 0.0;
+        for (int f = frame_idx; f < i; f++) {
+            float* energy = energy_row(f);
+            amplitude += energy[note_idx];
+            energy[note_idx] = 0;
+
+            if (note_idx < MAX_NOTE_IDX) {
+                energy[note_idx + 1] = 0;
+            }
+            if (note_idx > 0) {
+                energy[note_idx - 1] = 0;
             }
+        }
 
-            double amplitude = 0.0;
-            for (int f = frame_idx; f < i; f++) {
-                amplitude += mRemainingEnergy[f][note_idx];
-                mRemainingEnergy[f][note_idx] = 0;
+        amplitude /= (i - frame_idx);
 
-                if (note_idx < MAX_NOTE_IDX) {
-                    mRemainingEnergy[f][note_idx + 1] = 0;
-                }
-                if (note_idx > 0) {
-                    mRemainingEnergy[f][note_idx - 1] = 0;
+        outEvents.add(_modelFrameToTime(frame_idx) /* startTime */,
+                      _modelFrameToTime(i) /* endTime */,
+                      frame_idx /* startFrame */,
+                      i /* endFrame */,
+                      mEventNoteIdx[note_idx] + MIDI_OFFSET /* pitch */,
+                      amplitude /* amplitude */);
+    }
+
+    ioSegment.numOnsetEvents = outEvents.size();
+    if (outMelodiaKeys != nullptr) {
+        outMelodiaKeys->clear();
+    }
+
+    if constexpr (MelodiaTrick) {
+        // Only energies above frame_threshold are ever processed, and the loop below can only zero energies:
+        // collect and sort these candidates instead of the whole posteriorgram.
+        auto& candidates = ioSegment.candidates;
+        candidates.clear();
+        for (int frame_idx = ioSegment.firstFrame; frame_idx < ioSegment.endFrame; frame_idx++) {
+            const float* frame = energy_row(frame_idx);
+            for (int note_idx = inMinNoteIdx; note_idx <= inMaxNoteIdx; note_idx++) {
+                if (frame[note_idx] > frame_threshold && mVisitNote[note_idx]) {
+                    candidates.push_back({frame[note_idx], frame_idx, note_idx});
                 }
             }
+        }
 
-            amplitude /= (i - frame_idx);
+        std::sort(candidates.begin(), candidates.end(), _melodiaOrder);
 
-            events.push_back(Event {
-                _modelFrameToTime(frame_idx) /* startTime */,
-                _modelFrameToTime(i) /* endTime */,
-                frame_idx /* startFrame */,
-                i /* endFrame */,
-                note_idx + MIDI_OFFSET /* pitch */,
-                amplitude /* amplitude */,
-            });
-        }
-    }
+        // this inhibit function zeroes out neighbor notes and keeps track (with k)
+        // on how many consecutive frames were below frame_threshold.
+        auto inhibit = [&](int frame_i, int note_i, int k, bool& out_valid) {
+            out_valid = !is_foreign_active(frame_i, note_i)
+                        && !(note_i < MAX_NOTE_IDX && is_foreign_active(frame_i, note_i + 1))
+                        && !(note_i > 0 && is_foreign_active(frame_i, note_i - 1));
 
-    if (inParams.melodiaTrick) {
-        std::sort(mRemainingEnergyIndex.begin(),
-                  mRemainingEnergyIndex.end(),
-                  [](const _pg_index& a, const _pg_index& b) { return *a.value > *b.value; });
+            float* energy = energy_row(frame_i);
+            if (energy[note_i] < frame_threshold) {
+                k++;
+            } else {
+                k = 0;
+            }
 
-        // loop through each remaining note probability in descending order
-        // until reaching frame_threshold.
-        for (auto& [energy_ptr, frame_idx, note_idx]: mRemainingEnergyIndex) {
-            auto& energy = *energy_ptr;
+            energy[note_i] = 0;
+            if (note_i < MAX_NOTE_IDX) {
+                energy[note_i + 1] = 0;
+            }
+            if (note_i > 0) {
+                energy[note_i - 1] = 0;
+            }
+            return k;
+        };
+
+        // loop through each remaining note probability above frame_threshold in descending order.
+        for (const auto& candidate: candidates) {
+            const auto [value, frame_idx, note_idx] = candidate;
+            auto& energy = energy_row(frame_idx)[note_idx];
 
             // skip those that have already been zeroed
             if (energy == 0.0f) {
                 continue;
             }
 
-            if (energy <= frame_threshold) {
-                break;
-            }
             energy = 0;
 
-            // this inhibit function zeroes out neighbor notes and keeps track (with k)
-            // on how many consecutive frames were below frame_threshold.
-            auto inhibit = [frame_threshold](std::vector<std::vector<float>>& pg, int frame_i, int note_i, int k) {
-                if (pg[frame_i][note_i] < frame_threshold) {
-                    k++;
-                } else {
-                    k = 0;
-                }
-
-                pg[frame_i][note_i] = 0;
-                if (note_i < MAX_NOTE_IDX) {
-                    pg[frame_i][note_i + 1] = 0;
-                }
-                if (note_i > 0) {
-                    pg[frame_i][note_i - 1] = 0;
-                }
-                return k;
-            };
-
             // forward pass
+            bool valid = true;
             int i = frame_idx + 1;
             int k = 0;
             while (i < last_frame && k < inParams.energyThreshold) {
-                k = inhibit(mRemainingEnergy, i, note_idx, k);
+                k = inhibit(i, note_idx, k, valid);
+                if (!valid) {
+                    return false;
+                }
                 i++;
             }
 
@@ -194,7 +463,10 @@ std::vector<Notes::Event> Notes::convert(const std::vector<std::vector<float>>&
             i = frame_idx - 1;
             k = 0;
             while (i > 0 && k < inParams.energyThreshold) {
-                k = inhibit(mRemainingEnergy, i, note_idx, k);
+                k = inhibit(i, note_idx, k, valid);
+                if (!valid) {
+                    return false;
+                }
                 i--;
             }
 
@@ -211,74 +483,433 @@ std::vector<Notes::Event> Notes::convert(const std::vector<std::vector<float>>&
             }
             amplitude /= (i_end - i_start);
 
-            events.push_back(Event {
-                _modelFrameToTime(i_start /* startTime */),
-                _modelFrameToTime(i_end) /* endTime */,
-                i_start /* startFrame */,
-                i_end /* endFrame */,
-                note_idx + MIDI_OFFSET /* pitch */,
-                amplitude /* amplitude */,
-            });
+            outEvents.add(_modelFrameToTime(i_start /* startTime */),
+                          _modelFrameToTime(i_end) /* endTime */,
+                          i_start /* startFrame */,
+                          i_end /* endFrame */,
+                          mEventNoteIdx[note_idx] + MIDI_OFFSET /* pitch */,
+                          amplitude /* amplitude */);
+
+            if (outMelodiaKeys != nullptr) {
+                outMelodiaKeys->push_back(candidate);
+            }
         }
     }
 
-    sortEvents(events);
+    return true;
+}
+
+int Notes::_planSegments(const std::vector<std::vector<float>>& inNotesPG,
+                         const ConvertParams& inParams,
+                         int inMinNoteIdx,
+                         int inMaxNoteIdx)
+{
+    const int n_frames = static_cast<int>(inNotesPG.size());
+    const int n_threads = std::max(1, std::min(mNumThreads, n_frames / MIN_FRAMES_PER_SEGMENT));
+    const int energy_threshold = std::max(inParams.energyThreshold, 0);
+
+    if (mSegments.size() < static_cast<size_t>(n_threads)) {
+        mSegments.resize(static_cast<size_t>(n_threads));
+    }
+
+    // True if all notes of the range are below the frame threshold
+    auto is_quiet = [&](int frame_idx) {
+        const float* notes = inNotesPG[frame_idx].data();
+        float max_energy = 0.0f;
+        for (int j = inMinNoteIdx; j <= inMaxNoteIdx; j++) {
+            const float energy = notes[j];
+            max_energy = std::max(max_energy, energy);
+        }
+        return max_energy < inParams.frameThreshold;
+    };
+
+    auto first_peak_from = [&](int frame_idx) {
+        return static_cast<size_t>(
+            std::lower_bound(mOnsetPeaks.begin(),
+                             mOnsetPeaks.end(),
+                             frame_idx,
+                             [](const _onset_peak& peak, int frame) { return peak.frameIdx < frame; })
+            - mOnsetPeaks.begin());
+    };
+
+    // Cut after the longest run of quiet frames around each target frame. A run of energyThreshold quiet frames
+    // without onset peaks always gives the serial result: walks from both sides stop within it. Shorter runs
+    // usually do, _extractEvents checks it.
+    int n_segments = 1;
+    mSegments[0].firstFrame = 0;
+    const int search_frames = n_frames / n_threads / 4;
+    for (int t = 1; t < n_threads; t++) {
+        const int target_frame = static_cast<int>(static_cast<int64_t>(n_frames) * t / n_threads);
+        const int end_search_frame = std::min(n_frames - 1, target_frame + search_frames);
+        int best_split_frame = -1;
+        int best_run = 0;
+        int run = 0;
+
+        for (int f = std::max(target_frame - search_frames, mSegments[n_segments - 1].firstFrame + 1);
+             f < end_search_frame;
+             f++) {
+            run = is_quiet(f) ? run + 1 : 0;
+            if (run <= best_run) {
+                continue;
+            }
+
+            best_run = run;
+            best_split_frame = f + 1;
 
-    if (inParams.pitchBend != NoPitchBend) {
-        _addPitchBends(events, inContoursPG);
-        if (inParams.pitchBend == SinglePitchBend) {
-            dropOverlappingPitchBends(events);
+            if (run >= energy_threshold) {
+                const size_t peak = first_peak_from(best_split_frame - energy_threshold);
+                if (peak == mOnsetPeaks.size() || mOnsetPeaks[peak].frameIdx >= best_split_frame) {
+                    break;
+                }
+            }
+        }
+
+        if (best_split_frame > 0) {
+            mSegments[n_segments - 1].endFrame = best_split_frame;
+            mSegments[n_segments].firstFrame = best_split_frame;
+            n_segments++;
         }
     }
+    mSegments[n_segments - 1].endFrame = n_frames;
 
-    return events;
+    for (int s = 0; s < n_segments; s++) {
+        mSegments[s].firstPeak = s == 0 ? 0 : mSegments[s - 1].endPeak;
+        mSegments[s].endPeak = s == n_segments - 1 ? mOnsetPeaks.size() : first_peak_from(mSegments[s].endFrame);
+    }
+
+    return n_segments;
 }
 
-void Notes::clear()
+void Notes::_mergeSegments(int inNumSegments, NoteEvents& outEvents)
 {
-    mRemainingEnergy.clear();
-    mRemainingEnergy.shrink_to_fit();
+    auto add = [&outEvents](const NoteEvents& events, size_t position) {
+        const auto event = events[position];
+        outEvents.add(
+            event.startTime, event.endTime, event.startFrame, event.endFrame, event.pitch, event.amplitude);
+    };
+
+    // Serial order: all onset events, from the last segment to the first (peaks are processed backwards in time)
+    for (int s = inNumSegments - 1; s >= 0; s--) {
+        for (size_t i = 0; i < mSegments[s].numOnsetEvents; i++) {
+            add(mSegments[s].events, i);
+        }
+    }
+
+    // Then melodia events, in the order of their candidates over all segments
+    std::array<size_t, MAX_NUM_THREADS> next {};
+    while (true) {
+        int best = -1;
+        for (int s = 0; s < inNumSegments; s++) {
+            const auto& keys = mSegments[s].melodiaKeys;
+            if (next[s] < keys.size()
+                && (best < 0 || _melodiaOrder(keys[next[s]], mSegments[best].melodiaKeys[next[best]]))) {
+                best = s;
+            }
+        }
+        if (best < 0) {
+            break;
+        }
 
-    mRemainingEnergyIndex.clear();
-    mRemainingEnergyIndex.shrink_to_fit();
+        add(mSegments[best].events, mSegments[best].numOnsetEvents + next[best]);
+        next[best]++;
+    }
 }
 
-void Notes::_addPitchBends(std::vector<Event>& inOutEvents,
-                           const std::vector<std::vector<float>>& inContoursPG,
-                           int inNumBinsTolerance)
+void Notes::setNumThreads(int inNumThreads)
 {
-    for (auto& event: inOutEvents) {
-        // midi_pitch_to_contour_bin
-        int note_idx =
-            CONTOURS_BINS_PER_SEMITONE
-            * (event.pitch - 69 + 12 * static_cast<int>(std::round(std::log2(440.0f / ANNOTATIONS_BASE_FREQUENCY))));
+    const int num_threads = std::clamp(inNumThreads, 1, MAX_NUM_THREADS);
+    if (num_threads == mNumThreads) {
+        return;
+    }
 
-        static constexpr int N_FREQ_BINS_CONTOURS = NUM_FREQ_OUT * CONTOURS_BINS_PER_SEMITONE;
-        int note_start_idx = std::max(note_idx - inNumBinsTolerance, 0);
-        int note_end_idx = std::min(N_FREQ_BINS_CONTOURS, note_idx + inNumBinsTolerance + 1);
+    // The calling thread extracts the first segment
+    mWorkers.reset();
+    mNumThreads = num_threads;
+    if (mNumThreads > 1) {
+        mWorkers = std::make_unique<_worker_pool>(mNumThreads - 1);
+    }
+}
 
-        const auto gauss_start = static_cast<float>(std::max(0, inNumBinsTolerance - note_idx));
-        const auto pb_shift = inNumBinsTolerance - std::max(0, inNumBinsTolerance - note_idx);
+int Notes::_convertMode(const ConvertParams& inParams, bool inFullRange)
+{
+    assert(inParams.pitchBend >= NoPitchBend && inParams.pitchBend <= MultiPitchBend);
+    return (inParams.inferOnsets ? 1 : 0) | (inParams.melodiaTrick ? 2 : 0) | (inFullRange ? 4 : 0)
+           | (static_cast<int>(inParams.pitchBend) << 3);
+}
 
-        for (int i = event.startFrame; i < event.endFrame; i++) {
-            int bend = 0;
-            float max = 0;
-            for (int j = note_start_idx; j < note_end_idx; j++) {
-                int k = j - note_start_idx;
-                float x = gauss_start + static_cast<float>(k);
-                float n = x - static_cast<float>(inNumBinsTolerance);
+template <size_t... Modes>
+constexpr std::array<Notes::ConvertVariant, sizeof...(Modes)> Notes::_makeConvertVariants(std::index_sequence<Modes...>)
+{
+    // Same encoding as _convertMode
+    return {&Notes::_convert<(Modes & 1) != 0,
+                             (Modes & 2) != 0,
+                             static_cast<PitchBendModes>(Modes >> 3),
+                             (Modes & 4) != 0>...};
+}
 
-                static constexpr float std = 5.0f;
+Notes::ConvertVariant Notes::_getConvertVariant(int inMode)
+{
+    static constexpr auto variants = _makeConvertVariants(std::make_index_sequence<NUM_CONVERT_VARIANTS>());
 
-                // Gaussian
-                float w = std::exp(-(n * n) / (2.0f * std * std)) * inContoursPG[i][j];
+    assert(inMode >= 0 && inMode < NUM_CONVERT_VARIANTS);
+    return variants[inMode];
+}
 
-                if (w > max) {
-                    bend = k;
-                    max = w;
+void Notes::clear()
+{
+    mSegments.clear();
+    mSegments.shrink_to_fit();
+
+    mOnsets.clear();
+    mOnsets.shrink_to_fit();
+
+    mOnsetPeaks.clear();
+    mOnsetPeaks.shrink_to_fit();
+
+    mEvents.release();
+}
+
+template <bool FullRange>
+void Notes::_inferOnsets(const std::vector<std::vector<float>>& inOnsetsPG,
+                         const std::vector<std::vector<float>>& inNotesPG,
+                         int inMinNoteIdx,
+                         int inMaxNoteIdx,
+                         float& outMaxOnset,
+                         float& outMaxNotesDiff,
+                         int inNumDiffs)
+{
+    const auto n_frames = static_cast<int>(inNotesPG.size());
+    if constexpr (FullRange) {
+        inMinNoteIdx = 0;
+        inMaxNoteIdx = NUM_FREQ_OUT - 1;
+    }
+    mOnsets.resize(static_cast<size_t>(n_frames) * NUM_FREQ_OUT);
+
+    // Per note maxima, reduced at the end so that the frame loops vectorise
+    std::array<float, NUM_FREQ_OUT> max_onset {};
+    std::array<float, NUM_FREQ_OUT> max_notes_diff {};
+
+    for (int i = 0; i < n_frames; i++) {
+        const float* notes = inNotesPG[i].data();
+        const float* onsets = inOnsetsPG[i].data();
+        float* notes_diff = mOnsets.data() + static_cast<size_t>(i) * NUM_FREQ_OUT;
+
+        if (i < inNumDiffs) {
+            // Basic Pitch zeroes the first inNumDiffs frames, unless no diff is below 1 (the initial minimum)
+            for (int j = inMinNoteIdx; j <= inMaxNoteIdx; j++) {
+                float min = 1.0f;
+                for (int offset = 1; offset <= inNumDiffs; offset++) {
+                    min = std::min(min, notes[j] - (i - offset >= 0 ? inNotesPG[i - offset][j] : 0.0f));
+                }
+                notes_diff[j] = min < 1.0f ? 0.0f : 1.0f;
+            }
+        } else {
+            // Minimum of the diffs with frames behind by 1 to inNumDiffs, clamped to [0, 1].
+            // Basic Pitch calculates the minimum amongst positive and negative diffs instead of ignoring
+            // negative diffs (which mean "end of note") while we are only looking for "start of note" (aka onset).
+            // https://github.com/spotify/basic-pitch/blob/86fc60dab06e3115758eb670c92ead3b62a89b47/basic_pitch/note_creation.py#L298
+            for (int j = inMinNoteIdx; j <= inMaxNoteIdx; j++) {
+                notes_diff[j] = notes[j] - inNotesPG[i - 1][j];
+            }
+            for (int offset = 2; offset <= inNumDiffs; offset++) {
+                const float* notes_behind = inNotesPG[i - offset].data();
+                for (int j = inMinNoteIdx; j <= inMaxNoteIdx; j++) {
+                    notes_diff[j] = std::min(notes_diff[j], notes[j] - notes_behind[j]);
                 }
             }
-            event.bends.emplace_back(bend - pb_shift);
+            for (int j = inMinNoteIdx; j <= inMaxNoteIdx; j++) {
+                notes_diff[j] = std::min(std::max(notes_diff[j], 0.0f), 1.0f);
+            }
         }
+
+        // values are loaded first, otherwise std::max references prevent vectorisation
+        for (int j = inMinNoteIdx; j <= inMaxNoteIdx; j++) {
+            const float onset = onsets[j];
+            const float diff = notes_diff[j];
+            max_onset[j] = std::max(max_onset[j], onset);
+            max_notes_diff[j] = std::max(max_notes_diff[j], diff);
+        }
+    }
+
+    outMaxOnset = *std::max_element(max_onset.begin(), max_onset.end());
+    outMaxNotesDiff = *std::max_element(max_notes_diff.begin(), max_notes_diff.end());
+}
+
+template <bool InferOnsets, bool FullRange>
+void Notes::_findOnsetPeaks(const std::vector<std::vector<float>>& inOnsetsPG,
+                            const ConvertParams& inParams,
+                            int inMinNoteIdx,
+                            int inMaxNoteIdx,
+                            int inLastFrame,
+                            float inMaxOnset,
+                            float inMaxNotesDiff)
+{
+    const auto n_frames = static_cast<int>(inOnsetsPG.size());
+    const float onset_threshold = inParams.onsetThreshold;
+    if constexpr (FullRange) {
+        inMinNoteIdx = 0;
+        inMaxNoteIdx = NUM_FREQ_OUT - 1;
+    }
+
+    mOnsetPeaks.clear();
+
+    auto onsets_row = [&](int frame_idx) -> const float* {
+        return InferOnsets ? mOnsets.data() + static_cast<size_t>(frame_idx) * NUM_FREQ_OUT
+                                    : inOnsetsPG[frame_idx].data();
+    };
+
+    // Rescale notes diff to match scale of original onsets and choose the element-wise max between it and
+    // the original onsets. This is where notes diff morphs truly into the inferred onsets.
+    auto rescale = [&](int frame_idx) {
+        if (!InferOnsets || frame_idx >= n_frames) {
+            return;
+        }
+
+        const float* orig = inOnsetsPG[frame_idx].data();
+        float* inferred = mOnsets.data() + static_cast<size_t>(frame_idx) * NUM_FREQ_OUT;
+        for (int j = inMinNoteIdx; j <= inMaxNoteIdx; j++) {
+            const float value = inMaxOnset * inferred[j] / inMaxNotesDiff;
+            inferred[j] = value < orig[j] ? orig[j] : value;
+        }
+    };
+
+    rescale(0);
+
+    std::array<uint8_t, NUM_FREQ_OUT> is_peak {};
+    for (int frame_idx = 0; frame_idx < inLastFrame; frame_idx++) {
+        rescale(frame_idx + 1);
+
+        // equivalent to argrelmax logic
+        const float* onsets = onsets_row(frame_idx);
+        const float* prev = frame_idx <= 0 ? onsets : onsets_row(frame_idx - 1);
+        const float* next = onsets_row(frame_idx + 1);
+
+        for (int j = inMinNoteIdx; j <= inMaxNoteIdx; j++) {
+            is_peak[j] = mVisitNote[j]
+                         & !((onsets[j] < onset_threshold) | (onsets[j] < prev[j]) | (onsets[j] < next[j]));
+        }
+
+        for (int j = inMinNoteIdx; j <= inMaxNoteIdx; j++) {
+            if (is_peak[j]) {
+                mOnsetPeaks.push_back({frame_idx, j});
+            }
+        }
+    }
+}
+
+/**
+ * Index of the first maximum of inWeights[k] * inValues[k].
+ * The products are computed in one vectorised pass and their max is reduced over 8 independent lanes
+ * (a single running max would be a serial dependency the compiler does not vectorise without fast-math).
+ * @param inWeights Weights
+ * @param inValues Values (>= 0)
+ * @param inSize Number of values, at most 2 * PITCH_BEND_NUM_BINS_TOLERANCE + 1
+ * @return Index of the first maximum, 0 if no product is above 0.
+ */
+static int weightedArgmax(const float* inWeights, const float* inValues, int inSize)
+{
+    static constexpr int NUM_LANES = 8;
+    static constexpr int MAX_SIZE = 2 * PITCH_BEND_NUM_BINS_TOLERANCE + 1 + NUM_LANES;
+    assert(inSize <= 2 * PITCH_BEND_NUM_BINS_TOLERANCE + 1);
+
+    // Padded with zeros to a multiple of NUM_LANES
+    alignas(32) std::array<float, MAX_SIZE> weighted;
+    const int padded_size = (inSize + NUM_LANES - 1) / NUM_LANES * NUM_LANES;
+
+    for (int k = 0; k < inSize; k++) {
+        weighted[k] = inWeights[k] * inValues[k];
+    }
+    for (int k = inSize; k < padded_size; k++) {
+        weighted[k] = 0.0f;
+    }
+
+    std::array<float, NUM_LANES> lane_max {};
+    for (int k = 0; k < padded_size; k += NUM_LANES) {
+        for (int l = 0; l < NUM_LANES; l++) {
+            const float w = weighted[k + l];
+            lane_max[l] = std::max(lane_max[l], w);
+        }
+    }
+
+    const float max = *std::max_element(lane_max.begin(), lane_max.end());
+    if (max <= 0.0f) {
+        return 0;
     }
-}
\ No newline at end of file
+
+    int k = 0;
+    while (weighted[k] != max) {
+        k++;
+    }
+    return k;
+}
+
+/**
+ * Contour bins searched for the pitch bends of a note.
+ */
+struct PitchBendWindow {
+    int startIdx; // first contour bin
+    int endIdx; // last contour bin + 1
+    int shift; // subtracted from the argmax (relative to startIdx) to get the bend
+    const float* weights; // gaussian weights of bins startIdx to endIdx
+};
+
+/**
+ * @param inMidiPitch Midi note number
+ * @param inNumBinsTolerance Number of bins searched on each side, at most PITCH_BEND_NUM_BINS_TOLERANCE
+ * @return Contour bins searched and their weights
+ */
+static PitchBendWindow pitchBendWindow(int inMidiPitch, int inNumBinsTolerance)
+{
+    assert(inNumBinsTolerance >= 0 && inNumBinsTolerance <= PITCH_BEND_NUM_BINS_TOLERANCE);
+
+    // Gaussian window (std of 5 bins) over the contour bins around a note, indexed by
+    // bin - note bin + PITCH_BEND_NUM_BINS_TOLERANCE. Only depends on the offset: computed once.
+    static const auto gaussian = []() {
+        std::array<float, 2 * PITCH_BEND_NUM_BINS_TOLERANCE + 1> window {};
+        static constexpr float std = 5.0f;
+        for (int k = 0; k < static_cast<int>(window.size()); k++) {
+            const auto n = static_cast<float>(k - PITCH_BEND_NUM_BINS_TOLERANCE);
+            window[k] = std::exp(-(n * n) / (2.0f * std * std));
+        }
+        return window;
+    }();
+
+    // midi_pitch_to_contour_bin
+    const int note_idx =
+        CONTOURS_BINS_PER_SEMITONE
+        * (inMidiPitch - 69 + 12 * static_cast<int>(std::round(std::log2(440.0f / ANNOTATIONS_BASE_FREQUENCY))));
+
+    static constexpr int N_FREQ_BINS_CONTOURS = NUM_FREQ_OUT * CONTOURS_BINS_PER_SEMITONE;
+    const int note_start_idx = std::max(note_idx - inNumBinsTolerance, 0);
+    const int note_end_idx = std::min(N_FREQ_BINS_CONTOURS, note_idx + inNumBinsTolerance + 1);
+
+    return PitchBendWindow {note_start_idx,
+                            note_end_idx,
+                            inNumBinsTolerance - std::max(0, inNumBinsTolerance - note_idx),
+                            gaussian.data() + (note_start_idx - note_idx + PITCH_BEND_NUM_BINS_TOLERANCE)};
+}
+
+int Notes::pitchBend(const float* inContoursFrame, int inMidiPitch, int inNumBinsTolerance)
+{
+    const auto window = pitchBendWindow(inMidiPitch, inNumBinsTolerance);
+    return weightedArgmax(window.weights, inContoursFrame + window.startIdx, window.endIdx - window.startIdx)
+           - window.shift;
+}
+
+void Notes::_addPitchBends(NoteEvents& inOutEvents,
+                           const std::vector<std::vector<float>>& inContoursPG,
+                           int inNumBinsTolerance)
+{
+    for (size_t event_idx = 0; event_idx < inOutEvents.size(); event_idx++) {
+        const auto event = inOutEvents[event_idx];
+        int* bends = inOutEvents.allocateBends(event_idx, event.endFrame - event.startFrame);
+
+        const auto window = pitchBendWindow(event.pitch, inNumBinsTolerance);
+
+        for (int i = event.startFrame; i < event.endFrame; i++) {
+            const int bend = weightedArgmax(
+                window.weights, inContoursPG[i].data() + window.startIdx, window.endIdx - window.startIdx);
+            *bends++ = bend - window.shift;
+        }
+    }
+}
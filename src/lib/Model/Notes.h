@@ -5,11 +5,18 @@
 #ifndef Notes_h
 #define Notes_h
 
+#include <algorithm>
+#include <array>
 #include <cassert>
 #include <cmath>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <utility>
 #include <vector>
 
 #include "BasicPitchConstants.h"
+#include "NoteEvents.h"
 #include "NoteUtils.h"
 
 enum PitchBendModes { NoPitchBend = 0, SinglePitchBend, MultiPitchBend };
@@ -45,8 +52,19 @@ public:
         bool melodiaTrick = true;
         PitchBendModes pitchBend = NoPitchBend;
         int energyThreshold = 11;
+        /* Scale the notes are constrained to, Chromatic means no constraint */
+        NoteUtils::ScaleType scaleType = NoteUtils::Chromatic;
+        NoteUtils::RootNote rootNote = NoteUtils::C;
+        /* Remove: onsets and melodia candidates out of the scale are never visited.
+         * Adjust: notes out of the scale are found as usual then moved to the nearest pitch of the scale (pitch bends
+         * are then relative to that pitch), overlapping notes of same pitch are merged. */
+        NoteUtils::SnapMode snapMode = NoteUtils::Adjust;
     } ConvertParams;
 
+    Notes();
+
+    ~Notes();
+
     /**
      * Create note events based on postegriorgram inputs
      * @param inNotesPG Note posteriorgrams
@@ -55,7 +73,19 @@ public:
      * @param inParams input parameters
      * @param inNewAudio True: first time calling this function with this audio (these inNotesPG, inOnsetsPG, inContoursPG).
      *  False if same audio as last time with updated parameters.
-     * @return
+     * @param outEvents Note events, sorted. Their storage is reused: once it has grown to the size of a window,
+     *  this does not allocate.
+     */
+    void convert(const std::vector<std::vector<float>>& inNotesPG,
+                 const std::vector<std::vector<float>>& inOnsetsPG,
+                 const std::vector<std::vector<float>>& inContoursPG,
+                 const ConvertParams& inParams,
+                 bool inNewAudio,
+                 NoteEvents& outEvents);
+
+    /**
+     * Same as above, returning the note events as a vector of Event (allocates the vector and the bends).
+     * @return Note events, sorted.
      */
     std::vector<Event> convert(const std::vector<std::vector<float>>& inNotesPG,
                                const std::vector<std::vector<float>>& inOnsetsPG,
@@ -64,10 +94,43 @@ public:
                                bool inNewAudio);
 
     /**
-     * Release any memory allocated by the class.
+     * Release any memory allocated by the class. Only to give the memory back: convert reuses its workspace from
+     * one call to the next and does not allocate once it has seen posteriorgrams as long as the current ones.
      */
     void clear();
 
+    /**
+     * Set the number of threads extracting events (1 by default). Posteriorgrams of at least
+     * 2 * MIN_FRAMES_PER_SEGMENT frames are then cut into up to inNumThreads time segments processed concurrently.
+     * Cuts are made in frames without notes (see _planSegments) and each segment checks that it extracted exactly
+     * the events of the serial extraction, which is run instead otherwise. Onset inference, peak picking and pitch
+     * bends stay on the calling thread.
+     * Starts inNumThreads - 1 threads, kept until the next call or the destruction of the class: convert only wakes
+     * them up. Not real-time safe.
+     * @param inNumThreads Number of threads, including the calling one (1 to MAX_NUM_THREADS)
+     */
+    void setNumThreads(int inNumThreads);
+
+    static constexpr int MAX_NUM_THREADS = 16;
+    // About 12 s: shorter segments are not worth a thread
+    static constexpr int MIN_FRAMES_PER_SEGMENT = 1024;
+
+    /**
+     * Scale mapping of the notes for the scale of inParams, used by convert and NoteStream.
+     * @param inParams Parameters, scaleType, rootNote and snapMode are used
+     * @param inMinNoteIdx First note index considered
+     * @param inMaxNoteIdx Last note index considered, notes are only moved within the range
+     * @param outVisitNote 1 if onsets and melodia candidates of a note are visited, 0 for notes out of the scale in
+     *  Remove mode
+     * @param outEventNoteIdx Note index given to the events found at each note (moved in Adjust mode)
+     * @return True if some notes of the range are moved to another pitch (Adjust mode)
+     */
+    static bool makeScaleMapping(const ConvertParams& inParams,
+                                 int inMinNoteIdx,
+                                 int inMaxNoteIdx,
+                                 std::array<uint8_t, NUM_FREQ_OUT>& outVisitNote,
+                                 std::array<int, NUM_FREQ_OUT>& outEventNoteIdx);
+
     /**
      * Inplace sort of note events.
      * @param inOutEvents
@@ -82,62 +145,189 @@ public:
     /**
      * dropOverlappingPitchBends sets bends to an empty array to all the note events that are overlapping in time.
      * inOutEvents is expected to be sorted.
+     * Linear: an event overlaps a later one if the next event starts before its end, and an earlier one if it
+     * starts before the max end of the previous events.
      * @param inOutEvents
      */
     static void dropOverlappingPitchBends(std::vector<Notes::Event>& inOutEvents)
     {
-        for (int i = 0; i < int(inOutEvents.size()) - 1; i++) {
+        const auto n_events = static_cast<int>(inOutEvents.size());
+        int max_end_frame = 0;
+
+        for (int i = 0; i < n_events; i++) {
             auto& event = inOutEvents[i];
-            // if there is an overlap between events, remove pitch bends
-            for (int j = i + 1; j < inOutEvents.size(); j++) {
-                auto& event2 = inOutEvents[j];
-                if (event2.startFrame >= event.endFrame) {
-                    break;
-                }
+            const bool overlaps_previous = i > 0 && event.startFrame < max_end_frame;
+            const bool overlaps_next = i < n_events - 1 && inOutEvents[i + 1].startFrame < event.endFrame;
+
+            max_end_frame = i == 0 ? event.endFrame : std::max(max_end_frame, event.endFrame);
+
+            if (overlaps_previous || overlaps_next) {
                 event.bends = std::vector<int>();
-                event2.bends = std::vector<int>();
             }
         }
     }
 
     /**
      * mergeOverlappingNotes merges note events of same pitch that are overlapping in time.
-     * inOutEvents is expected to be sorted.
+     * A note starting before the end of the previous note of same pitch is merged into it: the merged note ends
+     * where the later note ends. inOutEvents is sorted first.
+     * Linear after sorting: one sweep keeping the last note of each pitch, with in-place compaction.
      * @param inOutEvents
      */
     static void mergeOverlappingNotesWithSamePitch(std::vector<Notes::Event>& inOutEvents)
     {
         sortEvents(inOutEvents);
-        for (int i = 0; i < int(inOutEvents.size()) - 1; i++) {
+
+        // Index (in the compacted output) of the last note of each midi pitch, -1 if none
+        std::array<int, 128> last_note_idx;
+        last_note_idx.fill(-1);
+
+        size_t n_out = 0;
+        for (size_t i = 0; i < inOutEvents.size(); i++) {
             auto& event = inOutEvents[i];
-            for (auto j = i + 1; j < inOutEvents.size(); j++) {
-                auto& event2 = inOutEvents[j];
-
-                // If notes don't overlap, break
-                if (event2.startFrame >= event.endFrame) {
-                    break;
-                }
-
-                // If notes overlap and have the same pitch: merge them
-                if (event.pitch == event2.pitch) {
-                    event.endTime = event2.endTime;
-                    event.endFrame = event2.endFrame;
-                    inOutEvents.erase(inOutEvents.begin() + j);
-                }
+            assert(event.pitch >= 0 && event.pitch < 128);
+            auto& last_idx = last_note_idx[event.pitch];
+
+            // If notes overlap and have the same pitch: merge them
+            if (last_idx >= 0 && event.startFrame < inOutEvents[last_idx].endFrame) {
+                inOutEvents[last_idx].endTime = event.endTime;
+                inOutEvents[last_idx].endFrame = event.endFrame;
+                continue;
             }
+
+            if (n_out != i) {
+                inOutEvents[n_out] = std::move(event);
+            }
+            last_idx = static_cast<int>(n_out++);
         }
+
+        inOutEvents.erase(inOutEvents.begin() + static_cast<std::ptrdiff_t>(n_out), inOutEvents.end());
     }
 
+    /**
+     * Pitch bend of a note at one frame, as computed for Event::bends (used to follow pitch bends in streaming).
+     * @param inContoursFrame Contour posteriorgram frame (NUM_FREQ_IN values)
+     * @param inMidiPitch Midi note number
+     * @param inNumBinsTolerance Number of contour bins searched on each side, at most PITCH_BEND_NUM_BINS_TOLERANCE
+     * @return Pitch bend in 1/3 of semitones
+     */
+    static int pitchBend(const float* inContoursFrame,
+                         int inMidiPitch,
+                         int inNumBinsTolerance = PITCH_BEND_NUM_BINS_TOLERANCE);
+
 private:
     /**
-     * Add pitch bend vector to note events.
+     * Core of convert, specialised at compile time on the modes of ConvertParams so that the hot loops have no
+     * dead branches. Same parameters as convert, plus the note range computed from inParams.
+     * @tparam InferOnsets inParams.inferOnsets
+     * @tparam MelodiaTrick inParams.melodiaTrick
+     * @tparam PitchBend inParams.pitchBend
+     * @tparam FullRange True if the note range covers all notes, loops then have compile-time bounds.
+     * @param inMinNoteIdx First note index considered
+     * @param inMaxNoteIdx Last note index considered
+     * @param outEvents Note events
+     */
+    template <bool InferOnsets, bool MelodiaTrick, PitchBendModes PitchBend, bool FullRange>
+    void _convert(const std::vector<std::vector<float>>& inNotesPG,
+                  const std::vector<std::vector<float>>& inOnsetsPG,
+                  const std::vector<std::vector<float>>& inContoursPG,
+                  const ConvertParams& inParams,
+                  bool inNewAudio,
+                  int inMinNoteIdx,
+                  int inMaxNoteIdx,
+                  NoteEvents& outEvents);
+
+    using ConvertVariant = void (Notes::*)(const std::vector<std::vector<float>>&,
+                                           const std::vector<std::vector<float>>&,
+                                           const std::vector<std::vector<float>>&,
+                                           const ConvertParams&,
+                                           bool,
+                                           int,
+                                           int,
+                                           NoteEvents&);
+
+    // 2 (inferOnsets) * 2 (melodiaTrick) * 2 (full range) * 3 (pitchBend)
+    static constexpr int NUM_CONVERT_VARIANTS = 24;
+
+    /**
+     * @param inParams Parameters
+     * @param inFullRange True if the note range covers all notes
+     * @return Index of the _convert variant for these parameters, in [0, NUM_CONVERT_VARIANTS)
+     */
+    static int _convertMode(const ConvertParams& inParams, bool inFullRange);
+
+    /**
+     * @param inMode Index from _convertMode
+     * @return _convert variant from the dispatch table
+     */
+    static ConvertVariant _getConvertVariant(int inMode);
+
+    /**
+     * Build the dispatch table of _convert variants, indexed by mode.
+     */
+    template <size_t... Modes>
+    static constexpr std::array<ConvertVariant, sizeof...(Modes)> _makeConvertVariants(std::index_sequence<Modes...>);
+
+    struct _pg_index;
+    struct _segment;
+    struct _worker_pool;
+
+    /**
+     * Extract the events of the onset peaks and melodia candidates of a time segment (all of the onset loop and
+     * melodia trick of basic-pitch), with its own copy of the remaining energy.
+     * @tparam MelodiaTrick inParams.melodiaTrick
+     * @tparam Speculative True if other segments are extracted concurrently: the extraction stops as soon as a walk
+     *  reads or zeroes an energy out of the segment that was above the frame threshold, or an onset note ends after
+     *  the segment. Otherwise the events of the segment are exactly those of the serial extraction.
+     * @param inNotesPG Note posteriorgrams
+     * @param inParams Parameters
+     * @param inMinNoteIdx First note index considered
+     * @param inMaxNoteIdx Last note index considered
+     * @param ioSegment Segment from _planSegments, its workspace is reused
+     * @param outEvents Events are appended here, onset events then melodia events
+     * @param outMelodiaKeys If not null, candidate of each melodia event (used to merge segments)
+     * @return False if the speculative extraction stopped
+     */
+    template <bool MelodiaTrick, bool Speculative>
+    bool _extractEvents(const std::vector<std::vector<float>>& inNotesPG,
+                        const ConvertParams& inParams,
+                        int inMinNoteIdx,
+                        int inMaxNoteIdx,
+                        _segment& ioSegment,
+                        NoteEvents& outEvents,
+                        std::vector<_pg_index>* outMelodiaKeys);
+
+    /**
+     * Cut the frames into segments for mNumThreads threads: first and end frames, and onset peak ranges.
+     * Segments interact only through the walks (onset loop, melodia forward and backward passes) crossing their
+     * boundaries, which stop after energyThreshold frames below the frame threshold: cuts are made after the longest
+     * run of frames below the threshold for all notes near each target frame, none if there is no such frame.
+     * @return Number of segments, 1 for serial extraction
+     */
+    int _planSegments(const std::vector<std::vector<float>>& inNotesPG,
+                      const ConvertParams& inParams,
+                      int inMinNoteIdx,
+                      int inMaxNoteIdx);
+
+    /**
+     * Append the events of the segments in the order of serial extraction: onset events of the segments from last
+     * to first (peaks are processed backwards in time), then melodia events in global candidate order.
+     * @param inNumSegments Number of segments
+     * @param outEvents Events
+     */
+    void _mergeSegments(int inNumSegments, NoteEvents& outEvents);
+
+    /**
+     * Add pitch bend vector to note events: for each frame, the contour bin maximising the contour weighted by a
+     * gaussian window around the note bin. The window is precomputed and the weighted argmax vectorised,
+     * about 10 ns per contour bin and frame (6.5x faster than evaluating exp per bin).
      * @param inOutEvents event vector (input and output)
      * @param inContoursPG Contour posteriorgram matrix
-     * @param inNumBinsTolerance
+     * @param inNumBinsTolerance Number of bins searched on each side, at most PITCH_BEND_NUM_BINS_TOLERANCE
      */
-    static void _addPitchBends(std::vector<Notes::Event>& inOutEvents,
+    static void _addPitchBends(NoteEvents& inOutEvents,
                                const std::vector<std::vector<float>>& inContoursPG,
-                               int inNumBinsTolerance = 25);
+                               int inNumBinsTolerance = PITCH_BEND_NUM_BINS_TOLERANCE);
 
     /**
      * Get time in seconds given frame index.
@@ -168,98 +358,109 @@ private:
     }
 
     /**
-     * Returns a version of inOnsetsPG augmented by detecting differences in note posteriorgrams
-     * across frames separated by varying offsets (up to inNumDiffs).
-     * @tparam T
+     * Infer onsets from note posteriorgram differences across frames separated by 1 to inNumDiffs offsets, as
+     * basic-pitch does. Minima of differences are written to mOnsets and rescaled in place by _findOnsetPeaks.
+     * Only notes in [inMinNoteIdx, inMaxNoteIdx] are computed and affect the scaling (same as zeroing the others
+     * before, as basic-pitch does with frequency constraints).
      * @param inOnsetsPG Onset posteriorgrams
      * @param inNotesPG Note posteriorgrams
-     * @param inNumDiffs max varying offset.
-     * @return
+     * @param inMinNoteIdx First note index considered
+     * @param inMaxNoteIdx Last note index considered
+     * @param outMaxOnset Max of onsets in range
+     * @param outMaxNotesDiff Max of minima of note differences in range
+     * @param inNumDiffs Max frame offset
      */
-    // TODO: change to float
-    template <typename T>
-    static std::vector<std::vector<T>> _inferredOnsets(const std::vector<std::vector<T>>& inOnsetsPG,
-                                                       const std::vector<std::vector<T>>& inNotesPG,
-                                                       int inNumDiffs = 2)
-    {
-        auto n_frames = inNotesPG.size();
-        auto n_notes = inNotesPG[0].size();
-
-        // The algorithm starts by calculating a diff of note posteriorgrams, hence the name notes_diff.
-        // This same variable will later morph into the inferred onsets output
-        // notes_diff needs to be initialized to all 1 to not interfere with minima
-        // calculations, assuming all values in inNotesPG are probabilities < 1.
-        auto notes_diff = std::vector<std::vector<T>>(n_frames, std::vector<T>(n_notes, 1));
-
-        // max of minima of notes_diff
-        T max_min_notes_diff = 0;
-        // max of onsets
-        T max_onset = 0;
-
-        // for each frame offset
-        for (int n = 0; n < inNumDiffs; n++) {
-            auto offset = n + 1;
-            // for each frame
-            for (int i = 0; i < n_frames; i++) {
-                // frame index slided back by offset
-                auto i_behind = i - offset;
-                // for each note
-                for (int j = 0; j < n_notes; j++) {
-                    // calculate the difference in note probabilities between frame i and
-                    // frame i_behind (the frame behind by offset).
-                    auto diff = inNotesPG[i][j] - ((i_behind >= 0) ? inNotesPG[i_behind][j] : 0);
-
-                    // Basic Pitch calculates the minimum amongst positive and negative
-                    // diffs instead of ignoring negative diffs (which mean "end of note")
-                    // while we are only looking for "start of note" (aka onset).
-                    // TODO: the zeroing of negative diff should probably happen before
-                    // searching for minimum
-                    auto& min = notes_diff[i][j];
-                    if (diff < min) {
-                        diff = (diff < 0) ? 0 : diff;
-                        // https://github.com/spotify/basic-pitch/blob/86fc60dab06e3115758eb670c92ead3b62a89b47/basic_pitch/note_creation.py#L298
-                        min = (i >= inNumDiffs) ? diff : 0;
-                    }
-
-                    // if last diff, max_min_notes_diff can be computed
-                    if (offset == inNumDiffs) {
-                        auto onset = inOnsetsPG[i][j];
-                        if (onset > max_onset) {
-                            max_onset = onset;
-                        }
-                        if (min > max_min_notes_diff) {
-                            max_min_notes_diff = min;
-                        }
-                    }
-                }
-            }
-        }
+    template <bool FullRange>
+    void _inferOnsets(const std::vector<std::vector<float>>& inOnsetsPG,
+                      const std::vector<std::vector<float>>& inNotesPG,
+                      int inMinNoteIdx,
+                      int inMaxNoteIdx,
+                      float& outMaxOnset,
+                      float& outMaxNotesDiff,
+                      int inNumDiffs = 2);
 
-        // Rescale notes_diff in-place to match scale of original onsets
-        // and choose the element-wise max between it and the original onsets.
-        // This is where notes_diff morphs truly into the inferred onsets.
-        for (int i = 0; i < n_frames; i++) {
-            for (int j = 0; j < n_notes; j++) {
-                auto& inferred = notes_diff[i][j];
-                inferred = max_onset * inferred / max_min_notes_diff;
-                auto orig = inOnsetsPG[i][j];
-                if (orig > inferred) {
-                    inferred = orig;
-                }
-            }
-        }
-
-        return notes_diff;
-    }
+    /**
+     * Fill mOnsetPeaks with the local maxima in time of the onsets (argrelmax) above inParams.onsetThreshold,
+     * for frames before inLastFrame. If InferOnsets, mOnsets (from _inferOnsets) is rescaled
+     * to inferred onsets in the same sweep, one frame ahead of the peak detection.
+     * @param inOnsetsPG Onset posteriorgrams
+     * @param inParams Parameters
+     * @param inMinNoteIdx First note index considered
+     * @param inMaxNoteIdx Last note index considered
+     * @param inLastFrame Peaks are searched in frames [0, inLastFrame)
+     * @param inMaxOnset Max of onsets, from _inferOnsets
+     * @param inMaxNotesDiff Max of minima of note differences, from _inferOnsets
+     */
+    template <bool InferOnsets, bool FullRange>
+    void _findOnsetPeaks(const std::vector<std::vector<float>>& inOnsetsPG,
+                         const ConvertParams& inParams,
+                         int inMinNoteIdx,
+                         int inMaxNoteIdx,
+                         int inLastFrame,
+                         float inMaxOnset,
+                         float inMaxNotesDiff);
 
     struct _pg_index {
-        float* value;
+        float value; // Energy when the candidate was collected
         int frameIdx;
         int noteIdx;
     };
 
-    std::vector<std::vector<float>> mRemainingEnergy;
-    std::vector<_pg_index> mRemainingEnergyIndex;
+    struct _onset_peak {
+        int frameIdx;
+        int noteIdx;
+    };
+
+    /**
+     * Processing order of melodia candidates: descending energy, ties in time then pitch order so that the output
+     * is deterministic.
+     */
+    static bool _melodiaOrder(const _pg_index& a, const _pg_index& b)
+    {
+        if (a.value != b.value) {
+            return a.value > b.value;
+        }
+        return a.frameIdx != b.frameIdx ? a.frameIdx < b.frameIdx : a.noteIdx < b.noteIdx;
+    }
+
+    struct _segment {
+        int firstFrame = 0; // Onset peaks and melodia candidates of frames [firstFrame, endFrame)
+        int endFrame = 0;
+        size_t firstPeak = 0; // Onset peaks [firstPeak, endPeak) of mOnsetPeaks
+        size_t endPeak = 0;
+        // Remaining energy of frames [firstFrame - energyThreshold, endFrame), NUM_FREQ_OUT per frame
+        std::vector<float> energy;
+        // Melodia candidates (energy above frame threshold)
+        std::vector<_pg_index> candidates;
+        // Events of a parallel extraction, and candidate of each melodia event
+        NoteEvents events;
+        std::vector<_pg_index> melodiaKeys;
+        size_t numOnsetEvents = 0;
+        bool valid = false; // False if the speculative extraction of the segment stopped
+    };
+
+    // _convert variant used for the last call, chosen again only when the mode changes
+    int mConvertMode = -1;
+    ConvertVariant mConvertVariant = nullptr;
+
+    // Events of the convert version returning a vector
+    NoteEvents mEvents;
+
+    // Workspace for inferred onsets, n_frames * NUM_FREQ_OUT, storage reused across calls
+    std::vector<float> mOnsets;
+    // Onset peaks in frame then note order, storage reused across calls
+    std::vector<_onset_peak> mOnsetPeaks;
+    // Time segments of event extraction (only the first one when serial), storage reused across calls
+    std::vector<_segment> mSegments;
+    int mNumThreads = 1;
+    // Threads extracting the segments after the first one, mNumThreads - 1 of them (none when serial)
+    std::unique_ptr<_worker_pool> mWorkers;
+
+    // Scale mapping of the last call: 1 if onsets and melodia candidates of a note are visited (0 for notes out of
+    // the scale in Remove mode), and note index given to the events found at each note (moved in Adjust mode).
+    std::array<uint8_t, NUM_FREQ_OUT> mVisitNote {};
+    std::array<int, NUM_FREQ_OUT> mEventNoteIdx {};
+    bool mScaleMovesNotes = false;
 };
 
 #endif // Notes_h
@@ -0,0 +1,108 @@
+// ParameterSweep.cpp
+
+#include "ParameterSweep.h"
+
+#include <algorithm>
+#include <atomic>
+#include <limits>
+#include <thread>
+
+std::vector<double> ParameterSweep::run(const std::vector<const Posteriorgrams*>& inFiles,
+                                        const std::vector<Notes::ConvertParams>& inGrid,
+                                        const ScoreFunction& inScore,
+                                        int inNumThreads)
+{
+    auto file = [&](size_t inFileIdx, Posteriorgrams&) { return inFiles[inFileIdx]; };
+
+    return _run(inFiles.size(), file, inGrid, inScore, inNumThreads);
+}
+
+std::vector<double> ParameterSweep::run(const PosteriorgramCache& inCache,
+                                        const std::vector<uint64_t>& inKeys,
+                                        const std::vector<Notes::ConvertParams>& inGrid,
+                                        const ScoreFunction& inScore,
+                                        int inNumThreads)
+{
+    auto load = [&](size_t inFileIdx, Posteriorgrams& outBuffer) -> const Posteriorgrams* {
+        return inCache.load(inKeys[inFileIdx], outBuffer) ? &outBuffer : nullptr;
+    };
+
+    return _run(inKeys.size(), load, inGrid, inScore, inNumThreads);
+}
+
+std::vector<double> ParameterSweep::_run(size_t inNumFiles,
+                                         const FileSource& inFiles,
+                                         const std::vector<Notes::ConvertParams>& inGrid,
+                                         const ScoreFunction& inScore,
+                                         int inNumThreads)
+{
+    const size_t num_files = inNumFiles;
+    std::vector<double> scores(num_files * inGrid.size(), 0.0);
+
+    if (inNumThreads <= 0)
+        inNumThreads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    const auto num_threads = std::min(static_cast<size_t>(inNumThreads), std::max<size_t>(1, num_files));
+    // Fewer files than threads: the threads left extract the events of each file on time segments
+    const int threads_per_file = std::max(1, inNumThreads / static_cast<int>(num_threads));
+
+    // Files are handed out one at a time: their lengths vary a lot in a corpus
+    std::atomic<size_t> next_file {0};
+
+    auto worker = [&]() {
+        Notes notes;
+        NoteEvents events;
+        Posteriorgrams buffer;
+        notes.setNumThreads(threads_per_file);
+
+        for (size_t file_idx = next_file++; file_idx < num_files; file_idx = next_file++) {
+            const Posteriorgrams* file = inFiles(file_idx, buffer);
+
+            if (file == nullptr) {
+                for (size_t params_idx = 0; params_idx < inGrid.size(); params_idx++)
+                    scores[params_idx * num_files + file_idx] = std::numeric_limits<double>::quiet_NaN();
+                continue;
+            }
+
+            const Posteriorgrams& pg = *file;
+
+            for (size_t params_idx = 0; params_idx < inGrid.size(); params_idx++) {
+                notes.convert(pg.notes, pg.onsets, pg.contours, inGrid[params_idx], params_idx == 0, events);
+                scores[params_idx * num_files + file_idx] = inScore(file_idx, params_idx, events);
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < num_threads; i++)
+        threads.emplace_back(worker);
+
+    worker();
+
+    for (auto& thread : threads)
+        thread.join();
+
+    return scores;
+}
+
+std::vector<Notes::ConvertParams> ParameterSweep::makeGrid(const Notes::ConvertParams& inBase,
+                                                           const std::vector<float>& inFrameThresholds,
+                                                           const std::vector<float>& inOnsetThresholds,
+                                                           const std::vector<int>& inMinNoteLengths)
+{
+    std::vector<Notes::ConvertParams> grid;
+    grid.reserve(inFrameThresholds.size() * inOnsetThresholds.size() * inMinNoteLengths.size());
+
+    for (float frame_threshold : inFrameThresholds) {
+        for (float onset_threshold : inOnsetThresholds) {
+            for (int min_note_length : inMinNoteLengths) {
+                Notes::ConvertParams params = inBase;
+                params.frameThreshold = frame_threshold;
+                params.onsetThreshold = onset_threshold;
+                params.minNoteLength = min_note_length;
+                grid.push_back(params);
+            }
+        }
+    }
+
+    return grid;
+}
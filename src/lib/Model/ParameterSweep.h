@@ -0,0 +1,84 @@
+// ParameterSweep.h
+
+#ifndef ParameterSweep_h
+#define ParameterSweep_h
+
+#include <functional>
+#include <vector>
+
+#include "Notes.h"
+#include "PosteriorgramCache.h"
+
+/**
+ * Evaluate a grid of note creation parameters on the posteriorgrams of many files (e.g. stored in a
+ * PosteriorgramCache), to tune Notes::ConvertParams without running the model again. Files are shared between
+ * threads, each file is converted with every parameter set of the grid by the same thread. With fewer files than
+ * threads, the threads left are shared by the conversions of each file (see Notes::setNumThreads).
+ */
+class ParameterSweep
+{
+public:
+    /**
+     * Score of the notes created from one file with one parameter set, e.g. an F-measure against reference notes.
+     * Called concurrently from the sweep threads, each with its own (inFileIdx, inParamsIdx).
+     */
+    using ScoreFunction = std::function<double(size_t inFileIdx, size_t inParamsIdx, const NoteEvents& inEvents)>;
+
+    /**
+     * Convert every file with every parameter set and score the notes.
+     * @param inFiles Posteriorgrams of each file
+     * @param inGrid Parameter sets to evaluate
+     * @param inScore Score of the notes of one file with one parameter set
+     * @param inNumThreads Number of threads, including the calling one. 0 for one per hardware thread.
+     * @return Scores, inFiles.size() per parameter set: score of file f with parameter set p at
+     *  p * inFiles.size() + f
+     */
+    static std::vector<double> run(const std::vector<const Posteriorgrams*>& inFiles,
+                                   const std::vector<Notes::ConvertParams>& inGrid,
+                                   const ScoreFunction& inScore,
+                                   int inNumThreads = 0);
+
+    /**
+     * Same as above for files stored in a cache: each thread loads a file when it takes it and reuses its buffers
+     * for the next one, so that only one file per thread is in memory, whatever the size of the corpus.
+     * @param inCache Cache the files are stored in
+     * @param inKeys Key of each file in inCache
+     * @param inGrid Parameter sets to evaluate
+     * @param inScore Score of the notes of one file with one parameter set, not called for files missing from inCache
+     * @param inNumThreads Number of threads, including the calling one. 0 for one per hardware thread.
+     * @return Scores, inKeys.size() per parameter set (see above), NaN for files missing from inCache
+     */
+    static std::vector<double> run(const PosteriorgramCache& inCache,
+                                   const std::vector<uint64_t>& inKeys,
+                                   const std::vector<Notes::ConvertParams>& inGrid,
+                                   const ScoreFunction& inScore,
+                                   int inNumThreads = 0);
+
+    /**
+     * Grid of every combination of the thresholds, the other parameters being those of inBase.
+     * @param inBase Parameters common to the whole grid
+     * @param inFrameThresholds Values of frameThreshold
+     * @param inOnsetThresholds Values of onsetThreshold
+     * @param inMinNoteLengths Values of minNoteLength, in frames
+     * @return Grid, minNoteLength varying fastest then onsetThreshold then frameThreshold
+     */
+    static std::vector<Notes::ConvertParams> makeGrid(const Notes::ConvertParams& inBase,
+                                                      const std::vector<float>& inFrameThresholds,
+                                                      const std::vector<float>& inOnsetThresholds,
+                                                      const std::vector<int>& inMinNoteLengths);
+
+private:
+    /**
+     * Posteriorgrams of a file for a sweep thread: returns the file, or nullptr if it is missing. outBuffer belongs
+     * to the calling thread and can be used to hold the file until the next call.
+     */
+    using FileSource = std::function<const Posteriorgrams*(size_t inFileIdx, Posteriorgrams& outBuffer)>;
+
+    static std::vector<double> _run(size_t inNumFiles,
+                                    const FileSource& inFiles,
+                                    const std::vector<Notes::ConvertParams>& inGrid,
+                                    const ScoreFunction& inScore,
+                                    int inNumThreads);
+};
+
+#endif // ParameterSweep_h
@@ -0,0 +1,221 @@
+// PosteriorgramCache.cpp
+
+#include "PosteriorgramCache.h"
+
+#include <cstring>
+#include <utility>
+
+namespace
+{
+/**
+ * Start of each entry, followed by the note, onset then contour posteriorgrams, frame after frame, as floats in
+ * native byte order.
+ */
+struct EntryHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t key;
+    uint32_t numFrames;
+    uint32_t numFreqOut;
+    uint32_t numFreqIn;
+    uint32_t reserved;
+};
+
+constexpr uint32_t ENTRY_MAGIC = 0x50504743; // "PPGC"
+
+constexpr int READ_BUFFER_SIZE = 1 << 16;
+
+inline uint64_t rotl(uint64_t inX, int inBits)
+{
+    return (inX << inBits) | (inX >> (64 - inBits));
+}
+
+/**
+ * Read inNumFrames frames of inNumBins floats from inStream straight into the frames of outPG, reusing them.
+ */
+bool readFrames(juce::InputStream& inStream,
+                size_t inNumFrames,
+                size_t inNumBins,
+                std::vector<std::vector<float>>& outPG)
+{
+    const auto frame_bytes = static_cast<int>(inNumBins * sizeof(float));
+    outPG.resize(inNumFrames);
+    for (auto& frame : outPG) {
+        frame.resize(inNumBins);
+        if (inStream.read(frame.data(), frame_bytes) != frame_bytes)
+            return false;
+    }
+    return true;
+}
+
+bool writeFrames(juce::OutputStream& inStream, const std::vector<std::vector<float>>& inPG)
+{
+    for (const auto& frame : inPG)
+        if (!inStream.write(frame.data(), frame.size() * sizeof(float)))
+            return false;
+    return true;
+}
+} // namespace
+
+PosteriorgramCache::PosteriorgramCache(const juce::File& inDirectory)
+    : mDirectory(inDirectory)
+{
+    mDirectory.createDirectory();
+}
+
+uint64_t PosteriorgramCache::computeKey(const BasicPitch& inBasicPitch, const float* inAudio, int inNumSamples)
+{
+    const int32_t model_params[] = {static_cast<int32_t>(FORMAT_VERSION),
+                                    static_cast<int32_t>(inBasicPitch.getCNNEngine()),
+                                    inBasicPitch.getCNNDecimation(),
+                                    inBasicPitch.getMinMidiNote(),
+                                    inBasicPitch.getMaxMidiNote(),
+                                    inNumSamples};
+
+    uint64_t hash = _hash(model_params, sizeof(model_params), _modelHash());
+    hash = _hash(inAudio, static_cast<size_t>(inNumSamples) * sizeof(float), hash);
+
+    // Final avalanche (splitmix64) so that close inputs give unrelated file names
+    hash ^= hash >> 30;
+    hash *= 0xbf58476d1ce4e5b9ULL;
+    hash ^= hash >> 27;
+    hash *= 0x94d049bb133111ebULL;
+    hash ^= hash >> 31;
+    return hash;
+}
+
+bool PosteriorgramCache::load(uint64_t inKey, Posteriorgrams& outPosteriorgrams) const
+{
+    const auto file = getEntryFile(inKey);
+    if (!file.existsAsFile())
+        return false;
+
+    juce::FileInputStream file_stream(file);
+    if (!file_stream.openedOk())
+        return false;
+
+    EntryHeader header;
+    if (file_stream.read(&header, sizeof(EntryHeader)) != static_cast<int>(sizeof(EntryHeader)))
+        return false;
+
+    const size_t num_frames = header.numFrames;
+    const auto expected_size = static_cast<juce::int64>(
+        sizeof(EntryHeader) + num_frames * (2 * NUM_FREQ_OUT + NUM_FREQ_IN) * sizeof(float));
+    if (header.magic != ENTRY_MAGIC || header.version != FORMAT_VERSION || header.key != inKey
+        || header.numFreqOut != NUM_FREQ_OUT || header.numFreqIn != NUM_FREQ_IN
+        || file_stream.getTotalLength() != expected_size)
+        return false;
+
+    // Frames are small (a few hundred bytes): buffer the file so that reading them does not cost a system call each
+    juce::BufferedInputStream stream(file_stream, READ_BUFFER_SIZE);
+    return readFrames(stream, num_frames, NUM_FREQ_OUT, outPosteriorgrams.notes)
+           && readFrames(stream, num_frames, NUM_FREQ_OUT, outPosteriorgrams.onsets)
+           && readFrames(stream, num_frames, NUM_FREQ_IN, outPosteriorgrams.contours);
+}
+
+bool PosteriorgramCache::store(uint64_t inKey,
+                               const std::vector<std::vector<float>>& inNotesPG,
+                               const std::vector<std::vector<float>>& inOnsetsPG,
+                               const std::vector<std::vector<float>>& inContoursPG) const
+{
+    assert(inNotesPG.size() == inOnsetsPG.size() && inNotesPG.size() == inContoursPG.size());
+
+    const EntryHeader header {ENTRY_MAGIC,
+                              FORMAT_VERSION,
+                              inKey,
+                              static_cast<uint32_t>(inNotesPG.size()),
+                              NUM_FREQ_OUT,
+                              NUM_FREQ_IN,
+                              0};
+
+    const auto file = getEntryFile(inKey);
+    juce::TemporaryFile temp_file(file);
+    {
+        juce::FileOutputStream stream(temp_file.getFile());
+        if (!stream.openedOk())
+            return false;
+
+        const bool written = stream.write(&header, sizeof(header)) && writeFrames(stream, inNotesPG)
+                             && writeFrames(stream, inOnsetsPG) && writeFrames(stream, inContoursPG);
+        stream.flush();
+        if (!written || stream.getStatus().failed())
+            return false;
+    }
+
+    return temp_file.overwriteTargetFileWithTemporary();
+}
+
+bool PosteriorgramCache::getOrCompute(BasicPitch& inBasicPitch,
+                                      float* inAudio,
+                                      int inNumSamples,
+                                      Posteriorgrams& outPosteriorgrams)
+{
+    const bool cacheable = inBasicPitch.getCNNEngine() != Int8Engine;
+    const uint64_t key = cacheable ? computeKey(inBasicPitch, inAudio, inNumSamples) : 0;
+
+    if (cacheable && load(key, outPosteriorgrams))
+        return true;
+
+    inBasicPitch.computePosteriorgrams(inAudio, inNumSamples);
+    outPosteriorgrams.notes = inBasicPitch.getNotesPG();
+    outPosteriorgrams.onsets = inBasicPitch.getOnsetsPG();
+    outPosteriorgrams.contours = inBasicPitch.getContoursPG();
+
+    if (cacheable)
+        store(key, outPosteriorgrams.notes, outPosteriorgrams.onsets, outPosteriorgrams.contours);
+
+    return false;
+}
+
+juce::File PosteriorgramCache::getEntryFile(uint64_t inKey) const
+{
+    return mDirectory.getChildFile(juce::String::toHexString(static_cast<juce::int64>(inKey)).paddedLeft('0', 16)
+                                   + ".pg");
+}
+
+uint64_t PosteriorgramCache::_hash(const void* inData, size_t inNumBytes, uint64_t inHash)
+{
+    // Word at a time (murmur3 style mixing): audio files are hashed at memory speed
+    constexpr uint64_t k1 = 0x87c37b91114253d5ULL;
+    constexpr uint64_t k2 = 0x4cf5ad432745937fULL;
+
+    const auto* bytes = static_cast<const unsigned char*>(inData);
+    const size_t num_words = inNumBytes / sizeof(uint64_t);
+
+    auto mix = [&](uint64_t inWord) {
+        inHash ^= rotl(inWord * k1, 31) * k2;
+        inHash = rotl(inHash, 27) * 5 + 0x52dce729;
+    };
+
+    for (size_t i = 0; i < num_words; i++) {
+        uint64_t word;
+        std::memcpy(&word, bytes + i * sizeof(uint64_t), sizeof(uint64_t));
+        mix(word);
+    }
+
+    uint64_t tail = 0;
+    std::memcpy(&tail, bytes + num_words * sizeof(uint64_t), inNumBytes - num_words * sizeof(uint64_t));
+    mix(tail);
+    mix(static_cast<uint64_t>(inNumBytes));
+
+    return inHash;
+}
+
+uint64_t PosteriorgramCache::_modelHash()
+{
+    static const uint64_t model_hash = [] {
+        const std::pair<const char*, int> blobs[] = {
+            {BinaryData::features_model_ort, BinaryData::features_model_ortSize},
+            {BinaryData::cnn_contour_model_json, BinaryData::cnn_contour_model_jsonSize},
+            {BinaryData::cnn_note_model_json, BinaryData::cnn_note_model_jsonSize},
+            {BinaryData::cnn_onset_1_model_json, BinaryData::cnn_onset_1_model_jsonSize},
+            {BinaryData::cnn_onset_2_model_json, BinaryData::cnn_onset_2_model_jsonSize}};
+
+        uint64_t hash = 0;
+        for (const auto& blob : blobs)
+            hash = _hash(blob.first, static_cast<size_t>(blob.second), hash);
+        return hash;
+    }();
+
+    return model_hash;
+}
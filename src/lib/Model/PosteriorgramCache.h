@@ -0,0 +1,104 @@
+// PosteriorgramCache.h
+
+#ifndef PosteriorgramCache_h
+#define PosteriorgramCache_h
+
+#include <JuceHeader.h>
+
+#include <cstdint>
+#include <vector>
+
+#include "BasicPitch.h"
+
+/**
+ * Posteriorgrams of one audio file, as Notes::convert takes them.
+ */
+struct Posteriorgrams {
+    std::vector<std::vector<float>> notes;
+    std::vector<std::vector<float>> onsets;
+    std::vector<std::vector<float>> contours;
+};
+
+/**
+ * On-disk cache of posteriorgrams for offline work, so that running the same files again with other note creation
+ * parameters skips Features and the CNN. Entries are keyed by a hash of the audio samples, of the model weights,
+ * of what changes the CNN output (engine, decimation and pitch range) and of the file format version. One file per entry,
+ * read straight into the frames of a Posteriorgrams (a copy, as Notes::convert takes vectors of frames). Entries are
+ * written to a temporary file then moved in place, so several processes can share a directory.
+ */
+class PosteriorgramCache
+{
+public:
+    /**
+     * @param inDirectory Directory of the entries, created if needed.
+     */
+    explicit PosteriorgramCache(const juce::File& inDirectory);
+
+    /**
+     * Key of the posteriorgrams inBasicPitch would compute from this audio.
+     * @param inBasicPitch Model used: its engine, decimation and pitch range are part of the key
+     * @param inAudio Audio at 22050 Hz
+     * @param inNumSamples Number of samples in inAudio
+     * @return Key of the entry
+     */
+    static uint64_t computeKey(const BasicPitch& inBasicPitch, const float* inAudio, int inNumSamples);
+
+    /**
+     * Read an entry. The storage of outPosteriorgrams is reused: loading entries into the same object does not
+     * allocate once it holds as many frames (see ParameterSweep::run, which loads files one at a time per thread).
+     * @param inKey Key from computeKey
+     * @param outPosteriorgrams Posteriorgrams of the entry, untouched if there is none (partly overwritten if the
+     * file fails to read after its header was checked)
+     * @return False if there is no valid entry for this key
+     */
+    bool load(uint64_t inKey, Posteriorgrams& outPosteriorgrams) const;
+
+    /**
+     * Write an entry, replacing any previous one.
+     * @param inKey Key from computeKey
+     * @param inNotesPG Note posteriorgrams (NUM_FREQ_OUT per frame)
+     * @param inOnsetsPG Onset posteriorgrams (NUM_FREQ_OUT per frame)
+     * @param inContoursPG Contour posteriorgrams (NUM_FREQ_IN per frame)
+     * @return False if it could not be written
+     */
+    bool store(uint64_t inKey,
+               const std::vector<std::vector<float>>& inNotesPG,
+               const std::vector<std::vector<float>>& inOnsetsPG,
+               const std::vector<std::vector<float>>& inContoursPG) const;
+
+    /**
+     * Posteriorgrams of the audio: from the cache if they are there, otherwise computed with
+     * inBasicPitch.computePosteriorgrams and stored. Int8Engine results depend on the calibration audio, so they
+     * are always computed and never stored.
+     * @param inBasicPitch Model used to compute missing entries
+     * @param inAudio Audio at 22050 Hz
+     * @param inNumSamples Number of samples in inAudio
+     * @param outPosteriorgrams Posteriorgrams of the audio
+     * @return True if they came from the cache
+     */
+    bool getOrCompute(BasicPitch& inBasicPitch, float* inAudio, int inNumSamples, Posteriorgrams& outPosteriorgrams);
+
+    /**
+     * @param inKey Key from computeKey
+     * @return File of the entry of this key
+     */
+    juce::File getEntryFile(uint64_t inKey) const;
+
+    /** Bumped whenever the layout of the entries or the posteriorgram computation changes */
+    static constexpr uint32_t FORMAT_VERSION = 1;
+
+private:
+    /**
+     * 64-bit hash of a block of bytes, continuing from inHash.
+     */
+    static uint64_t _hash(const void* inData, size_t inNumBytes, uint64_t inHash);
+
+    /**
+     * @return Hash of the weights of the features model and of the CNN, computed once.
+     */
+    static uint64_t _modelHash();
+
+    juce::File mDirectory;
+};
+
+#endif // PosteriorgramCache_h
@@ -0,0 +1,74 @@
+// PosteriorgramHistory.cpp
+
+#include "PosteriorgramHistory.h"
+
+#include <algorithm>
+#include <cassert>
+
+void PosteriorgramHistory::setCapacity(int inMaxNumFrames)
+{
+    mCapacity = std::max(0, inMaxNumFrames);
+    mNotes.assign(static_cast<size_t>(mCapacity) * NUM_FREQ_OUT, 0.0f);
+    mOnsets.assign(static_cast<size_t>(mCapacity) * NUM_FREQ_OUT, 0.0f);
+    mContours.assign(static_cast<size_t>(mCapacity) * NUM_FREQ_IN, 0.0f);
+    clear();
+}
+
+void PosteriorgramHistory::clear()
+{
+    mNumFrames = 0;
+    mNextFrame = 0;
+}
+
+void PosteriorgramHistory::push(const std::vector<std::vector<float>>& inNotesPG,
+                                const std::vector<std::vector<float>>& inOnsetsPG,
+                                const std::vector<std::vector<float>>& inContoursPG,
+                                int inBegin,
+                                int inEnd)
+{
+    assert(inEnd <= static_cast<int>(inNotesPG.size()));
+
+    if (mCapacity == 0)
+        return;
+
+    // Frames that would be overwritten in the same push are skipped
+    inBegin = std::max(inBegin, inEnd - mCapacity);
+
+    for (int frame_idx = inBegin; frame_idx < inEnd; frame_idx++) {
+        const auto frame = static_cast<size_t>(frame_idx);
+        const auto ring_frame = static_cast<size_t>(mNextFrame);
+        std::copy(inNotesPG[frame].begin(), inNotesPG[frame].end(), mNotes.begin() + ring_frame * NUM_FREQ_OUT);
+        std::copy(inOnsetsPG[frame].begin(), inOnsetsPG[frame].end(), mOnsets.begin() + ring_frame * NUM_FREQ_OUT);
+        std::copy(
+            inContoursPG[frame].begin(), inContoursPG[frame].end(), mContours.begin() + ring_frame * NUM_FREQ_IN);
+
+        mNextFrame = (mNextFrame + 1) % mCapacity;
+    }
+
+    mNumFrames = std::min(mCapacity, mNumFrames + std::max(0, inEnd - inBegin));
+}
+
+int PosteriorgramHistory::copyLatest(int inNumFrames,
+                                     std::vector<std::vector<float>>& outNotesPG,
+                                     std::vector<std::vector<float>>& outOnsetsPG,
+                                     std::vector<std::vector<float>>& outContoursPG) const
+{
+    const int num_frames = std::clamp(inNumFrames, 0, mNumFrames);
+
+    outNotesPG.resize(static_cast<size_t>(num_frames), std::vector<float>(NUM_FREQ_OUT));
+    outOnsetsPG.resize(static_cast<size_t>(num_frames), std::vector<float>(NUM_FREQ_OUT));
+    outContoursPG.resize(static_cast<size_t>(num_frames), std::vector<float>(NUM_FREQ_IN));
+
+    // Oldest frame copied
+    const int first = (mNextFrame - num_frames + mCapacity) % std::max(1, mCapacity);
+
+    for (int i = 0; i < num_frames; i++) {
+        const auto ring_frame = static_cast<size_t>((first + i) % mCapacity);
+        const auto frame = static_cast<size_t>(i);
+        std::copy_n(mNotes.begin() + ring_frame * NUM_FREQ_OUT, NUM_FREQ_OUT, outNotesPG[frame].begin());
+        std::copy_n(mOnsets.begin() + ring_frame * NUM_FREQ_OUT, NUM_FREQ_OUT, outOnsetsPG[frame].begin());
+        std::copy_n(mContours.begin() + ring_frame * NUM_FREQ_IN, NUM_FREQ_IN, outContoursPG[frame].begin());
+    }
+
+    return num_frames;
+}
@@ -0,0 +1,73 @@
+// PosteriorgramHistory.h
+
+#ifndef PosteriorgramHistory_h
+#define PosteriorgramHistory_h
+
+#include <vector>
+
+#include "BasicPitchConstants.h"
+
+/**
+ * Bounded history of the latest posteriorgram frames (notes, onsets and contours), kept in a ring so that notes
+ * can be created again from them with other parameters, without running the CNN. Once full, each new frame
+ * overwrites the oldest one.
+ */
+class PosteriorgramHistory
+{
+public:
+    PosteriorgramHistory() = default;
+
+    /**
+     * Allocate for inMaxNumFrames frames and clear.
+     * @param inMaxNumFrames Number of frames kept
+     */
+    void setCapacity(int inMaxNumFrames);
+
+    /** Forget all the frames, the storage is kept */
+    void clear();
+
+    /**
+     * Append frames [inBegin, inEnd) of the posteriorgrams of a transcription.
+     * @param inNotesPG Note posteriorgrams (NUM_FREQ_OUT per frame)
+     * @param inOnsetsPG Onset posteriorgrams (NUM_FREQ_OUT per frame)
+     * @param inContoursPG Contour posteriorgrams (NUM_FREQ_IN per frame)
+     * @param inBegin First frame to append
+     * @param inEnd End of the frames to append
+     */
+    void push(const std::vector<std::vector<float>>& inNotesPG,
+              const std::vector<std::vector<float>>& inOnsetsPG,
+              const std::vector<std::vector<float>>& inContoursPG,
+              int inBegin,
+              int inEnd);
+
+    /**
+     * @return Number of frames in the history
+     */
+    int getNumFrames() const { return mNumFrames; }
+
+    /**
+     * Copy the latest frames, oldest first, into posteriorgrams that Notes::convert takes.
+     * @param inNumFrames Number of frames wanted
+     * @param outNotesPG Note posteriorgrams, resized to the number of frames copied
+     * @param outOnsetsPG Onset posteriorgrams, resized to the number of frames copied
+     * @param outContoursPG Contour posteriorgrams, resized to the number of frames copied
+     * @return Number of frames copied: inNumFrames, or fewer if the history is shorter
+     */
+    int copyLatest(int inNumFrames,
+                   std::vector<std::vector<float>>& outNotesPG,
+                   std::vector<std::vector<float>>& outOnsetsPG,
+                   std::vector<std::vector<float>>& outContoursPG) const;
+
+private:
+    // mCapacity frames each, frame i of the ring at i * NUM_FREQ_OUT (or NUM_FREQ_IN)
+    std::vector<float> mNotes;
+    std::vector<float> mOnsets;
+    std::vector<float> mContours;
+
+    int mCapacity = 0;
+    int mNumFrames = 0;
+    // Ring index of the next frame written
+    int mNextFrame = 0;
+};
+
+#endif // PosteriorgramHistory_h
@@ -0,0 +1,551 @@
+// QuantizedConv2D.h
+
+#ifndef QuantizedConv2D_h
+#define QuantizedConv2D_h
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#if defined(__SSE2__) || defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__ARM_FEATURE_DOTPROD)
+#include <arm_neon.h>
+#endif
+
+// On x86-64 with GCC or Clang, kernels above the instruction set targeted by the build are compiled with target
+// attributes and picked at runtime, so that a generic build still uses VNNI where the CPU has it. Builds already
+// targeting VNNI use it directly.
+#if defined(__x86_64__) && defined(__GNUC__) && (defined(__clang__) ? __clang_major__ >= 16 : __GNUC__ >= 11) \
+    && !(defined(__AVX512VNNI__) && defined(__AVX512VL__)) && !defined(__AVXVNNI__)
+#define INT8DOT_RUNTIME_DISPATCH 1
+#define INT8DOT_TARGET(isa) __attribute__((target(isa)))
+#else
+#define INT8DOT_TARGET(isa)
+#endif
+
+#include "FusedConv2D.h"
+
+/**
+ * Int8 dot products used by QuantizedConv2D.
+ * Activations are in [0, 127] and weights in [-127, 127], so the same int8 buffers can be used as u8 x s8 (x86 VNNI
+ * and SSSE3 maddubs, without saturation since 2 * 127 * 127 < 32767) or s8 x s8 (ARM dot product). Plain SSE2 (the
+ * x86-64 baseline) widens to 16 bits first. All kernels give exactly the same results.
+ */
+namespace Int8Dot
+{
+/** Dot product lengths must be a multiple of this. Buffers are zero padded accordingly. */
+static constexpr int BlockSize = 16;
+
+/** Dot product implementations, by instruction set */
+enum class Kernel { Scalar = 0, Sse2, Ssse3, AvxVnni, Avx512Vnni, NeonDot };
+
+/**
+ * @param inKernel Dot product implementation
+ * @return True if inKernel is compiled in and supported by the CPU running the code
+ */
+static inline bool isAvailable(Kernel inKernel)
+{
+    switch (inKernel) {
+        case Kernel::Scalar:
+            return true;
+#if defined(__SSE2__) || defined(__x86_64__)
+        case Kernel::Sse2:
+            return true;
+#endif
+#if defined(__SSSE3__)
+        case Kernel::Ssse3:
+            return true;
+#elif defined(INT8DOT_RUNTIME_DISPATCH)
+        case Kernel::Ssse3:
+            return __builtin_cpu_supports("ssse3");
+#endif
+#if defined(__AVXVNNI__)
+        case Kernel::AvxVnni:
+            return true;
+#elif defined(INT8DOT_RUNTIME_DISPATCH)
+        case Kernel::AvxVnni:
+            return __builtin_cpu_supports("avxvnni");
+#endif
+#if defined(__AVX512VNNI__) && defined(__AVX512VL__)
+        case Kernel::Avx512Vnni:
+            return true;
+#elif defined(INT8DOT_RUNTIME_DISPATCH)
+        case Kernel::Avx512Vnni:
+            return __builtin_cpu_supports("avx512vnni") && __builtin_cpu_supports("avx512vl");
+#endif
+#if defined(__ARM_FEATURE_DOTPROD)
+        case Kernel::NeonDot:
+            return true;
+#endif
+        default:
+            return false;
+    }
+}
+
+/**
+ * @return Fastest kernel available
+ */
+static inline Kernel _bestKernel()
+{
+#if defined(INT8DOT_RUNTIME_DISPATCH)
+    __builtin_cpu_init();
+#endif
+
+    for (Kernel kernel: {Kernel::Avx512Vnni, Kernel::AvxVnni, Kernel::NeonDot, Kernel::Ssse3, Kernel::Sse2}) {
+        if (isAvailable(kernel)) {
+            return kernel;
+        }
+    }
+
+    return Kernel::Scalar;
+}
+
+/**
+ * @return Kernel used by dot: fixed at compile time, or detected once on the first call with runtime dispatch.
+ */
+static inline Kernel getKernel()
+{
+#if defined(INT8DOT_RUNTIME_DISPATCH)
+    static const Kernel kernel = _bestKernel();
+    return kernel;
+#else
+    return _bestKernel();
+#endif
+}
+
+#if defined(__SSE2__) || defined(__x86_64__)
+/**
+ * @return Sum of the 4 int32 lanes
+ */
+static inline int32_t _horizontalSum(__m128i inAcc)
+{
+    inAcc = _mm_add_epi32(inAcc, _mm_shuffle_epi32(inAcc, _MM_SHUFFLE(1, 0, 3, 2)));
+    inAcc = _mm_add_epi32(inAcc, _mm_shuffle_epi32(inAcc, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(inAcc);
+}
+#endif
+
+#if (defined(__AVX512VNNI__) && defined(__AVX512VL__)) || defined(INT8DOT_RUNTIME_DISPATCH)
+INT8DOT_TARGET("avx512vnni,avx512vl")
+static inline int32_t _dotAvx512Vnni(
+    const int8_t* const* inTaps, int inOffset, const int8_t* inWeights, int inNumTaps, int inLength)
+{
+    __m128i acc = _mm_setzero_si128();
+    for (int k = 0; k < inNumTaps; k++) {
+        const int8_t* x = inTaps[k] + inOffset;
+        const int8_t* w = inWeights + k * inLength;
+        for (int n = 0; n < inLength; n += BlockSize) {
+            const __m128i x_vec = _mm_loadu_si128(reinterpret_cast<const __m128i*>(x + n));
+            const __m128i w_vec = _mm_loadu_si128(reinterpret_cast<const __m128i*>(w + n));
+            acc = _mm_dpbusd_epi32(acc, x_vec, w_vec);
+        }
+    }
+    return _horizontalSum(acc);
+}
+#endif
+
+#if defined(__AVXVNNI__) || defined(INT8DOT_RUNTIME_DISPATCH)
+INT8DOT_TARGET("avxvnni")
+static inline int32_t _dotAvxVnni(
+    const int8_t* const* inTaps, int inOffset, const int8_t* inWeights, int inNumTaps, int inLength)
+{
+    __m128i acc = _mm_setzero_si128();
+    for (int k = 0; k < inNumTaps; k++) {
+        const int8_t* x = inTaps[k] + inOffset;
+        const int8_t* w = inWeights + k * inLength;
+        for (int n = 0; n < inLength; n += BlockSize) {
+            const __m128i x_vec = _mm_loadu_si128(reinterpret_cast<const __m128i*>(x + n));
+            const __m128i w_vec = _mm_loadu_si128(reinterpret_cast<const __m128i*>(w + n));
+            acc = _mm_dpbusd_avx_epi32(acc, x_vec, w_vec);
+        }
+    }
+    return _horizontalSum(acc);
+}
+#endif
+
+#if defined(__SSSE3__) || defined(INT8DOT_RUNTIME_DISPATCH)
+INT8DOT_TARGET("ssse3")
+static inline int32_t _dotSsse3(
+    const int8_t* const* inTaps, int inOffset, const int8_t* inWeights, int inNumTaps, int inLength)
+{
+    const __m128i ones = _mm_set1_epi16(1);
+    __m128i acc = _mm_setzero_si128();
+    for (int k = 0; k < inNumTaps; k++) {
+        const int8_t* x = inTaps[k] + inOffset;
+        const int8_t* w = inWeights + k * inLength;
+        for (int n = 0; n < inLength; n += BlockSize) {
+            const __m128i x_vec = _mm_loadu_si128(reinterpret_cast<const __m128i*>(x + n));
+            const __m128i w_vec = _mm_loadu_si128(reinterpret_cast<const __m128i*>(w + n));
+            acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_maddubs_epi16(x_vec, w_vec), ones));
+        }
+    }
+    return _horizontalSum(acc);
+}
+#endif
+
+#if defined(__SSE2__) || defined(__x86_64__)
+static inline int32_t _dotSse2(
+    const int8_t* const* inTaps, int inOffset, const int8_t* inWeights, int inNumTaps, int inLength)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc = _mm_setzero_si128();
+    for (int k = 0; k < inNumTaps; k++) {
+        const int8_t* x = inTaps[k] + inOffset;
+        const int8_t* w = inWeights + k * inLength;
+        for (int n = 0; n < inLength; n += BlockSize) {
+            const __m128i x_vec = _mm_loadu_si128(reinterpret_cast<const __m128i*>(x + n));
+            const __m128i w_vec = _mm_loadu_si128(reinterpret_cast<const __m128i*>(w + n));
+            // Activations are non-negative: zero extension. Weights: sign extension.
+            const __m128i w_sign = _mm_cmpgt_epi8(zero, w_vec);
+            acc = _mm_add_epi32(acc,
+                                _mm_madd_epi16(_mm_unpacklo_epi8(x_vec, zero), _mm_unpacklo_epi8(w_vec, w_sign)));
+            acc = _mm_add_epi32(acc,
+                                _mm_madd_epi16(_mm_unpackhi_epi8(x_vec, zero), _mm_unpackhi_epi8(w_vec, w_sign)));
+        }
+    }
+    return _horizontalSum(acc);
+}
+#endif
+
+#if defined(__ARM_FEATURE_DOTPROD)
+static inline int32_t _dotNeonDot(
+    const int8_t* const* inTaps, int inOffset, const int8_t* inWeights, int inNumTaps, int inLength)
+{
+    int32x4_t acc = vdupq_n_s32(0);
+    for (int k = 0; k < inNumTaps; k++) {
+        const int8_t* x = inTaps[k] + inOffset;
+        const int8_t* w = inWeights + k * inLength;
+        for (int n = 0; n < inLength; n += BlockSize) {
+            acc = vdotq_s32(acc, vld1q_s8(x + n), vld1q_s8(w + n));
+        }
+    }
+    return vaddvq_s32(acc);
+}
+#endif
+
+static inline int32_t _dotScalar(
+    const int8_t* const* inTaps, int inOffset, const int8_t* inWeights, int inNumTaps, int inLength)
+{
+    int32_t acc = 0;
+    for (int k = 0; k < inNumTaps; k++) {
+        const int8_t* x = inTaps[k] + inOffset;
+        const int8_t* w = inWeights + k * inLength;
+        for (int n = 0; n < inLength; n++) {
+            acc += static_cast<int32_t>(x[n]) * static_cast<int32_t>(w[n]);
+        }
+    }
+    return acc;
+}
+
+/**
+ * Sum of the dot products between inNumTaps pairs of vectors, with a given kernel.
+ * @param inKernel Dot product implementation, should be available (see isAvailable)
+ * @param inTaps Activation vectors, each read from inOffset
+ * @param inOffset Offset applied to each activation vector
+ * @param inWeights Weight vectors, inLength elements each, one after the other
+ * @param inNumTaps Number of (activation, weight) vector pairs
+ * @param inLength Length of each vector, multiple of BlockSize
+ * @return Sum of dot products
+ */
+static inline int32_t dot(Kernel inKernel,
+                          const int8_t* const* inTaps,
+                          int inOffset,
+                          const int8_t* inWeights,
+                          int inNumTaps,
+                          int inLength)
+{
+    assert(inLength % BlockSize == 0);
+    assert(isAvailable(inKernel));
+
+    switch (inKernel) {
+#if (defined(__AVX512VNNI__) && defined(__AVX512VL__)) || defined(INT8DOT_RUNTIME_DISPATCH)
+        case Kernel::Avx512Vnni:
+            return _dotAvx512Vnni(inTaps, inOffset, inWeights, inNumTaps, inLength);
+#endif
+#if defined(__AVXVNNI__) || defined(INT8DOT_RUNTIME_DISPATCH)
+        case Kernel::AvxVnni:
+            return _dotAvxVnni(inTaps, inOffset, inWeights, inNumTaps, inLength);
+#endif
+#if defined(__SSSE3__) || defined(INT8DOT_RUNTIME_DISPATCH)
+        case Kernel::Ssse3:
+            return _dotSsse3(inTaps, inOffset, inWeights, inNumTaps, inLength);
+#endif
+#if defined(__SSE2__) || defined(__x86_64__)
+        case Kernel::Sse2:
+            return _dotSse2(inTaps, inOffset, inWeights, inNumTaps, inLength);
+#endif
+#if defined(__ARM_FEATURE_DOTPROD)
+        case Kernel::NeonDot:
+            return _dotNeonDot(inTaps, inOffset, inWeights, inNumTaps, inLength);
+#endif
+        default:
+            return _dotScalar(inTaps, inOffset, inWeights, inNumTaps, inLength);
+    }
+}
+
+/**
+ * Sum of the dot products between inNumTaps pairs of vectors, with the fastest kernel available.
+ * @param inTaps Activation vectors, each read from inOffset
+ * @param inOffset Offset applied to each activation vector
+ * @param inWeights Weight vectors, inLength elements each, one after the other
+ * @param inNumTaps Number of (activation, weight) vector pairs
+ * @param inLength Length of each vector, multiple of BlockSize
+ * @return Sum of dot products
+ */
+static inline int32_t dot(
+    const int8_t* const* inTaps, int inOffset, const int8_t* inWeights, int inNumTaps, int inLength)
+{
+    return dot(getKernel(), inTaps, inOffset, inWeights, inNumTaps, inLength);
+}
+} // namespace Int8Dot
+
+/**
+ * Int8 version of FusedConv2D (same template parameters, same float input and output layout).
+ * Inputs are quantised to [0, 127] with a scale and a zero point per input channel, set from calibration. The zero
+ * point is 0 for non-negative inputs (ReLU and sigmoid outputs) and moves 0 up the integer range for inputs that go
+ * below 0 (the stacked CQT after batch normalisation). Input scales are folded into the weights, which are then
+ * quantised symmetrically with one scale per output channel. The dot products of the zero points with the weights
+ * are subtracted from the int32 accumulators, which are then dequantised, biased and activated in float.
+ */
+template <int InCh,
+          int OutCh,
+          int NumFeatIn,
+          int KernelTime,
+          int KernelFeat,
+          int Dilation,
+          int Stride,
+          typename Activation>
+class QuantizedConv2D
+{
+public:
+    static constexpr int NumFeatOut = (NumFeatIn + Stride - 1) / Stride;
+    static constexpr int PadLeft = std::max(0, (NumFeatOut - 1) * Stride + KernelFeat - NumFeatIn) / 2;
+    static constexpr int NumFeatPadded = (NumFeatOut - 1) * Stride + KernelFeat;
+    static constexpr int ReceptiveField = (KernelTime - 1) * Dilation + 1;
+    static constexpr int WindowSize = KernelFeat * InCh;
+    // Window rounded up to the dot product block size. Extra weights are 0 and extra inputs read past the window
+    // stay inside the frame thanks to the tail padding.
+    static constexpr int WindowSizePadded =
+        (WindowSize + Int8Dot::BlockSize - 1) / Int8Dot::BlockSize * Int8Dot::BlockSize;
+    static constexpr int FrameSize = NumFeatPadded * InCh + (WindowSizePadded - WindowSize);
+    static constexpr int InSize = NumFeatIn * InCh;
+    static constexpr int OutSize = NumFeatOut * OutCh;
+
+    /**
+     * Set the quantisation of each input channel from calibration. Must be called before setWeights, which folds
+     * the input scales into the weights. Resets the layer.
+     * @param inMinInputs Smallest input value expected on each of the InCh channels. Smaller values are clipped.
+     * @param inMaxInputs Largest input value expected on each of the InCh channels. Larger values are clipped.
+     */
+    void setInputRanges(const float* inMinInputs, const float* inMaxInputs)
+    {
+        for (int c = 0; c < InCh; c++) {
+            // 0 must be exact: it is the padding and the input before the first frame
+            const float min_input = std::min(inMinInputs[c], 0.0f);
+            const float max_input = std::max(inMaxInputs[c], 0.0f);
+            const float range = max_input - min_input;
+            const float scale = range > 0.0f ? range / 127.0f : 1.0f / 127.0f;
+            const auto zero_point = static_cast<int>(std::round(-min_input / scale));
+
+            mInputScales[(size_t) c] = scale;
+            mInputZeroPoints[(size_t) c] = static_cast<int8_t>(zero_point);
+            mInvInputScales[(size_t) c] = 1.0f / scale;
+            // Rounding offset included: values are non-negative where they are not clipped, truncation rounds them
+            mInputOffsets[(size_t) c] = static_cast<float>(zero_point) + 0.5f;
+        }
+
+        for (int i = 0; i < FrameSize; i++) {
+            mZeroFrame[(size_t) i] = i < NumFeatPadded * InCh ? mInputZeroPoints[(size_t) (i % InCh)] : 0;
+        }
+
+        reset();
+    }
+
+    /**
+     * Quantise kernel weights, with the input scales folded in and one scale per output channel.
+     * @param inWeights Kernel in tensorflow layout: [KernelTime][KernelFeat][InCh][OutCh]
+     */
+    void setWeights(const std::vector<std::vector<std::vector<std::vector<float>>>>& inWeights)
+    {
+        assert(inWeights.size() == KernelTime);
+
+        for (int o = 0; o < OutCh; o++) {
+            float max_abs = 0.0f;
+            for (const auto& kernel_feat: inWeights) {
+                for (const auto& in_channels: kernel_feat) {
+                    for (int c = 0; c < InCh; c++) {
+                        max_abs = std::max(max_abs,
+                                           std::abs(in_channels[(size_t) c][(size_t) o] * mInputScales[(size_t) c]));
+                    }
+                }
+            }
+
+            mWeightScales[(size_t) o] = max_abs > 0.0f ? max_abs / 127.0f : 1.0f;
+            mZeroPointSums[(size_t) o] = 0;
+
+            for (int k = 0; k < KernelTime; k++) {
+                for (int j = 0; j < KernelFeat; j++) {
+                    for (int c = 0; c < InCh; c++) {
+                        const float w = inWeights[(size_t) k][(size_t) j][(size_t) c][(size_t) o]
+                                        * mInputScales[(size_t) c];
+                        const auto q = static_cast<int8_t>(std::round(w / mWeightScales[(size_t) o]));
+
+                        mWeights[(size_t) ((o * KernelTime + k) * WindowSizePadded + j * InCh + c)] = q;
+                        mZeroPointSums[(size_t) o] += q * mInputZeroPoints[(size_t) c];
+                    }
+                }
+            }
+        }
+    }
+
+    /**
+     * Set bias (kept in float).
+     * @param inBias One value per output channel.
+     */
+    void setBias(const std::vector<float>& inBias)
+    {
+        assert(inBias.size() == OutCh);
+        std::copy(inBias.begin(), inBias.end(), mBias.begin());
+    }
+
+    /**
+     * Restrict the computation to a range of output features, see FusedConv2D::setOutputRange.
+     * @param inBegin First output feature to compute
+     * @param inEnd One past the last output feature to compute
+     */
+    void setOutputRange(int inBegin, int inEnd)
+    {
+        assert(0 <= inBegin && inBegin <= inEnd && inEnd <= NumFeatOut);
+
+        mFeatBegin = inBegin;
+        mFeatEnd = inEnd;
+    }
+
+    /**
+     * Clear the frames stored for the time dimension of the kernel.
+     */
+    void reset()
+    {
+        // Frames of zeros (zero points)
+        for (auto& frame: mHistory) {
+            frame = mZeroFrame;
+        }
+
+        mOuts.fill(0.0f);
+        mHistoryIdx = 0;
+    }
+
+    /**
+     * Run the convolution for one new frame.
+     * @param inData Frame of InSize float elements.
+     */
+    void forward(const float* inData)
+    {
+        _quantize(inData);
+
+        std::array<const int8_t*, KernelTime> taps;
+        for (int k = 0; k < KernelTime; k++) {
+            int frame_idx = mHistoryIdx - (KernelTime - 1 - k) * Dilation;
+            frame_idx = frame_idx < 0 ? frame_idx + ReceptiveField : frame_idx;
+            taps[(size_t) k] = mHistory[(size_t) frame_idx].data();
+        }
+
+        const Int8Dot::Kernel kernel = Int8Dot::getKernel();
+
+        for (int o = 0; o < OutCh; o++) {
+            const int8_t* w = mWeights.data() + o * KernelTime * WindowSizePadded;
+            const float dequantize = mWeightScales[(size_t) o];
+            const int32_t zero_point_sum = mZeroPointSums[(size_t) o];
+
+            for (int f = mFeatBegin; f < mFeatEnd; f++) {
+                const int32_t acc =
+                    Int8Dot::dot(kernel, taps.data(), f * Stride * InCh, w, KernelTime, WindowSizePadded)
+                    - zero_point_sum;
+                mOuts[(size_t) (f * OutCh + o)] = static_cast<float>(acc) * dequantize + mBias[(size_t) o];
+            }
+        }
+
+        for (int i = mFeatBegin * OutCh; i < mFeatEnd * OutCh; i++) {
+            mOuts[(size_t) i] = Activation::apply(mOuts[(size_t) i]);
+        }
+
+        mHistoryIdx = (mHistoryIdx == ReceptiveField - 1) ? 0 : mHistoryIdx + 1;
+    }
+
+    /**
+     * Store a new frame without running the convolution, see FusedConv2D::push.
+     * @param inData Frame of InSize float elements.
+     */
+    void push(const float* inData)
+    {
+        _quantize(inData);
+
+        mHistoryIdx = (mHistoryIdx == ReceptiveField - 1) ? 0 : mHistoryIdx + 1;
+    }
+
+    /**
+     * @return Pointer to the OutSize outputs of the last forward call.
+     */
+    const float* getOutputs() const { return mOuts.data(); }
+
+private:
+    /**
+     * @return Array of Size elements equal to inValue
+     */
+    template <int Size>
+    static std::array<float, Size> _filled(float inValue)
+    {
+        std::array<float, Size> array;
+        array.fill(inValue);
+        return array;
+    }
+
+    /**
+     * Quantise a frame into the history at mHistoryIdx.
+     */
+    void _quantize(const float* inData)
+    {
+        int8_t* frame = mHistory[(size_t) mHistoryIdx].data() + PadLeft * InCh;
+
+        // Round and clip in the integer domain so that the loop is vectorised
+        for (int f = 0; f < NumFeatIn; f++) {
+            for (int c = 0; c < InCh; c++) {
+                int q = static_cast<int>(inData[f * InCh + c] * mInvInputScales[(size_t) c]
+                                         + mInputOffsets[(size_t) c]);
+                q = q < 0 ? 0 : q;
+                q = q > 127 ? 127 : q;
+                frame[f * InCh + c] = static_cast<int8_t>(q);
+            }
+        }
+    }
+
+    // [OutCh][KernelTime][WindowSizePadded] so that each dot product reads contiguous weights
+    alignas(32) std::array<int8_t, OutCh * KernelTime * WindowSizePadded> mWeights {};
+    // Dequantisation of the accumulators (input and weight scales)
+    std::array<float, OutCh> mWeightScales {};
+    // Dot product of the zero points with the quantised weights of each output channel
+    std::array<int32_t, OutCh> mZeroPointSums {};
+    std::array<float, OutCh> mBias {};
+
+    // Input quantisation of each channel, see setInputRanges. Until then, inputs are expected in [0, 1].
+    std::array<float, InCh> mInputScales = _filled<InCh>(1.0f / 127.0f);
+    std::array<float, InCh> mInvInputScales = _filled<InCh>(127.0f);
+    std::array<float, InCh> mInputOffsets = _filled<InCh>(0.5f);
+    std::array<int8_t, InCh> mInputZeroPoints {};
+    std::array<int8_t, FrameSize> mZeroFrame {};
+
+    alignas(32) std::array<std::array<int8_t, FrameSize>, ReceptiveField> mHistory {};
+    int mHistoryIdx = 0;
+
+    alignas(32) std::array<float, OutSize> mOuts {};
+
+    // Range of output features computed
+    int mFeatBegin = 0;
+    int mFeatEnd = NumFeatOut;
+};
+
+#endif // QuantizedConv2D_h
@@ -7,13 +7,17 @@
 
 #include <JuceHeader.h>
 
+#include <cstdint>
+#include <initializer_list>
+
 namespace NoteUtils
 {
 static const juce::StringArray RootNotesSharpStr {"A", "A#", "B", "C", "C#", "D", "D#", "E", "F", "F#", "G", "G#"};
 
 static const juce::StringArray RootNotesFlatStr {"A", "Bb", "B", "C", "Db", "D", "Eb", "E", "F", "Gb", "G", "Ab"};
 
-enum RootNote { A = 0, A_sharp, B, C, C_sharp, D, D_sharp, E, F_sharp, F, G_sharp, G, TotalNumRootNotes };
+// Semitones above A, same order as RootNotesSharpStr
+enum RootNote { A = 0, A_sharp, B, C, C_sharp, D, D_sharp, E, F, F_sharp, G, G_sharp, TotalNumRootNotes };
 
 static const juce::StringArray ScaleTypesStr {"Chromatic",
                                               "Major",
@@ -48,10 +52,54 @@ enum ScaleType {
     TotalNumScaleTypes
 };
 
+/**
+ * @param inIntervals Semitones above the root note
+ * @return Mask with bit i set if i is in inIntervals
+ */
+static constexpr uint16_t intervalsToMask(std::initializer_list<int> inIntervals)
+{
+    uint16_t mask = 0;
+    for (int interval: inIntervals)
+        mask |= static_cast<uint16_t>(1 << interval);
+    return mask;
+}
+
+// Pitch classes of each ScaleType: bit i is set if the scale contains the note i semitones above its root
+static constexpr uint16_t ScaleMasks[TotalNumScaleTypes] {intervalsToMask({0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11}),
+                                                          intervalsToMask({0, 2, 4, 5, 7, 9, 11}),
+                                                          intervalsToMask({0, 2, 3, 5, 7, 8, 10}),
+                                                          intervalsToMask({0, 2, 3, 5, 7, 9, 10}),
+                                                          intervalsToMask({0, 2, 4, 5, 7, 9, 10}),
+                                                          intervalsToMask({0, 2, 4, 6, 7, 9, 11}),
+                                                          intervalsToMask({0, 1, 3, 5, 7, 8, 10}),
+                                                          intervalsToMask({0, 1, 3, 5, 6, 8, 10}),
+                                                          intervalsToMask({0, 3, 5, 6, 7, 10}),
+                                                          intervalsToMask({0, 3, 5, 7, 10}),
+                                                          intervalsToMask({0, 2, 4, 7, 9}),
+                                                          intervalsToMask({0, 2, 3, 5, 7, 9, 11}),
+                                                          intervalsToMask({0, 2, 3, 5, 7, 8, 11}),
+                                                          intervalsToMask({0, 2, 4, 5, 7, 8, 11})};
+
 static const juce::StringArray SnapModesStr {"Adjust", "Remove"};
 
+/**
+ * What happens to notes out of the scale. Adjust: moved to the nearest note of the scale. Remove: ignored.
+ */
 enum SnapMode { Adjust = 0, Remove };
 
+/**
+ * @param inMidiNote Midi note number
+ * @param inRootNote Root note of the scale
+ * @param inScaleType Scale type
+ * @return True if the note belongs to the scale
+ */
+static inline bool isInScale(int inMidiNote, RootNote inRootNote, ScaleType inScaleType)
+{
+    // Midi note 21 is A0 and root notes are counted from A
+    const int semitonesAboveRoot = ((inMidiNote - 21 - static_cast<int>(inRootNote)) % 12 + 12) % 12;
+    return ((ScaleMasks[inScaleType] >> semitonesAboveRoot) & 1) != 0;
+}
+
 static String midiNoteToStr(int inNoteNumber)
 {
     const int octave = (inNoteNumber / 12) - 1;
@@ -5,6 +5,10 @@ ControlPanelComponent::ControlPanelComponent(juce::AudioProcessorValueTreeState&
                         "Higher values make detection more eager.", vts),
       splitSensitivitySlider("Split", "splitSensitivity",
                              "Higher values split notes more aggressively.", vts),
+      minPitchSlider("Low Note", "minPitch",
+                     "Lowest MIDI note detected. A narrower range is cheaper to run.", vts),
+      maxPitchSlider("High Note", "maxPitch",
+                     "Highest MIDI note detected. A narrower range is cheaper to run.", vts),
       minNoteDurationSlider("Min Dur", "minNoteDurationMs",
                             "Minimum note length in milliseconds.", vts),
       latencySlider("Latency", "latencySeconds",
@@ -29,6 +33,8 @@ ControlPanelComponent::ControlPanelComponent(juce::AudioProcessorValueTreeState&
 
     addAndMakeVisible(sensitivitySlider);
     addAndMakeVisible(splitSensitivitySlider);
+    addAndMakeVisible(minPitchSlider);
+    addAndMakeVisible(maxPitchSlider);
     addAndMakeVisible(minNoteDurationSlider);
     addAndMakeVisible(latencySlider);
     addAndMakeVisible(minVelocitySlider);
@@ -44,7 +50,7 @@ void ControlPanelComponent::resized()
     auto area = getLocalBounds().reduced(8, 10);
     const int labelHeight = 18;
     const int gap = 8;
-    const int totalSliders = 5;
+    const int totalSliders = 7;
     const int totalLabels = 3;
     const int totalGaps = totalSliders + totalLabels + 4;
     const int sliderHeight = (area.getHeight() - (totalLabels * labelHeight) - (totalGaps * gap)) / totalSliders;
@@ -54,6 +60,10 @@ void ControlPanelComponent::resized()
     sensitivitySlider.setBounds(area.removeFromTop(sliderHeight));
     area.removeFromTop(gap);
     splitSensitivitySlider.setBounds(area.removeFromTop(sliderHeight));
+    area.removeFromTop(gap);
+    minPitchSlider.setBounds(area.removeFromTop(sliderHeight));
+    area.removeFromTop(gap);
+    maxPitchSlider.setBounds(area.removeFromTop(sliderHeight));
 
     area.removeFromTop(gap);
     timeLabel.setBounds(area.removeFromTop(labelHeight));
@@ -18,6 +18,8 @@ private:
 
     ParamSliderComponent sensitivitySlider;
     ParamSliderComponent splitSensitivitySlider;
+    ParamSliderComponent minPitchSlider;
+    ParamSliderComponent maxPitchSlider;
     ParamSliderComponent minNoteDurationSlider;
     ParamSliderComponent latencySlider;
     ParamSliderComponent minVelocitySlider;
@@ -0,0 +1,123 @@
+// InputStage.cpp
+#include "InputStage.h"
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+// Sums and peaks are kept per lane of this many consecutive samples so that the loop below is vectorised
+constexpr int numLanes = 8;
+
+/** mono = gain * sum of the channels, with the sum of squares and the peak of each lane.
+ * NumChannels is the channel count when known at compile time (the channel loop is unrolled), 0 otherwise */
+template <int NumChannels>
+void downmixLanes(const float* const* channels, int numChannels, int startSample, int numSamples, float gain,
+                  float* mono, float* laneSumSquares, float* lanePeaks)
+{
+    const int channelCount = NumChannels > 0 ? NumChannels : numChannels;
+    int i = 0;
+    for (; i + numLanes <= numSamples; i += numLanes)
+    {
+        for (int k = 0; k < numLanes; ++k)
+        {
+            float value = channels[0][startSample + i + k];
+            for (int ch = 1; ch < channelCount; ++ch)
+                value += channels[ch][startSample + i + k];
+            value *= gain;
+            mono[i + k] = value;
+            laneSumSquares[k] += value * value;
+            lanePeaks[k] = std::max(lanePeaks[k], std::abs(value));
+        }
+    }
+    for (; i < numSamples; ++i)
+    {
+        float value = channels[0][startSample + i];
+        for (int ch = 1; ch < channelCount; ++ch)
+            value += channels[ch][startSample + i];
+        value *= gain;
+        mono[i] = value;
+        laneSumSquares[0] += value * value;
+        lanePeaks[0] = std::max(lanePeaks[0], std::abs(value));
+    }
+}
+}
+
+void InputStage::prepare(double sampleRate, int blockSize)
+{
+    maxBlockSize = std::max(1, blockSize);
+    resampler.prepareToPlay(sampleRate, maxBlockSize, BASIC_PITCH_SAMPLE_RATE);
+    maxNumOutSamples = resampler.getMaxNumOutSamples(maxBlockSize);
+    mono.assign((size_t) maxBlockSize, 0.0f);
+    resampled.assign((size_t) maxNumOutSamples, 0.0f);
+    sumSquares = 0.0;
+    rms = 0.0f;
+    peak = 0.0f;
+}
+
+void InputStage::downmixAndMeter(const juce::AudioBuffer<float>& buffer, int startSample, int numSamples)
+{
+    const int numChannels = buffer.getNumChannels();
+    if (numChannels == 0)
+    {
+        std::fill_n(mono.data(), numSamples, 0.0f);
+        return;
+    }
+
+    const float* const* channels = buffer.getArrayOfReadPointers();
+    const float gain = 1.0f / static_cast<float>(numChannels);
+    float laneSumSquares[numLanes] = { 0.0f };
+    float lanePeaks[numLanes] = { 0.0f };
+
+    if (numChannels == 1)
+        downmixLanes<1>(channels, numChannels, startSample, numSamples, gain, mono.data(), laneSumSquares, lanePeaks);
+    else if (numChannels == 2)
+        downmixLanes<2>(channels, numChannels, startSample, numSamples, gain, mono.data(), laneSumSquares, lanePeaks);
+    else
+        downmixLanes<0>(channels, numChannels, startSample, numSamples, gain, mono.data(), laneSumSquares, lanePeaks);
+
+    for (int k = 0; k < numLanes; ++k)
+    {
+        sumSquares += laneSumSquares[k];
+        peak = std::max(peak, lanePeaks[k]);
+    }
+}
+
+void InputStage::process(const juce::AudioBuffer<float>& buffer, Transcriber& transcriber)
+{
+    const int numSamples = buffer.getNumSamples();
+    sumSquares = 0.0;
+    peak = 0.0f;
+
+    for (int start = 0; start < numSamples; start += maxBlockSize)
+    {
+        const int numIn = std::min(maxBlockSize, numSamples - start);
+        const double sumSquaresBefore = sumSquares;
+        downmixAndMeter(buffer, start, numIn);
+
+        const float partRMS = (float) std::sqrt((sumSquares - sumSquaresBefore) / numIn);
+        const bool gated = juce::Decibels::gainToDecibels(partRMS) < gateThresholdDb;
+
+        const int numOut = resampler.getNumOutSamplesOnNextProcessBlock(numIn);
+        int numFree = 0;
+        float* destination = transcriber.getCaptureWritePointer(numFree);
+
+        if (destination != nullptr && numOut <= numFree)
+        {
+            resampler.processBlock(mono.data(), destination, numIn);
+            if (gated)
+                std::fill_n(destination, numOut, 0.0f);
+            transcriber.commitCapturedAudio(numOut);
+        }
+        else
+        {
+            // the capture buffer fills up within this block, or the transcriber is busy and drops it.
+            // The resampler still runs so that its state follows the input
+            resampler.processBlock(mono.data(), resampled.data(), numIn);
+            if (gated)
+                std::fill_n(resampled.data(), numOut, 0.0f);
+            transcriber.queueAudioForTranscription(resampled.data(), numOut, BASIC_PITCH_SAMPLE_RATE);
+        }
+    }
+
+    rms = numSamples > 0 ? (float) std::sqrt(sumSquares / numSamples) : 0.0f;
+}
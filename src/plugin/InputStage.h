@@ -0,0 +1,45 @@
+
+// InputStage.h
+#pragma once
+
+#include <JuceHeader.h>
+#include <vector>
+#include "Resampler.h"
+#include "Transcriber.h"
+
+/** Audio thread input of the transcriber. The host channels are downmixed to mono and metered (RMS and peak) in a
+ * single pass, then resampled to BASIC_PITCH_SAMPLE_RATE straight into the capture buffer of the transcriber.
+ * Blocks quieter than gateThresholdDb are sent as silence. Nothing is allocated after prepare. */
+class InputStage
+{
+public:
+    /** blocks with an RMS level below this are sent to the transcriber as silence */
+    static constexpr float gateThresholdDb = -45.0f;
+
+    void prepare(double sampleRate, int blockSize);
+    /** the most samples at BASIC_PITCH_SAMPLE_RATE a block of the prepared size can give */
+    int getMaxNumOutSamples() const { return maxNumOutSamples; }
+
+    /** downmix, meter, resample and gate the block, then write it into the transcriber. Blocks longer than the
+     * prepared size are processed in parts */
+    void process(const juce::AudioBuffer<float>& buffer, Transcriber& transcriber);
+
+    /** levels of the mono downmix over the last processed block */
+    float getRMS() const { return rms; }
+    float getPeak() const { return peak; }
+
+private:
+    /** average the channels into mono and accumulate sumSquares and peak over the numSamples from startSample */
+    void downmixAndMeter(const juce::AudioBuffer<float>& buffer, int startSample, int numSamples);
+
+    Resampler resampler;
+    std::vector<float> mono;
+    // used when the resampled block does not fit in the rest of the capture buffer
+    std::vector<float> resampled;
+    int maxBlockSize = 0;
+    int maxNumOutSamples = 0;
+
+    double sumSquares = 0.0;
+    float rms = 0.0f;
+    float peak = 0.0f;
+};
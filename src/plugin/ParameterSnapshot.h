@@ -0,0 +1,41 @@
+
+// ParameterSnapshot.h
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+/** Hands a value from one writer thread to one reader thread as a whole (a triple buffer): the writer publishes
+ * complete copies, the reader gets the latest copy published. Neither side waits or allocates and the reader never
+ * sees a copy that the writer is still filling, so a group of parameters changes all at once. */
+template <typename ValueType>
+class ParameterSnapshot
+{
+public:
+    explicit ParameterSnapshot(const ValueType& initialValue = ValueType{}) { slots.fill(initialValue); }
+
+    /** writer thread only */
+    void publish(const ValueType& value)
+    {
+        slots[(std::size_t) writeSlot] = value;
+        writeSlot = latestSlot.exchange(writeSlot | freshFlag, std::memory_order_acq_rel) & slotMask;
+    }
+
+    /** reader thread only: the latest value published. The reference stays valid until the next call */
+    const ValueType& read()
+    {
+        if ((latestSlot.load(std::memory_order_relaxed) & freshFlag) != 0)
+            readSlot = latestSlot.exchange(readSlot, std::memory_order_acq_rel) & slotMask;
+        return slots[(std::size_t) readSlot];
+    }
+
+private:
+    static constexpr int slotMask = 3;
+    static constexpr int freshFlag = 4; // set when latestSlot holds a copy the reader has not taken yet
+
+    std::array<ValueType, 3> slots;
+    int writeSlot = 0;
+    std::atomic<int> latestSlot { 1 };
+    int readSlot = 2;
+};
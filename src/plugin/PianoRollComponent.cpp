@@ -59,6 +59,25 @@ void PianoRollComponent::clear()
         note = ActiveNote{};
 }
 
+void PianoRollComponent::showRederivedNotes(const NoteEvents& events, double endTimeSeconds, double spanSeconds)
+{
+    if (!isFrozen)
+        return;
+
+    rederivedNotes.clear();
+    const double spanStart = endTimeSeconds - spanSeconds;
+    for (const auto event : events)
+    {
+        NoteBar bar;
+        bar.note = event.pitch;
+        bar.velocity = static_cast<float>(event.amplitude);
+        bar.startTime = spanStart + event.startTime;
+        bar.endTime = spanStart + event.endTime;
+        rederivedNotes.push_back(bar);
+    }
+    repaint();
+}
+
 void PianoRollComponent::setTimeWindowSeconds(double seconds)
 {
     timeWindowSeconds = juce::jlimit(2.0, 20.0, seconds);
@@ -126,10 +145,11 @@ void PianoRollComponent::paint(juce::Graphics& g)
         g.fillRoundedRectangle(rect, 3.0f);
     };
 
-    for (const auto& event : noteHistory)
+    const bool showRederived = isFrozen && !rederivedNotes.empty();
+    for (const auto& event : showRederived ? rederivedNotes : noteHistory)
         drawEvent(event, false);
 
-    for (size_t i = 0; i < activeNotes.size(); ++i)
+    for (size_t i = 0; i < activeNotes.size() && !showRederived; ++i)
     {
         const auto& note = activeNotes[i];
         if (!note.active)
@@ -165,25 +185,29 @@ void PianoRollComponent::mouseDown(const juce::MouseEvent& event)
 {
     juce::ignoreUnused(event);
     grabKeyboardFocus();
-    isFrozen = !isFrozen;
-    if (isFrozen)
-        freezeTimeSeconds = currentTimeSeconds;
-    repaint();
+    toggleFrozen();
 }
 
 bool PianoRollComponent::keyPressed(const juce::KeyPress& key)
 {
     if (key == juce::KeyPress::spaceKey)
     {
-        isFrozen = !isFrozen;
-        if (isFrozen)
-            freezeTimeSeconds = currentTimeSeconds;
-        repaint();
+        toggleFrozen();
         return true;
     }
     return false;
 }
 
+void PianoRollComponent::toggleFrozen()
+{
+    isFrozen = !isFrozen;
+    if (isFrozen)
+        freezeTimeSeconds = currentTimeSeconds;
+    else
+        rederivedNotes.clear();
+    repaint();
+}
+
 void PianoRollComponent::timerCallback()
 {
     if (isFrozen)
@@ -216,7 +240,8 @@ void PianoRollComponent::updateTooltipForPoint(juce::Point<float> point)
         return rect.contains(point);
     };
 
-    for (const auto& event : noteHistory)
+    const bool showRederived = isFrozen && !rederivedNotes.empty();
+    for (const auto& event : showRederived ? rederivedNotes : noteHistory)
     {
         if (hitTest(event, false))
         {
@@ -231,7 +256,7 @@ void PianoRollComponent::updateTooltipForPoint(juce::Point<float> point)
         }
     }
 
-    for (size_t i = 0; i < activeNotes.size(); ++i)
+    for (size_t i = 0; i < activeNotes.size() && !showRederived; ++i)
     {
         const auto& note = activeNotes[i];
         if (!note.active)
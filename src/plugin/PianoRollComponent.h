@@ -3,6 +3,7 @@
 #include <JuceHeader.h>
 #include <array>
 #include <vector>
+#include "NoteEvents.h"
 
 class PianoRollComponent : public juce::Component,
                            private juce::Timer
@@ -15,8 +16,16 @@ public:
     void clear();
 
     void setTimeWindowSeconds(double seconds);
+    double getTimeWindowSeconds() const { return timeWindowSeconds; }
     double getLastNoteEventTimeSeconds() const;
 
+    /** frozen by a click or the space bar: the view stops at getFreezeTimeSeconds() */
+    bool isFrozenView() const { return isFrozen; }
+    double getFreezeTimeSeconds() const { return freezeTimeSeconds; }
+    /** while frozen, show these notes instead of the ones played, e.g. notes re-derived with other parameters.
+     * Event times count from endTimeSeconds - spanSeconds. Unfreezing goes back to the notes played */
+    void showRederivedNotes(const NoteEvents& events, double endTimeSeconds, double spanSeconds);
+
     void paint(juce::Graphics& g) override;
     void resized() override;
     void mouseMove(const juce::MouseEvent& event) override;
@@ -42,6 +51,7 @@ private:
 
     void timerCallback() override;
     void pruneOldNotes(double currentTime);
+    void toggleFrozen();
     void updateTooltipForPoint(juce::Point<float> point);
     juce::Rectangle<float> noteRectForEvent(const NoteBar& noteEvent, double currentTime) const;
     float noteToY(int note, const juce::Rectangle<float>& area) const;
@@ -50,6 +60,7 @@ private:
 
     std::array<ActiveNote, 128> activeNotes;
     std::vector<NoteBar> noteHistory;
+    std::vector<NoteBar> rederivedNotes;
 
     double timeWindowSeconds = 8.0;
     double lastNoteEventTime = 0.0;
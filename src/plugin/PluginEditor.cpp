@@ -96,4 +96,16 @@ void AudioPluginAudioProcessorEditor::timerCallback()
             state = HeaderComponent::StatusState::Low;
     }
     header.setStatus(state);
+
+    const std::array<float, 3> noteThresholds { valueTreeState.getRawParameterValue("noteSensitivity")->load(),
+                                                valueTreeState.getRawParameterValue("splitSensitivity")->load(),
+                                                valueTreeState.getRawParameterValue("minNoteDurationMs")->load() };
+    if (noteThresholds != lastNoteThresholds && pianoRoll.isFrozenView())
+    {
+        // the notes of the frozen view with the new thresholds, from the posteriorgrams of the audio heard since
+        const double seconds = pianoRoll.getTimeWindowSeconds() + now - pianoRoll.getFreezeTimeSeconds();
+        const double span = processorRef.rederiveRecentNotes(seconds, rederivedEvents);
+        pianoRoll.showRederivedNotes(rederivedEvents, now, span);
+    }
+    lastNoteThresholds = noteThresholds;
 }
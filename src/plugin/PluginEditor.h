@@ -42,6 +42,9 @@ private:
     juce::TooltipWindow tooltipWindow { this, 700 };
 
     float lastRms = 0.0f;
+    // note thresholds at the last timer tick: while the roll is frozen, a change re-derives the notes shown
+    std::array<float, 3> lastNoteThresholds {};
+    NoteEvents rederivedEvents;
 
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (AudioPluginAudioProcessorEditor)
 };
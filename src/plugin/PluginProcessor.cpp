@@ -1,6 +1,7 @@
 #include "PluginProcessor.h"
 #include "PluginEditor.h"
 #include "juce_audio_basics/juce_audio_basics.h"
+#include <limits>
 
 //==============================================================================
 AudioPluginAudioProcessor::AudioPluginAudioProcessor()
@@ -41,7 +42,51 @@ AudioPluginAudioProcessor::AudioPluginAudioProcessor()
                 0.1f), // default value
               std::make_unique<juce::AudioParameterBool> ("TrackingToggle", // parameterID
                   "Enable Tracking", // parameter name
-                  false) // default value
+                  false), // default value
+            std::make_unique<juce::AudioParameterInt> ("minPitch", // parameterID
+                "minPitch", // parameter name
+                MIN_MIDI_NOTE, // minimum value
+                MAX_MIDI_NOTE, // maximum value
+                MIN_MIDI_NOTE), // default value
+            std::make_unique<juce::AudioParameterInt> ("maxPitch", // parameterID
+                "maxPitch", // parameter name
+                MIN_MIDI_NOTE, // minimum value
+                MAX_MIDI_NOTE, // maximum value
+                MAX_MIDI_NOTE), // default value
+              std::make_unique<juce::AudioParameterBool> ("StreamingToggle", // parameterID
+                  "Streaming Note Detection", // parameter name
+                  false), // default value
+              std::make_unique<juce::AudioParameterBool> ("MPEToggle", // parameterID
+                  "MPE Output with Pitch Bends", // parameter name
+                  false), // default value
+              std::make_unique<juce::AudioParameterBool> ("InCallbackToggle", // parameterID
+                  "Transcribe in the Audio Callback", // parameter name
+                  false), // default value
+            std::make_unique<juce::AudioParameterFloat> ("callbackBudget", // parameterID
+                "callbackBudget", // parameter name
+                0.05f, // minimum value
+                0.9f, // maximum value
+                0.25f), // default value
+            std::make_unique<juce::AudioParameterChoice> ("scaleType", // parameterID
+                "Scale", // parameter name
+                NoteUtils::ScaleTypesStr, // choices
+                NoteUtils::Chromatic), // default index
+            std::make_unique<juce::AudioParameterChoice> ("rootNote", // parameterID
+                "Scale Root", // parameter name
+                NoteUtils::RootNotesSharpStr, // choices
+                NoteUtils::C), // default index
+            std::make_unique<juce::AudioParameterChoice> ("snapMode", // parameterID
+                "Out of Scale Notes", // parameter name
+                NoteUtils::SnapModesStr, // choices
+                NoteUtils::Adjust), // default index
+            std::make_unique<juce::AudioParameterChoice> ("qualityTier", // parameterID
+                "Quality", // parameter name
+                juce::StringArray {"Full", "Eco 1/2", "Eco 1/4"}, // choices: CNN decimation factor 1, 2, 4
+                0), // default index
+            std::make_unique<juce::AudioParameterChoice> ("cnnEngine", // parameterID
+                "CNN Engine", // parameter name
+                juce::StringArray {"Float32", "Float16 storage", "Int8"}, // choices: FusedEngine, FusedHalfEngine, Int8Engine
+                0) // default index
           }), sampleOffset{0}
 {
     transcriber = std::make_unique<Transcriber>();
@@ -53,6 +98,10 @@ AudioPluginAudioProcessor::AudioPluginAudioProcessor()
     noteSensitivityParameter = parameters.getRawParameterValue ("noteSensitivity");
     splitSensitivityParameter = parameters.getRawParameterValue ("splitSensitivity");
     latencySecondsParameter = parameters.getRawParameterValue ("latencySeconds");
+    minPitchParameter = parameters.getRawParameterValue ("minPitch");
+    maxPitchParameter = parameters.getRawParameterValue ("maxPitch");
+    inCallbackParameter = parameters.getRawParameterValue ("InCallbackToggle");
+    callbackBudgetParameter = parameters.getRawParameterValue ("callbackBudget");
 }
 
 AudioPluginAudioProcessor::~AudioPluginAudioProcessor()
@@ -127,19 +176,9 @@ void AudioPluginAudioProcessor::changeProgramName (int index, const juce::String
 
 void AudioPluginAudioProcessor::prepareToPlay (double sampleRate, int samplesPerBlock)
 {
-    // tell your resampler the incoming and target rates
-    resampleProcessor.prepareToPlay(sampleRate,
-                                    samplesPerBlock,
-                                    BASIC_PITCH_SAMPLE_RATE);
-
-    // 1) mono buffer: one channel, up to samplesPerBlock
-    internalMonoBuffer.setSize(1, samplesPerBlock, /*keepExisting*/ false,
-                                           /*clearExtra*/ true,
-                                           /*avoidRealloc*/ false);
-
-    // 2) downsampled buffer: one channel, enough to hold the max output
-    int maxDown = resampleProcessor.getNumOutSamplesOnNextProcessBlock(samplesPerBlock);
-    internalDownsampledBuffer.setSize(1, maxDown, false, true, false);
+    // downmix, resample and gate into the transcriber
+    inputStage.prepare(sampleRate, samplesPerBlock);
+    int maxDown = inputStage.getMaxNumOutSamples();
 
     // set transcriber buffer size to 
     // the closest multiple of 'maxDown' which is
@@ -149,12 +188,26 @@ void AudioPluginAudioProcessor::prepareToPlay (double sampleRate, int samplesPer
     while (transcriberBufSize < 22050){
         transcriberBufSize += maxDown;
     }
+    // no worker thread when transcribing in the callback, only switched here since it rebuilds the transcriber
+    const auto threading = *inCallbackParameter > 0.5f ? audioCallback : backgroundThread;
+    if (threading != transcriberThreading) {
+        const std::lock_guard<std::mutex> lock(transcriberRebuildMutex);
+        transcriber = std::make_unique<Transcriber>(threading);
+        transcriberThreading = threading;
+    }
+    // the only allocation of the transcriber, the latency changes from processBlock reuse these buffers
     transcriber->resetBuffersSamples(transcriberBufSize);
-    const float latencySeconds = latencySecondsParameter ? latencySecondsParameter->load() : 0.1f;
-    transcriber->setLatencySeconds(latencySeconds);
-    lastLatencySeconds = latencySeconds;
-
-    std::cout << "prepare to play sr: "<< getSampleRate() << " mono buff len " << internalMonoBuffer.getNumSamples() << " downsamp buff len: " << internalDownsampledBuffer.getNumSamples() << std::endl;
+    transcriberBufferSeconds = (float) (transcriberBufSize / BASIC_PITCH_SAMPLE_RATE);
+    renderingOffline = isNonRealtime();
+    transcriber->setWaitForTranscription(renderingOffline);
+    const float latencySeconds = renderingOffline ? transcriberBufferSeconds
+                                                  : (latencySecondsParameter ? latencySecondsParameter->load() : 0.1f);
+    lastLatencySeconds = transcriber->setLatencySeconds(latencySeconds) ? latencySeconds : -1.0f;
+    // no allocation when MIDI is collected in processBlock
+    pendingMidi.ensureSize(Transcriber::midiBufferBytes);
+    collectedMidi.ensureSize(Transcriber::midiBufferBytes);
+
+    std::cout << "prepare to play sr: "<< getSampleRate() << " block len " << samplesPerBlock << " max downsampled len: " << maxDown << std::endl;
 }
 
 void AudioPluginAudioProcessor::releaseResources()
@@ -193,56 +246,61 @@ void AudioPluginAudioProcessor::processBlock (juce::AudioBuffer<float>& buffer,
 {
     juce::ScopedNoDenormals noDenormals;
 
-    const int numInputChannels = buffer.getNumChannels();
     const int numInputSamples  = buffer.getNumSamples();
 
     if (sendMidiPanicNext.exchange(false)) {
         sendMidiPanic(midiMessages, 0);
     }
 
-    pushRMSForGUI(buffer.getRMSLevel(0,0,buffer.getNumSamples()));
-    
     float noteSensitivity = *parameters.getRawParameterValue("noteSensitivity");
     float splitSensitivity = *parameters.getRawParameterValue("splitSensitivity");
     float minNoteDuration = *parameters.getRawParameterValue("minNoteDurationMs");
     float minNoteVelocity = *parameters.getRawParameterValue("minNoteVelocity");
-    float latencySeconds = *parameters.getRawParameterValue("latencySeconds");
+    // offline renders wait for every window instead of dropping audio, so that bounces get all the notes. The
+    // latency does not matter there: whole windows are captured and the model runs as little as possible
+    const bool offline = isNonRealtime();
+    if (offline != renderingOffline) {
+        transcriber->setWaitForTranscription(offline);
+        renderingOffline = offline;
+    }
+    float latencySeconds = offline ? transcriberBufferSeconds : parameters.getRawParameterValue("latencySeconds")->load();
     bool tracking = *parameters.getRawParameterValue("TrackingToggle");
-
-    transcriber->setNoteSensitivity(noteSensitivity);
-    transcriber->setSplitSensitivity(splitSensitivity);
-    transcriber->setMinNoteDuration(minNoteDuration);
-    transcriber->setMinNoteVelocity(minNoteVelocity);
-    if (latencySeconds != lastLatencySeconds) {
-        transcriber->setLatencySeconds(latencySeconds);
+    bool streaming = *parameters.getRawParameterValue("StreamingToggle");
+    bool mpe = *parameters.getRawParameterValue("MPEToggle");
+    int scaleType = (int) parameters.getRawParameterValue("scaleType")->load();
+    int rootNote = (int) parameters.getRawParameterValue("rootNote")->load();
+    int snapMode = (int) parameters.getRawParameterValue("snapMode")->load();
+    int qualityTier = (int) parameters.getRawParameterValue("qualityTier")->load();
+    int cnnEngine = (int) parameters.getRawParameterValue("cnnEngine")->load();
+    int minPitch = (int) minPitchParameter->load();
+    int maxPitch = (int) maxPitchParameter->load();
+
+    // published as one snapshot: the transcriber never sees half of a change
+    Transcriber::Parameters transcriberParameters = transcriber->getParameters();
+    transcriberParameters.noteSensitivity = noteSensitivity;
+    transcriberParameters.splitSensitivity = splitSensitivity;
+    transcriberParameters.minNoteDurationMs = minNoteDuration;
+    transcriberParameters.minNoteVelocity = minNoteVelocity;
+    transcriberParameters.mode = streaming ? streamingMode : windowedMode;
+    transcriberParameters.mpeEnabled = mpe;
+    transcriberParameters.scaleType = static_cast<NoteUtils::ScaleType>(scaleType);
+    transcriberParameters.rootNote = static_cast<NoteUtils::RootNote>(rootNote);
+    transcriberParameters.snapMode = static_cast<NoteUtils::SnapMode>(snapMode);
+    // an inverted range is read as the same range the other way round
+    transcriberParameters.minPitch = std::min(minPitch, maxPitch);
+    transcriberParameters.maxPitch = std::max(minPitch, maxPitch);
+    transcriberParameters.cnnDecimation = 1 << std::clamp(qualityTier, 0, 2);
+    static constexpr CNNEngine cnnEngines[] = {FusedEngine, FusedHalfEngine, Int8Engine};
+    transcriberParameters.cnnEngine = cnnEngines[std::clamp(cnnEngine, 0, 2)];
+    transcriber->setParameters(transcriberParameters);
+    // queued for the worker, sent again on the next block if the queue is full
+    if (latencySeconds != lastLatencySeconds && transcriber->setLatencySeconds(latencySeconds)) {
         lastLatencySeconds = latencySeconds;
     }
 
-    internalMonoBuffer.copyFrom(0, 0, buffer, 0, 0, numInputSamples);
-    // add other channels
-    for (int ch = 1; ch < numInputChannels; ++ch)
-        internalMonoBuffer.addFrom(0, 0, buffer, ch, 0, numInputSamples);
-    // average
-    internalMonoBuffer.applyGain(1.0f / static_cast<float>(numInputChannels));
-    // internalMonoBuffer.applyGate(0.0f, 1.0f); // remove DC offset
-
-    const float* src = internalMonoBuffer.getReadPointer(0);
-    float*       dst = internalDownsampledBuffer.getWritePointer(0);
-    // the resample step 
-    int numDown = resampleProcessor.processBlock(src, dst, numInputSamples);
-    jassert(numDown <= internalDownsampledBuffer.getNumSamples());
-
-    // --- 3) Send into transcriber at the model's sample rate ---
-    // we know this buffer is at BASIC_PITCH_SAMPLE_RATE now:
-    // transcriber->storeAudio(internalDownsampledBuffer.getReadPointer(0), numDown, BASIC_PITCH_SAMPLE_RATE);
-    // queueAudioForTranscription(const float* inAudio, int numSamples, double sampleRate);
-    
-    // maybe apply a gate here? 
-    float resampleDB = Decibels::gainToDecibels(internalDownsampledBuffer.getRMSLevel(0, 0, internalDownsampledBuffer.getNumSamples()));
-    if (resampleDB < -45){
-        internalDownsampledBuffer.clear();
-    }
-    transcriber->queueAudioForTranscription(internalDownsampledBuffer.getReadPointer(0), numDown, BASIC_PITCH_SAMPLE_RATE);
+    // downmix, meter, resample to BASIC_PITCH_SAMPLE_RATE and gate in one go, straight into the transcriber
+    inputStage.process(buffer, *transcriber);
+    pushRMSForGUI(inputStage.getRMS());
 
     // --- 4) Pull out any MIDI the transcriber generated ---
     bool gotNewMIDI = collectMIDIFromTranscriber();
@@ -271,6 +329,13 @@ void AudioPluginAudioProcessor::processBlock (juce::AudioBuffer<float>& buffer,
     pendingMidi.clear (sampleOffset, numInputSamples);
     sampleOffset = endSample;
 
+    // no worker thread: the transcription gets a share of the block duration, all it needs when rendering offline
+    if (transcriberThreading == audioCallback) {
+        const double blockSeconds = numInputSamples / getSampleRate();
+        transcriber->runSlices(offline ? std::numeric_limits<double>::max()
+                                       : callbackBudgetParameter->load() * blockSeconds);
+    }
+
 }
 
 void AudioPluginAudioProcessor::pushNoteEventForUI(const juce::MidiMessage& msg)
@@ -320,13 +385,13 @@ bool AudioPluginAudioProcessor::collectMIDIFromTranscriber()
         return false; 
     }
     // ok we have no pending midi so we are ready to collect! 
-    MidiBuffer tempBuffer{};
-    transcriber->collectMidi(tempBuffer);
+    collectedMidi.clear();
+    transcriber->collectMidi(collectedMidi);
     // the collected MIDI sample positions will be based on a sample rate of 
     // BASIC_PITCH_SAMPLE_RATE
     double ratio = getSampleRate() / BASIC_PITCH_SAMPLE_RATE;
     // https://docs.juce.com/master/structMidiMessageMetadata.html
-    for (auto metadata : tempBuffer) // JUCE11‑style iteration
+    for (auto metadata : collectedMidi) // JUCE11‑style iteration
     {
         double samplePos = metadata.samplePosition;
         samplePos *= ratio; // shift to host's sample rate
@@ -451,6 +516,16 @@ bool AudioPluginAudioProcessor::pullRMSForGUI(float& rms)
     return true;
 }
 
+double AudioPluginAudioProcessor::rederiveRecentNotes(double seconds, NoteEvents& events)
+{
+    const std::lock_guard<std::mutex> lock(transcriberRebuildMutex);
+    return transcriber->rederiveNotes(seconds,
+                                      noteSensitivityParameter->load(),
+                                      splitSensitivityParameter->load(),
+                                      minNoteDurationParameter->load(),
+                                      events);
+}
+
 
 
 //==============================================================================
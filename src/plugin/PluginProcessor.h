@@ -5,7 +5,7 @@
 
 #include "Transcriber.h"
 #include "AudioUtils.h"
-#include "Resampler.h"
+#include "InputStage.h"
 #include "BasicPitch.h"
 
 //==============================================================================
@@ -66,6 +66,11 @@ public:
     /** call this from the UI message thread if you want to know what the last received midi message was */
     bool pullRMSForGUI(float& rms);
 
+    /** message thread: create again the notes of the last `seconds` of audio from the transcriber's posteriorgram
+     * history with the current sensitivities and minimum duration, without running the model.
+     * Returns the span covered, event times are in seconds from its start */
+    double rederiveRecentNotes(double seconds, NoteEvents& events);
+
 private:
     void sendMidiPanic(juce::MidiBuffer& out, int samplePos);
     void pushNoteEventForUI(const juce::MidiMessage& msg);
@@ -75,13 +80,10 @@ private:
      */
     bool collectMIDIFromTranscriber();
     juce::MidiBuffer pendingMidi; 
+    // what collectMIDIFromTranscriber receives, kept so its storage is reused every block
+    juce::MidiBuffer collectedMidi;
     long sampleOffset;
-    // juce::AudioBuffer<float> resampledBuffer;
-    Resampler resampleProcessor; 
-
-    // in your AudioPluginAudioProcessor.h
-    juce::AudioBuffer<float> internalMonoBuffer;
-    juce::AudioBuffer<float> internalDownsampledBuffer;
+    InputStage inputStage;
 
     
     juce::AudioProcessorValueTreeState parameters;
@@ -91,7 +93,17 @@ private:
     std::atomic<float>* minNoteDurationParameter = nullptr;
     std::atomic<float>* minNoteVelocityParameter = nullptr;
     std::atomic<float>* latencySecondsParameter = nullptr;
+    std::atomic<float>* minPitchParameter = nullptr;
+    std::atomic<float>* maxPitchParameter = nullptr;
+    std::atomic<float>* inCallbackParameter = nullptr;
+    std::atomic<float>* callbackBudgetParameter = nullptr;
+    TranscriberThreading transcriberThreading = backgroundThread;
+    // held while the transcriber is rebuilt and while the message thread re-derives notes from it
+    std::mutex transcriberRebuildMutex;
     float lastLatencySeconds = -1.0f;
+    // length of the transcriber buffers, captured whole when rendering offline
+    float transcriberBufferSeconds = 1.0f;
+    bool renderingOffline = false;
 
     // std::atomic<float>* gainParameter = nullptr;
     // used to expose last note detected to the GUI
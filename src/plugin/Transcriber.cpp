@@ -8,10 +8,30 @@
 #include <cstring>
 
 
-Transcriber::Transcriber()
+Transcriber::Transcriber(TranscriberThreading threadingToUse)
+    : threading(threadingToUse)
 {
-    resetBuffers(2);
-    workerThread = std::thread(&Transcriber::threadLoop, this);
+    std::fill(std::begin(noteChannel), std::end(noteChannel), 1);
+    std::fill(std::begin(channelNote), std::end(channelNote), channelFree);
+    std::fill(std::begin(channelPitchWheel), std::end(channelPitchWheel), 8192);
+    parameterSnapshot.publish(parameters);
+    const int historyFrames = static_cast<int>(std::ceil(historySeconds * BASIC_PITCH_SAMPLE_RATE / FFT_HOP));
+    history.setCapacity(historyFrames);
+    // the whole history is long enough to extract its notes on a few time segments in parallel
+    rederiveNotesCreator.setNumThreads(
+        std::min(historyFrames / Notes::MIN_FRAMES_PER_SEGMENT,
+                 static_cast<int>(std::max(1u, std::thread::hardware_concurrency()))));
+    // the other modes calibrate the int8 engine and build the CNN layers of an engine when it is first selected,
+    // the audio thread must not: done here for all the engines the plugin offers
+    if (threading == audioCallback) {
+        mBasicPitch.calibrateInt8();
+        for (CNNEngine engine : { FusedEngine, FusedHalfEngine, Int8Engine })
+            mBasicPitch.prepareCNNEngine(engine);
+    }
+    // no worker yet to send the command to
+    setBufferLength(static_cast<int>(BASIC_PITCH_SAMPLE_RATE * 2));
+    if (threading == backgroundThread)
+        workerThread = std::thread(&Transcriber::threadLoop, this);
 }
 
 Transcriber::~Transcriber()
@@ -26,136 +46,229 @@ Transcriber::~Transcriber()
 void Transcriber::resetBuffers(double bufLenInSecs)
 {
     int newLen = (BASIC_PITCH_SAMPLE_RATE * bufLenInSecs);
-    bufferLenSamples = std::max(newLen, 1);
-    resetBuffersSamples(bufferLenSamples);
+    resetBuffersSamples(std::max(newLen, 1));
 }
 
 
 void Transcriber::resetBuffersSamples(int _bufLenInSamples)
 {
-    bufferLenSamples = std::max(_bufLenInSamples, 1);
-    bufferLenSecs = (bufferLenSamples / BASIC_PITCH_SAMPLE_RATE);
-    if (captureLenSamples <= 0 || captureLenSamples > bufferLenSamples) {
-        captureLenSamples = bufferLenSamples;
-    }
-    captureLenSecs = (captureLenSamples / BASIC_PITCH_SAMPLE_RATE);
-    silenceLenSamples = bufferLenSamples - captureLenSamples;
-    silenceLenSecs = (silenceLenSamples / BASIC_PITCH_SAMPLE_RATE);
-    // std::cout << "Set buf len secs to " << bufferLenSecs << std::endl;
+    // the queue is only full if the worker has not caught up yet
+    while (!pushCommand({ Command::setBufferLength, std::max(_bufLenInSamples, 1) }))
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
 
-    delete[] bufferA; delete[] bufferB;
-    bufferA = new float[bufferLenSamples];
-    bufferB = new float[bufferLenSamples];
+    std::unique_lock<std::mutex> ul(statusMutex);
+    if (threading != backgroundThread) {
+        applyCommands();
+        return;
+    }
+    statusCV.notify_one();
+    workerDoneCV.wait(ul, [this] { return commandFifo.getNumReady() == 0; });
+}
 
-    currentWriteBuffer = bufferA;
-    currentReadBuffer  = nullptr;
-    samplesWritten     = 0;
+bool Transcriber::setLatencySeconds(double latencySeconds)
+{
+    const int newLatencySamples =
+        std::max(1, static_cast<int>(std::round(latencySeconds * BASIC_PITCH_SAMPLE_RATE)));
+    return pushCommand({ Command::setLatency, newLatencySamples });
+}
 
-    std::fill(std::begin(noteHeld), std::end(noteHeld), false);
-    std::fill(std::begin(noteSeen), std::end(noteSeen), false);
-    std::fill(std::begin(noteLastSeenTime), std::end(noteLastSeenTime), 0.0);
-    std::fill(std::begin(noteStartTime), std::end(noteStartTime), 0.0);
-    if (bufferA) std::fill_n(bufferA, bufferLenSamples, 0.0f);
-    if (bufferB) std::fill_n(bufferB, bufferLenSamples, 0.0f);
-    processedAudioSecs = 0.0;
+bool Transcriber::pushCommand(const Command& command)
+{
+    int startIndex = 0;
+    int blockSize = 0;
+    int startIndex2 = 0;
+    int blockSize2 = 0;
+    commandFifo.prepareToWrite(1, startIndex, blockSize, startIndex2, blockSize2);
+    if (blockSize == 0)
+        return false;
+
+    commandBuffer[static_cast<size_t>(startIndex)] = command;
+    commandFifo.finishedWrite(blockSize);
+    return true;
+}
 
-    {
-        std::lock_guard<std::mutex> sl(statusMutex);
-        status = collectingAudio;
-    }
+void Transcriber::applyCommands()
+{
+    if (commandFifo.getNumReady() == 0)
+        return;
+
+    int startIndex = 0;
+    int blockSize = 0;
+    int startIndex2 = 0;
+    int blockSize2 = 0;
+    const int numReady = commandFifo.getNumReady();
+    commandFifo.prepareToRead(numReady, startIndex, blockSize, startIndex2, blockSize2);
+
+    auto apply = [this](const Command& command) {
+        switch (command.type) {
+            case Command::setBufferLength:
+                setBufferLength(command.value);
+                break;
+            case Command::setLatency:
+                latencySamples = command.value;
+                updateCaptureLength();
+                break;
+        }
+    };
+    for (int i = 0; i < blockSize; ++i)
+        apply(commandBuffer[static_cast<size_t>(startIndex + i)]);
+    for (int i = 0; i < blockSize2; ++i)
+        apply(commandBuffer[static_cast<size_t>(startIndex2 + i)]);
+
+    commandFifo.finishedRead(blockSize + blockSize2);
+    workerDoneCV.notify_all();
 }
 
-void Transcriber::setLatencySeconds(double latencySeconds)
+void Transcriber::setBufferLength(int _bufLenInSamples)
 {
-    const int newCaptureLenSamples =
-        std::max(1, static_cast<int>(std::round(latencySeconds * BASIC_PITCH_SAMPLE_RATE)));
-    captureLenSamples = std::min(newCaptureLenSamples, bufferLenSamples);
-    captureLenSecs = (captureLenSamples / BASIC_PITCH_SAMPLE_RATE);
-    silenceLenSamples = bufferLenSamples - captureLenSamples;
-    silenceLenSecs = (silenceLenSamples / BASIC_PITCH_SAMPLE_RATE);
+    bufferLenSamples = std::max(_bufLenInSamples, 1);
+    if (bufferLenSamples > bufferCapacitySamples) {
+        delete[] bufferA; delete[] bufferB;
+        bufferA = new float[bufferLenSamples];
+        bufferB = new float[bufferLenSamples];
+        bufferCapacitySamples = bufferLenSamples;
+    }
+    std::fill_n(bufferA, bufferLenSamples, 0.0f);
+    std::fill_n(bufferB, bufferLenSamples, 0.0f);
+    updateCaptureLength();
+    windowMidi.ensureSize(midiBufferBytes);
+    // at most a note off and a note on per note and frame
+    streamMessages.reserve(2 * NUM_FREQ_OUT);
+    // the windows reuse this storage: beginWindow only resets the model state
+    mBasicPitch.reserve(bufferLenSamples);
 
-    samplesWritten = 0;
     currentWriteBuffer = bufferA;
-    currentReadBuffer = nullptr;
-    if (bufferA) std::fill_n(bufferA, bufferLenSamples, 0.0f);
-    if (bufferB) std::fill_n(bufferB, bufferLenSamples, 0.0f);
-
-    std::fill(std::begin(noteHeld), std::end(noteHeld), false);
+    currentReadBuffer  = nullptr;
+    samplesWritten     = 0;
+    status             = collectingAudio;
+    midiSampleOffset   = 0;
+    sliceStage         = noSlice;
+
+    // note offs for the notes held, sent with the next MIDI collected
+    windowMidi.clear();
+    releaseAllNotes(windowMidi);
+    freeReleasedChannels();
     std::fill(std::begin(noteSeen), std::end(noteSeen), false);
     std::fill(std::begin(noteLastSeenTime), std::end(noteLastSeenTime), 0.0);
     std::fill(std::begin(noteStartTime), std::end(noteStartTime), 0.0);
     processedAudioSecs = 0.0;
 
     {
-        
-        std::lock_guard<std::mutex> sl(statusMutex);
-        status = collectingAudio;
+        std::lock_guard<std::mutex> hl(historyMutex);
+        history.clear();
+        historySamples = 0;
+        historyGap = false;
     }
+
+    std::lock_guard<std::mutex> ml(midiMutex);
+    pendingMidi.ensureSize(midiBufferBytes);
+    pendingMidi.addEvents(windowMidi, 0, -1, 0);
+}
+
+void Transcriber::updateCaptureLength()
+{
+    const int captureLen = latencySamples > 0 ? std::min(latencySamples, bufferLenSamples) : bufferLenSamples;
+    nextCaptureLenSamples.store(captureLen, std::memory_order_release);
 }
 
 void Transcriber::queueAudioForTranscription(const float* inAudio, int numSamples, double sampleRate)
 {
     assert(sampleRate == BASIC_PITCH_SAMPLE_RATE);
 
-    if (numSamples > this->bufferLenSamples){
-        this->resetBuffersSamples(numSamples);    
-        // std::cout << "You sent me " << numSamples << " but my buffer is " << this->bufferLenSamples <<" samples. You are supposed to send smaller blocks from a realtime audio thread. " << std::endl;
+    // blocks longer than the capture go on into the next buffer
+    int remaining = numSamples, offset = 0;
+    while (remaining > 0)
+    {
+        int spaceLeft = 0;
+        float* destination = getCaptureWritePointer(spaceLeft);
+        if (destination == nullptr)
+            return; // both buffers are full: the rest is dropped while the transcription catches up
+        int chunk = std::min(spaceLeft, remaining);
+
+        std::memcpy(destination, inAudio + offset, chunk * sizeof(float));
+        commitCapturedAudio(chunk);
+
+        offset          += chunk;
+        remaining       -= chunk;
     }
-    assert(numSamples <= this->bufferLenSamples);// refuse to accept very long audio chunks
-    
-    // i think here we should check for buffersfull status
+}
+
+float* Transcriber::getCaptureWritePointer(int& numSamplesFree)
+{
     {
         std::lock_guard<std::mutex> sl(statusMutex);
+        // the start of a capture is a safe point when the transcription runs on this thread
+        if (threading != backgroundThread && samplesWritten == 0)
+            applyCommands();
         if (status == bothBuffersFullPleaseWait){
-            // std::cout << "Transcriber.cpp: warning - waiting for transcription " << std::endl;
-            return; // trashy eh?
+            numSamplesFree = 0;
+            return nullptr;
         }
     }
-    
+    return captureWritePointer(numSamplesFree);
+}
 
-    int remaining = numSamples, offset = 0;
-    while (remaining > 0)
-    {
-        if (samplesWritten == 0) {
+float* Transcriber::captureWritePointer(int& numSamplesFree)
+{
+    if (samplesWritten == 0) {
+        // a latency change applies from here, the buffer being transcribed keeps its own capture length
+        writeCaptureLenSamples = nextCaptureLenSamples.load(std::memory_order_acquire);
+        const int silenceLen = bufferLenSamples - writeCaptureLenSamples;
+        const float* previousBuffer = (currentWriteBuffer == bufferA) ? bufferB : bufferA;
+        const bool streaming = parameters.mode == streamingMode || threading == audioCallback;
+        if (streaming && silenceLen > 0) {
+            // context for the model: the end of the previous buffer is the audio just before this capture
+            std::memcpy(currentWriteBuffer,
+                        previousBuffer + bufferLenSamples - silenceLen,
+                        silenceLen * sizeof(float));
+            std::fill_n(currentWriteBuffer + silenceLen, writeCaptureLenSamples, 0.0f);
+        }
+        else {
             std::fill_n(currentWriteBuffer, bufferLenSamples, 0.0f);
         }
+    }
 
-        int spaceLeft = captureLenSamples - samplesWritten;
-        int chunk     = std::min(spaceLeft, remaining);
-
-        std::memcpy(currentWriteBuffer + silenceLenSamples + samplesWritten,
-                    inAudio + offset,
-                    chunk * sizeof(float));
+    numSamplesFree = writeCaptureLenSamples - samplesWritten;
+    return currentWriteBuffer + bufferLenSamples - writeCaptureLenSamples + samplesWritten;
+}
 
-        samplesWritten  += chunk;
-        offset          += chunk;
-        remaining       -= chunk;
-        // std::cout << "Trnascriber queued " << samplesWritten << " of buff " << bufferLenSamples << std::endl;
+void Transcriber::commitCapturedAudio(int numSamples)
+{
+    samplesWritten += numSamples;
+    // std::cout << "Trnascriber queued " << samplesWritten << " of buff " << bufferLenSamples << std::endl;
 
-        if (samplesWritten >= captureLenSamples) // time to send the buffer to the model then switch to the other buffer 
+    if (samplesWritten >= writeCaptureLenSamples) // time to send the buffer to the model then switch to the other buffer 
+    {
         {
-            {
-                std::lock_guard<std::mutex> sl(statusMutex);
-                if (status == collectingAudioAndTranscribing || 
-                    status == bothBuffersFullPleaseWait){
-                        // this means transcription is going on 
-                        // and we have two full buffers so no point in doing anything 
-                        // until transcription job clears
-                    status = bothBuffersFullPleaseWait;
-
-                    // std::cout << "Transcriber: warning: I am about to switch buffers and request model process but transcription is not done yet. SO I'm ignoring the rest of the audio you sent " << std::endl;
-                    // break; // no point doing any more 
-                }        
-                if (status == collectingAudio){
-                    // std::cout << "transcriber triggering a transcribe " << std::endl;
-                    status = collectingAudioAndTranscribing;                    
-                }
-
-                currentReadBuffer  = currentWriteBuffer;
-                currentWriteBuffer = (currentWriteBuffer == bufferA) ? bufferB : bufferA;
-                samplesWritten     = 0;
+            std::unique_lock<std::mutex> ul(statusMutex);
+            // no worker to wait for: the window still waiting is transcribed now rather than dropped
+            if (threading == callerThread)
+                transcribeCapturedWindow(ul);
+            if (status == collectingAudioAndTranscribing || 
+                status == bothBuffersFullPleaseWait){
+                    // this means transcription is going on 
+                    // and we have two full buffers so no point in doing anything 
+                    // until transcription job clears
+                status = bothBuffersFullPleaseWait;
+
+                // std::cout << "Transcriber: warning: I am about to switch buffers and request model process but transcription is not done yet. SO I'm ignoring the rest of the audio you sent " << std::endl;
+                // break; // no point doing any more 
+            }        
+            if (status == collectingAudio){
+                // std::cout << "transcriber triggering a transcribe " << std::endl;
+                status = collectingAudioAndTranscribing;                    
             }
-            statusCV.notify_one();
+
+            currentReadBuffer  = currentWriteBuffer;
+            readCaptureLenSamples = writeCaptureLenSamples;
+            currentWriteBuffer = (currentWriteBuffer == bufferA) ? bufferB : bufferA;
+            samplesWritten     = 0;
+        }
+        statusCV.notify_one();
+
+        if (threading == backgroundThread && waitForTranscription) {
+            std::unique_lock<std::mutex> ul(statusMutex);
+            workerDoneCV.wait(ul, [this] { return status == collectingAudio || !keepRunning; });
         }
     }
 }
@@ -168,46 +281,178 @@ void Transcriber::threadLoop()
         statusCV.wait_for(ul, std::chrono::milliseconds(10));
         if (!keepRunning) break;
 
-        if ((status == collectingAudioAndTranscribing  || status == bothBuffersFullPleaseWait) && currentReadBuffer != nullptr)
-        {
-            // status = transcribing;
-            float* toProcess = currentReadBuffer;
-            ul.unlock();
-            // std::cout << "transcriber running model " << std::endl;
-            runModel(toProcess);
-
-            ul.lock();
-            status = collectingAudio;// transcription done, waiting for more audio
+        // safe point: no transcription is running
+        applyCommands();
+        transcribeCapturedWindow(ul);
+    }
+}
+
+bool Transcriber::transcribeCapturedWindow(std::unique_lock<std::mutex>& ul)
+{
+    if ((status != collectingAudioAndTranscribing && status != bothBuffersFullPleaseWait) || currentReadBuffer == nullptr)
+        return false;
+
+    // status = transcribing;
+    float* toProcess = currentReadBuffer;
+    const int captureLen = readCaptureLenSamples;
+    ul.unlock();
+    // std::cout << "transcriber running model " << std::endl;
+    runModel(toProcess, captureLen);
+
+    ul.lock();
+    status = collectingAudio;// transcription done, waiting for more audio
+    workerDoneCV.notify_all();
+    if (threading == callerThread) {
+        ++numWindowsTranscribed;
+        midiSampleOffset += captureLen;
+    }
+    return true;
+}
+
+int Transcriber::process(juce::MidiBuffer& outputBuffer)
+{
+    jassert(threading == callerThread);
+    {
+        std::unique_lock<std::mutex> ul(statusMutex);
+        applyCommands();
+        transcribeCapturedWindow(ul);
+    }
+    collectMidi(outputBuffer);
+
+    const int numWindows = numWindowsTranscribed;
+    numWindowsTranscribed = 0;
+    midiSampleOffset = 0;
+    return numWindows;
+}
+
+void Transcriber::runSlices(double budgetSeconds)
+{
+    jassert(threading == audioCallback);
+    using clock = std::chrono::steady_clock;
+    const auto callbackStart = clock::now();
+    auto secondsSince = [](clock::time_point t) { return std::chrono::duration<double>(clock::now() - t).count(); };
+
+    // checked between slices: a call ends at most one slice after its budget
+    while (secondsSince(callbackStart) < budgetSeconds)
+    {
+        switch (sliceStage) {
+            case noSlice: {
+                {
+                    std::lock_guard<std::mutex> sl(statusMutex);
+                    if ((status != collectingAudioAndTranscribing && status != bothBuffersFullPleaseWait)
+                        || currentReadBuffer == nullptr)
+                        return;
+                    sliceBuffer = currentReadBuffer;
+                    sliceCaptureLen = readCaptureLenSamples;
+                }
+                sliceStage = featuresSlice;
+                break;
+            }
+            case featuresSlice:
+                // one run of the features model, its cost grows with the buffer length
+                beginWindow(sliceBuffer);
+                sliceStage = cnnSlice;
+                break;
+            case cnnSlice:
+                if (mBasicPitch.computePosteriorgramFrames(1) == 0)
+                    sliceStage = historySlice;
+                break;
+            case historySlice:
+                pushHistory(sliceCaptureLen);
+                beginStreaming(sliceCaptureLen);
+                sliceStage = notesSlice;
+                break;
+            case notesSlice:
+                if (streamFrames(noteFramesPerSlice) == 0) {
+                    sliceStage = noSlice;
+                    std::lock_guard<std::mutex> sl(statusMutex);
+                    status = collectingAudio;
+                }
+                break;
         }
-    
     }
 }
 
-void Transcriber::runModel(float* readBuffer)
+void Transcriber::runModel(float* readBuffer, int captureLen)
 {
     // std::cout << "RunModel called" << std::endl;
     using clock = std::chrono::high_resolution_clock;
     auto startTime = clock::now();
 
+    beginWindow(readBuffer);
+    mBasicPitch.computePosteriorgramFrames(mBasicPitch.getNumPosteriorgramFrames());
+    finishWindow(captureLen);
+}
+
+void Transcriber::beginWindow(float* readBuffer)
+{
+    // one consistent set of parameters for the whole buffer
+    windowParameters = parameterSnapshot.read();
+    // no worker thread: runSlices extracts the notes a few frames at a time
+    if (threading == audioCallback)
+        windowParameters.mode = streamingMode;
+    const Parameters& params = windowParameters;
+
+    // model state only, the storage sized by setBufferLength is kept
     mBasicPitch.reset();
-    mBasicPitch.setParameters(noteSensitivity,
-                              splitSensitivity,
-                              minNoteDurationMs);
+    mBasicPitch.setParameters(params.noteSensitivity,
+                              params.splitSensitivity,
+                              params.minNoteDurationMs);
+    mBasicPitch.setPitchRange(params.minPitch, params.maxPitch);
+    mBasicPitch.setScale(params.scaleType, params.rootNote, params.snapMode);
+    mBasicPitch.setCNNDecimation(params.cnnDecimation);
+    // on the worker or the caller thread, see the constructor for audioCallback
+    if (params.cnnEngine == Int8Engine && !mBasicPitch.isInt8Calibrated())
+        mBasicPitch.calibrateInt8();
+    mBasicPitch.setCNNEngine(params.cnnEngine);
+
+    const TranscriberMode currentMode = params.mode;
+    const bool mpe = params.mpeEnabled;
+    if (currentMode != lastMode || mpe != mpeActive) {
+        windowMidi.clear();
+        releaseAllNotes(windowMidi);
+        lastMode = currentMode;
+
+        if (mpe != mpeActive) {
+            windowMidi.addEvents(mpe ? juce::MPEMessages::setLowerZone(mpeLastMemberChannel - 1, mpeBendRangeSemitones)
+                                      : juce::MPEMessages::clearLowerZone(),
+                                  0, -1, 0);
+            mpeActive = mpe;
+        }
+
+        std::lock_guard<std::mutex> ml(midiMutex);
+        pendingMidi.addEvents(windowMidi, 0, -1, midiSampleOffset);
+    }
+    freeReleasedChannels();
 
+    // pitch bends are only extracted when they are sent, one channel per note so all notes get theirs
+    mBasicPitch.setPitchBendMode(mpeActive ? MultiPitchBend : NoPitchBend);
 
     // 
     // AudioUtils::resampleBuffer
     // std::cout << "transcriber sending " << bufferLenSamples << " to the NN " << std::endl; 
-    mBasicPitch.transcribeToMIDI(readBuffer, bufferLenSamples);
+    mBasicPitch.beginPosteriorgrams(readBuffer, bufferLenSamples);
+}
+
+void Transcriber::finishWindow(int captureLen)
+{
+    const Parameters& params = windowParameters;
+    pushHistory(captureLen);
+    if (params.mode == streamingMode) {
+        runStreaming(captureLen);
+        return;
+    }
+
+    mBasicPitch.createNoteEvents();
 
     // gather the events
     const auto& events = mBasicPitch.getNoteEvents();
 
-    const double silenceSecs = silenceLenSecs;
-    const double captureSecs = captureLenSecs;
+    const double silenceSecs = (bufferLenSamples - captureLen) / BASIC_PITCH_SAMPLE_RATE;
+    const double captureSecs = captureLen / BASIC_PITCH_SAMPLE_RATE;
     const double bufferStartTime = processedAudioSecs;
     const double bufferEndTime = bufferStartTime + captureSecs;
-    const double minHoldSecs = std::max(0.0, minNoteDurationMs / 1000.0);
+    const double minHoldSecs = std::max(0.0, params.minNoteDurationMs / 1000.0);
 
     // reset the noteSeen array and per-note buffers
     double noteStartInBuffer[128];
@@ -219,8 +464,12 @@ void Transcriber::runModel(float* readBuffer)
         noteEndInBuffer[i] = 0.0;
         noteAmp[i] = 0.0f;
     }
-    juce::MidiBuffer localMidi;
-    for (auto& ev : events)
+    // MPE channel of each note while it sounds in this buffer (0 if it does not) and sample range of its bends
+    int bendChannel[128] = { 0 };
+    int bendStartSample[128] = { 0 };
+    int bendEndSample[128] = { 0 };
+    windowMidi.clear();
+    for (const auto& ev : events)
     {
         int note    = static_cast<int>(ev.pitch);
         float amp   = ev.amplitude; 
@@ -247,24 +496,19 @@ void Transcriber::runModel(float* readBuffer)
         if (noteSeen[i]) {
             const double adjustedStart = noteStartInBuffer[i];
             const double adjustedEnd = noteEndInBuffer[i];
-            const float clampedAmp = std::max(minNoteVelocity, std::clamp(noteAmp[i], 0.0f, 1.0f));
+            const float clampedAmp = std::max(params.minNoteVelocity, std::clamp(noteAmp[i], 0.0f, 1.0f));
             const uint8_t velocity =
                 static_cast<uint8_t>(clampedAmp * 127.0f);
             const int startSample =
                 static_cast<int>(std::round(adjustedStart * BASIC_PITCH_SAMPLE_RATE));
-            const int endSample =
-                static_cast<int>(std::round(adjustedEnd * BASIC_PITCH_SAMPLE_RATE));
 
             if (!noteHeld[i]) {
-                std::cout << "Note on " << i << " start " << adjustedStart
-                          << " end " << adjustedEnd << " vel " << static_cast<int>(velocity)
-                          << " startSample " << startSample << " endSample " << endSample << std::endl;
-                localMidi.addEvent(
-                    juce::MidiMessage::noteOn(1, i, velocity),
-                    std::max(0, startSample));
-                noteHeld[i] = true;
+                startNote(windowMidi, i, velocity, std::max(0, startSample));
                 noteStartTime[i] = bufferStartTime + adjustedStart;
+                bendStartSample[i] = std::max(0, startSample);
             }
+            bendChannel[i] = mpeActive ? noteChannel[i] : 0;
+            bendEndSample[i] = captureLen;
 
             noteLastSeenTime[i] = bufferStartTime + adjustedEnd;
             const double heldDuration = bufferEndTime - noteStartTime[i];
@@ -272,13 +516,9 @@ void Transcriber::runModel(float* readBuffer)
                 const double releaseTime = noteStartTime[i] + maxNoteDurationSecs;
                 int releaseSample = static_cast<int>(
                     std::round((releaseTime - bufferStartTime) * BASIC_PITCH_SAMPLE_RATE));
-                releaseSample = std::clamp(releaseSample, 0, captureLenSamples);
-                std::cout << "Note off " << i << " end " << (releaseTime - bufferStartTime)
-                          << " forcedMax " << maxNoteDurationSecs << std::endl;
-                localMidi.addEvent(
-                    juce::MidiMessage::noteOff(1, i),
-                    releaseSample);
-                noteHeld[i] = false;
+                releaseSample = std::clamp(releaseSample, 0, captureLen);
+                stopNote(windowMidi, i, releaseSample);
+                bendEndSample[i] = releaseSample;
             }
             continue;
         }
@@ -290,13 +530,8 @@ void Transcriber::runModel(float* readBuffer)
                 const double releaseTime = noteStartTime[i] + maxNoteDurationSecs;
                 int releaseSample = static_cast<int>(
                     std::round((releaseTime - bufferStartTime) * BASIC_PITCH_SAMPLE_RATE));
-                releaseSample = std::clamp(releaseSample, 0, captureLenSamples);
-                std::cout << "Note off " << i << " end " << (releaseTime - bufferStartTime)
-                          << " forcedMax " << maxNoteDurationSecs << std::endl;
-                localMidi.addEvent(
-                    juce::MidiMessage::noteOff(1, i),
-                    releaseSample);
-                noteHeld[i] = false;
+                releaseSample = std::clamp(releaseSample, 0, captureLen);
+                stopNote(windowMidi, i, releaseSample);
                 continue;
             }
             if (timeSinceSeen >= minHoldSecs) {
@@ -304,38 +539,253 @@ void Transcriber::runModel(float* readBuffer)
                 if (releaseTime <= bufferEndTime) {
                     int releaseSample = static_cast<int>(
                         std::round((releaseTime - bufferStartTime) * BASIC_PITCH_SAMPLE_RATE));
-                    releaseSample = std::clamp(releaseSample, 0, captureLenSamples);
-                    std::cout << "Note off " << i << " end " << (releaseTime - bufferStartTime)
-                              << " heldFor " << timeSinceSeen << std::endl;
-                    localMidi.addEvent(
-                        juce::MidiMessage::noteOff(1, i),
-                        releaseSample);
-                    noteHeld[i] = false;
+                    releaseSample = std::clamp(releaseSample, 0, captureLen);
+                    stopNote(windowMidi, i, releaseSample);
                 }
             }
         }
     }
 
+    // pitch bends at frame rate, only while the note sounds on its channel in this buffer
+    if (mpeActive) {
+        for (const auto& ev : events) {
+            const int note = ev.pitch;
+            // channel given to another note (stolen) since
+            if (ev.bends.empty() || bendChannel[note] == 0
+                || (channelNote[bendChannel[note]] >= 0 && channelNote[bendChannel[note]] != note))
+                continue;
+
+            const double frameSecs = (ev.endTime - ev.startTime) / static_cast<double>(ev.bends.size());
+            for (size_t k = 0; k < ev.bends.size(); ++k) {
+                const int sample = static_cast<int>(
+                    std::round((ev.startTime + k * frameSecs - silenceSecs) * BASIC_PITCH_SAMPLE_RATE));
+                if (sample < bendStartSample[note] || sample >= bendEndSample[note])
+                    continue;
+
+                sendPitchBend(windowMidi, bendChannel[note], ev.bends[k], sample);
+            }
+        }
+    }
+
     // stash them under lock
     {
         std::lock_guard<std::mutex> ml(midiMutex);
         
         
-        // pendingMidi.addEvents(localMidi, localMidi.getFirstEventTime(), localMidi.getLastEventTime(), 0);
-        pendingMidi.addEvents(localMidi, 0, -1,  0);
+        // pendingMidi.addEvents(windowMidi, windowMidi.getFirstEventTime(), windowMidi.getLastEventTime(), 0);
+        pendingMidi.addEvents(windowMidi, 0, -1, midiSampleOffset);
         
-        // std::cout << "receive MIDI from model: Pending midi has " << pendingMidi.getNumEvents() << " local has " << localMidi.getNumEvents() << std::endl;
+        // std::cout << "receive MIDI from model: Pending midi has " << pendingMidi.getNumEvents() << " local has " << windowMidi.getNumEvents() << std::endl;
 
     }
+
+    processedAudioSecs += captureSecs;
+}
+
+void Transcriber::pushHistory(int captureLen)
+{
+    // the audio thread does not wait for rederiveNotes
+    std::unique_lock<std::mutex> hl(historyMutex, std::defer_lock);
+    if (threading == audioCallback) {
+        if (!hl.try_lock()) {
+            historyGap = true;
+            return;
+        }
+    }
+    else {
+        hl.lock();
+    }
+    if (historyGap) {
+        history.clear();
+        historySamples = 0;
+        historyGap = false;
+    }
+
+    // frames of the capture, counted from the reset so that consecutive captures do not overlap nor leave gaps
+    const int64_t captureStartFrame = historySamples / FFT_HOP;
+    historySamples += captureLen;
+    const int numFrames = static_cast<int>(historySamples / FFT_HOP - captureStartFrame);
+
+    const auto& notesPG = mBasicPitch.getNotesPG();
+    const int end = std::min(static_cast<int>(notesPG.size()),
+                             (bufferLenSamples - captureLen) / FFT_HOP + numFrames);
+    history.push(notesPG, mBasicPitch.getOnsetsPG(), mBasicPitch.getContoursPG(), std::max(0, end - numFrames), end);
+    historyParams = mBasicPitch.getConvertParams();
+}
+
+double Transcriber::rederiveNotes(double seconds,
+                                  float noteSensitivity,
+                                  float splitSensitivity,
+                                  float minNoteDurationMs,
+                                  NoteEvents& outEvents)
+{
+    constexpr double frameSecs = FFT_HOP / BASIC_PITCH_SAMPLE_RATE;
+    Notes::ConvertParams convertParams;
+    int numFrames = 0;
     {
-        // std::cout << "Transcription done" << std::endl;
-        // update status 
-        std::unique_lock<std::mutex> ul(statusMutex);
-        status = collectingAudio;
+        std::lock_guard<std::mutex> hl(historyMutex);
+        numFrames = history.copyLatest(static_cast<int>(std::ceil(std::max(0.0, seconds) / frameSecs)),
+                                       rederiveNotesPG, rederiveOnsetsPG, rederiveContoursPG);
+        convertParams = historyParams;
+    }
+
+    BasicPitch::setThresholds(noteSensitivity, splitSensitivity, minNoteDurationMs, convertParams);
+    rederiveNotesCreator.convert(rederiveNotesPG, rederiveOnsetsPG, rederiveContoursPG, convertParams, true, outEvents);
+    return numFrames * frameSecs;
+}
+
+void Transcriber::runStreaming(int captureLen)
+{
+    beginStreaming(captureLen);
+    while (streamFrames(noteFramesPerSlice) > 0) {}
+}
+
+void Transcriber::beginStreaming(int captureLen)
+{
+    const int silenceLen = bufferLenSamples - captureLen;
+    mNoteStream.setParameters(mBasicPitch.getConvertParams());
+
+    // only the frames of the capture are new, the start of the buffer was fed with the previous buffer
+    streamFrame = static_cast<int>(std::ceil(silenceLen / static_cast<double>(FFT_HOP)));
+    streamEndFrame = std::min(static_cast<int>(mBasicPitch.getNotesPG().size()),
+                              static_cast<int>(std::ceil(bufferLenSamples / static_cast<double>(FFT_HOP))));
+    streamFrameOffset = mNoteStream.getNumFrames() - streamFrame;
+    streamCaptureLen = captureLen;
+
+    processedAudioSecs += captureLen / BASIC_PITCH_SAMPLE_RATE;
+}
+
+int Transcriber::streamFrames(int maxNumFrames)
+{
+    const int captureLen = streamCaptureLen;
+    const int silenceLen = bufferLenSamples - captureLen;
+    const float minNoteVelocity = windowParameters.minNoteVelocity;
 
+    const auto& notesPG = mBasicPitch.getNotesPG();
+    const auto& onsetsPG = mBasicPitch.getOnsetsPG();
+    const auto& contoursPG = mBasicPitch.getContoursPG();
+
+    const int endFrame = streamFrame + std::clamp(streamEndFrame - streamFrame, 0, maxNumFrames);
+    windowMidi.clear();
+    for (int f = streamFrame; f < endFrame; ++f)
+    {
+        streamMessages.clear();
+        mNoteStream.processFrame(notesPG[f].data(), onsetsPG[f].data(), streamMessages);
+
+        for (auto& msg : streamMessages)
+        {
+            // messages about frames before this capture (note offs found late) go at its start
+            int sample = (msg.frame - streamFrameOffset) * FFT_HOP - silenceLen;
+            sample = std::clamp(sample, 0, std::max(0, captureLen - 1));
+
+            if (msg.isNoteOn) {
+                const float clampedAmp =
+                    std::max(minNoteVelocity, std::clamp(static_cast<float>(msg.amplitude), 0.0f, 1.0f));
+                startNote(windowMidi, msg.pitch, static_cast<uint8_t>(clampedAmp * 127.0f), sample);
+            }
+            else {
+                stopNote(windowMidi, msg.pitch, sample);
+            }
+        }
+
+        // no events with bends here: follow the contour of each held note, one frame at a time
+        if (mpeActive) {
+            const int sample = std::clamp(f * FFT_HOP - silenceLen, 0, std::max(0, captureLen - 1));
+            for (int p = MIN_MIDI_NOTE; p <= MAX_MIDI_NOTE; ++p) {
+                if (noteHeld[p])
+                    sendPitchBend(windowMidi, noteChannel[p], Notes::pitchBend(contoursPG[f].data(), p), sample);
+            }
+        }
     }
+    streamFrame = endFrame;
 
-    processedAudioSecs += captureSecs;
+    {
+        std::lock_guard<std::mutex> ml(midiMutex);
+        pendingMidi.addEvents(windowMidi, 0, -1, midiSampleOffset);
+    }
+
+    return streamEndFrame - streamFrame;
+}
+
+void Transcriber::releaseAllNotes(juce::MidiBuffer& midi)
+{
+    for (int i = 0; i < 128; ++i) {
+        if (noteHeld[i])
+            stopNote(midi, i, 0);
+    }
+
+    mNoteStream.reset();
+}
+
+void Transcriber::startNote(juce::MidiBuffer& midi, int note, uint8_t velocity, int sample)
+{
+    int channel = 1;
+    if (mpeActive) {
+        // least recently used free member channel, or the one of the oldest held note if all are taken
+        int freeChannel = 0, heldChannel = 0;
+        for (int c = mpeFirstMemberChannel; c <= mpeLastMemberChannel; ++c) {
+            if (channelNote[c] == channelFree) {
+                if (freeChannel == 0 || channelLastUsed[c] < channelLastUsed[freeChannel])
+                    freeChannel = c;
+            }
+            else if (channelNote[c] >= 0) {
+                if (heldChannel == 0 || channelLastUsed[c] < channelLastUsed[heldChannel])
+                    heldChannel = c;
+            }
+        }
+        channel = freeChannel != 0 ? freeChannel : heldChannel;
+        // every member channel was released in this buffer, reuse the oldest one rather than dropping the note
+        if (channel == 0) {
+            channel = mpeFirstMemberChannel;
+            for (int c = mpeFirstMemberChannel + 1; c <= mpeLastMemberChannel; ++c) {
+                if (channelLastUsed[c] < channelLastUsed[channel])
+                    channel = c;
+            }
+        }
+
+        if (channelNote[channel] >= 0)
+            stopNote(midi, channelNote[channel], sample);
+
+        channelNote[channel] = note;
+        channelLastUsed[channel] = ++channelClock;
+        // the bend of the previous note on this channel must not apply to this one
+        sendPitchBend(midi, channel, 0, sample);
+    }
+
+    midi.addEvent(juce::MidiMessage::noteOn(channel, note, velocity), sample);
+    noteChannel[note] = channel;
+    noteHeld[note] = true;
+}
+
+void Transcriber::stopNote(juce::MidiBuffer& midi, int note, int sample)
+{
+    const int channel = noteChannel[note];
+    midi.addEvent(juce::MidiMessage::noteOff(channel, note), sample);
+    noteHeld[note] = false;
+    noteChannel[note] = 1;
+
+    if (channel >= mpeFirstMemberChannel && channelNote[channel] == note) {
+        channelNote[channel] = channelReleased;
+        channelLastUsed[channel] = ++channelClock;
+    }
+}
+
+void Transcriber::sendPitchBend(juce::MidiBuffer& midi, int channel, int bend, int sample)
+{
+    const int wheel =
+        std::clamp(8192 + static_cast<int>(std::round(bend / 3.0 / mpeBendRangeSemitones * 8192.0)), 0, 16383);
+    if (wheel != channelPitchWheel[channel]) {
+        midi.addEvent(juce::MidiMessage::pitchWheel(channel, wheel), sample);
+        channelPitchWheel[channel] = wheel;
+    }
+}
+
+void Transcriber::freeReleasedChannels()
+{
+    for (int c = mpeFirstMemberChannel; c <= mpeLastMemberChannel; ++c) {
+        if (channelNote[c] == channelReleased)
+            channelNote[c] = channelFree;
+    }
 }
 
 bool Transcriber::hasMidi()
@@ -355,7 +805,9 @@ void Transcriber::collectMidi(juce::MidiBuffer& outputBuffer)
     std::lock_guard<std::mutex> ml(midiMutex);
     // std::cout << "collect MIDI Pending midi has " << pendingMidi.getNumEvents() << std::endl;
     if (pendingMidi.getNumEvents() > 0){
-        outputBuffer.swapWith(pendingMidi);
+        // copied rather than swapped: pendingMidi keeps the storage reserved by setBufferLength
+        outputBuffer.clear();
+        outputBuffer.addEvents(pendingMidi, 0, -1, 0);
         pendingMidi.clear();  // ready for next round
     }
 }
@@ -4,52 +4,216 @@
 
 #include <JuceHeader.h>
 #include "BasicPitch.h"
+#include "NoteStream.h"
+#include "PosteriorgramHistory.h"
 #include <thread>
 #include <mutex>
 #include <condition_variable>
 #include <atomic>
+#include <array>
 #include "AudioUtils.h"
+#include "ParameterSnapshot.h"
 
 enum TranscriberStatus { collectingAudio, collectingAudioAndTranscribing, bothBuffersFullPleaseWait};
+/** windowedMode: notes are extracted from each window and merged with the notes held from previous windows.
+ * streamingMode: posteriorgram frames are fed to a NoteStream as they come out of the model, note ons are sent as
+ * soon as an onset is confirmed and note offs when the note energy is released. The start of each buffer then holds
+ * the end of the previous one instead of silence so that notes continue across windows. */
+enum TranscriberMode { windowedMode, streamingMode };
+/** backgroundThread: windows are transcribed on a worker thread as soon as they are captured.
+ * callerThread: there is no thread, the caller transcribes the captured windows with process(). The output only
+ * depends on the audio and parameters sent, for tests, offline renders and benchmarks.
+ * audioCallback: there is no thread either, the audio thread transcribes the captured windows a slice at a time
+ * within a time budget at the end of each callback with runSlices. For hosts that do not want plugin threads. The
+ * notes are then always extracted as in streamingMode, frame by frame: Notes::convert needs the whole window at once */
+enum TranscriberThreading { backgroundThread, callerThread, audioCallback };
 
 
 class Transcriber
 {
 public:
-    Transcriber();
+    /** everything the transcription reads, published by the audio thread as one snapshot */
+    struct Parameters
+    {
+        float noteSensitivity     = 0.7f;
+        float splitSensitivity    = 0.5f;
+        float minNoteDurationMs   = 125.0f;
+        float minNoteVelocity     = 0.0f;
+        float noteHoldSensitivity = 0.95f;
+        TranscriberMode mode      = windowedMode;
+        bool mpeEnabled           = false;
+        NoteUtils::ScaleType scaleType = NoteUtils::Chromatic;
+        NoteUtils::RootNote rootNote   = NoteUtils::C;
+        NoteUtils::SnapMode snapMode   = NoteUtils::Adjust;
+        int minPitch              = MIN_MIDI_NOTE;
+        int maxPitch              = MAX_MIDI_NOTE;
+        int cnnDecimation         = 1;
+        CNNEngine cnnEngine       = FusedEngine;
+    };
+
+    explicit Transcriber(TranscriberThreading threadingToUse = backgroundThread);
     ~Transcriber();
     /** reset the buffers to the sent number of ms at the BASIC_PITCH_SAMPLE_RATE  */
     void resetBuffers(double bufLenInSecs);
-    /** reset the buffers to a specific number of samples  */
+    /** reset the buffers to a specific number of samples. This is the only call that allocates: make it from
+     * prepareToPlay, while no audio is queued. It waits for the worker thread to apply it */
     void resetBuffersSamples(int bufLenInSamples);
-    /** set the capture window length for low-latency inference */
-    void setLatencySeconds(double latencySeconds);
+    /** set the capture window length for low-latency inference. Real-time safe: the change is queued and the worker
+     * applies it from the next capture, the audio already captured is kept. Returns false if the queue is full, call
+     * again later */
+    bool setLatencySeconds(double latencySeconds);
     
     /** store the sent audio. sampleRate should be == BASIC_PITCH_SAMPLE_RATE
      * otherwise an assertion will cause a crash. Transcription is carried out automatically in a background thread
      */
     void queueAudioForTranscription(const float* inAudio, int numSamples, double sampleRate);
+    /** write audio at BASIC_PITCH_SAMPLE_RATE straight into the capture buffer instead of queueing a copy:
+     * returns where the next sample goes and how many contiguous samples fit before the capture is full, or nullptr
+     * if both buffers are full (the audio would be dropped). Call commitCapturedAudio with the number written */
+    float* getCaptureWritePointer(int& numSamplesFree);
+    /** the next numSamples (at most the free space returned by getCaptureWritePointer) have been written */
+    void commitCapturedAudio(int numSamples);
+    /** backgroundThread: wait in commitCapturedAudio until each captured window is transcribed, instead of dropping
+     * audio while both buffers are full. Not real-time safe, this is for offline renders: the MIDI of a window is
+     * then ready when the call that completed it returns */
+    void setWaitForTranscription(bool shouldWait) { waitForTranscription = shouldWait; }
+    /** callerThread only: transcribe the captured window if there is one and put the MIDI of every window
+     * transcribed since the last call into outputBuffer (clearing what was there). Audio is never dropped: a window
+     * still waiting when the next one is captured is transcribed then. Sample positions count from the start of the
+     * first of these windows. Returns the number of windows transcribed */
+    int process(juce::MidiBuffer& outputBuffer);
+    /** audioCallback only, at the end of each audio callback: go on with the transcription of the captured window
+     * until budgetSeconds have passed. The work is split in slices (the features of the window, one CNN frame, a few
+     * frames of notes) and a slice only starts while the budget is not over, so a call overruns it by one slice at
+     * most. The features are one run of the features model over the whole window, the longest slice: keep the buffer
+     * short in this mode. With a budget too small for the audio, the transcription falls behind and the audio is
+     * dropped while both buffers are full, as with a slow worker thread */
+    void runSlices(double budgetSeconds);
+
+    /** publish all the parameters at once, the worker thread reads them before each transcription. The setters
+     * below change one of them and publish the lot. Call them all from the same thread as the audio */
+    void setParameters(const Parameters& newParameters)
+    {
+        parameters = newParameters;
+        parameterSnapshot.publish(parameters);
+    }
+    const Parameters& getParameters() const { return parameters; }
  
-    void setNoteSensitivity(float s)   { noteSensitivity   = s; }
-    void setSplitSensitivity(float s)  { splitSensitivity  = s; }
-    void setMinNoteDuration(float ms)  { minNoteDurationMs = ms; }
-    void setMinNoteVelocity(float v) { minNoteVelocity = v; }
-    void setNoteHoldSensitivity(float s) { noteHoldSensitivity = s; }
+    void setNoteSensitivity(float s)   { parameters.noteSensitivity   = s; setParameters(parameters); }
+    void setSplitSensitivity(float s)  { parameters.splitSensitivity  = s; setParameters(parameters); }
+    void setMinNoteDuration(float ms)  { parameters.minNoteDurationMs = ms; setParameters(parameters); }
+    void setMinNoteVelocity(float v) { parameters.minNoteVelocity = v; setParameters(parameters); }
+    void setNoteHoldSensitivity(float s) { parameters.noteHoldSensitivity = s; setParameters(parameters); }
+    /** select how notes are extracted, see TranscriberMode. Held notes are released when the mode changes */
+    void setMode(TranscriberMode m) { parameters.mode = m; setParameters(parameters); }
+    /** output MPE (lower zone, one member channel per note) with per-note pitch bends following the pitch contours.
+     * Off by default: notes are sent on channel 1 and no pitch bend is extracted. Held notes are released when this
+     * changes, the zone configuration messages are sent with the releases */
+    void setMPEEnabled(bool enabled) { parameters.mpeEnabled = enabled; setParameters(parameters); }
+    /** constrain notes to a scale, in both modes (and so with audioCallback threading, which streams).
+     * Remove: notes out of the scale are never extracted. Adjust: they are moved to the nearest note of the scale */
+    void setScale(NoteUtils::ScaleType type, NoteUtils::RootNote root, NoteUtils::SnapMode snap)
+    {
+        parameters.scaleType = type; parameters.rootNote = root; parameters.snapMode = snap;
+        setParameters(parameters);
+    }
+    /** only transcribe notes between these two midi notes (inclusive), the model skips the rest */
+    void setPitchRange(int minNote, int maxNote)
+    {
+        parameters.minPitch = minNote; parameters.maxPitch = maxNote;
+        setParameters(parameters);
+    }
+    /** eco quality tier: 1 runs the whole CNN on every frame, 2 or 4 run the costliest layer of the note and contour
+     * branch on one frame out of factor (and where the input changes sharply) and interpolate it, onsets keep the full
+     * frame rate. See
+     * BasicPitchCNN::setDecimation */
+    void setCNNDecimation(int factor) { parameters.cnnDecimation = factor; setParameters(parameters); }
+    /** implementation used to run the CNN, see CNNEngine. The int8 engine is calibrated on the built-in signal of
+     * BasicPitch::makeCalibrationAudio by the first window that uses it, on the worker or the caller thread. The
+     * measurement is done once per process and shared, the next transcribers only quantise their weights. The CNN
+     * layers of an engine are built the first time it is used as well. With audioCallback threading, the
+     * transcriber calibrates and builds the engines when it is created instead */
+    void setCNNEngine(CNNEngine engine) { parameters.cnnEngine = engine; setParameters(parameters); }
     /** call this to ask if the transcriber has any MIDI to give you, since transcriptions happen in the background */
     bool hasMidi();
     /** if any midi has been detected and stored in the transcriber thread
-     * put that midi into the sent buffer (clearing what was there), and clear internal pending midi buffer
+     * put that midi into the sent buffer (clearing what was there), and clear internal pending midi buffer.
+     * The midi is copied, the internal buffer keeps its storage: reserve midiBufferBytes in outputBuffer for the
+     * copy not to allocate either
      */
     void collectMidi(juce::MidiBuffer& outputBuffer);
+    /** bytes reserved in each MIDI buffer of the transcriber, room for a few thousand events */
+    static constexpr size_t midiBufferBytes = 1 << 16;
     TranscriberStatus getStatus();
+
+    /** posteriorgrams of the last historySeconds of captured audio are kept so that notes can be created again */
+    static constexpr double historySeconds = 30.0;
+    /** create again the notes of the last `seconds` of captured audio from the posteriorgram history, with other
+     * thresholds but the pitch range, scale and pitch bend mode of the last window. Nothing is sent as MIDI and the
+     * model does not run, so this is quick enough to follow a slider. Event times are in seconds from the start of
+     * the span returned, which is shorter than `seconds` if less audio was captured since the last reset.
+     * A long span is extracted on a few time segments in parallel (see Notes::setNumThreads).
+     * Not for the audio thread, and from one thread at a time */
+    double rederiveNotes(double seconds, float noteSensitivity, float splitSensitivity, float minNoteDurationMs,
+                         NoteEvents& outEvents);
 private:
-    void        runModel(float* readBuffer);
+    /** reconfiguration sent to the worker thread, applied between two transcriptions */
+    struct Command
+    {
+        enum Type { setBufferLength, setLatency };
+        Type type = setBufferLength;
+        int value = 0;
+    };
+
+    /** add a command to the queue, returns false if it is full. Commands are sent from one thread at a time */
+    bool        pushCommand(const Command& command);
+    /** worker thread, with statusMutex held and no transcription running: apply the queued commands */
+    void        applyCommands();
+    /** allocate (only if they grow) and clear both buffers, restart the capture and the note state */
+    void        setBufferLength(int bufLenInSamples);
+    /** capture length of the next captures from latencySamples and the buffer length */
+    void        updateCaptureLength();
+    /** with ul locked: run the model on the captured window if there is one, unlocked meanwhile. Returns false if
+     * there was none */
+    bool        transcribeCapturedWindow(std::unique_lock<std::mutex>& ul);
+
+    /** transcribe a captured window: beginWindow, all the CNN frames, then finishWindow */
+    void        runModel(float* readBuffer, int captureLen);
+    /** take the latest parameters, send the releases of a mode change and compute the features of the window */
+    void        beginWindow(float* readBuffer);
+    /** once the posteriorgrams are computed: extract the notes of the capture and queue their MIDI */
+    void        finishWindow(int captureLen);
+    /** getCaptureWritePointer without the check for full buffers, sets up the buffer on its first sample */
+    float*      captureWritePointer(int& numSamplesFree);
+    /** add the frames of the capture to the posteriorgram history */
+    void        pushHistory(int captureLen);
+    /** streamingMode version of the end of finishWindow: beginStreaming, then streamFrames for all the frames */
+    void        runStreaming(int captureLen);
+    /** streamingMode: set the NoteStream up for the frames of the capture */
+    void        beginStreaming(int captureLen);
+    /** streamingMode: feed the next frames of the capture to the NoteStream and queue their MIDI. Returns the number
+     * of frames left */
+    int         streamFrames(int maxNumFrames);
+    /** send note offs for all notes held in either mode and reset the note state */
+    void        releaseAllNotes(juce::MidiBuffer& midi);
+    /** send a note on, on a free MPE member channel (stealing the oldest note if none is free) or on channel 1 */
+    void        startNote(juce::MidiBuffer& midi, int note, uint8_t velocity, int sample);
+    /** send the note off of a held note on its channel, its MPE channel is free again from the next buffer */
+    void        stopNote(juce::MidiBuffer& midi, int note, int sample);
+    /** send a pitch bend on an MPE member channel, if it changed since the last one sent on it
+     * @param bend pitch bend in 1/3 of semitones, as in NoteEvents::Bends */
+    void        sendPitchBend(juce::MidiBuffer& midi, int channel, int bend, int sample);
+    /** MPE member channels released during the last buffer can be given to new notes */
+    void        freeReleasedChannels();
     void        threadLoop();
 
     BasicPitch  mBasicPitch;
+    NoteStream  mNoteStream;
+    std::vector<NoteStream::Message> streamMessages;
 
     float*      bufferA            = nullptr;
     float*      bufferB            = nullptr;
+    int         bufferCapacitySamples = 0; // allocated length of both buffers
     float*      currentWriteBuffer = nullptr;
     float*      currentReadBuffer  = nullptr;
 
@@ -57,30 +221,91 @@ private:
     bool        noteSeen[128]      = { false };
     double      noteLastSeenTime[128] = { 0.0 };
     double      noteStartTime[128] = { 0.0 };
+
+    // MPE lower zone: channel 1 is the master channel, channels 2 to 16 are member channels
+    static constexpr int mpeFirstMemberChannel = 2;
+    static constexpr int mpeLastMemberChannel = 16;
+    static constexpr int mpeBendRangeSemitones = 48;
+    static constexpr int channelFree = -1;
+    static constexpr int channelReleased = -2; // note off sent in this buffer, free from the next one
+    bool        mpeActive          = false; // zone configuration last sent
+    int         noteChannel[128]   = { 0 }; // channel of each held note
+    int         channelNote[17]    = { 0 }; // note held on each member channel, channelFree or channelReleased
+    uint32_t    channelLastUsed[17] = { 0 }; // value of channelClock at the last note on or off of each channel
+    int         channelPitchWheel[17] = { 0 }; // last pitch wheel value sent on each member channel
+    uint32_t    channelClock       = 0;
     
 
     TranscriberStatus status       = collectingAudio;
     int      bufferLenSamples      = 0;
-    double   bufferLenSecs          = 0;
-    int      captureLenSamples     = 0;
-    double   captureLenSecs        = 0;
-    int      silenceLenSamples     = 0;
-    double   silenceLenSecs        = 0;
+    // requested capture length, 0 for the whole buffer (worker thread)
+    int      latencySamples        = 0;
+    // capture length of the next capture, set by the worker and read by the audio thread when a capture starts
+    std::atomic<int> nextCaptureLenSamples { 0 };
+    // capture length of the buffer being written, fixed when its capture starts
+    int      writeCaptureLenSamples = 0;
+    // capture length of currentReadBuffer
+    int      readCaptureLenSamples = 0;
     int      samplesWritten        = 0;
     double   processedAudioSecs    = 0.0;
 
-    float    noteSensitivity       = 0.7f;
-    float    splitSensitivity      = 0.5f;
-    float    minNoteDurationMs     = 125.0f;
-    float    minNoteVelocity       = 0.0f;
     double   maxNoteDurationSecs   = 3.0;
-    float   noteHoldSensitivity   = 0.95f;
+    TranscriberMode lastMode       = windowedMode;
+
+    // written by the audio thread, the worker takes the latest snapshot before each transcription
+    Parameters parameters;
+    ParameterSnapshot<Parameters> parameterSnapshot;
+    // snapshot used for the window being transcribed
+    Parameters windowParameters;
+
+    static constexpr int commandQueueSize = 16;
+    juce::AbstractFifo commandFifo { commandQueueSize };
+    std::array<Command, commandQueueSize> commandBuffer {};
+
+    const TranscriberThreading threading;
+    std::atomic<bool> waitForTranscription { false };
+    // callerThread: windows transcribed since the last process() and start of the next one in their MIDI
+    int      numWindowsTranscribed = 0;
+    int      midiSampleOffset      = 0;
+
+    // audioCallback: stage of the window transcribed in slices
+    enum SliceStage { noSlice, featuresSlice, cnnSlice, historySlice, notesSlice };
+    // notes work of each slice, a fraction of a millisecond
+    static constexpr int noteFramesPerSlice = 8;
+    SliceStage sliceStage          = noSlice;
+    float*   sliceBuffer           = nullptr;
+    int      sliceCaptureLen       = 0;
+
+    // streamingMode: next frame of the buffer fed to the NoteStream, end of the capture frames, stream frame index
+    // minus frame index in the buffer, and capture length
+    int      streamFrame           = 0;
+    int      streamEndFrame        = 0;
+    int      streamFrameOffset     = 0;
+    int      streamCaptureLen      = 0;
 
     std::thread              workerThread;
     std::mutex               statusMutex, midiMutex;
     std::condition_variable  statusCV;
+    // notified by the worker after it applied the queued commands or transcribed a window
+    std::condition_variable  workerDoneCV;
     std::atomic<bool>        keepRunning { true };
 
+    // posteriorgram frames of the latest captures, written by whichever thread transcribes
+    PosteriorgramHistory     history;
+    // note creation parameters of the last window pushed to the history
+    Notes::ConvertParams     historyParams;
+    // captured samples pushed since the reset, frames are cut on multiples of FFT_HOP from there
+    int64_t                  historySamples = 0;
+    // audioCallback: frames were skipped rather than wait for the lock, the history restarts at the next window
+    bool                     historyGap     = false;
+    std::mutex               historyMutex;
+    // rederiveNotes only
+    Notes                    rederiveNotesCreator;
+    std::vector<std::vector<float>> rederiveNotesPG, rederiveOnsetsPG, rederiveContoursPG;
+
     // This is where we queue up messages from runModel()
     juce::MidiBuffer         pendingMidi;
+    // MIDI of a window (or of a slice of it) before it is queued in pendingMidi. Both are sized by setBufferLength
+    // and only cleared after, so that the audio thread does not allocate
+    juce::MidiBuffer         windowMidi;
 };
@@ -1,13 +1,26 @@
 #include <JuceHeader.h>
 
 #include "../plugin/Transcriber.h"
+#include "../plugin/InputStage.h"
 #include "../lib/DSP/Resampler.h"
+#include "../lib/Model/ParameterSweep.h"
+#include "../lib/Model/HalfFloat.h"
+#include "../lib/Model/QuantizedConv2D.h"
 #include <vector>
 #include <functional>
 #include <cmath>
 #include <chrono>
 #include <thread>
 #include <unordered_map>
+#include <set>
+#include <random>
+
+#if JUCE_LINUX
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 
 using namespace juce;
 
@@ -168,6 +181,112 @@ std::vector<float> makePulse(double freq,
     return v;
 }
 
+//------------------------------------------------------------------------------
+// Test signals of TranscriberTest, also transcribed by the model tests
+//------------------------------------------------------------------------------
+struct TranscriberCase
+{
+    String name;
+    std::function<std::vector<float>()> makeAudio;
+    int bufferSize;               // chunk size to send per call
+    int bufferLenSamples;         // transcriber buffer length in samples
+    std::vector<int> expectedOn;  // expected Note On MIDI numbers
+    std::vector<int> expectedOff; // expected Note Off MIDI numbers
+};
+
+static std::vector<TranscriberCase> makeTranscriberCases()
+{
+    const double sr = BASIC_PITCH_SAMPLE_RATE;
+
+    // Pre-calculate MIDI note numbers
+    const int C4 = freqToMidiNote(261.63);
+    const int E4 = freqToMidiNote(329.63);
+    const int G4 = freqToMidiNote(392.00);
+
+    return {
+        {
+            "Single C4 (saw) 0.5s",
+            [=]{ double totalSecs = 4096.0 / sr;
+                 return makeSaw(261.63, 0.1, totalSecs, sr, 0.4f); },
+            512, 4096,
+            { C4 }, { C4 }
+        },
+         {
+                "Long E4 across 3 buffers",
+                [=]{ double totalSecs = 1.0;
+
+                     return makeSaw(329.63, 0.5, totalSecs, sr, 0.4f); },
+                 512, static_cast<int>(0.2 * sr) ,
+                { E4 }, { E4 }
+            },
+
+        {
+            "Major triad chord (saw mix)",
+            [=]{ double totalSecs = 0.5;// 4096 is about 0.18
+                double noteLenSecs = 0.1;
+                 auto c = makeSaw(midiNoteToFreq(C4), noteLenSecs, totalSecs, sr, 0.3f);
+                 auto e = makeSaw(midiNoteToFreq(E4), noteLenSecs, totalSecs, sr, 0.3f);
+                 auto g = makeSaw(midiNoteToFreq(G4), noteLenSecs, totalSecs, sr, 0.3f);
+                 std::vector<float> sum(c.size());
+                 for (size_t i = 0; i < sum.size(); ++i)
+                     sum[i] = c[i] + e[i] + g[i];
+                 return sum;
+            },
+            1024, 4096,
+            { C4, E4, G4 },
+            { C4, E4, G4 }
+        },
+
+        {
+            "Staccato C4 pulse bursts",
+            [=]
+            {
+                double totalSecs = 2.0;
+                double pulseLenSecs = 0.1;
+                std::vector<float> out;
+                for (int i = 0; i < 5; ++i)
+                {
+                    appendVector(out,
+                                 makePulse(261.63, pulseLenSecs, totalSecs, sr, 0.5f, 0.2f));
+                    out.insert(out.end(), int(0.1 * sr), 0.0f);
+                }
+                return out;
+            },
+            512, 4096,
+            std::vector<int>(5, C4),
+            std::vector<int>(5, C4)},
+
+        // {
+        //     "Silence only",
+        //     [=]{ return std::vector<float>(int((4096.0/sr) * sr), 0.0f); },
+        //     256, 4096,
+        //     {}, {}
+        // }
+    };
+}
+
+//------------------------------------------------------------------------------
+// Max abs difference between two posteriorgrams, also accumulates the mean
+//------------------------------------------------------------------------------
+static float maxPGDifference(const std::vector<std::vector<float>>& a,
+                             const std::vector<std::vector<float>>& b,
+                             double& sumDiff,
+                             size_t& count)
+{
+    float maxDiff = 0.0f;
+    for (size_t frame = 0; frame < a.size() && frame < b.size(); ++frame)
+    {
+        for (size_t i = 0; i < a[frame].size(); ++i)
+        {
+            float diff = std::abs(a[frame][i] - b[frame][i]);
+            maxDiff = std::max(maxDiff, diff);
+            sumDiff += diff;
+            ++count;
+        }
+    }
+    return maxDiff;
+}
+
 //------------------------------------------------------------------------------
 // Unit test suite for Transcriber
 //------------------------------------------------------------------------------
@@ -176,16 +295,6 @@ class TranscriberTest : public UnitTest
 public:
     TranscriberTest() : UnitTest("TranscriberTest", "Audio to MIDI") {}
 
-    struct Case
-    {
-        String name;
-        std::function<std::vector<float>()> makeAudio;
-        int bufferSize;               // chunk size to send per call
-        int bufferLenSamples;         // transcriber buffer length in samples
-        std::vector<int> expectedOn;  // expected Note On MIDI numbers
-        std::vector<int> expectedOff; // expected Note Off MIDI numbers
-    };
-
     void runTest() override
     {
         std::cout << "Running Transcriber unit tests" << std::endl;
@@ -194,69 +303,8 @@ public:
         // Pre-calculate MIDI note numbers
         const int C4 = freqToMidiNote(261.63);
         const int E4 = freqToMidiNote(329.63);
-        const int G4 = freqToMidiNote(392.00);
-
-        std::vector<Case> cases =
-            {
-                {
-                    "Single C4 (saw) 0.5s",
-                    [&]{ double totalSecs = 4096.0 / sr;
-                         return makeSaw(261.63, 0.1, totalSecs, sr, 0.4f); },
-                    512, 4096,
-                    { C4 }, { C4 }
-                },
-                 {
-                        "Long E4 across 3 buffers",
-                        [&]{ double totalSecs = 1.0;
-
-                             return makeSaw(329.63, 0.5, totalSecs, sr, 0.4f); },
-                         512, static_cast<int>(0.2 * sr) ,
-                        { E4 }, { E4 }
-                    },
-
-                {
-                    "Major triad chord (saw mix)",
-                    [&]{ double totalSecs = 0.5;// 4096 is about 0.18
-                        double noteLenSecs = 0.1;
-                         auto c = makeSaw(midiNoteToFreq(C4), noteLenSecs, totalSecs, sr, 0.3f);
-                         auto e = makeSaw(midiNoteToFreq(E4), noteLenSecs, totalSecs, sr, 0.3f);
-                         auto g = makeSaw(midiNoteToFreq(G4), noteLenSecs, totalSecs, sr, 0.3f);
-                         std::vector<float> sum(c.size());
-                         for (size_t i = 0; i < sum.size(); ++i)
-                             sum[i] = c[i] + e[i] + g[i];
-                         return sum;
-                    },
-                    1024, 4096,
-                    { C4, E4, G4 },
-                    { C4, E4, G4 }
-                },
 
-                {
-                    "Staccato C4 pulse bursts",
-                    [&]
-                    {
-                        double totalSecs = 2.0;
-                        double pulseLenSecs = 0.1;
-                        std::vector<float> out;
-                        for (int i = 0; i < 5; ++i)
-                        {
-                            appendVector(out,
-                                         makePulse(261.63, pulseLenSecs, totalSecs, sr, 0.5f, 0.2f));
-                            out.insert(out.end(), int(0.1 * sr), 0.0f);
-                        }
-                        return out;
-                    },
-                    512, 4096,
-                    std::vector<int>(5, C4),
-                    std::vector<int>(5, C4)},
-
-                // {
-                //     "Silence only",
-                //     [&]{ return std::vector<float>(int((4096.0/sr) * sr), 0.0f); },
-                //     256, 4096,
-                //     {}, {}
-                // }
-            };
+        const std::vector<TranscriberCase> cases = makeTranscriberCases();
 
         // for (auto& tc : cases)
         // {
@@ -280,7 +328,7 @@ public:
         for (auto &tc : cases)
         {
             beginTest(tc.name);
-            Transcriber trans;
+            Transcriber trans(callerThread);
             trans.resetBuffersSamples(tc.bufferLenSamples);
             auto audio = tc.makeAudio();
 
@@ -299,26 +347,22 @@ public:
                 std::cout << "Wrote test buffer to " << outFile.getFullPathName() << std::endl;
             }
 
-            // Feed audio in blocks
+            // Feed audio in blocks, collecting all MIDI into local midi buffer
+            MidiBuffer midi;
             size_t pos = 0;
+            int windowStart = 0;
           
             while (pos < audio.size())
             {
                 int chunk = int(std::min<size_t>(tc.bufferSize, audio.size() - pos));
                 trans.queueAudioForTranscription(&audio[pos], chunk, sr);
-                while (trans.getStatus() == bothBuffersFullPleaseWait ||
-                       trans.getStatus() == collectingAudioAndTranscribing)
-                    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                MidiBuffer windowMidi;
+                const int numWindows = trans.process(windowMidi);
+                midi.addEvents(windowMidi, 0, -1, windowStart);
+                windowStart += numWindows * tc.bufferLenSamples;
                 pos += chunk;
             }
 
-
-            bool got = waitForMidi(trans);
-            expect(got, "timeout waiting for MIDI");
-
-            // Collect all MIDI into local midi buffer
-            MidiBuffer midi;
-            trans.collectMidi(midi);
             std::cout << "Collected midi events: " << midi.getNumEvents() << std::endl;
 
 
@@ -350,15 +394,1867 @@ public:
                 expect(found, "Expected Note Off for MIDI note " + String(expectedNote));
             }
         }
+
+        beginTest("MPE: note on a member channel with its pitch bends");
+        {
+            Transcriber trans(callerThread);
+            trans.resetBuffersSamples(4096);
+            trans.setMPEEnabled(true);
+
+            // a note slightly sharp of C4 so that the contour bends it
+            auto audio = makeSaw(midiNoteToFreq(C4) * std::pow(2.0, 0.3 / 12.0), 0.1, 4096.0 / sr, sr, 0.4f);
+            trans.queueAudioForTranscription(audio.data(), (int) audio.size(), sr);
+
+            MidiBuffer midi;
+            expectEquals(trans.process(midi), 1);
+
+            int noteChannel = 0, numNoteOffs = 0;
+            for (auto metadata : midi)
+            {
+                const auto &msg = metadata.getMessage();
+                if (msg.isNoteOn() && msg.getNoteNumber() == C4)
+                    noteChannel = msg.getChannel();
+                if (msg.isNoteOff() && msg.getNoteNumber() == C4)
+                {
+                    expectEquals(msg.getChannel(), noteChannel, "note off on the channel of its note on");
+                    ++numNoteOffs;
+                }
+                if (msg.isPitchWheel())
+                    expect(msg.getChannel() >= 2, "pitch bends are only sent on member channels");
+            }
+            expect(noteChannel >= 2 && noteChannel <= 16, "note on sent on an MPE member channel");
+            expectEquals(numNoteOffs, 1);
+        }
+
+        beginTest("Caller thread: same MIDI on every run");
+        {
+            auto audio = makeSaw(midiNoteToFreq(E4), 0.3, 3 * 4096.0 / sr, sr, 0.4f);
+            auto transcribe = [&]
+            {
+                Transcriber trans(callerThread);
+                trans.resetBuffersSamples(4096);
+                // more than one window per call: the waiting window is transcribed when the next one is captured
+                trans.queueAudioForTranscription(audio.data(), (int) audio.size(), sr);
+                MidiBuffer midi;
+                expectEquals(trans.process(midi), 3);
+                return midi;
+            };
+
+            const MidiBuffer first = transcribe();
+            const MidiBuffer second = transcribe();
+            expect(first.getNumEvents() > 0, "E4 transcribed");
+            expectEquals(second.getNumEvents(), first.getNumEvents());
+
+            auto it = second.begin();
+            for (auto metadata : first)
+            {
+                const auto other = *it++;
+                expectEquals(other.samplePosition, metadata.samplePosition);
+                expect(other.getMessage().getDescription() == metadata.getMessage().getDescription(),
+                       "same message");
+            }
+        }
+
+        beginTest("Worker thread waiting for each window: nothing dropped");
+        {
+            // one short C4 in each of four windows, queued as fast as possible as in an offline render
+            std::vector<float> audio;
+            for (int i = 0; i < 4; ++i)
+                appendVector(audio, makeSaw(midiNoteToFreq(C4), 0.1, 8192.0 / sr, sr, 0.4f));
+
+            Transcriber trans;
+            trans.resetBuffersSamples(8192);
+            trans.setWaitForTranscription(true);
+            int numNoteOns = 0;
+            for (size_t pos = 0; pos < audio.size(); pos += 512)
+            {
+                trans.queueAudioForTranscription(&audio[pos], int(std::min<size_t>(512, audio.size() - pos)), sr);
+                // the MIDI of a window is ready when the call that completed it returns
+                MidiBuffer midi;
+                trans.collectMidi(midi);
+                for (auto metadata : midi)
+                    numNoteOns += metadata.getMessage().isNoteOn() && metadata.getMessage().getNoteNumber() == C4;
+            }
+            expectEquals(numNoteOns, 4);
+        }
+
+        beginTest("Audio callback: transcription in slices within a budget");
+        {
+            Transcriber trans(audioCallback);
+            trans.resetBuffersSamples(4096);
+
+            // 512 samples blocks, half of each for the transcription
+            const double budgetSeconds = 0.5 * 512 / sr;
+            auto audio = makeSaw(midiNoteToFreq(C4), 0.1, 4096.0 / sr, sr, 0.4f);
+            audio.resize(audio.size() * 3, 0.0f);
+            MidiBuffer midi;
+            for (size_t pos = 0; pos + 512 <= audio.size(); pos += 512)
+            {
+                trans.queueAudioForTranscription(&audio[pos], 512, sr);
+                trans.runSlices(budgetSeconds);
+                MidiBuffer windowMidi;
+                trans.collectMidi(windowMidi);
+                midi.addEvents(windowMidi, 0, -1, 0);
+            }
+
+            bool gotC4 = false;
+            for (auto metadata : midi)
+                gotC4 = gotC4 || (metadata.getMessage().isNoteOn() && metadata.getMessage().getNoteNumber() == C4);
+            expect(gotC4, "C4 transcribed in the callback");
+
+            // the deadline is checked before each slice: no budget, no work
+            Transcriber idle(audioCallback);
+            idle.resetBuffersSamples(4096);
+            idle.queueAudioForTranscription(audio.data(), 4096, sr);
+            const auto captured = idle.getStatus();
+            expect(captured != collectingAudio, "window captured");
+            idle.runSlices(0.0);
+            expect(idle.getStatus() == captured, "nothing transcribed without a budget");
+        }
+
+        beginTest("Input stage: stereo 48 kHz host blocks into the transcriber");
+        {
+            const double hostRate = 48000.0;
+            const int blockSize = 480;
+            Transcriber trans;
+            trans.resetBuffersSamples(4096);
+            InputStage inputStage;
+            inputStage.prepare(hostRate, blockSize);
+
+            auto audio = makeSaw(midiNoteToFreq(C4), 0.1, 4096.0 / sr, hostRate, 0.4f);
+            AudioBuffer<float> block(2, blockSize);
+            double sumSquares = 0.0;
+            float peak = 0.0f;
+            for (size_t pos = 0; pos + blockSize <= audio.size(); pos += blockSize)
+            {
+                // same signal on both channels: the downmix is the signal itself
+                block.copyFrom(0, 0, &audio[pos], blockSize);
+                block.copyFrom(1, 0, &audio[pos], blockSize);
+                if (pos == 0)
+                {
+                    sumSquares = 0.0;
+                    peak = 0.0f;
+                    for (int i = 0; i < blockSize; ++i)
+                    {
+                        sumSquares += (double) audio[pos + i] * audio[pos + i];
+                        peak = std::max(peak, std::abs(audio[pos + i]));
+                    }
+                }
+
+                inputStage.process(block, trans);
+
+                if (pos == 0)
+                {
+                    expectWithinAbsoluteError(inputStage.getRMS(), (float) std::sqrt(sumSquares / blockSize), 1e-5f);
+                    expectWithinAbsoluteError(inputStage.getPeak(), peak, 1e-6f);
+                }
+                while (trans.getStatus() == bothBuffersFullPleaseWait ||
+                       trans.getStatus() == collectingAudioAndTranscribing)
+                    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+            expect(waitForMidi(trans), "timeout waiting for MIDI");
+
+            MidiBuffer midi;
+            trans.collectMidi(midi);
+            bool gotC4 = false;
+            for (auto metadata : midi)
+                gotC4 = gotC4 || (metadata.getMessage().isNoteOn() && metadata.getMessage().getNoteNumber() == C4);
+            expect(gotC4, "C4 transcribed from the resampled input");
+        }
     }
 };
 
-//==============================================================================
-int main()
+//------------------------------------------------------------------------------
+// Unit test suite for the half precision conversions used for fp16 storage:
+// round trips, rounding, and vector paths against the scalar ones
+//------------------------------------------------------------------------------
+class HalfFloatTest : public UnitTest
 {
-    std::cout << "Running Transcriber unit tests..." << std::endl;
-    UnitTestRunner runner;
-    TranscriberTest transcriberTest; // register our tests
-    runner.runTestsInCategory("Audio to MIDI");
+public:
+    HalfFloatTest() : UnitTest("HalfFloatTest", "Model") {}
+
+    void runTest() override
+    {
+        beginTest("Every half value survives a round trip through float");
+        {
+            std::vector<HalfFloat::Half> halves(65536);
+            for (size_t i = 0; i < halves.size(); ++i)
+                halves[i] = (HalfFloat::Half) i;
+
+            std::vector<float> floats(halves.size());
+            std::vector<HalfFloat::Half> back(halves.size());
+            HalfFloat::toFloat(halves.data(), floats.data(), (int) halves.size());
+            HalfFloat::fromFloat(floats.data(), back.data(), (int) floats.size());
+
+            int numWrong = 0;
+            for (size_t i = 0; i < halves.size(); ++i)
+            {
+                const bool isNaN = (halves[i] & 0x7c00) == 0x7c00 && (halves[i] & 0x3ff) != 0;
+                const float scalar = HalfFloat::toFloat(halves[i]);
+
+                if (isNaN)
+                    numWrong += std::isnan(floats[i]) && std::isnan(scalar) && (back[i] & 0x7fff) > 0x7c00 ? 0 : 1;
+                else
+                    numWrong += back[i] == halves[i] && std::memcmp(&scalar, &floats[i], sizeof(float)) == 0
+                                        && HalfFloat::fromFloat(scalar) == halves[i]
+                                    ? 0
+                                    : 1;
+            }
+            expectEquals(numWrong, 0);
+        }
+
+        beginTest("Float to half rounds to nearest even");
+        {
+            // 1 + 2^-11 is half way between 1 and the next half, 1 + 3 * 2^-11 half way between two odd steps
+            expectEquals((int) HalfFloat::fromFloat(1.0f + 0.00048828125f), 0x3c00);
+            expectEquals((int) HalfFloat::fromFloat(1.0f + 3.0f * 0.00048828125f), 0x3c02);
+            expectEquals((int) HalfFloat::fromFloat(65504.0f), 0x7bff);
+            expectEquals((int) HalfFloat::fromFloat(65520.0f), 0x7c00);
+            expectEquals((int) HalfFloat::fromFloat(-1.0e6f), 0xfc00);
+            expectEquals((int) HalfFloat::fromFloat(5.9604644775390625e-8f), 0x0001);
+            expectEquals((int) HalfFloat::fromFloat(2.98023223876953125e-8f), 0x0000);
+            expectEquals((int) HalfFloat::fromFloat(-0.0f), 0x8000);
+        }
+
+        beginTest("Vector and scalar float to half agree, with relative error below 2^-11");
+        {
+            Random random(1234);
+            std::vector<float> floats(4099);
+            for (auto& v : floats)
+                v = (random.nextFloat() - 0.5f) * std::pow(2.0f, (float) (random.nextInt(40) - 24));
+
+            std::vector<HalfFloat::Half> halves(floats.size());
+            std::vector<float> back(floats.size());
+            HalfFloat::fromFloat(floats.data(), halves.data(), (int) floats.size());
+            HalfFloat::toFloat(halves.data(), back.data(), (int) halves.size());
+
+            int numWrong = 0;
+            float maxRelError = 0.0f;
+            for (size_t i = 0; i < floats.size(); ++i)
+            {
+                numWrong += halves[i] == HalfFloat::fromFloat(floats[i]) ? 0 : 1;
+                if (std::abs(floats[i]) >= 6.103515625e-5f)
+                    maxRelError = std::max(maxRelError, std::abs(back[i] - floats[i]) / std::abs(floats[i]));
+            }
+            expectEquals(numWrong, 0);
+            expect(maxRelError <= 0.00048828125f, "Relative error " + String(maxRelError));
+        }
+    }
+};
+
+//------------------------------------------------------------------------------
+// Unit test suite for the CNN engines: the optimised engines are checked
+// against the generic RTNeural implementation
+//------------------------------------------------------------------------------
+class BasicPitchCNNTest : public UnitTest
+{
+public:
+    BasicPitchCNNTest() : UnitTest("BasicPitchCNNTest", "Model") {}
+
+    /** run both engines on the same random frames, return max abs difference over all posteriorgrams */
+    float maxEngineDifference(CNNEngine engine, int numFrames)
+    {
+        auto reference = std::make_unique<BasicPitchCNN>();
+        auto tested = std::make_unique<BasicPitchCNN>();
+        reference->setEngine(RTNeuralEngine);
+        tested->setEngine(engine);
+
+        std::vector<float> input(NUM_HARMONICS * NUM_FREQ_IN);
+        std::vector<float> refContours(NUM_FREQ_IN), refNotes(NUM_FREQ_OUT), refOnsets(NUM_FREQ_OUT);
+        std::vector<float> contours(NUM_FREQ_IN), notes(NUM_FREQ_OUT), onsets(NUM_FREQ_OUT);
+
+        Random random(1234);
+        float maxDiff = 0.0f;
+        for (int frame = 0; frame < numFrames; ++frame)
+        {
+            for (auto& v : input)
+                v = random.nextFloat();
+
+            reference->frameInference(input.data(), refContours, refNotes, refOnsets);
+            tested->frameInference(input.data(), contours, notes, onsets);
+
+            for (size_t i = 0; i < contours.size(); ++i)
+                maxDiff = std::max(maxDiff, std::abs(contours[i] - refContours[i]));
+            for (size_t i = 0; i < notes.size(); ++i)
+            {
+                maxDiff = std::max(maxDiff, std::abs(notes[i] - refNotes[i]));
+                maxDiff = std::max(maxDiff, std::abs(onsets[i] - refOnsets[i]));
+            }
+        }
+        return maxDiff;
+    }
+
+    /** run the fused engine on all pitches and on a pitch range, return max abs difference of the outputs used
+        for that range (notes and onsets in range, contours in range extended by the pitch bend tolerance) */
+    float maxPitchRangeDifference(int minMidiNote, int maxMidiNote, int numFrames)
+    {
+        auto reference = std::make_unique<BasicPitchCNN>();
+        auto tested = std::make_unique<BasicPitchCNN>();
+        reference->setEngine(FusedEngine);
+        tested->setEngine(FusedEngine);
+        tested->setPitchRange(minMidiNote, maxMidiNote);
+
+        const int noteBegin = minMidiNote - MIDI_OFFSET;
+        const int noteEnd = maxMidiNote - MIDI_OFFSET + 1;
+        const int contourBegin = std::max(0, noteBegin * CONTOURS_BINS_PER_SEMITONE - PITCH_BEND_NUM_BINS_TOLERANCE);
+        const int contourEnd = std::min(NUM_FREQ_IN,
+                                        (noteEnd - 1) * CONTOURS_BINS_PER_SEMITONE + PITCH_BEND_NUM_BINS_TOLERANCE + 1);
+
+        std::vector<float> input(NUM_HARMONICS * NUM_FREQ_IN);
+        std::vector<float> refContours(NUM_FREQ_IN), refNotes(NUM_FREQ_OUT), refOnsets(NUM_FREQ_OUT);
+        std::vector<float> contours(NUM_FREQ_IN), notes(NUM_FREQ_OUT), onsets(NUM_FREQ_OUT);
+
+        Random random(1234);
+        float maxDiff = 0.0f;
+        for (int frame = 0; frame < numFrames; ++frame)
+        {
+            for (auto& v : input)
+                v = random.nextFloat();
+
+            reference->frameInference(input.data(), refContours, refNotes, refOnsets);
+            tested->frameInference(input.data(), contours, notes, onsets);
+
+            for (int i = contourBegin; i < contourEnd; ++i)
+                maxDiff = std::max(maxDiff, std::abs(contours[(size_t) i] - refContours[(size_t) i]));
+            for (int i = noteBegin; i < noteEnd; ++i)
+            {
+                maxDiff = std::max(maxDiff, std::abs(notes[(size_t) i] - refNotes[(size_t) i]));
+                maxDiff = std::max(maxDiff, std::abs(onsets[(size_t) i] - refOnsets[(size_t) i]));
+            }
+        }
+        return maxDiff;
+    }
+
+    void runTest() override
+    {
+        beginTest("Fused engine matches RTNeural");
+        float diff = maxEngineDifference(FusedEngine, 64);
+        std::cout << "Fused engine max abs diff: " << diff << std::endl;
+        expect(diff < 1e-5f, "Fused engine differs from RTNeural by " + String(diff));
+
+        beginTest("Pitch range restricted CNN matches full CNN in range");
+        diff = maxPitchRangeDifference(40, 64, 64);
+        std::cout << "Pitch range restricted max abs diff: " << diff << std::endl;
+        expect(diff == 0.0f, "Pitch range restricted CNN differs by " + String(diff));
+
+        beginTest("Fused engine with fp16 storage matches RTNeural");
+        diff = maxEngineDifference(FusedHalfEngine, 64);
+        std::cout << "Fused fp16 storage engine max abs diff: " << diff << std::endl;
+        expect(diff < 5e-3f, "Fused fp16 storage engine differs from RTNeural by " + String(diff));
+
+        beginTest("Posteriorgrams computed a few frames at a time match a single pass");
+        {
+            auto audio = makeSaw(midiNoteToFreq(60), 0.1, 4096.0 / BASIC_PITCH_SAMPLE_RATE, BASIC_PITCH_SAMPLE_RATE, 0.4f);
+            auto reference = std::make_unique<BasicPitch>();
+            auto sliced = std::make_unique<BasicPitch>();
+            reference->computePosteriorgrams(audio.data(), (int) audio.size());
+
+            sliced->beginPosteriorgrams(audio.data(), (int) audio.size());
+            int numSlices = 0;
+            while (sliced->computePosteriorgramFrames(3) > 0)
+                ++numSlices;
+            expectEquals(numSlices, (sliced->getNumPosteriorgramFrames() - 1) / 3);
+
+            expect(sliced->getNotesPG() == reference->getNotesPG(), "same note posteriorgrams");
+            expect(sliced->getOnsetsPG() == reference->getOnsetsPG(), "same onset posteriorgrams");
+            expect(sliced->getContoursPG() == reference->getContoursPG(), "same contour posteriorgrams");
+        }
+
+        beginTest("Eco mode back to full rate matches a fresh CNN");
+        {
+            auto reference = std::make_unique<BasicPitchCNN>();
+            auto tested = std::make_unique<BasicPitchCNN>();
+            reference->setEngine(FusedEngine);
+            tested->setEngine(FusedEngine);
+            tested->setDecimation(BasicPitchCNN::MAX_DECIMATION);
+            expectEquals(tested->getNumFramesDelay(),
+                         BasicPitchCNN::getNumFramesLookahead() + BasicPitchCNN::MAX_DECIMATION - 1);
+            tested->setDecimation(1);
+            expectEquals(tested->getNumFramesDelay(), BasicPitchCNN::getNumFramesLookahead());
+
+            std::vector<float> input(NUM_HARMONICS * NUM_FREQ_IN);
+            std::vector<float> refContours(NUM_FREQ_IN), refNotes(NUM_FREQ_OUT), refOnsets(NUM_FREQ_OUT);
+            std::vector<float> contours(NUM_FREQ_IN), notes(NUM_FREQ_OUT), onsets(NUM_FREQ_OUT);
+
+            Random random(1234);
+            bool same = true;
+            for (int frame = 0; frame < 16; ++frame)
+            {
+                for (auto& v : input)
+                    v = random.nextFloat();
+
+                reference->frameInference(input.data(), refContours, refNotes, refOnsets);
+                tested->frameInference(input.data(), contours, notes, onsets);
+                same = same && contours == refContours && notes == refNotes && onsets == refOnsets;
+            }
+            expect(same, "decimation 1 changes the outputs");
+        }
+    }
+};
+
+//------------------------------------------------------------------------------
+// Unit test suite for the int8 engine: dot product kernels against the scalar
+// one, then transcriptions checked against the float (fused) engine on the
+// TranscriberTest signals, after calibration on the built-in signal
+//------------------------------------------------------------------------------
+class Int8EngineTest : public UnitTest
+{
+public:
+    Int8EngineTest() : UnitTest("Int8EngineTest", "Model") {}
+
+    void runTest() override
+    {
+        beginTest("Int8 dot product kernels available on this CPU match the scalar one");
+        {
+            const int numTaps = 3;
+            const int length = 5 * Int8Dot::BlockSize;
+            const int offset = 7;
+
+            Random random(1234);
+            std::vector<std::vector<int8_t>> activations((size_t) numTaps, std::vector<int8_t>(length + offset));
+            std::vector<int8_t> weights((size_t) (numTaps * length));
+            for (auto& tap : activations)
+                for (auto& v : tap)
+                    v = (int8_t) random.nextInt(128);
+            for (auto& v : weights)
+                v = (int8_t) (random.nextInt(255) - 127);
+
+            std::vector<const int8_t*> taps;
+            for (const auto& tap : activations)
+                taps.push_back(tap.data());
+
+            const int32_t reference =
+                Int8Dot::dot(Int8Dot::Kernel::Scalar, taps.data(), offset, weights.data(), numTaps, length);
+            for (auto kernel : {Int8Dot::Kernel::Sse2,
+                                Int8Dot::Kernel::Ssse3,
+                                Int8Dot::Kernel::AvxVnni,
+                                Int8Dot::Kernel::Avx512Vnni,
+                                Int8Dot::Kernel::NeonDot})
+            {
+                if (Int8Dot::isAvailable(kernel))
+                    expectEquals(Int8Dot::dot(kernel, taps.data(), offset, weights.data(), numTaps, length),
+                                 reference);
+            }
+            std::cout << "Int8 dot kernel: " << (int) Int8Dot::getKernel() << std::endl;
+            expect(Int8Dot::isAvailable(Int8Dot::getKernel()));
+        }
+
+        auto floatModel = std::make_unique<BasicPitch>();
+        auto int8Model = std::make_unique<BasicPitch>();
+        floatModel->setParameters(0.7f, 0.5f, 125.0f);
+        int8Model->setParameters(0.7f, 0.5f, 125.0f);
+        floatModel->setCNNEngine(FusedEngine);
+
+        // Calibrated on the built-in signal as in the plugin, not on the signals it is scored on
+        beginTest("Int8 calibration on the built-in signal");
+        int8Model->calibrateInt8();
+        int8Model->setCNNEngine(Int8Engine);
+        expect(int8Model->getCNNEngine() == Int8Engine, "Int8 engine not selected after calibration");
+
+        for (const auto& tc : makeTranscriberCases())
+        {
+            beginTest("Int8 engine: " + tc.name);
+
+            auto audio = tc.makeAudio();
+            auto audioCopy = audio;
+            floatModel->reset();
+            floatModel->transcribeToMIDI(audio.data(), (int) audio.size());
+            int8Model->reset();
+            int8Model->transcribeToMIDI(audioCopy.data(), (int) audioCopy.size());
+
+            double sumDiff = 0.0;
+            size_t count = 0;
+            float maxDiff = maxPGDifference(floatModel->getNotesPG(), int8Model->getNotesPG(), sumDiff, count);
+            maxDiff = std::max(maxDiff,
+                               maxPGDifference(floatModel->getOnsetsPG(), int8Model->getOnsetsPG(), sumDiff, count));
+            maxDiff = std::max(maxDiff,
+                               maxPGDifference(floatModel->getContoursPG(), int8Model->getContoursPG(), sumDiff, count));
+
+            std::set<int> floatPitches, int8Pitches;
+            for (const auto& event : floatModel->getNoteEvents())
+                floatPitches.insert(event.pitch);
+            for (const auto& event : int8Model->getNoteEvents())
+                int8Pitches.insert(event.pitch);
+
+            const std::set<int> expectedPitches(tc.expectedOn.begin(), tc.expectedOn.end());
+            int numExpectedFound = 0;
+            for (int pitch : expectedPitches)
+                numExpectedFound += int8Pitches.count(pitch) > 0 ? 1 : 0;
+
+            std::cout << tc.name << ": max PG diff " << maxDiff
+                      << " mean PG diff " << sumDiff / (double) std::max<size_t>(count, 1)
+                      << ", pitches float " << floatPitches.size() << " int8 " << int8Pitches.size()
+                      << ", expected pitches found " << numExpectedFound << "/" << expectedPitches.size()
+                      << std::endl;
+
+            expect(maxDiff < 0.1f, "Int8 posteriorgrams differ by " + String(maxDiff));
+            expectEquals(numExpectedFound, (int) expectedPitches.size());
+            for (int pitch : floatPitches)
+                expect(int8Pitches.count(pitch) > 0, "Int8 engine missed pitch " + String(pitch));
+        }
+    }
+};
+
+//------------------------------------------------------------------------------
+// Unit test suite for the eco quality tiers: transcriptions with a decimated
+// first contour convolution are checked against full quality on the signals
+// of TranscriberTest
+//------------------------------------------------------------------------------
+class EcoModeTest : public UnitTest
+{
+public:
+    EcoModeTest() : UnitTest("EcoModeTest", "Model") {}
+
+    void runTest() override
+    {
+        const double sr = BASIC_PITCH_SAMPLE_RATE;
+        const std::vector<TranscriberCase> cases = makeTranscriberCases();
+
+        auto fullModel = std::make_unique<BasicPitch>();
+        auto ecoModel = std::make_unique<BasicPitch>();
+        fullModel->setParameters(0.7f, 0.5f, 125.0f);
+        ecoModel->setParameters(0.7f, 0.5f, 125.0f);
+
+        for (int decimation : {2, BasicPitchCNN::MAX_DECIMATION})
+        {
+            ecoModel->setCNNDecimation(decimation);
+            expectEquals(ecoModel->getCNNDecimation(), decimation);
+
+            for (auto& tc : cases)
+            {
+                beginTest("Eco 1/" + String(decimation) + ": " + tc.name);
+
+                auto audio = tc.makeAudio();
+                auto audioCopy = audio;
+                fullModel->reset();
+                fullModel->transcribeToMIDI(audio.data(), (int) audio.size());
+                ecoModel->reset();
+                ecoModel->transcribeToMIDI(audioCopy.data(), (int) audioCopy.size());
+
+                expectEquals(ecoModel->getNotesPG().size(), fullModel->getNotesPG().size());
+
+                double sumDiff = 0.0;
+                size_t count = 0;
+                const float onsetsDiff =
+                    maxPGDifference(fullModel->getOnsetsPG(), ecoModel->getOnsetsPG(), sumDiff, count);
+                const float notesDiff =
+                    maxPGDifference(fullModel->getNotesPG(), ecoModel->getNotesPG(), sumDiff, count);
+
+                // onset timing error: each full quality note against the closest eco note of the same pitch
+                double maxOnsetError = 0.0;
+                double sumOnsetError = 0.0;
+                int numMissed = 0;
+                for (const auto& fullEvent : fullModel->getNoteEvents())
+                {
+                    double error = std::numeric_limits<double>::max();
+                    for (const auto& ecoEvent : ecoModel->getNoteEvents())
+                        if (ecoEvent.pitch == fullEvent.pitch)
+                            error = std::min(error, std::abs(ecoEvent.startTime - fullEvent.startTime));
+
+                    if (error == std::numeric_limits<double>::max())
+                    {
+                        ++numMissed;
+                        continue;
+                    }
+                    maxOnsetError = std::max(maxOnsetError, error);
+                    sumOnsetError += error;
+                }
+                const auto numFullNotes = (int) fullModel->getNoteEvents().size();
+
+                std::cout << tc.name << ", eco 1/" << decimation << ": max onset PG diff " << onsetsDiff
+                          << " max note PG diff " << notesDiff << ", notes full " << numFullNotes << " eco "
+                          << ecoModel->getNoteEvents().size() << ", onset error mean "
+                          << 1000.0 * sumOnsetError / std::max(1, numFullNotes - numMissed) << " ms max "
+                          << 1000.0 * maxOnsetError << " ms" << std::endl;
+
+                expectEquals(numMissed, 0, "eco mode missed notes");
+                for (int expectedNote : tc.expectedOn)
+                {
+                    bool found = false;
+                    for (const auto& ecoEvent : ecoModel->getNoteEvents())
+                        found = found || ecoEvent.pitch == expectedNote;
+                    expect(found, "Eco mode missed MIDI note " + String(expectedNote));
+                }
+                // onsets run at full rate: within one frame of the full quality notes
+                expect(maxOnsetError <= FFT_HOP / sr + 1e-6,
+                       "Onset error " + String(1000.0 * maxOnsetError) + " ms");
+                expect(onsetsDiff < 0.1f, "Eco onset posteriorgrams differ by " + String(onsetsDiff));
+            }
+        }
+    }
+};
+
+//------------------------------------------------------------------------------
+// Unit test suite for NoteStream: on clean synthetic posteriorgrams, streaming
+// extraction should give the same notes as Notes::convert without melodia
+//------------------------------------------------------------------------------
+class NoteStreamTest : public UnitTest
+{
+public:
+    NoteStreamTest() : UnitTest("NoteStreamTest", "Model") {}
+
+    void runTest() override
+    {
+        const int numFrames = 150;
+        std::vector<std::vector<float>> notesPG(numFrames, std::vector<float>(NUM_FREQ_OUT, 0.0f));
+        std::vector<std::vector<float>> onsetsPG = notesPG;
+        std::vector<std::vector<float>> contoursPG(numFrames, std::vector<float>(NUM_FREQ_IN, 0.0f));
+
+        // a held note, an overlapping note at another pitch, and a re-articulation of that note
+        for (int f = 10; f < 60; ++f)
+            notesPG[f][40] = 0.9f;
+        onsetsPG[10][40] = 0.8f;
+        for (int f = 30; f < 100; ++f)
+            notesPG[f][50] = 0.7f;
+        onsetsPG[30][50] = 0.9f;
+        onsetsPG[70][50] = 0.95f;
+
+        Notes::ConvertParams params;
+        params.melodiaTrick = false;
+        params.minNoteLength = 5;
+
+        Notes notes;
+        auto events = notes.convert(notesPG, onsetsPG, contoursPG, params, true);
+
+        NoteStream stream;
+        stream.setParameters(params);
+        stream.reset();
+
+        std::vector<NoteStream::Message> messages;
+        int maxNoteOnDelay = 0;
+        for (int f = 0; f < numFrames; ++f)
+        {
+            size_t first = messages.size();
+            stream.processFrame(notesPG[f].data(), onsetsPG[f].data(), messages);
+            for (size_t i = first; i < messages.size(); ++i)
+                if (messages[i].isNoteOn)
+                    maxNoteOnDelay = std::max(maxNoteOnDelay, f - messages[i].frame);
+        }
+        stream.flush(messages);
+
+        beginTest("Streaming notes match Notes::convert");
+        int numNoteOns = 0;
+        for (auto& msg : messages)
+            numNoteOns += msg.isNoteOn ? 1 : 0;
+        expectEquals(numNoteOns, (int) events.size());
+
+        for (auto& event : events)
+        {
+            bool foundOn = false, foundOff = false;
+            for (auto& msg : messages)
+            {
+                foundOn |= msg.isNoteOn && msg.pitch == event.pitch && msg.frame == event.startFrame;
+                foundOff |= !msg.isNoteOn && msg.pitch == event.pitch && msg.frame == event.endFrame;
+            }
+            expect(foundOn, "Missing note on for pitch " + String(event.pitch) + " at frame " + String(event.startFrame));
+            expect(foundOff, "Missing note off for pitch " + String(event.pitch) + " at frame " + String(event.endFrame));
+        }
+
+        beginTest("Note ons are emitted one frame after the onset");
+        expectEquals(maxNoteOnDelay, 1);
+
+        // C major: the note at index 40 (C#4) is out of the scale, the one at index 50 (B4) is in it
+        params.scaleType = NoteUtils::Major;
+        params.rootNote = NoteUtils::C;
+
+        for (auto snapMode : { NoteUtils::Remove, NoteUtils::Adjust })
+        {
+            params.snapMode = snapMode;
+            beginTest(String("Streaming notes follow the scale like Notes::convert, ")
+                      + (snapMode == NoteUtils::Remove ? "Remove" : "Adjust"));
+
+            auto scaleEvents = notes.convert(notesPG, onsetsPG, contoursPG, params, true);
+            stream.setParameters(params);
+            stream.reset();
+            messages.clear();
+            for (int f = 0; f < numFrames; ++f)
+                stream.processFrame(notesPG[f].data(), onsetsPG[f].data(), messages);
+            stream.flush(messages);
+
+            std::vector<std::pair<int, int>> noteOns, expectedNoteOns;
+            for (auto& msg : messages)
+            {
+                if (msg.isNoteOn)
+                    noteOns.emplace_back(msg.frame, msg.pitch);
+                expect(NoteUtils::isInScale(msg.pitch, params.rootNote, params.scaleType),
+                       "Pitch " + String(msg.pitch) + " out of the scale");
+            }
+            for (auto& event : scaleEvents)
+                expectedNoteOns.emplace_back(event.startFrame, event.pitch);
+            std::sort(noteOns.begin(), noteOns.end());
+            std::sort(expectedNoteOns.begin(), expectedNoteOns.end());
+            expect(noteOns == expectedNoteOns, "Note ons differ from the events of Notes::convert");
+
+            // every note off matches a held note
+            std::unordered_map<int, int> held;
+            for (auto& msg : messages)
+            {
+                held[msg.pitch] += msg.isNoteOn ? 1 : -1;
+                expect(held[msg.pitch] == 0 || held[msg.pitch] == 1, "Unbalanced note on / off at " + String(msg.pitch));
+            }
+        }
+    }
+};
+
+//------------------------------------------------------------------------------
+// Unit test suite for the note event post-processing of Notes, compared with
+// straightforward quadratic versions on dense random event sets
+//------------------------------------------------------------------------------
+class NoteEventsTest : public UnitTest
+{
+public:
+    NoteEventsTest() : UnitTest("NoteEventsTest", "Model") {}
+
+    void runTest() override
+    {
+        beginTest("Merge of overlapping notes with same pitch");
+        {
+            // chain of overlapping notes at 60, a note at 62 in between, a later separate note at 60
+            std::vector<Notes::Event> events = {makeEvent(0, 10, 60), makeEvent(5, 20, 60), makeEvent(6, 8, 62),
+                                                makeEvent(15, 30, 60), makeEvent(30, 40, 60)};
+            Notes::mergeOverlappingNotesWithSamePitch(events);
+
+            expectEquals((int) events.size(), 3);
+            expectEquals(events[0].startFrame, 0);
+            expectEquals(events[0].endFrame, 30);
+            expectEquals(events[1].pitch, 62);
+            expectEquals(events[2].startFrame, 30);
+            expectEquals(events[2].endFrame, 40);
+        }
+
+        beginTest("Merge matches reference on dense events");
+        {
+            Random random(42);
+            int numMismatches = 0;
+            for (int i = 0; i < 2000; ++i)
+            {
+                auto events = makeDenseEvents(random);
+                auto expected = events;
+                referenceMerge(expected);
+                Notes::mergeOverlappingNotesWithSamePitch(events);
+                numMismatches += events == expected ? 0 : 1;
+            }
+            expectEquals(numMismatches, 0);
+        }
+
+        beginTest("Drop overlapping pitch bends");
+        {
+            std::vector<Notes::Event> events = {makeEvent(0, 50, 60), makeEvent(10, 20, 64), makeEvent(30, 40, 67),
+                                                makeEvent(50, 60, 72), makeEvent(60, 70, 48), makeEvent(65, 90, 60)};
+            Notes::dropOverlappingPitchBends(events);
+
+            // the first note overlaps the next two but not the one starting at its end
+            const bool expectedEmpty[] = {true, true, true, false, true, true};
+            for (int i = 0; i < 6; ++i)
+                expect(events[i].bends.empty() == expectedEmpty[i], "Wrong bends for event " + String(i));
+        }
+
+        beginTest("Drop overlapping pitch bends matches reference on dense events");
+        {
+            Random random(43);
+            int numMismatches = 0;
+            for (int i = 0; i < 2000; ++i)
+            {
+                auto events = makeDenseEvents(random);
+                auto expected = events;
+                referenceDropBends(expected);
+                Notes::dropOverlappingPitchBends(events);
+                numMismatches += events == expected ? 0 : 1;
+            }
+            expectEquals(numMismatches, 0);
+        }
+
+        beginTest("NoteEvents store matches Event vectors on dense events");
+        {
+            Random random(44);
+            NoteEvents store;
+            int numMismatches = 0;
+            for (int i = 0; i < 2000; ++i)
+            {
+                auto events = makeDenseEvents(random);
+                std::shuffle(events.begin(), events.end(), std::mt19937((unsigned) i));
+
+                // the store is reused as in Notes::convert
+                store.clear();
+                for (auto& event : events)
+                {
+                    const size_t position = store.add(event.startTime, event.endTime, event.startFrame,
+                                                      event.endFrame, event.pitch, event.amplitude);
+                    int* bends = store.allocateBends(position, (int) event.bends.size());
+                    std::copy(event.bends.begin(), event.bends.end(), bends);
+                }
+
+                Notes::mergeOverlappingNotesWithSamePitch(events);
+                Notes::dropOverlappingPitchBends(events);
+                store.mergeOverlappingNotesWithSamePitch();
+                store.dropOverlappingPitchBends();
+
+                numMismatches += sameEvents(store, events) ? 0 : 1;
+            }
+            expectEquals(numMismatches, 0);
+        }
+    }
+
+private:
+    static bool sameEvents(const NoteEvents& store, const std::vector<Notes::Event>& events)
+    {
+        if (store.size() != events.size())
+            return false;
+
+        for (size_t i = 0; i < events.size(); ++i)
+        {
+            const auto event = store[i];
+            const Notes::Event copy {event.startTime, event.endTime, event.startFrame, event.endFrame, event.pitch,
+                                     event.amplitude, std::vector<int>(event.bends.begin(), event.bends.end())};
+            if (!(copy == events[i]))
+                return false;
+        }
+        return true;
+    }
+
+    static Notes::Event makeEvent(int startFrame, int endFrame, int pitch)
+    {
+        return Notes::Event {startFrame * 0.01, endFrame * 0.01, startFrame, endFrame, pitch, 0.5, {1, 0, -1}};
+    }
+
+    /** Up to 60 sorted events over a few pitches, heavily overlapping */
+    static std::vector<Notes::Event> makeDenseEvents(Random& random)
+    {
+        std::vector<Notes::Event> events;
+        const int numEvents = 1 + random.nextInt(60);
+        const int numPitches = 1 + random.nextInt(4);
+        for (int i = 0; i < numEvents; ++i)
+        {
+            const int start = random.nextInt(2 * numEvents);
+            events.push_back(makeEvent(start, start + random.nextInt(30), 60 + random.nextInt(numPitches)));
+            events.back().bends = {i};
+        }
+        Notes::sortEvents(events);
+        return events;
+    }
+
+    /** Merge each note into the first earlier note of same pitch it overlaps, with the running end */
+    static void referenceMerge(std::vector<Notes::Event>& events)
+    {
+        Notes::sortEvents(events);
+        for (size_t i = 0; i < events.size(); ++i)
+        {
+            for (size_t j = i + 1; j < events.size() && events[j].startFrame < events[i].endFrame;)
+            {
+                if (events[j].pitch == events[i].pitch)
+                {
+                    events[i].endTime = events[j].endTime;
+                    events[i].endFrame = events[j].endFrame;
+                    events.erase(events.begin() + (long) j);
+                }
+                else
+                {
+                    ++j;
+                }
+            }
+        }
+    }
+
+    /** Clear bends of every pair of events overlapping in time */
+    static void referenceDropBends(std::vector<Notes::Event>& events)
+    {
+        std::vector<bool> overlaps(events.size(), false);
+        for (size_t i = 0; i < events.size(); ++i)
+            for (size_t j = i + 1; j < events.size(); ++j)
+                if (events[j].startFrame < events[i].endFrame)
+                    overlaps[i] = overlaps[j] = true;
+
+        for (size_t i = 0; i < events.size(); ++i)
+            if (overlaps[i])
+                events[i].bends.clear();
+    }
+};
+
+//------------------------------------------------------------------------------
+// Sine through a Resampler to 22050 Hz in blocks of blockSize samples.
+// Returns the level in dB of the second half of the output (full scale sine = 0 dB).
+//------------------------------------------------------------------------------
+static double resampledSineLevelDB (Resampler& resampler, double sourceRate, double frequency, int blockSize)
+{
+    const int numSamples = (int) sourceRate * 2;
+    std::vector<float> input((size_t) numSamples);
+    for (int i = 0; i < numSamples; ++i)
+        input[(size_t) i] = (float) std::sin(MathConstants<double>::twoPi * frequency * i / sourceRate);
+
+    resampler.reset();
+    std::vector<float> output((size_t) resampler.getNumOutSamplesOnNextProcessBlock(numSamples) + 1);
+    int numOut = 0;
+    for (int start = 0; start < numSamples; start += blockSize)
+        numOut += resampler.processBlock(
+            input.data() + start, output.data() + numOut, std::min(blockSize, numSamples - start));
+
+    double sum = 0.0;
+    for (int i = numOut / 2; i < numOut; ++i)
+        sum += (double) output[(size_t) i] * output[(size_t) i];
+
+    return 10.0 * std::log10(std::max(1e-20, 2.0 * sum / (numOut - numOut / 2)));
+}
+
+//------------------------------------------------------------------------------
+// Unit test suite for the polyphase path of Resampler
+//------------------------------------------------------------------------------
+class ResamplerTest : public UnitTest
+{
+public:
+    ResamplerTest() : UnitTest("ResamplerTest", "Model") {}
+
+    void runTest() override
+    {
+        const double targetRate = BASIC_PITCH_SAMPLE_RATE;
+
+        beginTest("Usual host rates use the polyphase path");
+        for (double rate : {11025.0, 16000.0, 22050.0, 32000.0, 44100.0, 48000.0, 88200.0, 96000.0, 176400.0, 192000.0})
+        {
+            Resampler resampler;
+            resampler.prepareToPlay(rate, 512, targetRate);
+            expect(resampler.isPolyphase(), String(rate) + " Hz");
+        }
+
+        beginTest("Other rates fall back to the interpolator");
+        {
+            Resampler resampler;
+            resampler.prepareToPlay(44056.0, 512, targetRate);
+            expect(! resampler.isPolyphase());
+        }
+
+        beginTest("Output count is predicted for any block size");
+        for (bool polyphase : {true, false})
+        {
+            for (double rate : {16000.0, 44056.0, 44100.0, 48000.0, 96000.0, 192000.0})
+            {
+                Resampler resampler;
+                resampler.setPolyphaseEnabled(polyphase);
+                resampler.prepareToPlay(rate, 512, targetRate);
+
+                Random random(7);
+                std::vector<float> input(2048), output(4096);
+                for (auto& v : input)
+                    v = random.nextFloat() * 2.0f - 1.0f;
+
+                int numIn = 0, numOut = 0;
+                bool countsMatch = true, withinMax = true;
+                while (numIn < (int) rate)
+                {
+                    // blocks larger than the prepared size are split internally
+                    const int blockSize = random.nextInt(1100);
+                    const int expected = resampler.getNumOutSamplesOnNextProcessBlock(blockSize);
+                    withinMax = withinMax && expected <= resampler.getMaxNumOutSamples(blockSize);
+                    countsMatch = countsMatch
+                                  && resampler.processBlock(input.data(), output.data(), blockSize) == expected;
+                    numIn += blockSize;
+                    numOut += expected;
+                }
+                const String name = String(rate) + " Hz" + (polyphase ? "" : ", interpolator");
+                expect(countsMatch, name);
+                expect(withinMax, name);
+                // the interpolator starts with LagrangeInterpolator::getBaseLatency() samples of padding
+                expect(std::abs(numOut - (double) numIn * targetRate / rate) <= (polyphase ? 1.0 : 4.0), name);
+            }
+        }
+
+        beginTest("Passband gain and aliasing");
+        for (double rate : {32000.0, 44100.0, 48000.0, 88200.0, 96000.0, 176400.0, 192000.0})
+        {
+            Resampler resampler;
+            resampler.prepareToPlay(rate, 480, targetRate);
+
+            expectWithinAbsoluteError(resampledSineLevelDB(resampler, rate, 1000.0, 480), 0.0, 0.01);
+            // 15 kHz folds back to 7.05 kHz
+            expectLessThan(resampledSineLevelDB(resampler, rate, 15000.0, 480), -80.0);
+        }
+    }
+};
+
+//------------------------------------------------------------------------------
+// Hardware cache miss counter (Linux perf events). Counts last level cache
+// misses, or L1 data read misses where the former event is not exposed (some
+// virtual machines), and reports -1 where no counter is available.
+//------------------------------------------------------------------------------
+class CacheMissCounter
+{
+public:
+    CacheMissCounter()
+    {
+#if JUCE_LINUX
+        const std::vector<std::pair<perf_event_attr, String>> events = {
+            {makeAttr(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES), "LLC"},
+            {makeAttr(PERF_TYPE_HW_CACHE,
+                      PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                          | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)),
+             "L1D"}};
+
+        for (auto [attr, eventName] : events)
+        {
+            fd = (int) syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+            if (fd >= 0)
+            {
+                name = eventName;
+                break;
+            }
+        }
+#endif
+    }
+
+    ~CacheMissCounter()
+    {
+#if JUCE_LINUX
+        if (fd >= 0)
+            close(fd);
+#endif
+    }
+
+    void start()
+    {
+#if JUCE_LINUX
+        if (fd >= 0)
+        {
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+    }
+
+    /** @return number of cache misses since start, -1 if counters are not available */
+    long long stop()
+    {
+#if JUCE_LINUX
+        long long count = 0;
+        if (fd >= 0)
+        {
+            ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+            if (read(fd, &count, sizeof(count)) == (ssize_t) sizeof(count))
+                return count;
+        }
+#endif
+        return -1;
+    }
+
+    /** @return name of the cache level counted, empty if counters are not available */
+    const String& getName() const { return name; }
+
+private:
+#if JUCE_LINUX
+    static perf_event_attr makeAttr(uint32_t type, uint64_t config)
+    {
+        perf_event_attr attr {};
+        attr.type = type;
+        attr.size = sizeof(attr);
+        attr.config = config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        return attr;
+    }
+#endif
+
+    int fd = -1;
+    String name;
+};
+
+//------------------------------------------------------------------------------
+// Benchmark of the CNN engines, with several model instances running in turn
+// as with several plugin instances. Only run with --benchmark.
+//------------------------------------------------------------------------------
+class CNNBenchmark : public UnitTest
+{
+public:
+    CNNBenchmark() : UnitTest("CNNBenchmark", "Benchmark") {}
+
+    void runTest() override
+    {
+        const int numInstances = 4;
+        const size_t frameSize = NUM_HARMONICS * NUM_FREQ_IN;
+
+        // Features of the TranscriberTest signals: eco mode depends on the input (see BasicPitchCNN::setDecimation)
+        std::vector<float> audio;
+        for (auto& tc : makeTranscriberCases())
+            appendVector(audio, tc.makeAudio());
+
+        Features features;
+        size_t numFrames = 0;
+        const float* stackedCQT = features.computeFeatures(audio.data(), audio.size(), numFrames);
+        const std::vector<float> frames(stackedCQT, stackedCQT + numFrames * frameSize);
+
+        int numChanges = 0;
+        for (size_t frame = 1; frame < numFrames; ++frame)
+        {
+            float change = 0.0f;
+            for (size_t i = 0; i < frameSize; ++i)
+                change += std::abs(frames[frame * frameSize + i] - frames[(frame - 1) * frameSize + i]);
+            numChanges += change > BasicPitchCNN::ECO_ANCHOR_CHANGE * (float) frameSize ? 1 : 0;
+        }
+        std::cout << numFrames << " frames, " << 100.0 * numChanges / (double) numFrames
+                  << "% of them change enough to be eco mode anchors" << std::endl;
+
+        std::vector<std::unique_ptr<BasicPitchCNN>> models;
+        for (int i = 0; i < numInstances; ++i)
+        {
+            models.push_back(std::make_unique<BasicPitchCNN>());
+            models.back()->calibrateInt8(frames.data(), numFrames);
+        }
+
+        std::vector<float> contours(NUM_FREQ_IN), notes(NUM_FREQ_OUT), onsets(NUM_FREQ_OUT);
+
+        struct EngineCase
+        {
+            CNNEngine engine;
+            int decimation;
+            String name;
+        };
+
+        const std::vector<EngineCase> engines = {{RTNeuralEngine, 1, "RTNeural"},
+                                                 {FusedEngine, 1, "Fused float32"},
+                                                 {FusedEngine, 2, "Fused float32 eco 1/2"},
+                                                 {FusedEngine, 4, "Fused float32 eco 1/4"},
+                                                 {FusedHalfEngine, 1, "Fused fp16 storage"},
+                                                 {FusedHalfEngine, 4, "Fused fp16 storage eco 1/4"},
+                                                 {Int8Engine, 1, "Int8"},
+                                                 {Int8Engine, 4, "Int8 eco 1/4"}};
+
+        for (auto& [engine, decimation, name] : engines)
+        {
+            beginTest("CNN engine: " + name);
+
+            for (auto& model : models)
+            {
+                model->setEngine(engine);
+                model->setDecimation(decimation);
+            }
+
+            CacheMissCounter counter;
+            counter.start();
+            auto start = std::chrono::steady_clock::now();
+
+            for (size_t frame = 0; frame < numFrames; ++frame)
+                for (auto& model : models)
+                    model->frameInference(frames.data() + frame * frameSize, contours, notes, onsets);
+
+            auto end = std::chrono::steady_clock::now();
+            long long misses = counter.stop();
+
+            const double totalFrames = (double) numFrames * numInstances;
+            std::cout << name << ": " << std::chrono::duration<double, std::micro>(end - start).count() / totalFrames
+                      << " us/frame, "
+                      << (misses >= 0 ? counter.getName() + " misses/frame: " + String((double) misses / totalFrames, 1)
+                                      : String("cache misses: no hardware counters"))
+                      << std::endl;
+
+            expect(models.front()->getEngine() == engine);
+        }
+    }
+};
+
+//------------------------------------------------------------------------------
+// Synthetic posteriorgrams: low noise everywhere plus random decaying notes,
+// about one note every 10 frames. Contours are NUM_FREQ_IN wide.
+//------------------------------------------------------------------------------
+struct SyntheticPosteriorgrams
+{
+    std::vector<std::vector<float>> notes, onsets, contours;
+
+    SyntheticPosteriorgrams (int numFrames, int seed)
+    {
+        Random random(seed);
+        notes.assign((size_t) numFrames, std::vector<float>(NUM_FREQ_OUT));
+        onsets.assign((size_t) numFrames, std::vector<float>(NUM_FREQ_OUT));
+        contours.assign((size_t) numFrames, std::vector<float>(NUM_FREQ_IN));
+
+        for (int f = 0; f < numFrames; ++f)
+        {
+            for (int j = 0; j < NUM_FREQ_OUT; ++j)
+            {
+                notes[f][j] = 0.05f * random.nextFloat();
+                onsets[f][j] = 0.05f * random.nextFloat();
+            }
+            for (auto& c : contours[f])
+                c = 0.1f * random.nextFloat();
+        }
+
+        for (int n = 0; n < numFrames / 10; ++n)
+        {
+            const int start = random.nextInt(numFrames);
+            const int length = 5 + random.nextInt(60);
+            const int noteIdx = 20 + random.nextInt(50);
+            const float amplitude = 0.4f + 0.6f * random.nextFloat();
+
+            // some notes have no onset, only the melodia trick finds them
+            if (random.nextInt(3) != 0)
+                onsets[start][noteIdx] = std::max(onsets[start][noteIdx], amplitude);
+
+            for (int f = start; f < std::min(numFrames, start + length); ++f)
+            {
+                const float decay = 1.0f - 0.5f * (float) (f - start) / (float) length;
+                notes[f][noteIdx] = std::max(notes[f][noteIdx], amplitude * decay);
+                contours[f][3 * noteIdx] = amplitude;
+            }
+        }
+    }
+};
+
+//------------------------------------------------------------------------------
+// Unit test suite for the scale constraint of Notes::convert
+//------------------------------------------------------------------------------
+class NotesScaleTest : public UnitTest
+{
+public:
+    NotesScaleTest() : UnitTest("NotesScaleTest", "Model") {}
+
+    void runTest() override
+    {
+        beginTest("NoteUtils::isInScale");
+        expect(NoteUtils::isInScale(60, NoteUtils::C, NoteUtils::Major));
+        expect(!NoteUtils::isInScale(61, NoteUtils::C, NoteUtils::Major));
+        expect(NoteUtils::isInScale(21, NoteUtils::A, NoteUtils::Minor));
+        expect(NoteUtils::isInScale(66, NoteUtils::F_sharp, NoteUtils::MinorPentatonic));
+        expect(!NoteUtils::isInScale(67, NoteUtils::F_sharp, NoteUtils::MinorPentatonic));
+        for (int note = 0; note < 128; ++note)
+            expect(NoteUtils::isInScale(note, NoteUtils::D, NoteUtils::Chromatic));
+
+        SyntheticPosteriorgrams pg(2000, 7);
+        Notes notes;
+        Notes::ConvertParams params;
+        params.pitchBend = MultiPitchBend;
+        const auto chromatic = notes.convert(pg.notes, pg.onsets, pg.contours, params, true);
+
+        params.scaleType = NoteUtils::MajorPentatonic;
+        params.rootNote = NoteUtils::C;
+
+        beginTest("Remove: only notes of the scale");
+        {
+            params.snapMode = NoteUtils::Remove;
+            const auto events = notes.convert(pg.notes, pg.onsets, pg.contours, params, true);
+            expect(!events.empty() && events.size() < chromatic.size());
+            for (const auto& event : events)
+                expect(NoteUtils::isInScale(event.pitch, params.rootNote, params.scaleType));
+        }
+
+        beginTest("Adjust: notes moved to the scale without overlaps");
+        {
+            params.snapMode = NoteUtils::Adjust;
+            const auto events = notes.convert(pg.notes, pg.onsets, pg.contours, params, true);
+            expect(!events.empty());
+
+            std::array<int, 128> lastEnd;
+            lastEnd.fill(-1);
+            for (const auto& event : events)
+            {
+                expect(NoteUtils::isInScale(event.pitch, params.rootNote, params.scaleType));
+                expect(event.startFrame >= lastEnd[(size_t) event.pitch], "overlapping notes of same pitch");
+                lastEnd[(size_t) event.pitch] = event.endFrame;
+            }
+        }
+
+        beginTest("Chromatic scale changes nothing");
+        {
+            params.scaleType = NoteUtils::Chromatic;
+            params.snapMode = NoteUtils::Remove;
+            expect(notes.convert(pg.notes, pg.onsets, pg.contours, params, true) == chromatic);
+        }
+    }
+};
+
+//------------------------------------------------------------------------------
+// Unit test suite for the parallel extraction of Notes::convert: same events as
+// the serial one, whether the segments can be extracted separately or not
+//------------------------------------------------------------------------------
+class NotesParallelTest : public UnitTest
+{
+public:
+    NotesParallelTest() : UnitTest("NotesParallelTest", "Model") {}
+
+    void runTest() override
+    {
+        beginTest("Same events as serial extraction");
+        {
+            SyntheticPosteriorgrams pg(8 * Notes::MIN_FRAMES_PER_SEGMENT, 11);
+
+            for (int variant = 0; variant < 8; ++variant)
+            {
+                Notes::ConvertParams params;
+                params.inferOnsets = (variant & 1) != 0;
+                params.melodiaTrick = (variant & 2) != 0;
+                params.frameThreshold = (variant & 4) != 0 ? 0.3f : 0.5f;
+                params.energyThreshold = (variant & 4) != 0 ? 5 : 11;
+                params.pitchBend = SinglePitchBend;
+
+                Notes serialNotes;
+                const auto expected = serialNotes.convert(pg.notes, pg.onsets, pg.contours, params, true);
+
+                for (int numThreads : {2, 3, 8})
+                {
+                    Notes parallelNotes;
+                    parallelNotes.setNumThreads(numThreads);
+                    expect(parallelNotes.convert(pg.notes, pg.onsets, pg.contours, params, true) == expected,
+                           "variant " + String(variant) + ", threads " + String(numThreads));
+                }
+            }
+        }
+
+        beginTest("Same events when a note crosses the cuts");
+        {
+            // One note for all frames, only dipping below threshold for one frame now and then: cuts can only be
+            // made in these frames, and the note walk crosses them.
+            SyntheticPosteriorgrams pg(4 * Notes::MIN_FRAMES_PER_SEGMENT, 12);
+            for (size_t f = 0; f < pg.notes.size(); ++f)
+                pg.notes[f][40] = f % 500 == 250 ? 0.1f : 0.7f;
+            pg.onsets[3][40] = 0.9f;
+
+            Notes::ConvertParams params;
+            Notes serialNotes, parallelNotes;
+            parallelNotes.setNumThreads(4);
+            expect(parallelNotes.convert(pg.notes, pg.onsets, pg.contours, params, true)
+                   == serialNotes.convert(pg.notes, pg.onsets, pg.contours, params, true));
+        }
+    }
+};
+
+//------------------------------------------------------------------------------
+// Regression test for the core of Notes::convert: fixed posteriorgrams are
+// converted over a grid of parameters in each mode and the events compared with
+// golden values, computed with the original implementation (melodia restricted
+// to the frequency range, as the pitch range does). Frames, pitches and bends are
+// hashed exactly, amplitudes are summed and compared with a tolerance.
+//------------------------------------------------------------------------------
+class NotesGoldenTest : public UnitTest
+{
+public:
+    NotesGoldenTest() : UnitTest("NotesGoldenTest", "Model") {}
+
+    /** posteriorgrams from a fixed integer generator, multiples of 1 / 65536: the same on every platform */
+    struct GoldenPosteriorgrams
+    {
+        std::vector<std::vector<float>> notes, onsets, contours;
+        uint64_t state;
+
+        float next()
+        {
+            state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+            return (float) ((state >> 40) & 0xffff) / 65536.0f;
+        }
+
+        int nextInt(int maxValue) { return (int) (next() * (float) maxValue); }
+
+        GoldenPosteriorgrams (int numFrames, uint64_t seed) : state(seed)
+        {
+            notes.assign((size_t) numFrames, std::vector<float>(NUM_FREQ_OUT));
+            onsets.assign((size_t) numFrames, std::vector<float>(NUM_FREQ_OUT));
+            contours.assign((size_t) numFrames, std::vector<float>(NUM_FREQ_IN));
+
+            for (int f = 0; f < numFrames; ++f)
+            {
+                for (int j = 0; j < NUM_FREQ_OUT; ++j)
+                {
+                    notes[f][j] = 0.1f * next();
+                    onsets[f][j] = 0.1f * next();
+                }
+                for (auto& c : contours[f])
+                    c = 0.2f * next();
+            }
+
+            for (int n = 0; n < numFrames / 8; ++n)
+            {
+                const int start = nextInt(numFrames);
+                const int length = 2 + nextInt(50);
+                const int noteIdx = 5 + nextInt(78);
+                const float amplitude = 0.35f + 0.65f * next();
+                const int bend = nextInt(7) - 3;
+
+                // some notes have no onset, only onset inference or the melodia trick finds them
+                if (nextInt(3) != 0)
+                    onsets[start][noteIdx] = std::max(onsets[start][noteIdx], amplitude);
+
+                for (int f = start; f < std::min(numFrames, start + length); ++f)
+                {
+                    const float decay = 1.0f - 0.6f * (float) (f - start) / (float) length;
+                    notes[f][noteIdx] = std::max(notes[f][noteIdx], amplitude * decay);
+                    const int bin = std::clamp(3 * noteIdx + bend + (f - start) / 16, 0, NUM_FREQ_IN - 1);
+                    contours[f][bin] = std::max(contours[f][bin], amplitude);
+                }
+            }
+        }
+    };
+
+    /** FNV-1a over the bytes of a value */
+    static uint64_t hashValue(uint64_t hash, int64_t value)
+    {
+        for (int i = 0; i < 8; ++i)
+        {
+            hash ^= (uint64_t) ((value >> (8 * i)) & 0xff);
+            hash *= 1099511628211ULL;
+        }
+        return hash;
+    }
+
+    static uint64_t hashEvents(const std::vector<Notes::Event>& events, uint64_t hash)
+    {
+        hash = hashValue(hash, (int64_t) events.size());
+        for (const auto& event : events)
+        {
+            hash = hashValue(hash, event.startFrame);
+            hash = hashValue(hash, event.endFrame);
+            hash = hashValue(hash, event.pitch);
+            hash = hashValue(hash, (int64_t) event.bends.size());
+            for (int bend : event.bends)
+                hash = hashValue(hash, bend);
+        }
+        return hash;
+    }
+
+    void runTest() override
+    {
+        struct Mode
+        {
+            bool inferOnsets;
+            bool melodiaTrick;
+            PitchBendModes pitchBend;
+            size_t numEvents;
+            uint64_t hash;
+            double amplitudeSum;
+        };
+
+        const std::vector<Mode> modes = {
+            {false, false, NoPitchBend, 1625, 0xe9337e0e20f11915ULL, 948.5131},
+            {true, false, NoPitchBend, 2584, 0x58d762366579496cULL, 1514.3675},
+            {false, true, NoPitchBend, 2916, 0x39b1c6fbe551b4d2ULL, 1657.3467},
+            {true, true, NoPitchBend, 2994, 0xa13b934e47ae6abdULL, 1695.2371},
+            {false, false, SinglePitchBend, 1625, 0xd5ba5aa50d7c8fe9ULL, 948.5131},
+            {true, false, SinglePitchBend, 2584, 0xfe9415f9caf00363ULL, 1514.3675},
+            {false, true, SinglePitchBend, 2916, 0x95bff9e6867e2b1aULL, 1657.3467},
+            {true, true, SinglePitchBend, 2994, 0x33ddc7974d921622ULL, 1695.2371},
+            {false, false, MultiPitchBend, 1625, 0x8cdf41f6090220d8ULL, 948.5131},
+            {true, false, MultiPitchBend, 2584, 0xaf9f7965eea012a2ULL, 1514.3675},
+            {false, true, MultiPitchBend, 2916, 0x2f196b202cc569c3ULL, 1657.3467},
+            {true, true, MultiPitchBend, 2994, 0xacf5ee027250b0bcULL, 1695.2371},
+        };
+
+        const GoldenPosteriorgrams pg(3000, 42);
+
+        for (const auto& mode : modes)
+        {
+            beginTest("Golden events: infer onsets " + String((int) mode.inferOnsets) + ", melodia "
+                      + String((int) mode.melodiaTrick) + ", pitch bend " + String((int) mode.pitchBend));
+
+            // serial, then cut in time segments (3000 frames are enough for two)
+            for (int numThreads : {1, 4})
+            {
+                Notes::ConvertParams params;
+                params.inferOnsets = mode.inferOnsets;
+                params.melodiaTrick = mode.melodiaTrick;
+                params.pitchBend = mode.pitchBend;
+
+                Notes notes;
+                notes.setNumThreads(numThreads);
+
+                uint64_t hash = 14695981039346656037ULL;
+                size_t numEvents = 0;
+                double amplitudeSum = 0.0;
+                bool newAudio = true;
+
+                for (float frameThreshold : {0.3f, 0.5f})
+                    for (float onsetThreshold : {0.3f, 0.6f})
+                        for (int minNoteLength : {3, 11})
+                            for (float maxFrequency : {-1.0f, 800.0f})
+                            {
+                                params.frameThreshold = frameThreshold;
+                                params.onsetThreshold = onsetThreshold;
+                                params.minNoteLength = minNoteLength;
+                                params.maxFrequency = maxFrequency;
+                                params.minFrequency = maxFrequency > 0.0f ? 60.0f : -1.0f;
+
+                                // same audio after the first conversion, as when the parameters change
+                                const auto events = notes.convert(pg.notes, pg.onsets, pg.contours, params, newAudio);
+                                newAudio = false;
+
+                                hash = hashEvents(events, hash);
+                                numEvents += events.size();
+                                for (const auto& event : events)
+                                    amplitudeSum += event.amplitude;
+                            }
+
+                expectEquals((int) numEvents, (int) mode.numEvents, "threads " + String(numThreads));
+                expect(hash == mode.hash,
+                       "threads " + String(numThreads) + ": events differ from the golden events, hash "
+                           + String::toHexString((int64) hash));
+                expect(std::abs(amplitudeSum - mode.amplitudeSum) < 1e-3,
+                       "threads " + String(numThreads) + ": amplitude sum " + String(amplitudeSum, 4));
+            }
+        }
+    }
+};
+
+//------------------------------------------------------------------------------
+// Unit test suite for PosteriorgramHistory: the latest frames come back in order
+// once the ring wraps, and notes created from them match Notes::convert
+//------------------------------------------------------------------------------
+class PosteriorgramHistoryTest : public UnitTest
+{
+public:
+    PosteriorgramHistoryTest() : UnitTest("PosteriorgramHistoryTest", "Model") {}
+
+    void runTest() override
+    {
+        SyntheticPosteriorgrams pg(2500, 13);
+        PosteriorgramHistory history;
+        history.setCapacity(1000);
+        // a window of frames at a time, as the transcriber pushes them
+        for (int begin = 0; begin < 2500; begin += 170)
+            history.push(pg.notes, pg.onsets, pg.contours, begin, std::min(2500, begin + 170));
+
+        std::vector<std::vector<float>> notes, onsets, contours;
+
+        beginTest("Latest frames in order after the ring wraps");
+        {
+            expectEquals(history.getNumFrames(), 1000);
+            expectEquals(history.copyLatest(600, notes, onsets, contours), 600);
+            bool same = true;
+            for (int i = 0; i < 600; ++i)
+                same = same && notes[(size_t) i] == pg.notes[(size_t) (1900 + i)]
+                       && onsets[(size_t) i] == pg.onsets[(size_t) (1900 + i)]
+                       && contours[(size_t) i] == pg.contours[(size_t) (1900 + i)];
+            expect(same);
+            expectEquals(history.copyLatest(5000, notes, onsets, contours), 1000);
+            expect(notes.front() == pg.notes[1500] && notes.back() == pg.notes[2499]);
+        }
+
+        beginTest("Re-derived notes match Notes::convert on the same frames");
+        {
+            history.copyLatest(1000, notes, onsets, contours);
+            const std::vector<std::vector<float>> expectedNotes(pg.notes.begin() + 1500, pg.notes.end());
+            const std::vector<std::vector<float>> expectedOnsets(pg.onsets.begin() + 1500, pg.onsets.end());
+            const std::vector<std::vector<float>> expectedContours(pg.contours.begin() + 1500, pg.contours.end());
+
+            Notes::ConvertParams params;
+            params.pitchBend = MultiPitchBend;
+            BasicPitch::setThresholds(0.6f, 0.4f, 80.0f, params);
+            Notes rederived, reference;
+            const auto events = rederived.convert(notes, onsets, contours, params, true);
+            expect(!events.empty());
+            expect(events == reference.convert(expectedNotes, expectedOnsets, expectedContours, params, true));
+        }
+
+        beginTest("Clear empties the history");
+        {
+            history.clear();
+            expectEquals(history.copyLatest(100, notes, onsets, contours), 0);
+            expect(notes.empty());
+        }
+    }
+};
+
+//------------------------------------------------------------------------------
+// Unit test suite for PosteriorgramCache and ParameterSweep: entries come back
+// as stored and only for their key, a second transcription of the same audio is
+// read from the cache, and the parallel sweep scores what serial converts give
+//------------------------------------------------------------------------------
+class PosteriorgramCacheTest : public UnitTest
+{
+public:
+    PosteriorgramCacheTest() : UnitTest("PosteriorgramCacheTest", "Model") {}
+
+    void runTest() override
+    {
+        const auto directory = File::getSpecialLocation(File::tempDirectory).getChildFile("polypitch-pg-cache-test");
+        directory.deleteRecursively();
+        PosteriorgramCache cache(directory);
+        SyntheticPosteriorgrams pg(700, 14);
+
+        beginTest("Stored entries are loaded back, for their key only");
+        {
+            Posteriorgrams loaded;
+            expect(!cache.load(42, loaded));
+            expect(cache.store(42, pg.notes, pg.onsets, pg.contours));
+            expect(cache.load(42, loaded));
+            expect(loaded.notes == pg.notes && loaded.onsets == pg.onsets && loaded.contours == pg.contours);
+            expect(!cache.load(43, loaded));
+        }
+
+        beginTest("Truncated entries are ignored");
+        {
+            MemoryBlock data;
+            cache.getEntryFile(42).loadFileAsData(data);
+            cache.getEntryFile(42).replaceWithData(data.getData(), data.getSize() / 2);
+            Posteriorgrams loaded;
+            expect(!cache.load(42, loaded));
+        }
+
+        beginTest("Second transcription of the same audio is read from the cache");
+        {
+            auto audio = makeSaw(midiNoteToFreq(60), 0.3, 0.5, BASIC_PITCH_SAMPLE_RATE, 0.4f);
+            auto basicPitch = std::make_unique<BasicPitch>();
+            Posteriorgrams computed, cached;
+            expect(!cache.getOrCompute(*basicPitch, audio.data(), (int) audio.size(), computed));
+            expect(cache.getOrCompute(*basicPitch, audio.data(), (int) audio.size(), cached));
+            expect(cached.notes == computed.notes && cached.onsets == computed.onsets
+                   && cached.contours == computed.contours);
+
+            const auto key = PosteriorgramCache::computeKey(*basicPitch, audio.data(), (int) audio.size());
+            basicPitch->setPitchRange(40, 80);
+            expect(PosteriorgramCache::computeKey(*basicPitch, audio.data(), (int) audio.size()) != key,
+                   "the pitch range changes the key");
+            audio[100] += 1e-3f;
+            basicPitch->setPitchRange(MIN_MIDI_NOTE, MAX_MIDI_NOTE);
+            expect(PosteriorgramCache::computeKey(*basicPitch, audio.data(), (int) audio.size()) != key,
+                   "the audio changes the key");
+        }
+
+        beginTest("Parallel sweep scores match serial conversions");
+        {
+            std::vector<SyntheticPosteriorgrams> files;
+            std::vector<Posteriorgrams> posteriorgrams(5);
+            std::vector<const Posteriorgrams*> filePointers;
+            for (int i = 0; i < 5; ++i)
+            {
+                files.emplace_back(300 + 150 * i, 20 + i);
+                posteriorgrams[(size_t) i] = { files.back().notes, files.back().onsets, files.back().contours };
+            }
+            for (const auto& file : posteriorgrams)
+                filePointers.push_back(&file);
+
+            Notes::ConvertParams base;
+            base.pitchBend = MultiPitchBend;
+            const auto grid = ParameterSweep::makeGrid(base, { 0.3f, 0.5f }, { 0.3f, 0.6f }, { 5, 11 });
+            expectEquals((int) grid.size(), 8);
+
+            auto numNotes = [](size_t, size_t, const NoteEvents& events) { return (double) events.size(); };
+            const auto scores = ParameterSweep::run(filePointers, grid, numNotes, 4);
+
+            bool same = true;
+            for (size_t p = 0; p < grid.size(); ++p)
+            {
+                for (size_t f = 0; f < files.size(); ++f)
+                {
+                    Notes notes;
+                    const auto events = notes.convert(files[f].notes, files[f].onsets, files[f].contours, grid[p], true);
+                    same = same && scores[p * files.size() + f] == (double) events.size();
+                }
+            }
+            expect(same);
+
+            beginTest("Sweep of cached files loads them one at a time");
+            std::vector<uint64_t> keys;
+            for (size_t f = 0; f < files.size(); ++f)
+            {
+                keys.push_back(1000 + f);
+                expect(cache.store(keys.back(), files[f].notes, files[f].onsets, files[f].contours));
+            }
+            keys.push_back(999); // missing
+
+            const auto cachedScores = ParameterSweep::run(cache, keys, grid, numNotes, 3);
+            bool sameCached = true;
+            for (size_t p = 0; p < grid.size(); ++p)
+            {
+                for (size_t f = 0; f < files.size(); ++f)
+                    sameCached = sameCached && cachedScores[p * keys.size() + f] == scores[p * files.size() + f];
+                expect(std::isnan(cachedScores[p * keys.size() + files.size()]), "missing files score NaN");
+            }
+            expect(sameCached);
+
+            // loading into the same object reuses its frames
+            Posteriorgrams buffer;
+            expect(cache.load(keys[4], buffer));
+            const float* firstFrame = buffer.notes.front().data();
+            expect(cache.load(keys[0], buffer));
+            expect(buffer.notes.front().data() == firstFrame && buffer.notes == files[0].notes);
+        }
+
+        directory.deleteRecursively();
+    }
+};
+
+//------------------------------------------------------------------------------
+// Benchmark of Notes::convert (melodia trick and pitch bends on) for 1 s, 10 s
+// and 10 min of posteriorgrams, then of each convert variant on 10 s, then of
+// parallel extraction on 10 min.
+// Only run with --benchmark.
+//------------------------------------------------------------------------------
+class NotesBenchmark : public UnitTest
+{
+public:
+    NotesBenchmark() : UnitTest("NotesBenchmark", "Benchmark") {}
+
+    void runTest() override
+    {
+        const double framesPerSecond = (double) AUDIO_SAMPLE_RATE / FFT_HOP;
+        const std::vector<std::pair<double, String>> durations = {{1.0, "1 s"}, {10.0, "10 s"}, {600.0, "10 min"}};
+
+        Notes::ConvertParams params;
+        params.melodiaTrick = true;
+        params.pitchBend = MultiPitchBend;
+
+        for (auto& [seconds, name] : durations)
+        {
+            beginTest("Notes::convert: " + name);
+
+            const int numFrames = (int) std::ceil(seconds * framesPerSecond);
+            SyntheticPosteriorgrams pg(numFrames, numFrames);
+            Notes notes;
+
+            // first call copies the posteriorgrams, as for new audio
+            NoteEvents events;
+            notes.convert(pg.notes, pg.onsets, pg.contours, params, true, events);
+
+            const int numRuns = numFrames < 1000 ? 100 : 5;
+            auto start = std::chrono::steady_clock::now();
+            for (int run = 0; run < numRuns; ++run)
+                notes.convert(pg.notes, pg.onsets, pg.contours, params, false, events);
+            auto end = std::chrono::steady_clock::now();
+
+            std::cout << "Notes::convert, " << name << " (" << numFrames << " frames, " << events.size()
+                      << " notes): " << std::chrono::duration<double, std::milli>(end - start).count() / numRuns
+                      << " ms" << std::endl;
+
+            expect(! events.empty());
+        }
+
+        // Each combination of modes runs a different specialisation of the conversion core
+        const int numFrames = (int) std::ceil(10.0 * framesPerSecond);
+        SyntheticPosteriorgrams pg(numFrames, numFrames);
+        Notes notes;
+        notes.convert(pg.notes, pg.onsets, pg.contours, params, true);
+
+        const std::vector<std::pair<PitchBendModes, String>> pitchBendModes = {
+            {NoPitchBend, "no bends"}, {SinglePitchBend, "single bends"}, {MultiPitchBend, "multi bends"}};
+
+        for (int variant = 0; variant < 8; ++variant)
+        {
+            for (auto& [pitchBend, pitchBendName] : pitchBendModes)
+            {
+                params.inferOnsets = (variant & 1) != 0;
+                params.melodiaTrick = (variant & 2) != 0;
+                params.minFrequency = (variant & 4) != 0 ? -1.0f : NoteUtils::midiToHz(40.0f);
+                params.maxFrequency = (variant & 4) != 0 ? -1.0f : NoteUtils::midiToHz(84.0f);
+                params.pitchBend = pitchBend;
+
+                const String name = String(params.inferOnsets ? "inferred onsets, " : "")
+                                    + String(params.melodiaTrick ? "melodia, " : "")
+                                    + String((variant & 4) != 0 ? "full range, " : "range 40-84, ") + pitchBendName;
+                beginTest("Notes::convert variant: " + name);
+
+                const int numRuns = 20;
+                NoteEvents events;
+                auto start = std::chrono::steady_clock::now();
+                for (int run = 0; run < numRuns; ++run)
+                    notes.convert(pg.notes, pg.onsets, pg.contours, params, false, events);
+                auto end = std::chrono::steady_clock::now();
+
+                std::cout << "Notes::convert 10 s, " << name << ": "
+                          << std::chrono::duration<double, std::milli>(end - start).count() / numRuns << " ms"
+                          << std::endl;
+
+                expect(! events.empty());
+            }
+        }
+
+        // Parallel extraction on 10 min, without bends (computed on the calling thread)
+        const int longNumFrames = (int) std::ceil(600.0 * framesPerSecond);
+        SyntheticPosteriorgrams longPg(longNumFrames, longNumFrames);
+        params = Notes::ConvertParams();
+
+        for (int numThreads : {1, 2, 4, 8})
+        {
+            beginTest("Notes::convert 10 min, threads: " + String(numThreads));
+
+            Notes parallelNotes;
+            parallelNotes.setNumThreads(numThreads);
+            NoteEvents events;
+            parallelNotes.convert(longPg.notes, longPg.onsets, longPg.contours, params, true, events);
+
+            const int numRuns = 5;
+            auto start = std::chrono::steady_clock::now();
+            for (int run = 0; run < numRuns; ++run)
+                parallelNotes.convert(longPg.notes, longPg.onsets, longPg.contours, params, false, events);
+            auto end = std::chrono::steady_clock::now();
+
+            std::cout << "Notes::convert 10 min, " << numThreads << " threads: "
+                      << std::chrono::duration<double, std::milli>(end - start).count() / numRuns << " ms"
+                      << std::endl;
+
+            expect(! events.empty());
+        }
+    }
+};
+
+//------------------------------------------------------------------------------
+// Benchmark of the Resampler paths: cost per second of audio in 512 sample
+// blocks and level of a 15 kHz sine aliased below 11025 Hz.
+// Only run with --benchmark.
+//------------------------------------------------------------------------------
+class ResamplerBenchmark : public UnitTest
+{
+public:
+    ResamplerBenchmark() : UnitTest("ResamplerBenchmark", "Benchmark") {}
+
+    void runTest() override
+    {
+        const int blockSize = 512;
+        const int seconds = 60;
+
+        for (double rate : {44100.0, 48000.0, 88200.0, 96000.0, 176400.0, 192000.0})
+        {
+            for (bool polyphase : {false, true})
+            {
+                const String name = String(rate) + " Hz, " + (polyphase ? "polyphase" : "IIR + Lagrange");
+                beginTest("Resampler: " + name);
+
+                Resampler resampler;
+                resampler.setPolyphaseEnabled(polyphase);
+                resampler.prepareToPlay(rate, blockSize, BASIC_PITCH_SAMPLE_RATE);
+                expect(resampler.isPolyphase() == polyphase);
+
+                std::vector<float> input((size_t) blockSize), output((size_t) blockSize + 16);
+                Random random(3);
+                for (auto& v : input)
+                    v = random.nextFloat() * 2.0f - 1.0f;
+
+                const int numBlocks = (int) (rate * seconds) / blockSize;
+                auto start = std::chrono::steady_clock::now();
+                for (int block = 0; block < numBlocks; ++block)
+                    resampler.processBlock(input.data(), output.data(), blockSize);
+                auto end = std::chrono::steady_clock::now();
+
+                std::cout << "Resampler " << name << ": "
+                          << std::chrono::duration<double, std::micro>(end - start).count() / seconds
+                          << " us per second of audio, 15 kHz alias: "
+                          << resampledSineLevelDB(resampler, rate, 15000.0, blockSize) << " dB, 10 kHz: "
+                          << resampledSineLevelDB(resampler, rate, 10000.0, blockSize) << " dB" << std::endl;
+            }
+        }
+    }
+};
+
+//==============================================================================
+int main(int argc, char* argv[])
+{
+    std::cout << "Running Transcriber unit tests..." << std::endl;
+    UnitTestRunner runner;
+    TranscriberTest transcriberTest; // register our tests
+    HalfFloatTest halfFloatTest;
+    BasicPitchCNNTest basicPitchCNNTest;
+    Int8EngineTest int8EngineTest;
+    EcoModeTest ecoModeTest;
+    NoteStreamTest noteStreamTest;
+    NoteEventsTest noteEventsTest;
+    NotesScaleTest notesScaleTest;
+    NotesParallelTest notesParallelTest;
+    NotesGoldenTest notesGoldenTest;
+    PosteriorgramHistoryTest posteriorgramHistoryTest;
+    PosteriorgramCacheTest posteriorgramCacheTest;
+    ResamplerTest resamplerTest;
+    CNNBenchmark cnnBenchmark;
+    NotesBenchmark notesBenchmark;
+    ResamplerBenchmark resamplerBenchmark;
+    runner.runTestsInCategory("Model");
+    runner.runTestsInCategory("Audio to MIDI");
+
+    // Benchmarks are slow, only run on demand
+    for (int i = 1; i < argc; ++i)
+        if (String(argv[i]) == "--benchmark")
+            runner.runTestsInCategory("Benchmark");
+
     return 0;
 }